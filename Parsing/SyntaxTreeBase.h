@@ -17,7 +17,6 @@ class SyntaxTreeBase: public NonCopyable
 
         virtual int GetNodeNumber() const = 0;
         virtual SynTreeNodeBase* ConstructSyntaxTree(const char* ps, const char* pe) = 0;
-        virtual SynTreeNodeBase* ConstructSyntaxTreeImp(const char* ps, const char* pe) = 0;
 };
 
 #endif
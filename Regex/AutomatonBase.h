@@ -23,8 +23,13 @@ class AutomatonBase: public NonCopyable
         int  GetStartState() const { return start_; }
         int  GetAcceptState() const { return accept_; }
 
-        virtual void SerializeState() const = 0;
-        virtual void DeserializeState() = 0;
+        // append a binary image of the built machine to image, see AutomatonImage.h.
+        // return false if the machine can't be saved.
+        virtual bool SerializeState(std::string& image) const = 0;
+
+        // load an image written by SerializeState(), it must be 8-byte aligned.
+        // return false if it is broken or of another kind of machine.
+        virtual bool DeserializeState(const char* image, size_t len) = 0;
 
         virtual int  BuildMachine(SyntaxTreeBase* tree) = 0;
         virtual bool RunMachine(const char* ps, const char* pe) = 0;
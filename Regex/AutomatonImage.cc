@@ -0,0 +1,105 @@
+#include "AutomatonImage.h"
+
+#include <stddef.h>
+
+#define AUTOMATON_IMAGE_VERSION (2)
+#define AUTOMATON_IMAGE_BYTE_ORDER (0x01020304)
+#define AUTOMATON_IMAGE_ALIGN (8)
+
+static const char automaton_image_magic[4] = { 'X', 'R', 'E', 'G' };
+
+AutomatonImageWriter::AutomatonImageWriter(std::string& buf, AutomatonImageType type)
+    :buf_(buf)
+{
+    // keep images appended to each other aligned.
+    buf_.resize((buf_.size() + AUTOMATON_IMAGE_ALIGN - 1) / AUTOMATON_IMAGE_ALIGN * AUTOMATON_IMAGE_ALIGN, 0);
+    start_ = buf_.size();
+
+    AutomatonImageHeader header;
+    memcpy(header.magic, automaton_image_magic, sizeof(header.magic));
+    header.version = AUTOMATON_IMAGE_VERSION;
+    header.type = type;
+    header.byteOrder = AUTOMATON_IMAGE_BYTE_ORDER;
+    header.size = 0;
+
+    buf_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void AutomatonImageWriter::WriteSection(const void* data, size_t size)
+{
+    uint64_t len = size;
+    buf_.append(reinterpret_cast<const char*>(&len), sizeof(len));
+
+    if (size) buf_.append(static_cast<const char*>(data), size);
+
+    size_t pad = (AUTOMATON_IMAGE_ALIGN - size % AUTOMATON_IMAGE_ALIGN) % AUTOMATON_IMAGE_ALIGN;
+    buf_.append(pad, 0);
+}
+
+void AutomatonImageWriter::Finish()
+{
+    uint64_t size = buf_.size() - start_;
+    memcpy(&buf_[start_ + offsetof(AutomatonImageHeader, size)], &size, sizeof(size));
+}
+
+AutomatonImageReader::AutomatonImageReader(const char* image, size_t len, AutomatonImageType type)
+    :cur_(NULL), end_(NULL)
+{
+    size_t size = GetImageSize(image, len);
+    if (!size) return;
+
+    // sections are read in place, the image itself must be aligned.
+    if (reinterpret_cast<uintptr_t>(image) % AUTOMATON_IMAGE_ALIGN) return;
+
+    AutomatonImageHeader header;
+    memcpy(&header, image, sizeof(header));
+    if (header.type != static_cast<uint32_t>(type)) return;
+
+    cur_ = image + sizeof(header);
+    end_ = image + size;
+}
+
+size_t AutomatonImageReader::GetImageSize(const char* image, size_t len)
+{
+    AutomatonImageHeader header;
+    if (!image || len < sizeof(header)) return 0;
+
+    memcpy(&header, image, sizeof(header));
+
+    if (memcmp(header.magic, automaton_image_magic, sizeof(header.magic))) return 0;
+    if (header.version != AUTOMATON_IMAGE_VERSION) return 0;
+    if (header.byteOrder != AUTOMATON_IMAGE_BYTE_ORDER) return 0;
+    if (header.size < sizeof(header) || header.size > len) return 0;
+
+    return header.size;
+}
+
+const char* AutomatonImageReader::ViewSection(size_t& size)
+{
+    if (!cur_) return NULL;
+
+    uint64_t len;
+    if (static_cast<size_t>(end_ - cur_) < sizeof(len)) return Fail<char>();
+
+    memcpy(&len, cur_, sizeof(len));
+    cur_ += sizeof(len);
+
+    uint64_t padded = (len + AUTOMATON_IMAGE_ALIGN - 1) / AUTOMATON_IMAGE_ALIGN * AUTOMATON_IMAGE_ALIGN;
+    if (len > padded || padded > static_cast<uint64_t>(end_ - cur_)) return Fail<char>();
+
+    const char* data = cur_;
+    size = len;
+    cur_ += padded;
+
+    return data;
+}
+
+bool AutomatonImageReader::ReadSection(void* out, size_t size)
+{
+    size_t len;
+    const char* data = ViewSection(len);
+    if (!data || len != size) return Fail<char>() != NULL;
+
+    memcpy(out, data, size);
+    return true;
+}
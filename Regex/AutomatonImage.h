@@ -0,0 +1,115 @@
+#ifndef _AUTOMATON_IMAGE_H_
+#define _AUTOMATON_IMAGE_H_
+
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+/*
+   binary image of a built automaton, written by SerializeState().
+
+   layout: header, then sections of (uint64 byte size, data, zero padding).
+   everything is 8-byte aligned relative to the image start and nothing is
+   stored as a pointer, so an image mapped at any 8-byte aligned address(mmap
+   gives page alignment) is usable in place. images can be concatenated, each
+   one records its own size.
+
+   data is in native byte order, images of another byte order or version are rejected.
+*/
+enum AutomatonImageType
+{
+    AutomatonImage_NFA = 1,
+    AutomatonImage_DFA = 2,
+    AutomatonImage_BitNFA = 3,
+    AutomatonImage_AhoCorasick = 4,
+    AutomatonImage_PikeVM = 5
+};
+
+struct AutomatonImageHeader
+{
+    char magic[4];      // "XREG"
+    uint32_t version;
+    uint32_t type;      // AutomatonImageType
+    uint32_t byteOrder; // 0x01020304 as written
+    uint64_t size;      // of the whole image, header included
+};
+
+class AutomatonImageWriter
+{
+    public:
+
+        // the image is appended to buf.
+        AutomatonImageWriter(std::string& buf, AutomatonImageType type);
+
+        void WriteSection(const void* data, size_t size);
+
+        template <class T>
+        void WriteSection(const std::vector<T>& v)
+        {
+            WriteSection(v.empty()? NULL : &v[0], v.size() * sizeof(T));
+        }
+
+        // fill in the image size, no more section after it.
+        void Finish();
+
+    private:
+
+        std::string& buf_;
+        size_t start_;
+};
+
+class AutomatonImageReader
+{
+    public:
+
+        // the image must stay valid as long as sections viewed from it are in use.
+        AutomatonImageReader(const char* image, size_t len, AutomatonImageType type);
+
+        // false once the image turns out to be broken.
+        bool IsValid() const { return cur_ != NULL; }
+
+        // size of the image starting at image, 0 if it is not an image.
+        static size_t GetImageSize(const char* image, size_t len);
+
+        // pointer to the next section in place, NULL if the image is broken.
+        const char* ViewSection(size_t& size);
+
+        template <class T>
+        const T* ViewSection(size_t& num)
+        {
+            size_t size;
+            const char* data = ViewSection(size);
+            if (!data || size % sizeof(T)) return Fail<T>();
+
+            num = size / sizeof(T);
+            return reinterpret_cast<const T*>(data);
+        }
+
+        template <class T>
+        bool ReadSection(std::vector<T>& v)
+        {
+            size_t num;
+            const T* data = ViewSection<T>(num);
+            if (!data) return false;
+
+            v.assign(data, data + num);
+            return true;
+        }
+
+        // section of exactly size bytes.
+        bool ReadSection(void* out, size_t size);
+
+    private:
+
+        template <class T>
+        const T* Fail() { cur_ = NULL; return NULL; }
+
+    private:
+
+        const char* cur_;
+        const char* end_;
+};
+
+#endif
+
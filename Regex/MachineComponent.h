@@ -1,6 +1,9 @@
 #ifndef MACHINE_COMPONENT_H_
 #define MACHINE_COMPONENT_H_
 
+#include <vector>
+#include <algorithm>
+
 enum StateType
 {
     State_None = 0, // not a state
@@ -59,5 +62,62 @@ struct MachineEdge
     int from; // state number
 };
 
+// transition on any char in [lo, hi]
+struct MachineRangeEdge
+{
+    unsigned char lo;
+    unsigned char hi;
+    int to;
+};
+
+// sparse set of states, checking, adding and clearing take O(1), states are
+// kept in the order added. memory is kept by Clear(), so a set can be reused
+// without allocating again.
+class MachineStateSet
+{
+    public:
+
+        MachineStateSet(): size_(0) {}
+
+        // make room for states in [0, num).
+        void Resize(int num)
+        {
+            if (static_cast<int>(sparse_.size()) >= num) return;
+
+            sparse_.resize(num, 0);
+            dense_.resize(num, 0);
+        }
+
+        bool Has(int st) const
+        {
+            int i = sparse_[st];
+            return i < size_ && dense_[i] == st;
+        }
+
+        void Add(int st)
+        {
+            sparse_[st] = size_;
+            dense_[size_++] = st;
+        }
+
+        void Clear() { size_ = 0; }
+        bool Empty() const { return size_ == 0; }
+        int  Size() const { return size_; }
+        int  operator[](int i) const { return dense_[i]; }
+
+        void Swap(MachineStateSet& other)
+        {
+            sparse_.swap(other.sparse_);
+            dense_.swap(other.dense_);
+            std::swap(size_, other.size_);
+        }
+
+    private:
+
+        int size_;
+        std::vector<int> sparse_;
+        std::vector<int> dense_;
+};
+
 #endif
 
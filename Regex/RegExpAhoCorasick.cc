@@ -0,0 +1,539 @@
+#include "RegExpAhoCorasick.h"
+
+#include <assert.h>
+#include <algorithm>
+
+#include "AutomatonImage.h"
+#include "RegExpTokenizer.h"
+#include "RegExpSyntaxTree.h"
+#include "RegExpSynTreeNode.h"
+
+// bounds on literals a tree may expand to, eg, (a|b)(c|d){4}.
+#define REG_EXP_AC_MAX_LITERAL (256)
+#define REG_EXP_AC_MAX_LITERAL_LEN (256)
+
+// code of a char in the double array, 0 is left unused so that no child
+// ever lands on the unit of its parent.
+#define REG_EXP_AC_CODE(ch) ((ch) + 1)
+
+RegExpAhoCorasick::RegExpAhoCorasick(bool partial)
+    :AutomatonBase(AutomatonType_DFA)
+    ,support_partial_match_(partial)
+{
+    Reset();
+}
+
+RegExpAhoCorasick::~RegExpAhoCorasick()
+{
+}
+
+void RegExpAhoCorasick::Reset()
+{
+    start_ = accept_ = -1;
+    stateNum_ = idNum_ = 0;
+
+    units_.clear();
+    outIndex_.clear();
+    outIds_.clear();
+}
+
+bool RegExpAhoCorasick::ExtractLiteral(const RegExpSyntaxTree* tree, std::vector<std::string>& literals)
+{
+    literals.clear();
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    if (tree->HasRefNode()) return false;
+#endif
+
+    const RegExpSynTreeNode* root = tree->GetRoot();
+    if (!ExtractLiteral(root, literals)) return false;
+
+    // an empty literal matches anything, not worth a trie.
+    for (size_t i = 0; i < literals.size(); ++i)
+    {
+        if (literals[i].empty()) return false;
+    }
+
+    return !literals.empty();
+}
+
+// every left literal followed by every right one.
+static bool CrossLiteral(const std::vector<std::string>& left,
+        const std::vector<std::string>& right, std::vector<std::string>& out)
+{
+    if (left.size() * right.size() > REG_EXP_AC_MAX_LITERAL) return false;
+
+    out.clear();
+    for (size_t i = 0; i < left.size(); ++i)
+    {
+        for (size_t j = 0; j < right.size(); ++j)
+        {
+            if (left[i].size() + right[j].size() > REG_EXP_AC_MAX_LITERAL_LEN) return false;
+
+            out.push_back(left[i] + right[j]);
+        }
+    }
+
+    return true;
+}
+
+bool RegExpAhoCorasick::ExtractLiteral(const RegExpSynTreeNode* node, std::vector<std::string>& literals)
+{
+    if (!node) return false;
+
+    if (node->IsLeafNode())
+    {
+        const RegExpSynTreeLeafNode* ln = node->AsLeafNode();
+        assert(ln);
+
+        const std::string& txt = ln->GetNodeText();
+        RegExpSynTreeNodeLeafNodeType lt = ln->GetLeafNodeType();
+
+        if (lt == RegExpSynTreeNodeLeafNodeType_Norm ||
+                ((lt == RegExpSynTreeNodeLeafNodeType_Esc || lt == RegExpSynTreeNodeLeafNodeType_Alt) && txt.size() == 1))
+        {
+            literals.assign(1, txt.substr(0, 1));
+            return true;
+        }
+        else if (lt == RegExpSynTreeNodeLeafNodeType_Str && txt.size() <= REG_EXP_AC_MAX_LITERAL_LEN)
+        {
+            literals.assign(1, txt);
+            return true;
+        }
+
+        return false;
+    }
+
+    std::vector<std::string> left, right;
+    if (node->GetNodeType() == RegExpSynTreeNodeType_Star)
+    {
+        if (!ExtractLiteral(node->GetLeftNode(), left)) return false;
+
+        const RegExpSynTreeStarNode* sn = node->AsStarNode();
+        assert(sn);
+
+        // only fixed count, (a|b){2} is aa, ab, ba, bb.
+        int num = sn->GetMinRepeat();
+        if (num != sn->GetMaxRepeat() || num <= 0) return false;
+
+        literals.assign(1, "");
+        for (int i = 0; i < num; ++i)
+        {
+            if (!CrossLiteral(literals, left, right)) return false;
+
+            literals.swap(right);
+        }
+
+        return true;
+    }
+
+    // the nodes of a chain one after another.
+    std::vector<RegExpSynTreeNode*> nodes;
+    RegExpSynTreeNodeType type = node->GetNodeType();
+
+    RegExpSyntaxTree::SplitChain(node->GetLeftNode(), type, nodes);
+    RegExpSyntaxTree::SplitChain(node->GetRightNode(), type, nodes);
+
+    if (!ExtractLiteral(nodes[0], left)) return false;
+
+    for (size_t i = 1; i < nodes.size(); ++i)
+    {
+        if (!ExtractLiteral(nodes[i], right)) return false;
+
+        if (type == RegExpSynTreeNodeType_Or)
+        {
+            if (left.size() + right.size() > REG_EXP_AC_MAX_LITERAL) return false;
+
+            left.insert(left.end(), right.begin(), right.end());
+            continue;
+        }
+
+        assert(type == RegExpSynTreeNodeType_Concat);
+        if (!CrossLiteral(left, right, literals)) return false;
+
+        left.swap(literals);
+    }
+
+    literals.swap(left);
+    return true;
+}
+
+int RegExpAhoCorasick::BuildMachine(SyntaxTreeBase* tree)
+{
+    Reset();
+
+    RegExpSyntaxTree* reg_tree = dynamic_cast<RegExpSyntaxTree*>(tree);
+    if (!reg_tree) return 0;
+
+    std::vector<std::string> literals;
+    if (!ExtractLiteral(reg_tree, literals)) return 0;
+
+    return BuildLiteralMachine(literals, std::vector<int>(literals.size(), 0));
+}
+
+// smallest base from nextFree on placing every child on a free unit,
+// units are added as needed.
+int RegExpAhoCorasick::FindUnitBase(const std::vector<std::pair<short, int> >& child, int& nextFree)
+{
+    assert(!child.empty());
+
+    const int size = units_.size();
+    const int begin = std::max(nextFree, child[0].first + 1);
+
+    // the first child tries every free unit, the scan starts later next time
+    // once the units passed are almost all taken, holes no child fits in
+    // would make it quadratic otherwise.
+    int used = 0;
+    for (int pos = begin; ; ++pos)
+    {
+        if (pos < size && units_[pos].check >= 0)
+        {
+            if (++used * 20 >= (pos - begin + 1) * 19 && pos > nextFree) nextFree = pos;
+            continue;
+        }
+
+        int base = pos - child[0].first;
+
+        size_t i = 1;
+        for (; i < child.size(); ++i)
+        {
+            int slot = base + child[i].first;
+            if (slot < size && units_[slot].check >= 0) break;
+        }
+
+        if (i == child.size()) return base;
+    }
+
+    return -1;
+}
+
+int RegExpAhoCorasick::BuildLiteralMachine(const std::vector<std::string>& literals, const std::vector<int>& ids)
+{
+    Reset();
+    assert(literals.size() == ids.size());
+
+    std::vector<TrieNode> trie(1);
+    for (size_t i = 0; i < literals.size(); ++i)
+    {
+        const std::string& lit = literals[i];
+        if (lit.empty()) continue;
+
+        int node = 0;
+        for (size_t j = 0; j < lit.size(); ++j)
+        {
+            unsigned char ch = lit[j];
+
+            std::pair<short, int> key(REG_EXP_AC_CODE(ch), -1);
+            std::vector<std::pair<short, int> >& child = trie[node].child;
+            std::vector<std::pair<short, int> >::iterator it =
+                std::lower_bound(child.begin(), child.end(), key);
+
+            if (it != child.end() && it->first == key.first)
+            {
+                node = it->second;
+                continue;
+            }
+
+            key.second = trie.size();
+            child.insert(it, key);
+            trie.push_back(TrieNode());
+            node = key.second;
+        }
+
+        trie[node].ids.push_back(ids[i]);
+        idNum_ = std::max(idNum_, ids[i] + 1);
+    }
+
+    if (trie.size() == 1) return 0;
+
+    // pack the trie breadth first.
+    units_.resize(1);
+    units_[0].check = 0;
+    trie[0].unit = 0;
+
+    int nextFree = 1;
+    std::vector<int> queue(1, 0);
+    for (size_t cur = 0; cur < queue.size(); ++cur)
+    {
+        const TrieNode& tn = trie[queue[cur]];
+        if (tn.child.empty()) continue;
+
+        int base = FindUnitBase(tn.child, nextFree);
+        int last = base + tn.child.back().first;
+        if (last >= static_cast<int>(units_.size())) units_.resize(last + 1);
+
+        units_[tn.unit].base = base;
+        for (size_t i = 0; i < tn.child.size(); ++i)
+        {
+            int slot = base + tn.child[i].first;
+
+            units_[slot].check = tn.unit;
+            trie[tn.child[i].second].unit = slot;
+            queue.push_back(tn.child[i].second);
+        }
+    }
+
+    std::vector<std::pair<int, int> > out; // (unit, id)
+    for (size_t i = 0; i < trie.size(); ++i)
+    {
+        for (size_t j = 0; j < trie[i].ids.size(); ++j)
+        {
+            out.push_back(std::make_pair(trie[i].unit, trie[i].ids[j]));
+        }
+    }
+
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+
+    outIndex_.assign(units_.size() + 1, 0);
+    for (size_t i = 0; i < out.size(); ++i)
+    {
+        ++outIndex_[out[i].first + 1];
+        outIds_.push_back(out[i].second);
+    }
+
+    for (size_t i = 1; i < outIndex_.size(); ++i) outIndex_[i] += outIndex_[i - 1];
+
+    BuildFailure(trie);
+
+    start_ = 0;
+    stateNum_ = trie.size();
+    return stateNum_;
+}
+
+// fail links in breadth first order, so links of shallower states are ready.
+void RegExpAhoCorasick::BuildFailure(const std::vector<TrieNode>& trie)
+{
+    std::vector<int> queue(1, 0);
+    for (size_t cur = 0; cur < queue.size(); ++cur)
+    {
+        const TrieNode& tn = trie[queue[cur]];
+        for (size_t i = 0; i < tn.child.size(); ++i)
+        {
+            int code = tn.child[i].first;
+            int to = trie[tn.child[i].second].unit;
+
+            int fail = 0;
+            if (tn.unit != 0)
+            {
+                int st = units_[tn.unit].fail;
+                while (st != 0 && Next(st, code) < 0) st = units_[st].fail;
+
+                fail = Next(st, code);
+                if (fail < 0) fail = 0;
+            }
+
+            units_[to].fail = fail;
+            units_[to].dict = (outIndex_[fail] != outIndex_[fail + 1])? fail : units_[fail].dict;
+
+            queue.push_back(tn.child[i].second);
+        }
+    }
+}
+
+inline int RegExpAhoCorasick::Next(int st, int code) const
+{
+    int to = units_[st].base + code;
+    if (to >= static_cast<int>(units_.size()) || units_[to].check != st) return -1;
+
+    return to;
+}
+
+// mark literals ending at st, ids newly marked are added to hits.
+void RegExpAhoCorasick::ReportMatch(int st, std::vector<char>& matched, std::vector<int>& hits) const
+{
+    if (outIndex_[st] == outIndex_[st + 1]) st = units_[st].dict;
+
+    for (; st >= 0; st = units_[st].dict)
+    {
+        for (int i = outIndex_[st]; i < outIndex_[st + 1]; ++i)
+        {
+            int id = outIds_[i];
+            if (matched[id]) continue;
+
+            matched[id] = 1;
+            hits.push_back(id);
+        }
+    }
+}
+
+// the whole input must be one of the literals.
+bool RegExpAhoCorasick::RunAnchored(const char* ps, const char* pe, std::vector<char>* matched) const
+{
+    int st = 0;
+    for (const char* in = ps; in <= pe; ++in)
+    {
+        unsigned char ch = *in;
+
+        st = Next(st, REG_EXP_AC_CODE(ch));
+        if (st < 0) return false;
+    }
+
+    if (outIndex_[st] == outIndex_[st + 1]) return false;
+
+    for (int i = outIndex_[st]; matched && i < outIndex_[st + 1]; ++i) (*matched)[outIds_[i]] = 1;
+
+    return true;
+}
+
+// stop at the first match if matched is NULL.
+bool RegExpAhoCorasick::RunPartial(const char* ps, const char* pe, std::vector<char>* matched) const
+{
+    bool found = false;
+    std::vector<int> hits;
+
+    int st = 0;
+    for (const char* in = ps; in <= pe; ++in)
+    {
+        unsigned char ch = *in;
+
+        int code = REG_EXP_AC_CODE(ch);
+        while (st != 0 && Next(st, code) < 0) st = units_[st].fail;
+
+        st = Next(st, code);
+        if (st < 0)
+        {
+            st = 0;
+            continue;
+        }
+
+        if (outIndex_[st] == outIndex_[st + 1] && units_[st].dict < 0) continue;
+
+        found = true;
+        if (!matched) break;
+
+        ReportMatch(st, *matched, hits);
+    }
+
+    return found;
+}
+
+bool RegExpAhoCorasick::Match(const char* ps, const char* pe, std::vector<char>& matched) const
+{
+    if (units_.empty()) return false;
+
+    if (matched.size() < static_cast<size_t>(idNum_)) matched.resize(idNum_, 0);
+
+    if (!support_partial_match_) return RunAnchored(ps, pe, &matched);
+
+    return RunPartial(ps, pe, &matched);
+}
+
+bool RegExpAhoCorasick::RunMachine(const char* ps, const char* pe)
+{
+    if (units_.empty()) return false;
+
+    if (!support_partial_match_) return RunAnchored(ps, pe, NULL);
+
+    return RunPartial(ps, pe, NULL);
+}
+
+bool RegExpAhoCorasick::SerializeState(std::string& image) const
+{
+    if (units_.empty()) return false;
+
+    int info[] = { support_partial_match_, stateNum_, idNum_ };
+
+    AutomatonImageWriter writer(image, AutomatonImage_AhoCorasick);
+    writer.WriteSection(info, sizeof(info));
+    writer.WriteSection(units_);
+    writer.WriteSection(outIndex_);
+    writer.WriteSection(outIds_);
+    writer.Finish();
+
+    return true;
+}
+
+// links[u] is followed from every u until it is end, false if some chain loops.
+static bool IsAcyclicLink(const std::vector<int>& links, int end)
+{
+    std::vector<char> mark(links.size(), 0); // 1: on the current chain, 2: reaches end
+    std::vector<int> chain;
+
+    for (size_t u = 0; u < links.size(); ++u)
+    {
+        int st = u;
+        chain.clear();
+
+        while (st != end && mark[st] == 0)
+        {
+            mark[st] = 1;
+            chain.push_back(st);
+            st = links[st];
+        }
+
+        if (st != end && mark[st] == 1) return false;
+
+        for (size_t i = 0; i < chain.size(); ++i) mark[chain[i]] = 2;
+    }
+
+    return true;
+}
+
+// every index matching follows stays in the arrays, and fail and dict
+// chains end at the root and -1.
+bool RegExpAhoCorasick::IsValidState() const
+{
+    const int size = units_.size();
+    if (size == 0 || idNum_ < 0 || stateNum_ <= 0 || stateNum_ > size) return false;
+
+    if (outIndex_.size() != units_.size() + 1 || outIndex_[0] != 0
+            || static_cast<size_t>(outIndex_[size]) != outIds_.size())
+    {
+        return false;
+    }
+
+    std::vector<int> fail(size), dict(size);
+    for (int u = 0; u < size; ++u)
+    {
+        const ArrayUnit& unit = units_[u];
+
+        if (unit.base < 0 || unit.base >= size || unit.check < -1 || unit.check >= size
+                || unit.fail < 0 || unit.fail >= size || unit.dict < -1 || unit.dict >= size
+                || outIndex_[u] > outIndex_[u + 1])
+        {
+            return false;
+        }
+
+        fail[u] = unit.fail;
+        dict[u] = unit.dict;
+    }
+
+    for (size_t i = 0; i < outIds_.size(); ++i)
+    {
+        if (outIds_[i] < 0 || outIds_[i] >= idNum_) return false;
+    }
+
+    return IsAcyclicLink(fail, 0) && IsAcyclicLink(dict, -1);
+}
+
+bool RegExpAhoCorasick::DeserializeState(const char* image, size_t len)
+{
+    Reset();
+
+    int info[3];
+    AutomatonImageReader reader(image, len, AutomatonImage_AhoCorasick);
+
+    if (!reader.ReadSection(info, sizeof(info))
+            || !reader.ReadSection(units_)
+            || !reader.ReadSection(outIndex_)
+            || !reader.ReadSection(outIds_))
+    {
+        Reset();
+        return false;
+    }
+
+    stateNum_ = info[1];
+    idNum_ = info[2];
+
+    if (!IsValidState())
+    {
+        Reset();
+        return false;
+    }
+
+    support_partial_match_ = info[0];
+    start_ = 0;
+
+    return true;
+}
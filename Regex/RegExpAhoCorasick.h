@@ -0,0 +1,97 @@
+#ifndef REGEXP_AHO_CORASICK_H_
+#define REGEXP_AHO_CORASICK_H_
+
+#include <string>
+#include <vector>
+#include "AutomatonBase.h"
+
+class RegExpSyntaxTree;
+class RegExpSynTreeNode;
+
+/*
+   aho-corasick automaton for patterns made of plain chars only, eg, keyword lists.
+   the trie is kept in a double array: child of state s on char c is
+   base + code(c) if the unit there is checked by s.
+
+   BuildMachine() takes one tree, a literal or alternation of literals like
+   foo|bar|baz. BuildLiteralMachine() takes a list of literals, each with
+   the id reported on match.
+*/
+class RegExpAhoCorasick: public AutomatonBase
+{
+    public:
+
+        // partial matching has the same meaning as RegExpNFA: a literal occurring
+        // anywhere is a match, otherwise the whole input must be a literal.
+        explicit RegExpAhoCorasick(bool enable_partial_match = true);
+        ~RegExpAhoCorasick();
+
+        virtual bool SerializeState(std::string& image) const;
+        virtual bool DeserializeState(const char* image, size_t len);
+
+        // return number of states, 0 if the tree is not made of literals.
+        virtual int  BuildMachine(SyntaxTreeBase* tree);
+        virtual bool RunMachine(const char* ps, const char* pe);
+
+        int BuildLiteralMachine(const std::vector<std::string>& literals, const std::vector<int>& ids);
+
+        // set matched[id] for literals found in [ps, pe], return false if
+        // there is none. matched is grown to hold every id.
+        bool Match(const char* ps, const char* pe, std::vector<char>& matched) const;
+
+        // literals the tree can match, false if it is not made of plain chars.
+        static bool ExtractLiteral(const RegExpSyntaxTree* tree, std::vector<std::string>& literals);
+
+        bool IsBuilt() const { return !units_.empty(); }
+        int  GetStateNumber() const { return stateNum_; }
+        int  GetArraySize() const { return units_.size(); }
+
+    private:
+
+        struct ArrayUnit
+        {
+            ArrayUnit(): base(0), check(-1), fail(0), dict(-1) {}
+
+            int base;
+            int check; // parent state, -1 if the unit is free
+            int fail;
+            int dict;  // closest state on the fail chain having output
+        };
+
+        // trie built before it is packed into the double array.
+        struct TrieNode
+        {
+            TrieNode(): unit(-1) {}
+
+            int unit;
+            std::vector<int> ids;
+            std::vector<std::pair<short, int> > child; // (code, node), sorted
+        };
+
+        void Reset();
+        int  FindUnitBase(const std::vector<std::pair<short, int> >& child, int& nextFree);
+        void BuildFailure(const std::vector<TrieNode>& trie);
+        bool IsValidState() const;
+
+        int  Next(int st, int code) const;
+        void ReportMatch(int st, std::vector<char>& matched, std::vector<int>& hits) const;
+
+        bool RunAnchored(const char* ps, const char* pe, std::vector<char>* matched) const;
+        bool RunPartial(const char* ps, const char* pe, std::vector<char>* matched) const;
+
+        static bool ExtractLiteral(const RegExpSynTreeNode* node, std::vector<std::string>& literals);
+
+    private:
+
+        bool support_partial_match_;
+        int stateNum_;
+        int idNum_;
+
+        std::vector<ArrayUnit> units_;
+
+        // ids of literals ending at unit u are outIds_[outIndex_[u], outIndex_[u + 1]).
+        std::vector<int> outIndex_;
+        std::vector<int> outIds_;
+};
+
+#endif
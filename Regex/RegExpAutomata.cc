@@ -1,65 +1,261 @@
 #include "RegExpAutomata.h"
+#include "RegExpSearch.h"
 
 #include <limits.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <algorithm>
 
+#include "AutomatonImage.h"
 #include "RegExpTokenizer.h"
 #include "RegExpSyntaxTree.h"
 #include "RegExpSynTreeNode.h"
 #include "Parsing/LexException.h"
 
+// unknown transition in the lazy dfa cache.
+#define REG_EXP_LAZY_DFA_UNKNOWN (-2)
+
+// the lazy dfa gives up once a run flushed the cache this many times
+// while building a new state every few input chars.
+#define REG_EXP_LAZY_DFA_MAX_FLUSH (3)
+#define REG_EXP_LAZY_DFA_MIN_CHAR_PER_STATE (10)
+
+// average size of precomputed epsilon closures allowed per state.
+#define REG_EXP_CLOSURE_PER_STATE (32)
+
+RegExpMatchContext::RegExpMatchContext()
+{
+    Reset();
+}
+
+void RegExpMatchContext::Reset()
+{
+    owner_ = NULL;
+    lazyStat_ = LazyDFAStat();
+    groups_.clear();
+
+    FlushLazyDFA();
+}
+
+void RegExpMatchContext::FlushLazyDFA()
+{
+    lazyStart_ = -1;
+    lazyCacheUsed_ = 0;
+
+    lazyTran_.clear();
+    lazyAccept_.clear();
+    lazyStates_.clear();
+    lazySetToState_.clear();
+}
+
+int RegExpMatchContext::AddLazyDFAState(const std::vector<int>& stat, bool accept, size_t cacheSize)
+{
+    // transition row, the state set and the bookkeeping of the map.
+    size_t sz = lazyClassNum_ * sizeof(int) + stat.size() * sizeof(int) + 64;
+    if (lazyCacheUsed_ + sz > cacheSize) return -1;
+
+    int st = lazyStates_.size();
+    LAZY_DFA_SET_T::iterator it = lazySetToState_.insert(std::make_pair(stat, st)).first;
+
+    lazyStates_.push_back(it);
+    lazyAccept_.push_back(accept);
+    lazyTran_.resize(lazyTran_.size() + lazyClassNum_, REG_EXP_LAZY_DFA_UNKNOWN);
+    lazyCacheUsed_ += sz;
+
+    return st;
+}
+
+
+// nfa
+
 RegExpNFA::RegExpNFA(bool partial)
     :AutomatonBase(AutomatonType_NFA), stateIndex_(0)
     ,headState_(-1), tailState_(-1), support_partial_match_(partial)
+    ,coreStart_(-1), coreAccept_(-1), search_(NULL), searchBuilt_(false), tailDFA_(NULL)
+    ,bitNFA_(partial), backtrack_(partial), pikeVM_(partial), lazyCacheSize_(0), hasCountedNode_(false)
 {
+    start_ = accept_ = -1;
+    pthread_mutex_init(&searchLock_, NULL);
 }
 
 RegExpNFA::~RegExpNFA()
 {
+    delete search_;
+    delete tailDFA_;
+    pthread_mutex_destroy(&searchLock_);
 }
 
-int RegExpNFA::BuildNFA(RegExpSyntaxTree* tree)
+void RegExpNFA::ResetNFA(int nodeNum)
 {
     stateIndex_ = 0;
     headState_ = tailState_ = -1;
     states_.clear();
     NFAStatTran_.clear();
     recycleStates_.clear();
+    context_.Reset();
+
+    delete search_;
+    delete tailDFA_;
+    search_ = NULL;
+    searchBuilt_ = false;
+    tailDFA_ = NULL;
+    start_ = accept_ = -1;
+    coreStart_ = coreAccept_ = -1;
+
+    edgeIndex_.clear();
+    edges_.clear();
+    epsilonIndex_.clear();
+    epsilonEdges_.clear();
+    closureIndex_.clear();
+    closureStates_.clear();
+
+    bitNFA_.Reset();
+    backtrack_.Reset();
+    pikeVM_.Reset();
+    prefilter_.SetLiterals(std::vector<std::string>());
 
 #ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-    groupCapture_.clear();
-    groupWatcher_.clear();
-    unitMatchPair_.clear();
-
-    hasReferNode_ = tree->HasRefNode();
+    hasReferNode_ = false;
 #endif
+    hasCountedNode_ = false;
 
-    int leaf_node_num = tree->GetNodeNumber() * 2;
+    int leaf_node_num = nodeNum * 2;
     states_.reserve(leaf_node_num);
     recycleStates_.reserve(leaf_node_num/2);
     NFAStatTran_.reserve(leaf_node_num);
+}
+
+int RegExpNFA::BuildNFA(RegExpSyntaxTree* tree)
+{
+    ResetNFA(tree->GetNodeNumber());
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    hasReferNode_ = tree->HasRefNode();
+#endif
+
+    // a counted repetition would take a copy of its child for every round,
+    // such patterns get no states and are run by the vms alone.
+    if (tree->HasCountedNode())
+    {
+        hasCountedNode_ = true;
+        prefilter_.Build(tree);
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+        if (hasReferNode_) return backtrack_.BuildMachine(tree);
+#endif
+        return pikeVM_.BuildMachine(tree);
+    }
 
-    int num = BuildNFAImp(dynamic_cast<RegExpSynTreeNode*>(tree->GetSynTree()),
+    int num = BuildNFAImp(tree->GetRoot(),
             start_, accept_, false, -1);
 
+    coreStart_ = start_;
+    coreAccept_ = accept_;
+
+    // partial matching is done by looping states in front of and behind the pattern.
+    // they must be dedicated states, looping on the original start/accept state
+    // only covers chars that have no transition yet, "ab" would then fail on "aab".
     if (support_partial_match_ && headState_ == -1)
     {
-        for (int i = 0; i < REG_EXP_CHAR_MAX; ++i)
+        int st = CreateState(State_Start);
+        for (int i = 0; i < REG_EXP_CHAR_EPSILON; ++i)
         {
-            if (NFAStatTran_[start_][i].empty()) NFAStatTran_[start_][i].push_back(start_);
+            NFAStatTran_[st][i].push_back(st);
         }
+
+        states_[start_].SetNormType();
+        NFAStatTran_[st][REG_EXP_CHAR_EPSILON].push_back(start_);
+        start_ = st;
+        ++num;
     }
 
     if (support_partial_match_ && tailState_ == -1)
     {
-        for (int i = 0; i < REG_EXP_CHAR_MAX; ++i)
+        int st = CreateState(State_Accept);
+        for (int i = 0; i < REG_EXP_CHAR_EPSILON; ++i)
+        {
+            NFAStatTran_[st][i].push_back(st);
+        }
+
+        states_[accept_].SetNormType();
+        NFAStatTran_[accept_][REG_EXP_CHAR_EPSILON].push_back(st);
+        accept_ = st;
+        ++num;
+    }
+
+    BuildCompactNFA();
+    BuildEpsilonClosure();
+    bitNFA_.BuildMachine(tree);
+    prefilter_.Build(tree);
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    if (hasReferNode_) backtrack_.BuildMachine(tree);
+#endif
+    pikeVM_.BuildMachine(tree);
+    BuildTailDFA();
+
+    NFA_TRAN_T().swap(NFAStatTran_);
+    return num;
+}
+
+/*
+   one nfa for all the trees, sharing the start state. floating patterns hang off
+   a single looping state instead of each having its own.
+   accepts[i] is the accept state of trees[i], sticky[i] tells if reaching it
+   anywhere in the input is a match, otherwise it must be reached at the end.
+   trees must not contain back reference.
+*/
+int RegExpNFA::BuildSetNFA(const std::vector<RegExpSyntaxTree*>& trees,
+        std::vector<int>& accepts, std::vector<char>& sticky)
+{
+    int node_num = 0;
+    for (size_t i = 0; i < trees.size(); ++i) node_num += trees[i]->GetNodeNumber();
+
+    ResetNFA(node_num);
+    accepts.clear();
+    sticky.clear();
+
+    start_ = CreateState(State_Start);
+    accept_ = -1;
+
+    int loop = -1;
+    int num = 1;
+    for (size_t i = 0; i < trees.size(); ++i)
+    {
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+        assert(!trees[i]->HasRefNode());
+#endif
+        int st, ac;
+        headState_ = tailState_ = -1;
+
+        num += BuildNFAImp(trees[i]->GetRoot(), st, ac, false, -1);
+        states_[st].SetNormType();
+
+        bool floating = support_partial_match_ && headState_ == -1;
+        if (floating && loop == -1)
         {
-            if (NFAStatTran_[accept_][i].empty()) NFAStatTran_[accept_][i].push_back(accept_);
+            loop = CreateState(State_Norm);
+            for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch)
+            {
+                NFAStatTran_[loop][ch].push_back(loop);
+            }
+
+            NFAStatTran_[start_][REG_EXP_CHAR_EPSILON].push_back(loop);
+            ++num;
         }
+
+        NFAStatTran_[floating? loop : start_][REG_EXP_CHAR_EPSILON].push_back(st);
+
+        accepts.push_back(ac);
+        sticky.push_back(support_partial_match_ && tailState_ == -1);
     }
 
+    headState_ = tailState_ = -1;
+
+    BuildCompactNFA();
+    BuildEpsilonClosure();
+
+    NFA_TRAN_T().swap(NFAStatTran_);
     return num;
 }
 
@@ -92,9 +288,9 @@ int RegExpNFA::CreateState(StateType type)
 
 void RegExpNFA::ReleaseState(int st)
 {
-    std::vector<std::vector<int> > tmps(REG_EXP_CHAR_MAX + 1);
+    std::vector<std::vector<int> >& tran = NFAStatTran_[st];
+    for (size_t i = 0; i < tran.size(); ++i) tran[i].clear();
 
-    NFAStatTran_[st].swap(tmps);
     states_[st].SetType(State_None);
 }
 
@@ -113,14 +309,14 @@ int RegExpNFA::BuildNFAImp(RegExpSynTreeNode* root, int& start,
     int num = 0;
     if (root->IsLeafNode())
     {
-        RegExpSynTreeLeafNode* ln = dynamic_cast<RegExpSynTreeLeafNode*>(root);
+        RegExpSynTreeLeafNode* ln = root->AsLeafNode();
         assert(ln);
 
         num = BuildStateForLeafNode(ln, start, accept);
     }
     else if (root->GetNodeType() == RegExpSynTreeNodeType_Star)
     {
-        RegExpSynTreeStarNode* sn = dynamic_cast<RegExpSynTreeStarNode*>(root);
+        RegExpSynTreeStarNode* sn = root->AsStarNode();
         assert(sn);
 
         num = BuildStateForStarNode(sn, start, accept, ignoreUnit, unit_start);
@@ -160,7 +356,6 @@ int RegExpNFA::BuildNFAImp(RegExpSynTreeNode* root, int& start,
 
         states_[start].SetParentUnit(parentUnit);
         states_[accept].SetParentUnit(start);
-        unitMatchPair_[start].insert(accept);
     }
 #endif
 
@@ -177,8 +372,9 @@ int RegExpNFA::BuildStateForLeafNode(RegExpSynTreeLeafNode* ln, int& start, int&
     if (lt == RegExpSynTreeNodeLeafNodeType_Dot)
     {
         std::vector<int> to(1, accept);
-        std::vector<std::vector<int> > char_to_state(REG_EXP_CHAR_MAX, to);
+        std::vector<std::vector<int> > char_to_state(REG_EXP_CHAR_MAX + 1, to);
         char_to_state[REG_EXP_CHAR_EPSILON].clear();
+        char_to_state[REG_EXP_CHAR_MAX].clear();
         NFAStatTran_[start].swap(char_to_state);
     }
     else if (lt == RegExpSynTreeNodeLeafNodeType_Head)
@@ -197,21 +393,34 @@ int RegExpNFA::BuildStateForLeafNode(RegExpSynTreeLeafNode* ln, int& start, int&
     {
         for (size_t i = 0; i < txt.size(); ++i)
         {
-            assert(txt[i] < REG_EXP_CHAR_MAX - 1);
-            NFAStatTran_[start][txt[i]].push_back(accept);
+            NFAStatTran_[start][static_cast<unsigned char>(txt[i])].push_back(accept);
         }
     }
     else if (lt == RegExpSynTreeNodeLeafNodeType_Esc)
     {
         for (size_t i = 0; i < txt.size(); ++i)
         {
-            NFAStatTran_[start][txt[i]].push_back(accept);
+            NFAStatTran_[start][static_cast<unsigned char>(txt[i])].push_back(accept);
         }
     }
+    else if (lt == RegExpSynTreeNodeLeafNodeType_Str)
+    {
+        // a state behind every char but the last.
+        int st = start;
+        for (size_t i = 0; i + 1 < txt.size(); ++i)
+        {
+            int next = CreateState(State_Norm);
+            NFAStatTran_[st][static_cast<unsigned char>(txt[i])].push_back(next);
+            st = next;
+        }
+
+        NFAStatTran_[st][static_cast<unsigned char>(txt[txt.size() - 1])].push_back(accept);
+        return txt.size() + 1;
+    }
     else if (lt == RegExpSynTreeNodeLeafNodeType_Ref)
     {
 #ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-        RegExpSynTreeRefNode* rt = dynamic_cast<RegExpSynTreeRefNode*>(ln);
+        RegExpSynTreeRefNode* rt = ln->AsRefNode();
         NFAStatTran_[start][REG_EXP_CHAR_MAX].push_back(accept);
         NFAStatTran_[start][REG_EXP_CHAR_MAX].push_back(rt->GetRef());
         states_[start].AppendType(State_Ref);
@@ -221,68 +430,83 @@ int RegExpNFA::BuildStateForLeafNode(RegExpSynTreeLeafNode* ln, int& start, int&
     }
     else
     {
-        NFAStatTran_[start][txt[0]].push_back(accept);
+        NFAStatTran_[start][static_cast<unsigned char>(txt[0])].push_back(accept);
     }
 
     return 2;
 }
 
+// the alternatives in a chain are built one after another, then linked
+// from the right as the right-deep tree has them.
 int RegExpNFA::BuildStateForOrNode(RegExpSynTreeNode* node, int& start,
         int& accept, bool ignoreUnit, int parentUnit)
 {
-    int left_child_start, left_child_accept;
-    int right_child_start, right_child_accept;
+    std::vector<RegExpSynTreeNode*> alts;
+    RegExpSyntaxTree::SplitChain(node->GetLeftNode(), RegExpSynTreeNodeType_Or, alts);
+    RegExpSyntaxTree::SplitChain(node->GetRightNode(), RegExpSynTreeNodeType_Or, alts);
 
-    RegExpSynTreeNode* lc = dynamic_cast<RegExpSynTreeNode*>(node->GetLeftChild());
-    RegExpSynTreeNode* rc = dynamic_cast<RegExpSynTreeNode*>(node->GetRightChild());
+    std::vector<int> starts(alts.size()), accepts(alts.size());
 
-    assert(lc);
-    assert(rc);
+    int num = 0;
+    for (size_t i = 0; i < alts.size(); ++i)
+    {
+        num += BuildNFAImp(alts[i], starts[i], accepts[i], ignoreUnit, parentUnit);
+    }
 
-    int left_child_state_num = BuildNFAImp(lc, left_child_start,
-            left_child_accept, ignoreUnit, parentUnit);
-    int right_child_state_num = BuildNFAImp(rc, right_child_start,
-            right_child_accept, ignoreUnit, parentUnit);
+    start = starts.back();
+    accept = accepts.back();
 
-    states_[right_child_start].SetNormType();
-    states_[right_child_accept].SetNormType();
+    for (size_t i = alts.size() - 1; i > 0; --i)
+    {
+        states_[start].SetNormType();
+        states_[accept].SetNormType();
 
-    // epsilon transition
-    NFAStatTran_[left_child_start][REG_EXP_CHAR_EPSILON].push_back(right_child_start);
-    NFAStatTran_[right_child_accept][REG_EXP_CHAR_EPSILON].push_back(left_child_accept);
+        // epsilon transition
+        NFAStatTran_[starts[i - 1]][REG_EXP_CHAR_EPSILON].push_back(start);
+        NFAStatTran_[accept][REG_EXP_CHAR_EPSILON].push_back(accepts[i - 1]);
 
-    start = left_child_start;
-    accept = left_child_accept;
+        start = starts[i - 1];
+        accept = accepts[i - 1];
+    }
 
-    return left_child_state_num + right_child_state_num;
+    return num;
 }
 
 int RegExpNFA::BuildStateForCatNode(RegExpSynTreeNode* node, int& start,
         int& accept, bool ignoreUnit, int parentUnit)
 {
-    int left_child_start, left_child_accept;
-    int right_child_start, right_child_accept;
+    std::vector<RegExpSynTreeNode*> nodes;
+    RegExpSyntaxTree::SplitChain(node->GetLeftNode(), RegExpSynTreeNodeType_Concat, nodes);
+    RegExpSyntaxTree::SplitChain(node->GetRightNode(), RegExpSynTreeNodeType_Concat, nodes);
 
-    RegExpSynTreeNode* lc = dynamic_cast<RegExpSynTreeNode*>(node->GetLeftChild());
-    RegExpSynTreeNode* rc = dynamic_cast<RegExpSynTreeNode*>(node->GetRightChild());
+    int num = BuildNFAImp(nodes[0], start, accept, ignoreUnit, parentUnit);
+    for (size_t i = 1; i < nodes.size(); ++i)
+    {
+        int child_start, child_accept;
+        num += BuildNFAImp(nodes[i], child_start, child_accept, ignoreUnit, parentUnit) - 1;
 
-    assert(lc);
-    assert(rc);
+        states_[accept].SetNormType();
+        states_[child_start].SetNormType();
 
-    int left_child_state_num = BuildNFAImp(lc, left_child_start,
-            left_child_accept, ignoreUnit, parentUnit);
-    int right_child_state_num = BuildNFAImp(rc, right_child_start,
-            right_child_accept, ignoreUnit, parentUnit);
+        NFAStatTran_[accept][REG_EXP_CHAR_EPSILON].push_back(child_start);
+        accept = child_accept;
+    }
 
-    states_[left_child_accept].SetNormType();
-    states_[right_child_start].SetNormType();
+    return num;
+}
 
-    NFAStatTran_[left_child_accept][REG_EXP_CHAR_EPSILON].push_back(right_child_start);
+// new start and accept around a loop from ls to la: the start gets no edge
+// into it and the accept none out of it, whatever is built around them.
+void RegExpNFA::WrapLoop(int ls, int la, int& start, int& accept)
+{
+    start = CreateState(State_Start);
+    accept = CreateState(State_Accept);
 
-    start = left_child_start;
-    accept = right_child_accept;
+    states_[ls].SetNormType();
+    states_[la].SetNormType();
 
-    return left_child_state_num + right_child_state_num - 1;
+    NFAStatTran_[start][REG_EXP_CHAR_EPSILON].push_back(ls);
+    NFAStatTran_[la][REG_EXP_CHAR_EPSILON].push_back(accept);
 }
 
 #define InsertIfNotExist(vec, val) \
@@ -292,22 +516,25 @@ int RegExpNFA::BuildStateForStarNode(RegExpSynTreeStarNode* sn, int& start,
         int& accept, bool ignoreUnit, int parentUnit)
 {
     int child_start, child_accept;
-    RegExpSynTreeNode* child = dynamic_cast<RegExpSynTreeNode*>(sn->GetLeftChild());
+    RegExpSynTreeNode* child = sn->GetLeftNode();
     if (!child) throw LexErrException(NULL, "\'*\' should come after specific character");
 
     int min = sn->GetMinRepeat();
     int max = sn->GetMaxRepeat();
-    bool is_unit = child->IsUnit();
 
     if (min == 0 && max == INT_MAX)
     {
         // (ab)*
-        int child_states_num = BuildNFAImp(child, start, accept, ignoreUnit, parentUnit);
+        int child_states_num = BuildNFAImp(child, child_start, child_accept, ignoreUnit, parentUnit);
 
-        InsertIfNotExist(NFAStatTran_[start][REG_EXP_CHAR_EPSILON], accept);
-        InsertIfNotExist(NFAStatTran_[accept][REG_EXP_CHAR_EPSILON], start);
+        InsertIfNotExist(NFAStatTran_[child_start][REG_EXP_CHAR_EPSILON], child_accept);
+        InsertIfNotExist(NFAStatTran_[child_accept][REG_EXP_CHAR_EPSILON], child_start);
 
-        return child_states_num;
+        // the loop is closed in states of its own, edges added to the child's
+        // start or accept would be taken in the middle of a round: "a*c|bx" would
+        // match "abx" through the start of a*.
+        WrapLoop(child_start, child_accept, start, accept);
+        return child_states_num + 2;
     }
     else if (min == 0)
     {
@@ -352,7 +579,6 @@ int RegExpNFA::BuildStateForStarNode(RegExpSynTreeStarNode* sn, int& start,
         int ts = child_start;
         int ta = child_accept;
 
-        child->SetUnit(false);
         for (int i = 0; i < min - 1; ++i)
         {
             BuildNFAImp(child, cs, ca, true, -1);
@@ -365,20 +591,29 @@ int RegExpNFA::BuildStateForStarNode(RegExpSynTreeStarNode* sn, int& start,
             ta = ca;
         }
 
+        InsertIfNotExist(NFAStatTran_[ta][REG_EXP_CHAR_EPSILON], ts);
+
+        // the first copy is the looping one for (ab)+.
+        if (ts == child_start)
+        {
+            WrapLoop(ts, ta, start, accept);
+            return child_states_num + 2;
+        }
+
+        // the start of a later copy is entered from the copy before it only.
         start = child_start;
-        accept = ta;
+        accept = CreateState(State_Accept);
 
-        InsertIfNotExist(NFAStatTran_[ta][REG_EXP_CHAR_EPSILON], ts);
-        child->SetUnit(is_unit);
+        states_[ta].SetNormType();
+        NFAStatTran_[ta][REG_EXP_CHAR_EPSILON].push_back(accept);
 
-        return child_states_num * min;
+        return child_states_num * min + 1;
     }
     else
     {
         //(ab){2, 4}
         int cs, ca;
         int cs2, ca2;
-        child->SetUnit(false);
 
         int num = BuildNFAImp(child, cs2, ca2, ignoreUnit, parentUnit);
         start = cs2;
@@ -429,7 +664,6 @@ int RegExpNFA::BuildStateForStarNode(RegExpSynTreeStarNode* sn, int& start,
             NFAStatTran_[min_end][REG_EXP_CHAR_EPSILON].push_back(cs2);
         }
 
-        child->SetUnit(is_unit);
         return num;
     }
 }
@@ -442,244 +676,207 @@ int RegExpNFA::BuildMachine(SyntaxTreeBase* tree)
     return BuildNFA(reg_tree);
 }
 
+// add st and its epsilon closure to "to", states already on are skipped.
 int RegExpNFA::AddStateWithEpsilon(int st, std::vector<char>& isOn, std::vector<int>& to) const
 {
-    if (!isOn[st])
+    if (!closureIndex_.empty())
     {
-        isOn[st] = 1;
-        to.push_back(st);
-    }
+        for (int i = closureIndex_[st]; i < closureIndex_[st + 1]; ++i)
+        {
+            int s = closureStates_[i];
+            if (isOn[s]) continue;
 
-    for (size_t i = 0; i < NFAStatTran_[st][REG_EXP_CHAR_EPSILON].size(); ++i)
-    {
-        int epsilon = NFAStatTran_[st][REG_EXP_CHAR_EPSILON][i];
-        if (isOn[epsilon]) continue;
+            isOn[s] = 1;
+            to.push_back(s);
+        }
 
-        AddStateWithEpsilon(epsilon, isOn, to);
+        return to.size();
     }
 
-    return  to.size();
-}
+    if (isOn[st]) return to.size();
 
-#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-// if closure of state st has transition on input ch then return true;
-// otherwise return false
-bool RegExpNFA::IfStateClosureHasTrans(int st, int parentUnit,
-        std::vector<char>& isCheck, char ch) const
-{
-    const std::vector<int>& vc = NFAStatTran_[st][REG_EXP_CHAR_EPSILON];
-    if (!NFAStatTran_[st][ch].empty()) return true;
+    // closure is not precomputed, walk epsilon edges using "to" as the queue.
+    size_t cur = to.size();
 
-    isCheck[st] = 1;
-    for (size_t i = 0; i < vc.size(); ++i)
-    {
-        st = vc[i];
-        if (isCheck[st]) continue;
+    isOn[st] = 1;
+    to.push_back(st);
 
-        int curParentUnit = states_[st].GetParentUnit();
-        while (curParentUnit != -1 && curParentUnit != parentUnit)
+    for (; cur < to.size(); ++cur)
+    {
+        int s = to[cur];
+        for (int i = epsilonIndex_[s]; i < epsilonIndex_[s + 1]; ++i)
         {
-            curParentUnit = states_[curParentUnit].GetParentUnit();
-        }
-
-        if (curParentUnit == -1) continue;
+            int epsilon = epsilonEdges_[i];
+            if (isOn[epsilon]) continue;
 
-        if (IfStateClosureHasTrans(st, parentUnit, isCheck, ch) ||
-                states_[st].IsRefState())
-        {
-            return true;
+            isOn[epsilon] = 1;
+            to.push_back(epsilon);
         }
     }
 
-    return false;
+    return to.size();
 }
 
-int RegExpNFA::DoSaveGroup(int st, int ac, const char* txtStart, const char* txtEnd)
+// same as above, the set tells the states already on.
+void RegExpNFA::AddStateWithEpsilon(int st, MachineStateSet& to) const
 {
-    if (unitMatchPair_[st].find(ac) != unitMatchPair_[st].end())
+    if (!closureIndex_.empty())
     {
-        int start_repeat = states_[st].UnitStart();
-        int end_repeat = states_[ac].UnitEnd();
-        int min = std::min(start_repeat, end_repeat);
-
-        std::map<std::pair<int, int>, std::vector<int> >::iterator iter =
-            groupWatcher_.find(std::pair<int, int>(st, ac));
-
-        if (iter != groupWatcher_.end())
-        {
-            for (size_t i = 0; i < iter->second.size(); ++i)
-            {
-                groupCapture_[iter->second[i]] = UnitInfo(st, ac, txtStart, txtEnd);
-            }
-        }
-        else
+        for (int i = closureIndex_[st]; i < closureIndex_[st + 1]; ++i)
         {
-            std::vector<int>& vc = groupWatcher_[std::pair<int, int>(st, ac)];
-            for (int i = 0; i < min; ++i)
-            {
-                vc.push_back(groupCapture_.size());
-                groupCapture_.push_back(UnitInfo(st, ac, txtStart, txtEnd));
-            }
+            int s = closureStates_[i];
+            if (!to.Has(s)) to.Add(s);
         }
 
-        return min;
+        return;
     }
 
-    return 0;
-}
+    if (to.Has(st)) return;
 
-int RegExpNFA::SaveCaptureGroup(const std::vector<int>& unitStart,
-        std::map<int, const char*>& unitSelect, int endState, const char* endTxt)
-{
-    int co = 0;
-    std::map<int, const char*>::iterator it = unitSelect.begin();
+    int cur = to.Size();
+    to.Add(st);
 
-    for (; it != unitSelect.end();)
+    for (; cur < to.Size(); ++cur)
     {
-        int st = it->first;
-        const char* txtStart = it->second;
-
-        int c = DoSaveGroup(st, endState, txtStart, endTxt);
-        if (c)
-        {
-            co += c;
-            unitSelect.erase(it++);
-        }
-        else
+        int s = to[cur];
+        for (int i = epsilonIndex_[s]; i < epsilonIndex_[s + 1]; ++i)
         {
-            ++it;
+            int epsilon = epsilonEdges_[i];
+            if (!to.Has(epsilon)) to.Add(epsilon);
         }
     }
-
-    for (size_t i = 0; i < unitStart.size(); ++i)
-    {
-        co += DoSaveGroup(unitStart[i], endState, "", "");
-    }
-
-    return co;
 }
 
-bool RegExpNFA::ConstructReferenceState(int st)
+// precompute epsilon closure of every state as a sorted span of closureStates_.
+// long chains of optional units have closures growing with the chain, closures
+// are dropped if they take more than REG_EXP_CLOSURE_PER_STATE entries per state.
+void RegExpNFA::BuildEpsilonClosure()
 {
-    // reference state
-    assert(NFAStatTran_[st][REG_EXP_CHAR_MAX].size() == 2);
+    closureIndex_.clear();
+    closureStates_.clear();
 
-    int to   = NFAStatTran_[st][REG_EXP_CHAR_MAX][0];
-    int unit = NFAStatTran_[st][REG_EXP_CHAR_MAX][1];
+    const int num = states_.size();
+    const size_t limit = REG_EXP_CLOSURE_PER_STATE * static_cast<size_t>(num);
 
-    // assert(unit < static_cast<int>(groupCapture_.size()));
-    if (unit >= groupCapture_.size())
-    {
-        NFAStatTran_[st][REG_EXP_CHAR_EPSILON].push_back(to);
-        return true;
-    }
+    std::vector<int> stack;
+    std::vector<int> visit(num, -1);
 
-    int new_st;
-    const char* ps = groupCapture_[unit].txtStart_;
-    const char* pe = groupCapture_[unit].txtEnd_;
+    closureIndex_.reserve(num + 1);
+    closureIndex_.push_back(0);
 
-    states_[st].ClearType(State_Ref);
-    while (ps <= pe && *ps)
+    for (int st = 0; st < num; ++st)
     {
-        new_st = CreateState(State_Norm);
-        NFAStatTran_[st][*ps].push_back(new_st);
-        st = new_st;
-        ++ps;
-    }
+        size_t begin = closureStates_.size();
 
-    NFAStatTran_[st][REG_EXP_CHAR_EPSILON].push_back(to);
-    return true;
-}
+        visit[st] = st;
+        stack.push_back(st);
 
-void RegExpNFA::RestoreRefStates(int st)
-{
-    int to   = NFAStatTran_[st][REG_EXP_CHAR_MAX][0];
-    int unit = NFAStatTran_[st][REG_EXP_CHAR_MAX][1];
+        while (!stack.empty())
+        {
+            int s = stack.back();
+            stack.pop_back();
+            closureStates_.push_back(s);
 
-    states_[st].AppendType(State_Ref);
+            for (int i = epsilonIndex_[s]; i < epsilonIndex_[s + 1]; ++i)
+            {
+                int epsilon = epsilonEdges_[i];
+                if (visit[epsilon] == st) continue;
 
-    if (unit >= groupCapture_.size())
-    {
-        NFAStatTran_[st][REG_EXP_CHAR_EPSILON].clear();
-        return;
-    }
+                visit[epsilon] = st;
+                stack.push_back(epsilon);
+            }
+        }
 
-    const char* ps = groupCapture_[unit].txtStart_;
-    const char* pe = groupCapture_[unit].txtEnd_;
+        if (closureStates_.size() > limit)
+        {
+            closureIndex_.clear();
+            std::vector<int>().swap(closureStates_);
+            return;
+        }
 
-    if (*ps == '\0' || ps > pe)
-    {
-        NFAStatTran_[st][REG_EXP_CHAR_EPSILON].clear();
-        return;
+        std::sort(closureStates_.begin() + begin, closureStates_.end());
+        closureIndex_.push_back(closureStates_.size());
     }
+}
 
-    assert(NFAStatTran_[st][*ps].size() == 1);
-    int next_st = NFAStatTran_[st][*ps][0];
-    NFAStatTran_[st][*ps].clear();
-    st = next_st;
+// flatten NFAStatTran_ into the compact layout, consecutive chars leading
+// to the same state are merged into one range edge.
+void RegExpNFA::BuildCompactNFA()
+{
+    edges_.clear();
+    edgeIndex_.assign(1, 0);
+    epsilonEdges_.clear();
+    epsilonIndex_.assign(1, 0);
 
-    ++ps;
-    while (ps <= pe)
+    std::vector<std::pair<int, int> > tran; // (to, ch)
+    for (size_t st = 0; st < NFAStatTran_.size(); ++st)
     {
-        std::vector<int>& vc = NFAStatTran_[st][*ps];
-        assert(vc.size() == 1);
-        next_st = vc[0];
-        ReleaseState(st);
-        st = next_st;
-        ++ps;
-    }
+        tran.clear();
+        for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch)
+        {
+            const std::vector<int>& vc = NFAStatTran_[st][ch];
+            for (size_t i = 0; i < vc.size(); ++i)
+            {
+                tran.push_back(std::make_pair(vc[i], ch));
+            }
+        }
 
-    std::vector<int>& vc = NFAStatTran_[st][REG_EXP_CHAR_EPSILON];
-    assert(vc.size() == 1);
-    assert(vc[0] == to);
-    ReleaseState(st);
-}
+        std::sort(tran.begin(), tran.end());
+        for (size_t i = 0; i < tran.size();)
+        {
+            MachineRangeEdge edge;
+            edge.to = tran[i].first;
+            edge.lo = edge.hi = tran[i].second;
 
-#endif
+            while (++i < tran.size() && tran[i].first == edge.to && tran[i].second <= edge.hi + 1)
+            {
+                edge.hi = tran[i].second;
+            }
 
-void RegExpNFA::GenStatesClosure(short ch, const std::vector<int>& curStat,
-        std::vector<int>& toStat, std::vector<char>& alreadyOn,
-        std::vector<int>& refStates, bool ignoreRef)
-{
-#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-    std::vector<int> newCurStat;
-    if (hasReferNode_) newCurStat.reserve(curStat.size());
-#endif
+            edges_.push_back(edge);
+        }
 
+        const std::vector<int>& eps = NFAStatTran_[st][REG_EXP_CHAR_EPSILON];
+        epsilonEdges_.insert(epsilonEdges_.end(), eps.begin(), eps.end());
+
+        edgeIndex_.push_back(edges_.size());
+        epsilonIndex_.push_back(epsilonEdges_.size());
+    }
+}
+
+// states reachable from curStat on input ch, including epsilon closure.
+// isOn must be all clear, it is cleared again before return.
+void RegExpNFA::GenStatesMove(short ch, const std::vector<int>& curStat,
+        std::vector<char>& isOn, std::vector<int>& toStat) const
+{
     for (size_t i = 0; i < curStat.size(); ++i)
     {
         int st = curStat[i];
-        const std::vector<int>* vc = &(NFAStatTran_[st][ch]);
-
-#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-        if (hasReferNode_ && !ignoreRef &&
-                states_[st].IsRefState() && ConstructReferenceState(st))
+        for (int j = edgeIndex_[st]; j < edgeIndex_[st + 1]; ++j)
         {
-            vc = &(NFAStatTran_[st][ch]);
-            refStates.push_back(st);
-            alreadyOn.resize(states_.size(), 0);
+            const MachineRangeEdge& edge = edges_[j];
+            if (ch < edge.lo || ch > edge.hi || isOn[edge.to]) continue;
 
-            std::vector<char> isOn(states_.size(), 0);
-            isOn[st] = 1;
-            AddStateWithEpsilon(st, isOn, newCurStat);
+            AddStateWithEpsilon(edge.to, isOn, toStat);
         }
-#endif
-        if (vc->empty()) continue;
+    }
+
+    for (size_t i = 0; i < toStat.size(); ++i) isOn[toStat[i]] = 0;
+}
 
-        for (size_t j = 0; j < vc->size(); ++j)
+void RegExpNFA::GenStatesMove(short ch, const MachineStateSet& curStat, MachineStateSet& toStat) const
+{
+    for (int i = 0; i < curStat.Size(); ++i)
+    {
+        int st = curStat[i];
+        for (int j = edgeIndex_[st]; j < edgeIndex_[st + 1]; ++j)
         {
-            if (alreadyOn[(*vc)[j]]) continue;
+            const MachineRangeEdge& edge = edges_[j];
+            if (ch < edge.lo || ch > edge.hi || toStat.Has(edge.to)) continue;
 
-            AddStateWithEpsilon((*vc)[j], alreadyOn, toStat);
+            AddStateWithEpsilon(edge.to, toStat);
         }
     }
-
-#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-    if (hasReferNode_ && !newCurStat.empty())
-    {
-        GenStatesClosure(ch, newCurStat, toStat, alreadyOn, refStates, ignoreRef);
-    }
-#endif
 }
 
 /*
@@ -687,194 +884,959 @@ void RegExpNFA::GenStatesClosure(short ch, const std::vector<int>& curStat,
 */
 bool RegExpNFA::RunMachine(const char* ps, const char* pe)
 {
-#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-    groupCapture_.clear();
-    groupWatcher_.clear();
-    groupCapture_.reserve(states_.size());
-#endif
-    return RunNFA(start_, accept_, ps, pe);
+    return Match(ps, pe, context_);
 }
 
-bool RegExpNFA::RunNFA(int start, int accept, const char* ps, const char* pe)
+bool RegExpNFA::Match(const char* ps, const char* pe, RegExpMatchContext& ctx) const
 {
-    char ch;
-    const char* in = ps;
+    ctx.groups_.clear();
 
-    std::vector<int> refStates;
-#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-    std::vector<int> curUnitEndStack;
-    std::vector<int> curUnitStartStack;
-    std::map<int, const char*> curUnitSelectedStack;
+    if (start_ < 0 && !hasCountedNode_) return false;
+    if (prefilter_.HasLiteral() && !prefilter_.MayMatch(ps, pe)) return false;
 
-    if (hasReferNode_)
-    {
-        refStates.reserve(states_.size());
-        curUnitEndStack.reserve(states_.size());
-        curUnitStartStack.reserve(states_.size());
-    }
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    if (hasReferNode_) return backtrack_.Match(ps, pe, &ctx.groups_, ctx.backtrack_);
 #endif
+    if (hasCountedNode_) return pikeVM_.Match(ps, pe, NULL, ctx.pikeVM_);
 
-    std::vector<int> curStat;
-    std::vector<int> toStat;
-    std::vector<char> alreadyOn(states_.size(), 0);
+    // a match must end at pe, scanning backward from there is decided
+    // within the match, instead of running forward over all the input.
+    if (tailDFA_) return RegExpSearch::MatchEnd(*tailDFA_, ps, pe);
 
-    curStat.reserve(states_.size());
-    toStat.reserve(states_.size());
-    AddStateWithEpsilon(start, alreadyOn, curStat);
+    if (lazyCacheSize_) return RunLazyDFA(ps, pe, ctx);
+    if (bitNFA_.IsBuilt()) return bitNFA_.Match(ps, pe);
 
-    while (in <= pe && !curStat.empty())
-    {
-        ch = *in++;
+    return RunNFA(start_, accept_, ps, pe, ctx);
+}
 
-        for (size_t i = 0; i < curStat.size(); ++i)
-        {
-            alreadyOn[curStat[i]] = false;
-#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-            if (hasReferNode_ && states_[curStat[i]].UnitStart())
-            {
-                curUnitStartStack.push_back(curStat[i]);
-            }
+bool RegExpNFA::Capture(const char* ps, const char* pe, std::vector<const char*>& groups) const
+{
+    groups.clear();
 
-            if (hasReferNode_ && states_[curStat[i]].UnitEnd())
-            {
-                curUnitEndStack.push_back(curStat[i]);
-            }
-#endif
-        }
+    if (start_ < 0 && !hasCountedNode_) return false;
+    if (prefilter_.HasLiteral() && !prefilter_.MayMatch(ps, pe)) return false;
 
 #ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-        for (size_t j = 0; j < curUnitStartStack.size(); ++j)
-        {
-            int st = curUnitStartStack[j];
+    if (hasReferNode_) return backtrack_.Match(ps, pe, &groups);
+#endif
 
-            // (ab)* ((ab)*)
-            std::vector<char> isCheck(states_.size(), 0);
-            if (IfStateClosureHasTrans(st, st, isCheck, ch))
-            {
-                curUnitStartStack[j] = -1;
-                curUnitSelectedStack[st] = in - 1;
-                continue;
-            }
-            else if (curUnitSelectedStack.find(st) != curUnitSelectedStack.end())
-            {
-                curUnitStartStack[j] = -1;
-            }
-        }
+    return pikeVM_.Match(ps, pe, &groups);
+}
 
-        if (!curUnitEndStack.empty())
-        {
-            GenStatesClosure(ch, curStat, toStat, alreadyOn, refStates, true);
+size_t RegExpNFA::GetMemorySize() const
+{
+    size_t size = sizeof(RegExpNFA) + states_.capacity() * sizeof(MachineState)
+        + (recycleStates_.capacity() + edgeIndex_.capacity() + epsilonIndex_.capacity()
+                + epsilonEdges_.capacity() + closureIndex_.capacity() + closureStates_.capacity()) * sizeof(int)
+        + edges_.capacity() * sizeof(MachineRangeEdge)
+        + pikeVM_.GetMemorySize() + backtrack_.GetMemorySize()
+        + (tailDFA_? tailDFA_->GetMemorySize() : 0);
 
-            for (size_t j = 0; j < curUnitEndStack.size(); ++j)
-            {
-                int st = curUnitEndStack[j];
-                if (std::find(toStat.begin(), toStat.end(), st) == toStat.end())
-                {
-                    size_t i = 0;
-                    const int parentUnit = states_[st].GetParentUnit();
-                    for (; i < toStat.size(); ++i)
-                    {
-                        int curParentUnit = states_[toStat[i]].GetParentUnit();
-                        while (parentUnit != curParentUnit && curParentUnit != -1)
-                        {
-                            curParentUnit = states_[curParentUnit].GetParentUnit();
-                        }
-
-                        if (curParentUnit != -1) break;
-                    }
-
-                    if (i == toStat.size())
-                    {
-                        SaveCaptureGroup(curUnitStartStack,
-                                curUnitSelectedStack, st, in - 2);
-                    }
-                }
-            }
-        }
+    const std::vector<std::string>& literals = prefilter_.GetLiterals();
+    for (size_t i = 0; i < literals.size(); ++i) size += sizeof(std::string) + literals[i].size();
 
-        curUnitEndStack.clear();
-        curUnitStartStack.clear();
-#endif
+    return size;
+}
 
-        GenStatesClosure(ch, curStat, toStat, alreadyOn, refStates, false);
+// threads sharing the nfa take the lock only until it is built, so it is
+// built once and searches after that run without any lock.
+const RegExpSearch* RegExpNFA::GetSearch() const
+{
+    if (__atomic_load_n(&searchBuilt_, __ATOMIC_ACQUIRE)) return search_;
 
-        curStat.swap(toStat);
-        toStat.clear();
+    pthread_mutex_lock(&searchLock_);
+    if (!searchBuilt_)
+    {
+        BuildSearch();
+        __atomic_store_n(&searchBuilt_, true, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&searchLock_);
+
+    return search_;
+}
+
+void RegExpNFA::BuildSearch() const
+{
+    if (coreStart_ < 0 || edgeIndex_.empty()) return;
 
 #ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-    // (a(b(cd)))\\0 , abcd
-    // a(bc*)fe\\0 , afe
-    if (hasReferNode_)
-    {
-        for (size_t i = 0; i < curStat.size(); ++i)
-        {
-            // alreadyOn[curStat[i]] = false;
-            if (states_[curStat[i]].UnitStart())
-            {
-                curUnitStartStack.push_back(curStat[i]);
-            }
+    if (hasReferNode_) return;
+#endif
 
-            if (states_[curStat[i]].UnitEnd())
-            {
-                curUnitEndStack.push_back(curStat[i]);
-            }
-        }
+    // without partial matching, the match must cover the whole input.
+    bool head = !support_partial_match_ || headState_ != -1;
+    bool tail = !support_partial_match_ || tailState_ != -1;
 
-        if (!curUnitEndStack.empty())
-        {
-            for (size_t j = 0; j < curUnitEndStack.size(); ++j)
-            {
-                int st = curUnitEndStack[j];
-                SaveCaptureGroup(curUnitStartStack, curUnitSelectedStack, st, pe);
-            }
-        }
+    search_ = new RegExpSearch();
+    search_->Build(*this, coreStart_, coreAccept_, head, tail);
+}
 
-        if (!curStat.empty())
-        {
-            GenStatesClosure(REG_EXP_CHAR_EPSILON, curStat,
-                    toStat, alreadyOn, refStates, false);
-            curStat.insert(curStat.end(), toStat.begin(), toStat.end());
-        }
+// built with the nfa, matching builds nothing. without it, the forward
+// engines run, a backward scan on the nfa costs more than they do.
+void RegExpNFA::BuildTailDFA()
+{
+    if (!support_partial_match_ || headState_ != -1 || tailState_ == -1 || coreStart_ < 0) return;
 
-        // restore ref states
-        for (size_t i = 0; i < refStates.size(); ++i)
-        {
-            int st = refStates[i];
-            RestoreRefStates(st);
-        }
-    }
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    if (hasReferNode_) return;
 #endif
 
-    return !curStat.empty() &&
-        std::find(curStat.begin(), curStat.end(), accept) != curStat.end();
+    tailDFA_ = new RegExpDFA(false);
+    if (RegExpSearch::BuildTailDFA(*this, coreStart_, coreAccept_, *tailDFA_)) return;
+
+    delete tailDFA_;
+    tailDFA_ = NULL;
 }
 
-void RegExpNFA::SerializeState() const
+bool RegExpNFA::Find(const char* ps, const char* pe, const char*& ms, const char*& me) const
 {
+    RegExpMatchIterator it(*this, ps, pe);
+    return it.Next(ms, me);
 }
 
-void RegExpNFA::DeserializeState()
+void RegExpNFA::SetLazyDFACache(size_t cacheSize)
 {
+    lazyCacheSize_ = cacheSize;
+    context_.Reset();
 }
 
-void RegExpNFA::ConvertToDFA(RegExpDFA&) const
+// set holds the states of "states" only, num states in total.
+static void SetStates(const std::vector<int>& states, int num, MachineStateSet& set)
 {
+    set.Resize(num);
+    set.Clear();
+
+    for (size_t i = 0; i < states.size(); ++i) set.Add(states[i]);
 }
 
-#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-std::vector<std::string> RegExpNFA::GetCaptureGroup() const
+bool RegExpNFA::RunLazyDFA(const char* ps, const char* pe, RegExpMatchContext& ctx) const
 {
-    std::vector<std::string> ret;
-    for (size_t i = 0; i < groupCapture_.size(); ++i)
-    {
-        const char* start = groupCapture_[i].txtStart_;
-        const char* end   = groupCapture_[i].txtEnd_;
+    std::vector<int>& to = ctx.lazyTo_;
+    std::vector<char>& isOn = ctx.isOn_;
 
-        ret.push_back(std::string(start, end - start + 1));
-    }
+    to.clear();
+    if (isOn.size() < states_.size()) isOn.resize(states_.size(), 0);
+
+    if (ctx.owner_ != this)
+    {
+        ctx.FlushLazyDFA();
+        ctx.owner_ = this;
+    }
+
+    if (ctx.lazyStart_ == -1)
+    {
+        ctx.lazyClassNum_ = BuildByteClass(ctx.lazyClass_);
+
+        AddStateWithEpsilon(start_, isOn, to);
+        for (size_t i = 0; i < to.size(); ++i) isOn[to[i]] = 0;
+
+        std::sort(to.begin(), to.end());
+        ctx.lazyStart_ = ctx.AddLazyDFAState(to, std::binary_search(to.begin(), to.end(), accept_), lazyCacheSize_);
+
+        if (ctx.lazyStart_ == -1)
+        {
+            ++ctx.lazyStat_.fallbacks;
+            SetStates(to, states_.size(), ctx.curStat_);
+            return RunNFAFrom(accept_, ps, pe, ctx);
+        }
+    }
+
+    const int classNum = ctx.lazyClassNum_;
+    const std::vector<unsigned char>& byteClass = ctx.lazyClass_;
+    RegExpMatchContext::LazyDFAStat& stat = ctx.lazyStat_;
+
+    int st = ctx.lazyStart_;
+    int runFlush = 0, runState = 0;
+    const char* in = ps;
+
+    const bool acceptLoop = HasAcceptLoop();
+
+    while (in <= pe)
+    {
+        if (acceptLoop && ctx.lazyAccept_[st]) return true;
+
+        unsigned char ch = *in++;
+
+        int next = ctx.lazyTran_[st * classNum + byteClass[ch]];
+        if (next != REG_EXP_LAZY_DFA_UNKNOWN)
+        {
+            ++stat.hits;
+            if (next < 0) return false;
+
+            st = next;
+            continue;
+        }
+
+        ++stat.misses;
+
+        to.clear();
+        GenStatesMove(ch, ctx.lazyStates_[st]->first, isOn, to);
+
+        if (to.empty())
+        {
+            ctx.lazyTran_[st * classNum + byteClass[ch]] = -1;
+            return false;
+        }
+
+        std::sort(to.begin(), to.end());
+        RegExpMatchContext::LAZY_DFA_SET_T::const_iterator it = ctx.lazySetToState_.find(to);
+
+        bool accept = std::binary_search(to.begin(), to.end(), accept_);
+        if (it != ctx.lazySetToState_.end())
+        {
+            next = it->second;
+        }
+        else if ((next = ctx.AddLazyDFAState(to, accept, lazyCacheSize_)) == -1)
+        {
+            // cache is full, start over with the current state only.
+            ctx.FlushLazyDFA();
+            ++runFlush;
+            ++stat.flushes;
+
+            if ((runFlush >= REG_EXP_LAZY_DFA_MAX_FLUSH &&
+                    in - ps < REG_EXP_LAZY_DFA_MIN_CHAR_PER_STATE * runState) ||
+                    (next = ctx.AddLazyDFAState(to, accept, lazyCacheSize_)) == -1)
+            {
+                ++stat.fallbacks;
+                SetStates(to, states_.size(), ctx.curStat_);
+                return RunNFAFrom(accept_, in, pe, ctx);
+            }
+
+            st = next;
+            ++runState;
+            continue;
+        }
+        else
+        {
+            ++runState;
+        }
+
+        ctx.lazyTran_[st * classNum + byteClass[ch]] = next;
+        st = next;
+    }
+
+    return ctx.lazyAccept_[st];
+}
+
+bool RegExpNFA::RunNFAFrom(int accept, const char* ps, const char* pe, RegExpMatchContext& ctx) const
+{
+    const char* in = ps;
+
+    MachineStateSet& curStat = ctx.curStat_;
+    MachineStateSet& toStat = ctx.toStat_;
+
+    toStat.Resize(states_.size());
+
+    // the set empties once nothing can match, as for a pattern starting with
+    // ^ past its match. it never does once the looping accept state is on,
+    // the match is certain by then.
+    const bool acceptLoop = accept == accept_ && HasAcceptLoop();
+
+    while (in <= pe && !curStat.Empty())
+    {
+        if (acceptLoop && curStat.Has(accept)) return true;
+
+        unsigned char ch = *in++;
+
+        toStat.Clear();
+        GenStatesMove(ch, curStat, toStat);
+
+        curStat.Swap(toStat);
+    }
+
+    return curStat.Has(accept);
+}
+
+bool RegExpNFA::RunNFA(int start, int accept, const char* ps, const char* pe) const
+{
+    RegExpMatchContext ctx;
+    return RunNFA(start, accept, ps, pe, ctx);
+}
+
+bool RegExpNFA::RunNFA(int start, int accept, const char* ps, const char* pe, RegExpMatchContext& ctx) const
+{
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    // the states around a reference are not matched, only the whole pattern is.
+    if (hasReferNode_) return backtrack_.Match(ps, pe, NULL, ctx.backtrack_);
+#endif
+    if (hasCountedNode_) return pikeVM_.Match(ps, pe, NULL, ctx.pikeVM_);
+
+    MachineStateSet& curStat = ctx.curStat_;
+
+    curStat.Resize(states_.size());
+    curStat.Clear();
+    AddStateWithEpsilon(start, curStat);
+
+    return RunNFAFrom(accept, ps, pe, ctx);
+}
+
+// index of a compact layout, spans of num states covering size entries.
+static bool IsValidCompactIndex(const std::vector<int>& index, size_t size, int num)
+{
+    if (index.size() != static_cast<size_t>(num) + 1 || index[0] != 0) return false;
+
+    for (int i = 0; i < num; ++i)
+    {
+        if (index[i] > index[i + 1]) return false;
+    }
+
+    return static_cast<size_t>(index[num]) == size;
+}
+
+/*
+   image sections: info, the compact nfa, epsilon closures, prefilter literals
+   the image of the bit parallel automaton and the one of the pike vm Capture() runs.
+   the building table is not saved, patterns with back reference can't be saved.
+*/
+bool RegExpNFA::SerializeState(std::string& image) const
+{
+    if (edgeIndex_.empty()) return false;
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    if (hasReferNode_) return false;
+#endif
+
+    int info[] = { support_partial_match_, static_cast<int>(states_.size()),
+        start_, accept_, coreStart_, coreAccept_, headState_ != -1, tailState_ != -1 };
+
+    // literals are saved as their lengths followed by the chars.
+    std::vector<int> litLen;
+    std::string litChars;
+    const std::vector<std::string>& literals = prefilter_.GetLiterals();
+
+    for (size_t i = 0; i < literals.size(); ++i)
+    {
+        litLen.push_back(literals[i].size());
+        litChars += literals[i];
+    }
+
+    std::string bitImage, pikeImage;
+    bitNFA_.SerializeState(bitImage);
+    pikeVM_.SerializeState(pikeImage);
+
+    AutomatonImageWriter writer(image, AutomatonImage_NFA);
+    writer.WriteSection(info, sizeof(info));
+    writer.WriteSection(edgeIndex_);
+    writer.WriteSection(edges_);
+    writer.WriteSection(epsilonIndex_);
+    writer.WriteSection(epsilonEdges_);
+    writer.WriteSection(closureIndex_);
+    writer.WriteSection(closureStates_);
+    writer.WriteSection(litLen);
+    writer.WriteSection(litChars.data(), litChars.size());
+    writer.WriteSection(bitImage.data(), bitImage.size());
+    writer.WriteSection(pikeImage.data(), pikeImage.size());
+    writer.Finish();
+
+    return true;
+}
+
+bool RegExpNFA::DeserializeState(const char* image, size_t len)
+{
+    ResetNFA(0);
+
+    int info[8];
+    std::vector<int> litLen;
+    std::vector<char> litChars;
+    const char* bitImage = NULL;
+    const char* pikeImage = NULL;
+    size_t bitLen = 0, pikeLen = 0;
+
+    AutomatonImageReader reader(image, len, AutomatonImage_NFA);
+
+    bool ok = reader.ReadSection(info, sizeof(info))
+        && reader.ReadSection(edgeIndex_)
+        && reader.ReadSection(edges_)
+        && reader.ReadSection(epsilonIndex_)
+        && reader.ReadSection(epsilonEdges_)
+        && reader.ReadSection(closureIndex_)
+        && reader.ReadSection(closureStates_)
+        && reader.ReadSection(litLen)
+        && reader.ReadSection(litChars)
+        && (bitImage = reader.ViewSection(bitLen)) != NULL
+        && (pikeImage = reader.ViewSection(pikeLen)) != NULL;
+
+    const int num = ok? info[1] : 0;
+
+    ok = ok && num > 0 && info[2] >= 0 && info[2] < num
+        && info[3] >= -1 && info[3] < num
+        && info[4] >= -1 && info[4] < num
+        && info[5] >= -1 && info[5] < num
+        && IsValidCompactIndex(edgeIndex_, edges_.size(), num)
+        && IsValidCompactIndex(epsilonIndex_, epsilonEdges_.size(), num)
+        && (closureIndex_.empty() || IsValidCompactIndex(closureIndex_, closureStates_.size(), num))
+        && bitNFA_.DeserializeState(bitImage, bitLen)
+        && (!pikeLen || pikeVM_.DeserializeState(pikeImage, pikeLen));
+
+    for (size_t i = 0; ok && i < edges_.size(); ++i)
+    {
+        ok = edges_[i].to >= 0 && edges_[i].to < num && edges_[i].lo <= edges_[i].hi;
+    }
+
+    for (size_t i = 0; ok && i < epsilonEdges_.size(); ++i)
+    {
+        ok = epsilonEdges_[i] >= 0 && epsilonEdges_[i] < num;
+    }
+
+    for (size_t i = 0; ok && i < closureStates_.size(); ++i)
+    {
+        ok = closureStates_[i] >= 0 && closureStates_[i] < num;
+    }
+
+    std::vector<std::string> literals;
+    for (size_t i = 0, pos = 0; ok && i < litLen.size(); ++i)
+    {
+        ok = litLen[i] > 0 && pos + litLen[i] <= litChars.size();
+        if (!ok) break;
+
+        literals.push_back(std::string(litChars.begin() + pos, litChars.begin() + pos + litLen[i]));
+        pos += litLen[i];
+    }
+
+    if (!ok)
+    {
+        ResetNFA(0);
+        return false;
+    }
+
+    support_partial_match_ = info[0];
+    start_ = info[2];
+    accept_ = info[3];
+    coreStart_ = info[4];
+    coreAccept_ = info[5];
+
+    // only used as flags once built.
+    headState_ = info[6]? start_ : -1;
+    tailState_ = info[7]? accept_ : -1;
+
+    states_.reserve(num);
+    for (int st = 0; st < num; ++st)
+    {
+        StateType type = State_Norm;
+        if (st == start_) type = State_Start;
+        if (st == accept_) type = (StateType)(type | State_Accept);
+
+        states_.push_back(MachineState(st, type));
+    }
+
+    stateIndex_ = num;
+    prefilter_.SetLiterals(literals);
+    BuildTailDFA();
+
+    return true;
+}
+
+// class boundaries are where some edge begins or ends.
+int RegExpNFA::BuildByteClass(std::vector<unsigned char>& byteClass) const
+{
+    std::vector<char> isBound(REG_EXP_CHAR_EPSILON + 1, 0);
+    isBound[0] = 1;
+
+    for (size_t i = 0; i < edges_.size(); ++i)
+    {
+        isBound[edges_[i].lo] = 1;
+        isBound[edges_[i].hi + 1] = 1;
+    }
+
+    int cls = -1;
+    byteClass.resize(REG_EXP_CHAR_EPSILON);
+
+    for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch)
+    {
+        if (isBound[ch]) ++cls;
+        byteClass[ch] = cls;
+    }
+
+    return cls + 1;
+}
+
+// states without char edges are only passed through on the way to others,
+// a set moves the same without them. the accept state is kept to tell accepting sets.
+void RegExpNFA::DropPassingStates(std::vector<int>& set) const
+{
+    size_t num = 0;
+    for (size_t i = 0; i < set.size(); ++i)
+    {
+        int st = set[i];
+        if (st == accept_ || edgeIndex_[st] < edgeIndex_[st + 1]) set[num++] = st;
+    }
+
+    set.resize(num);
+}
+
+bool RegExpNFA::ConvertToDFA(RegExpDFA& dfa, int maxState) const
+{
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    if (hasReferNode_) return false;
+#endif
+
+    dfa.Reset();
+    if (states_.empty()) return false;
+
+    dfa.classNum_ = BuildByteClass(dfa.byteClass_);
+
+    std::vector<int> to;
+    std::vector<char> isOn(states_.size(), 0);
+    std::vector<std::vector<int> > dfaStates;
+    std::map<std::vector<int>, int> setToState;
+
+    to.reserve(states_.size());
+    AddStateWithEpsilon(start_, isOn, to);
+
+    for (size_t i = 0; i < to.size(); ++i) isOn[to[i]] = 0;
+
+    DropPassingStates(to);
+    std::sort(to.begin(), to.end());
+    dfaStates.push_back(to);
+    setToState[to] = dfa.CreateState(State_Start);
+
+    if (std::binary_search(to.begin(), to.end(), accept_))
+    {
+        dfa.states_[0].AppendType(State_Accept);
+    }
+
+    // every dfa state stands for a set of nfa states, sets are kept sorted.
+    for (size_t cur = 0; cur < dfaStates.size(); ++cur)
+    {
+        // one char of each class is enough, classes are ranges.
+        for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch)
+        {
+            if (ch && dfa.byteClass_[ch] == dfa.byteClass_[ch - 1]) continue;
+
+            to.clear();
+            GenStatesMove(ch, dfaStates[cur], isOn, to);
+            DropPassingStates(to);
+
+            if (to.empty()) continue;
+
+            std::sort(to.begin(), to.end());
+            std::map<std::vector<int>, int>::iterator it = setToState.find(to);
+
+            int st;
+            if (it != setToState.end())
+            {
+                st = it->second;
+            }
+            else
+            {
+                if (static_cast<int>(dfa.states_.size()) >= maxState)
+                {
+                    dfa.Reset();
+                    return false;
+                }
+
+                st = dfa.CreateState(State_Norm);
+                if (std::binary_search(to.begin(), to.end(), accept_))
+                {
+                    dfa.states_[st].AppendType(State_Accept);
+                }
+
+                setToState[to] = st;
+                dfaStates.push_back(to);
+            }
+
+            dfa.DFAStatTran_[cur * dfa.classNum_ + dfa.byteClass_[ch]] = st;
+        }
+    }
+
+    dfa.UpdateTable();
+    return true;
+}
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+std::vector<std::string> RegExpNFA::GetCaptureGroup() const
+{
+    std::vector<std::string> ret;
+    const std::vector<const char*>& groups = context_.GetGroups();
+    for (size_t i = 0; i + 1 < groups.size(); i += 2)
+    {
+        const char* start = groups[i];
+        const char* end   = groups[i + 1];
+
+        ret.push_back(start? std::string(start, end - start + 1) : std::string());
+    }
 
     return ret;
 }
 #endif
 
+
+// dfa
+
+RegExpDFA::RegExpDFA(bool partial, int maxState)
+    :AutomatonBase(AutomatonType_DFA), stateIndex_(0)
+    ,support_partial_match_(partial), maxState_(maxState)
+{
+    Reset();
+}
+
+RegExpDFA::~RegExpDFA()
+{
+}
+
+void RegExpDFA::Reset()
+{
+    stateIndex_ = 0;
+    start_ = accept_ = -1;
+    classNum_ = 0;
+    states_.clear();
+    byteClass_.clear();
+    DFAStatTran_.clear();
+    UpdateTable();
+}
+
+size_t RegExpDFA::GetMemorySize() const
+{
+    return sizeof(RegExpDFA) + states_.capacity() * sizeof(MachineState)
+        + DFAStatTran_.capacity() * sizeof(int) + byteClass_.capacity() + isAccept_.capacity();
+}
+
+int RegExpDFA::CreateState(StateType type)
+{
+    int new_st = stateIndex_++;
+
+    if (type & State_Start) start_ = new_st;
+
+    states_.push_back(MachineState(new_st, type));
+    DFAStatTran_.resize(DFAStatTran_.size() + classNum_, -1);
+
+    return new_st;
+}
+
+int RegExpDFA::BuildDFA(RegExpSyntaxTree* tree)
+{
+    RegExpNFA nfa(support_partial_match_);
+
+    nfa.BuildMachine(tree);
+    if (!nfa.ConvertToDFA(*this, maxState_)) return 0;
+
+    return Minimize();
+}
+
+// called once building is done, the vectors don't move after it.
+void RegExpDFA::UpdateTable()
+{
+    stateNum_ = states_.size();
+    isAccept_.resize(stateNum_);
+
+    for (int i = 0; i < stateNum_; ++i)
+    {
+        isAccept_[i] = (states_[i].GetType() & State_Accept) != 0;
+    }
+
+    tranTable_ = stateNum_? &DFAStatTran_[0] : NULL;
+    acceptTable_ = stateNum_? &isAccept_[0] : NULL;
+    classTable_ = byteClass_.empty()? NULL : &byteClass_[0];
+}
+
+int RegExpDFA::BuildMachine(SyntaxTreeBase* tree)
+{
+    RegExpSyntaxTree* reg_tree = dynamic_cast<RegExpSyntaxTree*>(tree);
+    if (!reg_tree) return 0;
+
+    return BuildDFA(reg_tree);
+}
+
+bool RegExpDFA::RunMachine(const char* ps, const char* pe)
+{
+    return RunDFA(ps, pe);
+}
+
+bool RegExpDFA::RunDFA(const char* ps, const char* pe) const
+{
+    if (start_ < 0) return false;
+
+    int st = start_;
+    const int num = classNum_;
+    const int* tran = tranTable_;
+    const unsigned char* cls = classTable_;
+
+    while (ps <= pe)
+    {
+        unsigned char ch = *ps++;
+
+        st = tran[st * num + cls[ch]];
+        if (st < 0) return false;
+    }
+
+    return IsAcceptState(st);
+}
+
+/*
+   image sections: info, transition table, accept flags, char classes.
+   the tables are stored as they are laid out in memory, MapState() runs on them directly.
+*/
+bool RegExpDFA::SerializeState(std::string& image) const
+{
+    if (!stateNum_) return false;
+
+    int info[] = { support_partial_match_, stateNum_, start_, classNum_ };
+
+    AutomatonImageWriter writer(image, AutomatonImage_DFA);
+    writer.WriteSection(info, sizeof(info));
+    writer.WriteSection(tranTable_, sizeof(int) * stateNum_ * classNum_);
+    writer.WriteSection(acceptTable_, stateNum_);
+    writer.WriteSection(classTable_, REG_EXP_CHAR_EPSILON);
+    writer.Finish();
+
+    return true;
+}
+
+bool RegExpDFA::MapState(const char* image, size_t len)
+{
+    Reset();
+
+    int info[4];
+    size_t tranNum = 0, acceptNum = 0, classNum = 0;
+    AutomatonImageReader reader(image, len, AutomatonImage_DFA);
+
+    if (!reader.ReadSection(info, sizeof(info))) return false;
+
+    const int* tran = reader.ViewSection<int>(tranNum);
+    const char* accept = reader.ViewSection<char>(acceptNum);
+    const unsigned char* cls = reader.ViewSection<unsigned char>(classNum);
+
+    if (!tran || !accept || !cls || info[1] <= 0 || info[2] < 0 || info[2] >= info[1]
+            || info[3] <= 0 || info[3] > REG_EXP_CHAR_EPSILON
+            || acceptNum != static_cast<size_t>(info[1])
+            || tranNum != acceptNum * info[3]
+            || classNum != REG_EXP_CHAR_EPSILON)
+    {
+        return false;
+    }
+
+    for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch)
+    {
+        if (cls[ch] >= info[3]) return false;
+    }
+
+    // matching follows transitions unchecked, a state out of range is rejected here.
+    for (size_t i = 0; i < tranNum; ++i)
+    {
+        if (tran[i] < -1 || tran[i] >= info[1]) return false;
+    }
+
+    support_partial_match_ = info[0];
+    stateNum_ = info[1];
+    start_ = info[2];
+    classNum_ = info[3];
+    tranTable_ = tran;
+    acceptTable_ = accept;
+    classTable_ = cls;
+
+    return true;
+}
+
+bool RegExpDFA::DeserializeState(const char* image, size_t len)
+{
+    RegExpDFA mapped(support_partial_match_);
+    if (!mapped.MapState(image, len)) return false;
+
+    Reset();
+    support_partial_match_ = mapped.support_partial_match_;
+    classNum_ = mapped.classNum_;
+    byteClass_.assign(mapped.classTable_, mapped.classTable_ + REG_EXP_CHAR_EPSILON);
+
+    for (int st = 0; st < mapped.stateNum_; ++st)
+    {
+        StateType type = (st == mapped.start_)? State_Start : State_Norm;
+        CreateState(mapped.IsAcceptState(st)? (StateType)(type | State_Accept) : type);
+    }
+
+    DFAStatTran_.assign(mapped.tranTable_, mapped.tranTable_ + mapped.stateNum_ * classNum_);
+    UpdateTable();
+
+    return true;
+}
+
+/*
+   hopcroft's algorithm on the dfa completed by a dead state(numbered stateNum_),
+   splitting on char classes instead of chars.
+   blocks are kept as ranges of elems, states of a block moved to the front of
+   its range are the ones marked by the current splitter.
+   a (block, char) splitter is queued until the block has been split on that char.
+*/
+int RegExpDFA::Minimize()
+{
+    minStat_.before = minStat_.after = stateNum_;
+    if (!stateNum_) return 0;
+
+    const int num = stateNum_ + 1;
+    const int dead = stateNum_;
+    const int charNum = classNum_;
+
+    // predecessors of state t on char c are pred[predIndex[c * num + t], predIndex[c * num + t + 1]).
+    std::vector<int> predIndex(charNum * num + 1, 0);
+    std::vector<int> pred(charNum * num);
+
+    for (int st = 0; st < num; ++st)
+    {
+        for (int c = 0; c < charNum; ++c)
+        {
+            int to = (st == dead)? -1 : tranTable_[st * classNum_ + c];
+            ++predIndex[c * num + (to < 0? dead : to) + 1];
+        }
+    }
+
+    for (size_t i = 1; i < predIndex.size(); ++i) predIndex[i] += predIndex[i - 1];
+
+    std::vector<int> predPos(predIndex.begin(), predIndex.end() - 1);
+    for (int st = 0; st < num; ++st)
+    {
+        for (int c = 0; c < charNum; ++c)
+        {
+            int to = (st == dead)? -1 : tranTable_[st * classNum_ + c];
+            pred[predPos[c * num + (to < 0? dead : to)]++] = st;
+        }
+    }
+
+    // initial blocks: accepting states, the others.
+    std::vector<int> elems, loc(num), blockOf(num);
+    std::vector<int> first, end, mid;
+
+    for (int acc = 1; acc >= 0; --acc)
+    {
+        int begin = elems.size();
+        for (int st = 0; st < num; ++st)
+        {
+            if ((st != dead && acceptTable_[st]) != (acc != 0)) continue;
+
+            loc[st] = elems.size();
+            blockOf[st] = first.size();
+            elems.push_back(st);
+        }
+
+        if (static_cast<int>(elems.size()) == begin) continue;
+
+        first.push_back(begin);
+        end.push_back(elems.size());
+        mid.push_back(begin);
+    }
+
+    std::vector<std::pair<int, int> > work; // (block, char)
+    std::vector<std::vector<char> > inWork(first.size(), std::vector<char>(charNum, 1));
+
+    for (size_t b = 0; b < first.size(); ++b)
+    {
+        for (int c = 0; c < charNum; ++c) work.push_back(std::make_pair(b, c));
+    }
+
+    std::vector<int> marked, touched;
+    while (!work.empty())
+    {
+        int splitter = work.back().first;
+        int c = work.back().second;
+        work.pop_back();
+        inWork[splitter][c] = 0;
+
+        // predecessors are collected first, the splitter may be split by them.
+        marked.clear();
+        for (int i = first[splitter]; i < end[splitter]; ++i)
+        {
+            int t = elems[i];
+            marked.insert(marked.end(), pred.begin() + predIndex[c * num + t],
+                    pred.begin() + predIndex[c * num + t + 1]);
+        }
+
+        touched.clear();
+        for (size_t i = 0; i < marked.size(); ++i)
+        {
+            int st = marked[i];
+            int b = blockOf[st];
+            if (loc[st] < mid[b]) continue;
+
+            if (mid[b] == first[b]) touched.push_back(b);
+
+            int other = elems[mid[b]];
+            std::swap(elems[loc[st]], elems[mid[b]]);
+            loc[other] = loc[st];
+            loc[st] = mid[b]++;
+        }
+
+        for (size_t i = 0; i < touched.size(); ++i)
+        {
+            int b = touched[i];
+            if (mid[b] == end[b])
+            {
+                mid[b] = first[b];
+                continue;
+            }
+
+            // marked states form the new block.
+            int nb = first.size();
+            first.push_back(first[b]);
+            end.push_back(mid[b]);
+            mid.push_back(first[b]);
+            first[b] = mid[b];
+
+            for (int j = first[nb]; j < end[nb]; ++j) blockOf[elems[j]] = nb;
+
+            inWork.push_back(std::vector<char>(charNum, 0));
+
+            bool smaller = end[nb] - first[nb] <= end[b] - first[b];
+            for (int a = 0; a < charNum; ++a)
+            {
+                int add = (inWork[b][a] || smaller)? nb : b;
+                if (inWork[add][a]) continue;
+
+                inWork[add][a] = 1;
+                work.push_back(std::make_pair(add, a));
+            }
+        }
+    }
+
+    // number the blocks in the order they are reached from the start, the block
+    // of the dead state is left out.
+    const int deadBlock = blockOf[dead];
+    std::vector<int> blockToState(first.size(), -1);
+    std::vector<int> order;
+
+    blockToState[blockOf[start_]] = 0;
+    order.push_back(start_);
+
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        for (int c = 0; c < charNum; ++c)
+        {
+            int to = tranTable_[order[i] * classNum_ + c];
+            if (to < 0 || blockOf[to] == deadBlock || blockToState[blockOf[to]] >= 0) continue;
+
+            blockToState[blockOf[to]] = order.size();
+            order.push_back(to);
+        }
+    }
+
+    // rows of the new states are taken from one state of each block,
+    // the old tables may be in use as the source, build new ones aside.
+    DFA_TRAN_T tran(order.size() * classNum_, -1);
+    std::vector<MachineState> states;
+
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        int st = order[i];
+        StateType type = (i == 0)? State_Start : State_Norm;
+        if (acceptTable_[st]) type = (StateType)(type | State_Accept);
+
+        states.push_back(MachineState(i, type));
+
+        for (int c = 0; c < charNum; ++c)
+        {
+            int to = tranTable_[st * classNum_ + c];
+            if (to < 0 || blockOf[to] == deadBlock) continue;
+
+            tran[i * classNum_ + c] = blockToState[blockOf[to]];
+        }
+    }
+
+    std::vector<unsigned char> byteClass(classTable_, classTable_ + REG_EXP_CHAR_EPSILON);
+
+    states_.swap(states);
+    byteClass_.swap(byteClass);
+    DFAStatTran_.swap(tran);
+    stateIndex_ = states_.size();
+    start_ = 0;
+    UpdateTable();
+
+    minStat_.after = stateNum_;
+    return stateNum_;
+}
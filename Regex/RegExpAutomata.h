@@ -4,21 +4,113 @@
 #include <set>
 #include <map>
 #include <vector>
+#include <limits.h>
+#include <pthread.h>
 #include "AutomatonBase.h"
+#include "RegExpBitNFA.h"
+#include "RegExpBacktrack.h"
+#include "RegExpPikeVM.h"
+#include "RegExpPrefilter.h"
 #include "MachineComponent.h"
 
+class RegExpNFA;
 class RegExpDFA;
+class RegExpSearch;
 class SyntaxTreeBase;
 class RegExpSyntaxTree;
 class RegExpSynTreeNode;
 class RegExpSynTreeLeafNode;
 class RegExpSynTreeStarNode;
 
+/*
+   everything a RegExpNFA changes while matching: the lazy dfa cache, the
+   groups of the last match and the buffers of state sets. a compiled nfa is
+   read only when matched through a context, threads share one nfa and each
+   owns a context. buffers grow to the largest nfa matched and are reused,
+   matching the same patterns again allocates nothing.
+
+   RegExpMatchContext ctx;
+   nfa.Match(ps, pe, ctx);
+
+   the cache belongs to the last nfa matched, Reset() the context if that
+   nfa is built again.
+*/
+class RegExpMatchContext
+{
+    public:
+
+        struct LazyDFAStat
+        {
+            LazyDFAStat(): hits(0), misses(0), flushes(0), fallbacks(0) {}
+
+            size_t hits;      // transitions found in the cache
+            size_t misses;    // transitions computed from the nfa
+            size_t flushes;   // times the cache was full and got dropped
+            size_t fallbacks; // runs finished by nfa simulation
+        };
+
+        RegExpMatchContext();
+
+        // drop the cache, the statistics and the groups.
+        void Reset();
+
+        const LazyDFAStat& GetLazyDFAStat() const { return lazyStat_; }
+
+        // groups of the last match of a pattern with back reference,
+        // see RegExpBacktrack::Match().
+        const std::vector<const char*>& GetGroups() const { return groups_; }
+
+    private:
+
+        friend class RegExpNFA;
+        friend class RegExpSet;
+
+        void FlushLazyDFA();
+
+        // return -1 if the cache would take more than cacheSize bytes.
+        int  AddLazyDFAState(const std::vector<int>& stat, bool accept, size_t cacheSize);
+
+    private:
+
+        const RegExpNFA* owner_; // nfa the cache is built for
+
+        // lazy dfa cache, lazyTran_ has the same layout as RegExpDFA::DFA_TRAN_T,
+        // with lazyClass_ as the char classes.
+        typedef std::map<std::vector<int>, int> LAZY_DFA_SET_T;
+
+        int lazyStart_;
+        size_t lazyCacheUsed_;
+        LazyDFAStat lazyStat_;
+        int lazyClassNum_;
+        std::vector<unsigned char> lazyClass_;
+        std::vector<int> lazyTran_;
+        std::vector<char> lazyAccept_;
+        LAZY_DFA_SET_T lazySetToState_;
+        std::vector<LAZY_DFA_SET_T::const_iterator> lazyStates_;
+
+        std::vector<const char*> groups_;
+
+        // scratch of nfa simulation, isOn_ is all clear between uses.
+        MachineStateSet curStat_, toStat_;
+        std::vector<int> lazyTo_;
+        std::vector<char> isOn_;
+
+        // patterns of a RegExpSet matched, by id.
+        std::vector<char> setMatch_;
+
+        RegExpPikeVM::Scratch pikeVM_;
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+        RegExpBacktrack::Scratch backtrack_;
+#endif
+};
+
 class RegExpNFA: public AutomatonBase
 {
     public:
 
         typedef std::vector<std::vector<std::vector<int> > > NFA_TRAN_T;
+        typedef RegExpMatchContext::LazyDFAStat LazyDFAStat;
 
         /*
             a) if partial match mode is enabled:
@@ -31,53 +123,79 @@ class RegExpNFA: public AutomatonBase
         explicit RegExpNFA(bool enable_partial_match = true);
         ~RegExpNFA();
 
-        virtual void SerializeState() const;
-        virtual void DeserializeState();
+        virtual bool SerializeState(std::string& image) const;
+        virtual bool DeserializeState(const char* image, size_t len);
 
+        // the tree is built as it is given, it is not optimized here: Optimize()
+        // rewrites the caller's tree in place, and whether groups may be dropped
+        // depends on the caller, see RegExpSyntaxTree::Optimize().
         virtual int  BuildMachine(SyntaxTreeBase* tree);
-        virtual bool RunMachine(const char* ps, const char* pe);
 
-        void ConvertToDFA(RegExpDFA& dfa) const;
+        // matches through a context of the nfa's own, see Match().
+        virtual bool RunMachine(const char* ps, const char* pe);
 
+        // same result as RunMachine(), the nfa is not changed, so it can be
+        // matched from many threads, each with its own ctx.
+        bool Match(const char* ps, const char* pe, RegExpMatchContext& ctx) const;
+
+        // leftmost-longest match in [ps, pe] as [ms, me], me is ms - 1 for an empty match.
+        // see RegExpMatchIterator for all the matches.
+        // return false if there is no match, or the pattern contains back reference.
+        bool Find(const char* ps, const char* pe, const char*& ms, const char*& me) const;
+
+        // same result as RunMachine(), with the groups of the match, see
+        // RegExpBacktrack::Match(). without back reference, the cost is bounded
+        // by input length times the size of the pattern.
+        bool Capture(const char* ps, const char* pe, std::vector<const char*>& groups) const;
+
+        // chars are grouped into classes that move every state the same way,
+        // byteClass[ch] is the class of byte ch, each
+        // class is a range of chars. return number of classes.
+        int BuildByteClass(std::vector<unsigned char>& byteClass) const;
+
+        // subset construction, returns false if the pattern contains back reference
+        // or counted repetition, or the resulting dfa would have more than maxState states.
+        bool ConvertToDFA(RegExpDFA& dfa, int maxState = INT_MAX) const;
+
+        // match through a dfa that is built on demand, cached dfa states take
+        // at most cacheSize bytes of every context. 0 disables the lazy dfa(default).
+        // statistics are of the contexts, the one of RunMachine() is here.
+        void SetLazyDFACache(size_t cacheSize);
+        const LazyDFAStat& GetLazyDFAStat() const { return context_.GetLazyDFAStat(); }
+
+        // the building table is dropped once built, matching runs on the
+        // compact edges below.
         const NFA_TRAN_T& GetNFATran() const { return NFAStatTran_; }
         const std::vector<MachineState>& GetAllStates() const { return states_; }
 
+        // bytes of the built machine, roughly. scratch of matching and the
+        // search built by Find() are not counted.
+        size_t GetMemorySize() const;
+
 #ifdef SUPPORT_REG_EXP_BACK_REFERENCE
         std::vector<std::string> GetCaptureGroup() const;
 #endif
 
     protected:
 
-        int  BuildNFA(RegExpSyntaxTree* tree);
-        bool RunNFA(int start, int accept, const char* ps, const char* pe);
+        friend class RegExpSet;
+        friend class RegExpSearch;
+        friend class RegExpMatchIterator;
+        friend class RegExpStreamMatcher;
 
-#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
-        struct UnitInfo
-        {
-            UnitInfo(int s, int e, const char* st, const char* et)
-                :stateStart_(s), stateEnd_(e)
-                 ,txtStart_(st), txtEnd_(et)
-            {
-            }
-
-            UnitInfo() {}
-
-            int stateStart_;
-            int stateEnd_;
-            const char* txtStart_;
-            const char* txtEnd_;
-        };
+        // built on first use, NULL if matches can't be located.
+        const RegExpSearch* GetSearch() const;
 
-        bool IfStateClosureHasTrans(int st, int parentUnit,
-                std::vector<char>& isCheck, char ch) const;
-        int  SaveCaptureGroup(const std::vector<int>&,
-                std::map<int, const char*>& unitStart,
-                int endState, const char* endTxt);
-        int  DoSaveGroup(int st, int ac, const char* txtStart, const char* txtEnd);
+        void ResetNFA(int nodeNum);
+        int  BuildNFA(RegExpSyntaxTree* tree);
+        int  BuildSetNFA(const std::vector<RegExpSyntaxTree*>& trees,
+                std::vector<int>& accepts, std::vector<char>& sticky);
+        bool RunNFA(int start, int accept, const char* ps, const char* pe) const;
+        bool RunNFA(int start, int accept, const char* ps, const char* pe, RegExpMatchContext& ctx) const;
 
-        void RestoreRefStates(int st);
-        bool ConstructReferenceState(int st);
-#endif
+        // run from the states in ctx.curStat_.
+        bool RunNFAFrom(int accept, const char* ps, const char* pe, RegExpMatchContext& ctx) const;
+        bool RunLazyDFA(const char* ps, const char* pe, RegExpMatchContext& ctx) const;
 
     private:
 
@@ -85,17 +203,28 @@ class RegExpNFA: public AutomatonBase
         void ReleaseState(int st);
 
         int CreateState(StateType type);
+        void BuildCompactNFA();
+        void BuildEpsilonClosure();
         int AddStateWithEpsilon(int st, std::vector<char>& ison, std::vector<int>& to) const;
+        void AddStateWithEpsilon(int st, MachineStateSet& to) const;
+
+        void GenStatesMove(short ch, const std::vector<int>& curStat,
+                std::vector<char>& isOn, std::vector<int>& toStat) const;
+        void GenStatesMove(short ch, const MachineStateSet& curStat, MachineStateSet& toStat) const;
 
-        void GenStatesClosure(short ch, const std::vector<int>& curStat,
-                std::vector<int>& toStat, std::vector<char>& flag,
-                std::vector<int>& ref, bool ignoreRef);
+        void BuildSearch() const;
+        void BuildTailDFA();
+
+        // accept_ is the looping state of partial matching, see BuildNFA().
+        bool HasAcceptLoop() const { return support_partial_match_ && tailState_ == -1 && accept_ >= 0; }
 
         int BuildNFAImp(RegExpSynTreeNode* node, int& start, int& accept,
                 bool ignoreUnit = false, int parentUnit = -1);
 
         int BuildStateForStarNode(RegExpSynTreeStarNode* node, int& start,
                 int& accept, bool ignoreUnit, int parentUnit);
+        void WrapLoop(int loopStart, int loopAccept, int& start, int& accept);
+        void DropPassingStates(std::vector<int>& set) const;
         int BuildStateForOrNode(RegExpSynTreeNode* node, int& start,
                 int& accept, bool ignoreUnit, int parentUnit);
         int BuildStateForCatNode(RegExpSynTreeNode* node,
@@ -109,41 +238,148 @@ class RegExpNFA: public AutomatonBase
         int headState_, tailState_;
         bool support_partial_match_;
 
+        // start and accept state without the looping states for partial matching.
+        int coreStart_, coreAccept_;
+        // search_ is built once searchBuilt_ is set, which is read without the lock.
+        mutable RegExpSearch* search_;
+        mutable bool searchBuilt_;
+        mutable pthread_mutex_t searchLock_;
+
+        // floating patterns anchored at the tail are matched backward from the
+        // end on it, NULL if the dfa is too large, see BuildTailDFA().
+        RegExpDFA* tailDFA_;
+
         std::vector<int> recycleStates_;
         std::vector<MachineState> states_;
         NFA_TRAN_T NFAStatTran_; // state to char to state
 
+        // small patterns are matched by the bit parallel glushkov automaton.
+        RegExpBitNFA bitNFA_;
+
+        // patterns with back reference are matched by backtracking,
+        // groups of the others are located by the pike vm.
+        RegExpBacktrack backtrack_;
+        RegExpPikeVM pikeVM_;
+
+        // input without any of the required literals is rejected up front.
+        RegExpPrefilter prefilter_;
+
+        // compact nfa, edges of state st are edges_[edgeIndex_[st], edgeIndex_[st + 1]),
+        // epsilon edges are kept apart the same way.
+        std::vector<int> edgeIndex_;
+        std::vector<MachineRangeEdge> edges_;
+        std::vector<int> epsilonIndex_;
+        std::vector<int> epsilonEdges_;
+
+        // epsilon closure of state st is closureStates_[closureIndex_[st], closureIndex_[st + 1]),
+        // empty if closures are too large to precompute.
+        std::vector<int> closureIndex_;
+        std::vector<int> closureStates_;
+
+        // bytes of lazy dfa cache per context.
+        size_t lazyCacheSize_;
+
+        // context of RunMachine(), an nfa matched that way can't be shared.
+        RegExpMatchContext context_;
+
 #ifdef SUPPORT_REG_EXP_BACK_REFERENCE
         bool hasReferNode_;
-        std::map<int, std::set<int> > unitMatchPair_;
-        std::vector<UnitInfo> groupCapture_;
-
-        // auxiliary structure for capturing group.
-        // end state to group index.
-        std::map<std::pair<int, int>, std::vector<int> > groupWatcher_;
 #endif
+        // no states are built, see BuildNFA().
+        bool hasCountedNode_;
 };
 
 class RegExpDFA: public AutomatonBase
 {
     public:
 
-        RegExpDFA();
+        // dense transition table indexed by char class, row of state st starts
+        // at st * GetClassNumber(). -1 means dead state.
+        typedef std::vector<int> DFA_TRAN_T;
+
+        // BuildMachine() gives up on patterns taking more than maxState states
+        // before minimizing, the nfa matches them instead.
+        explicit RegExpDFA(bool enable_partial_match = true, int maxState = 4096);
         ~RegExpDFA();
 
+        virtual bool SerializeState(std::string& image) const;
+        virtual bool DeserializeState(const char* image, size_t len);
+
+        // return 0 if the pattern can't be matched by a dfa, or takes more than maxState states.
         virtual int  BuildMachine(SyntaxTreeBase* tree);
         virtual bool RunMachine(const char* ps, const char* pe);
 
+        struct MinimizeStat
+        {
+            MinimizeStat(): before(0), after(0) {}
+
+            int before; // states before the last Minimize()
+            int after;  // states after it
+        };
+
+        // merge equivalent states by hopcroft partition refinement, states that
+        // can never reach an accepting state are dropped as dead(-1).
+        // return number of states left.
+        int Minimize();
+        const MinimizeStat& GetMinimizeStat() const { return minStat_; }
+
+        // use an image written by SerializeState() in place, without copying the
+        // tables. the image must be 8-byte aligned and outlive the dfa, eg, mmaped.
+        // the tables are checked once, an image DeserializeState() rejects fails here too.
+        bool MapState(const char* image, size_t len);
+
+        int  GetStateNumber() const { return stateNum_; }
+        bool IsAcceptState(int st) const { return acceptTable_[st]; }
+
+        // next state on byte ch.
+        int  GetNextState(int st, unsigned char ch) const { return tranTable_[st * classNum_ + classTable_[ch]]; }
+
+        // the tables matching runs on, rows laid out as DFA_TRAN_T.
+        int  GetClassNumber() const { return classNum_; }
+        const int* GetTranTable() const { return tranTable_; }
+        const unsigned char* GetByteClass() const { return classTable_; }
+
+        // empty if the dfa is mapped from an image.
+        const DFA_TRAN_T& GetDFATran() const { return DFAStatTran_; }
+        const std::vector<MachineState>& GetAllStates() const { return states_; }
+
+        // bytes of the tables, roughly, nothing of a mapped image is counted.
+        size_t GetMemorySize() const;
+
     private:
 
-        int BuildDFA(RegExpSyntaxTree* tree);
-        int RunDFA(const char* ps, const char* pe) const;
+        friend class RegExpNFA;
+
+        void Reset();
+        int  CreateState(StateType type);
+        void UpdateTable();
+
+        int  BuildDFA(RegExpSyntaxTree* tree);
+        bool RunDFA(const char* ps, const char* pe) const;
 
     private:
 
         int stateIndex_;
+        bool support_partial_match_;
+
+        // state budget of BuildMachine().
+        int maxState_;
+
         std::vector<MachineState> states_;
+        DFA_TRAN_T DFAStatTran_; // state to char to state
+
+        // char to class, every char of a class has the same transitions.
+        int classNum_;
+        std::vector<unsigned char> byteClass_;
+
+        // point to DFAStatTran_, isAccept_ and byteClass_, or into a mapped image.
+        int stateNum_;
+        const int* tranTable_;
+        const char* acceptTable_;
+        const unsigned char* classTable_;
+        std::vector<char> isAccept_;
+
+        MinimizeStat minStat_;
 };
 
 #endif
-
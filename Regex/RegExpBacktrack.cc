@@ -0,0 +1,310 @@
+#include "RegExpBacktrack.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "RegExpSyntaxTree.h"
+
+// bits of the (pc, position) table, about 4MB.
+#define REG_EXP_BACKTRACK_MAX_MEMO (1 << 25)
+
+RegExpBacktrack::RegExpBacktrack(bool partial)
+    :AutomatonBase(AutomatonType_NFA)
+    ,support_partial_match_(partial)
+{
+    Reset();
+}
+
+RegExpBacktrack::~RegExpBacktrack()
+{
+}
+
+void RegExpBacktrack::Reset()
+{
+    start_ = accept_ = -1;
+    isBuilt_ = false;
+
+    prog_.Reset();
+    noMemo_.clear();
+}
+
+bool RegExpBacktrack::SerializeState(std::string&) const
+{
+    return false;
+}
+
+bool RegExpBacktrack::DeserializeState(const char*, size_t)
+{
+    return false;
+}
+
+int RegExpBacktrack::BuildMachine(SyntaxTreeBase* tree)
+{
+    Reset();
+
+    RegExpSyntaxTree* reg_tree = dynamic_cast<RegExpSyntaxTree*>(tree);
+    if (!reg_tree) return 0;
+
+    int num = prog_.Build(reg_tree);
+    if (!num) return 0;
+
+    BuildNoMemo();
+
+    start_ = 0;
+    accept_ = num - 1;
+    isBuilt_ = true;
+
+    return num;
+}
+
+void RegExpBacktrack::BuildNoMemo()
+{
+    const int num = prog_.GetInstNumber();
+    noMemo_.assign(num, 0);
+
+    // loops jump backward, repeat until nothing changes.
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int pc = num - 1; pc >= 0; --pc)
+        {
+            if (noMemo_[pc]) continue;
+
+            const RegExpInst& inst = prog_.GetInst(pc);
+
+            char reach = 0;
+            if (inst.op == RegExpInstOp_Ref)
+            {
+                reach = 1;
+            }
+            else if (inst.op == RegExpInstOp_Split)
+            {
+                reach = noMemo_[inst.x] || noMemo_[inst.y];
+            }
+            else if (inst.op == RegExpInstOp_Count)
+            {
+                reach = noMemo_[pc + 1] || noMemo_[inst.y];
+            }
+            else if (inst.op == RegExpInstOp_Jmp)
+            {
+                reach = noMemo_[inst.x];
+            }
+            else if (inst.op != RegExpInstOp_Match)
+            {
+                reach = noMemo_[pc + 1];
+            }
+
+            if (reach)
+            {
+                noMemo_[pc] = 1;
+                changed = true;
+            }
+        }
+    }
+
+    // counters are set to 0 in front of a loop, reaching one is fine.
+    for (int pc = 0; pc < num; ++pc)
+    {
+        if (prog_.IsCounted(pc)) noMemo_[pc] = 1;
+    }
+}
+
+bool RegExpBacktrack::RunMachine(const char* ps, const char* pe)
+{
+    return Match(ps, pe);
+}
+
+bool RegExpBacktrack::Match(const char* ps, const char* pe, std::vector<const char*>* groups) const
+{
+    Scratch scratch;
+    return Match(ps, pe, groups, scratch);
+}
+
+bool RegExpBacktrack::Match(const char* ps, const char* pe,
+        std::vector<const char*>* groups, Scratch& scratch) const
+{
+    if (!isBuilt_) return false;
+
+    // same as the looping start/accept states of RegExpNFA.
+    const bool floating = support_partial_match_ && !prog_.HasHeadAnchor();
+    const bool acceptLoop = support_partial_match_ && !prog_.HasTailAnchor();
+
+    const int len = (ps <= pe)? pe - ps + 1 : 0;
+    const int num = prog_.GetInstNumber();
+    const int groupNum = prog_.GetGroupNumber();
+
+    std::vector<Job>& jobs = scratch.jobs;
+    std::vector<int>& slots = scratch.slots;
+    std::vector<int>& regs = scratch.regs;
+    std::vector<int>& counters = scratch.counters;
+    std::vector<unsigned char>& visited = scratch.visited;
+
+    jobs.clear();
+    slots.assign(2 * groupNum, -1);
+    regs.assign(prog_.GetRegNumber(), -1);
+    counters.assign(prog_.GetCounterNumber(), 0);
+
+    const bool memo = static_cast<double>(num) * (len + 1) <= REG_EXP_BACKTRACK_MAX_MEMO;
+    if (memo) visited.assign((static_cast<size_t>(num) * (len + 1) + 7) / 8, 0);
+
+    bool matched = false;
+    for (int st = 0; st <= len && !matched; ++st)
+    {
+        if (st > 0 && !floating) break;
+
+        jobs.push_back(Job(Job_Thread, 0, st));
+        while (!jobs.empty() && !matched)
+        {
+            Job job = jobs.back();
+            jobs.pop_back();
+
+            if (job.type == Job_Slot)
+            {
+                slots[job.index] = job.value;
+                continue;
+            }
+            else if (job.type == Job_Reg)
+            {
+                regs[job.index] = job.value;
+                continue;
+            }
+            else if (job.type == Job_Counter)
+            {
+                counters[job.index] = job.value;
+                continue;
+            }
+
+            int pc = job.index;
+            int pos = job.value;
+
+            for (;;)
+            {
+                // the rest of the match depends on (pc, pos) only, try it once.
+                const bool memoPC = memo && !noMemo_[pc];
+                if (memoPC)
+                {
+                    size_t bit = static_cast<size_t>(pc) * (len + 1) + pos;
+                    if (visited[bit >> 3] & (1 << (bit & 7))) break;
+
+                    visited[bit >> 3] |= (1 << (bit & 7));
+                }
+
+                const RegExpInst& inst = prog_.GetInst(pc);
+                if (inst.op == RegExpInstOp_Char)
+                {
+                    if (pos >= len || !prog_.IsCharIn(inst.x, ps[pos])) break;
+
+                    ++pos;
+                    ++pc;
+                }
+                else if (inst.op == RegExpInstOp_Split)
+                {
+                    jobs.push_back(Job(Job_Thread, inst.y, pos));
+                    pc = inst.x;
+                }
+                else if (inst.op == RegExpInstOp_Jmp)
+                {
+                    pc = inst.x;
+                }
+                else if (inst.op == RegExpInstOp_Open || inst.op == RegExpInstOp_Close)
+                {
+                    for (int g = inst.x; g < inst.y; ++g)
+                    {
+                        int slot = 2 * g + (inst.op == RegExpInstOp_Close);
+
+                        jobs.push_back(Job(Job_Slot, slot, slots[slot]));
+                        slots[slot] = pos;
+                    }
+
+                    ++pc;
+                }
+                else if (inst.op == RegExpInstOp_Clear)
+                {
+                    for (int slot = 2 * inst.x; slot < 2 * inst.y; ++slot)
+                    {
+                        if (slots[slot] < 0) continue;
+
+                        jobs.push_back(Job(Job_Slot, slot, slots[slot]));
+                        slots[slot] = -1;
+                    }
+
+                    ++pc;
+                }
+                else if (inst.op == RegExpInstOp_Ref)
+                {
+                    // a group not matched matches empty.
+                    int s = slots[2 * inst.x];
+                    int e = slots[2 * inst.x + 1];
+                    int n = (s < 0 || e < s)? 0 : e - s;
+
+                    if (pos + n > len || memcmp(ps + s, ps + pos, n)) break;
+
+                    pos += n;
+                    ++pc;
+                }
+                else if (inst.op == RegExpInstOp_Mark)
+                {
+                    jobs.push_back(Job(Job_Reg, inst.x, regs[inst.x]));
+                    regs[inst.x] = pos;
+                    ++pc;
+                }
+                else if (inst.op == RegExpInstOp_Check)
+                {
+                    // the table already stops an empty round from going on.
+                    if (!memoPC && regs[inst.x] == pos) break;
+
+                    ++pc;
+                }
+                else if (inst.op == RegExpInstOp_Zero || inst.op == RegExpInstOp_Incr)
+                {
+                    jobs.push_back(Job(Job_Counter, inst.x, counters[inst.x]));
+                    counters[inst.x] = (inst.op == RegExpInstOp_Zero)? 0 : counters[inst.x] + 1;
+                    ++pc;
+                }
+                else if (inst.op == RegExpInstOp_Count)
+                {
+                    int n = counters[inst.x];
+                    if (n < prog_.GetCounterMin(inst.x))
+                    {
+                        ++pc;
+                    }
+                    else if (n >= prog_.GetCounterMax(inst.x))
+                    {
+                        pc = inst.y;
+                    }
+                    else
+                    {
+                        jobs.push_back(Job(Job_Thread, inst.y, pos));
+                        ++pc;
+                    }
+                }
+                else
+                {
+                    assert(inst.op == RegExpInstOp_Match);
+
+                    matched = acceptLoop || pos == len;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (!matched) return false;
+
+    if (groups)
+    {
+        groups->assign(2 * groupNum, NULL);
+        for (int i = 0; i < groupNum; ++i)
+        {
+            int s = slots[2 * i];
+            int e = slots[2 * i + 1];
+            if (s < 0 || e < s) continue;
+
+            (*groups)[2 * i] = ps + s;
+            (*groups)[2 * i + 1] = ps + e - 1;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,96 @@
+#ifndef REGEXP_BACKTRACK_H_
+#define REGEXP_BACKTRACK_H_
+
+#include <vector>
+#include "AutomatonBase.h"
+#include "RegExpProgram.h"
+
+/*
+   backtracking vm for patterns with back reference.
+
+   the program(see RegExpProgram) is run depth first with an explicit stack,
+   captures are undone on backtracking. the program is never modified, so
+   matching works on const data and scratch vectors of its own.
+
+   (pc, position) pairs already tried are remembered in a bit table, for the
+   instructions no reference is reachable from and outside counted loops:
+   what follows them depends on nothing but the position. the table is
+   dropped if it takes too many bits, loops that match empty are then cut by
+   checking progress.
+*/
+class RegExpBacktrack: public AutomatonBase
+{
+    public:
+
+        // partial matching has the same meaning as RegExpNFA.
+        explicit RegExpBacktrack(bool enable_partial_match = true);
+        ~RegExpBacktrack();
+
+        // the program is rebuilt from the tree, no image for it.
+        virtual bool SerializeState(std::string& image) const;
+        virtual bool DeserializeState(const char* image, size_t len);
+
+        // return number of instructions.
+        virtual int  BuildMachine(SyntaxTreeBase* tree);
+        virtual bool RunMachine(const char* ps, const char* pe);
+
+        // groups[2 * i], groups[2 * i + 1] are the first and last char of group i,
+        // NULL for groups not matched or cleared by a later round.
+        bool Match(const char* ps, const char* pe, std::vector<const char*>* groups = NULL) const;
+
+        struct Scratch;
+
+        // same as above, with the buffers of scratch reused.
+        bool Match(const char* ps, const char* pe, std::vector<const char*>* groups, Scratch& scratch) const;
+
+        void Reset();
+
+        bool IsBuilt() const { return isBuilt_; }
+        int  GetGroupNumber() const { return prog_.GetGroupNumber(); }
+        int  GetInstNumber() const { return prog_.GetInstNumber(); }
+        size_t GetMemorySize() const { return prog_.GetMemorySize() + noMemo_.capacity(); }
+
+    private:
+
+        // a thread to try, or a slot/register/counter to restore when backtracking.
+        enum JobType { Job_Thread, Job_Slot, Job_Reg, Job_Counter };
+
+        struct Job
+        {
+            Job(JobType t, int i, int v): type(t), index(i), value(v) {}
+
+            JobType type;
+            int index; // pc, slot, register or counter
+            int value; // position or the value to restore
+        };
+
+    public:
+
+        // buffers of one Match(), kept for the next.
+        struct Scratch
+        {
+            std::vector<Job> jobs;
+            std::vector<int> slots;
+            std::vector<int> regs;
+            std::vector<int> counters;
+            std::vector<unsigned char> visited;
+        };
+
+    private:
+
+        void BuildNoMemo();
+
+    private:
+
+        bool isBuilt_;
+        bool support_partial_match_;
+
+        RegExpProgram prog_;
+
+        // what follows instruction pc depends on more than the position: a
+        // reference is reachable from it, or it is in a counted loop.
+        std::vector<char> noMemo_;
+};
+
+#endif
+
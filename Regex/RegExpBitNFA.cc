@@ -0,0 +1,366 @@
+#include "RegExpBitNFA.h"
+
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+
+#include "AutomatonImage.h"
+#include "RegExpSyntaxTree.h"
+#include "RegExpSynTreeNode.h"
+
+#define BIT_OF(p) (static_cast<RegExpBitNFA::BIT_STATE_T>(1) << (p))
+
+RegExpBitNFA::RegExpBitNFA(bool partial)
+    :AutomatonBase(AutomatonType_NFA)
+    ,support_partial_match_(partial)
+{
+    Reset();
+}
+
+RegExpBitNFA::~RegExpBitNFA()
+{
+}
+
+void RegExpBitNFA::Reset()
+{
+    start_ = accept_ = -1;
+    isBuilt_ = false;
+    headAnchor_ = tailAnchor_ = false;
+    positionNum_ = 0;
+    root_ = PositionInfo();
+    shiftMask_ = exceptMask_ = 0;
+
+    memset(follow_, 0, sizeof(follow_));
+    memset(followExcept_, 0, sizeof(followExcept_));
+    memset(charMask_, 0, sizeof(charMask_));
+}
+
+int RegExpBitNFA::BuildMachine(SyntaxTreeBase* tree)
+{
+    Reset();
+
+    RegExpSyntaxTree* reg_tree = dynamic_cast<RegExpSyntaxTree*>(tree);
+    if (!reg_tree) return 0;
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    if (reg_tree->HasRefNode()) return 0;
+#endif
+
+    RegExpSynTreeNode* root = reg_tree->GetRoot();
+    if (!root || !BuildPosition(root, root_))
+    {
+        Reset();
+        return 0;
+    }
+
+    for (int p = 0; p < positionNum_; ++p)
+    {
+        BIT_STATE_T next = (p + 1 < MAX_POSITION)? BIT_OF(p + 1) : 0;
+
+        if (follow_[p] & next) shiftMask_ |= next;
+
+        followExcept_[p] = follow_[p] & ~next;
+        if (followExcept_[p]) exceptMask_ |= BIT_OF(p);
+    }
+
+    isBuilt_ = true;
+    return positionNum_;
+}
+
+// return -1 if positions run out.
+int RegExpBitNFA::CreatePosition(const char* chars, size_t len)
+{
+    if (positionNum_ >= MAX_POSITION) return -1;
+
+    int pos = positionNum_++;
+    for (size_t i = 0; i < len; ++i)
+    {
+        unsigned char ch = chars[i];
+        charMask_[ch] |= BIT_OF(pos);
+    }
+
+    return pos;
+}
+
+void RegExpBitNFA::AddFollow(BIT_STATE_T from, BIT_STATE_T to)
+{
+    for (int p = 0; p < positionNum_; ++p)
+    {
+        if (from & BIT_OF(p)) follow_[p] |= to;
+    }
+}
+
+RegExpBitNFA::PositionInfo RegExpBitNFA::Concat(const PositionInfo& left, const PositionInfo& right)
+{
+    PositionInfo info;
+
+    AddFollow(left.last, right.first);
+
+    info.nullable = left.nullable && right.nullable;
+    info.first = left.first | (left.nullable? right.first : 0);
+    info.last = right.last | (right.nullable? left.last : 0);
+
+    return info;
+}
+
+bool RegExpBitNFA::BuildPosition(RegExpSynTreeNode* node, PositionInfo& info)
+{
+    info = PositionInfo();
+    if (!node) return true;
+
+    if (node->IsLeafNode())
+    {
+        RegExpSynTreeLeafNode* ln = node->AsLeafNode();
+        assert(ln);
+
+        const std::string& txt = ln->GetNodeText();
+        RegExpSynTreeNodeLeafNodeType lt = ln->GetLeafNodeType();
+
+        if (lt == RegExpSynTreeNodeLeafNodeType_Head)
+        {
+            headAnchor_ = true;
+            return true;
+        }
+        else if (lt == RegExpSynTreeNodeLeafNodeType_Tail)
+        {
+            tailAnchor_ = true;
+            return true;
+        }
+        else if (lt == RegExpSynTreeNodeLeafNodeType_Ref)
+        {
+            return false;
+        }
+        else if (lt == RegExpSynTreeNodeLeafNodeType_Str)
+        {
+            // a position for every char, each followed by the next.
+            for (size_t i = 0; i < txt.size(); ++i)
+            {
+                int pos = CreatePosition(txt.c_str() + i, 1);
+                if (pos < 0) return false;
+
+                if (i == 0) info.first = BIT_OF(pos);
+                else AddFollow(info.last, BIT_OF(pos));
+
+                info.last = BIT_OF(pos);
+            }
+
+            info.nullable = false;
+            return true;
+        }
+
+        int pos;
+        if (lt == RegExpSynTreeNodeLeafNodeType_Dot)
+        {
+            char all[REG_EXP_CHAR_EPSILON];
+            for (int i = 0; i < REG_EXP_CHAR_EPSILON; ++i) all[i] = i;
+
+            pos = CreatePosition(all, REG_EXP_CHAR_EPSILON);
+        }
+        else if (lt == RegExpSynTreeNodeLeafNodeType_Norm)
+        {
+            pos = CreatePosition(txt.c_str(), 1);
+        }
+        else
+        {
+            pos = CreatePosition(txt.c_str(), txt.size());
+        }
+
+        if (pos < 0) return false;
+
+        info.nullable = false;
+        info.first = info.last = BIT_OF(pos);
+        return true;
+    }
+
+    if (node->GetNodeType() == RegExpSynTreeNodeType_Star)
+    {
+        RegExpSynTreeStarNode* sn = node->AsStarNode();
+        assert(sn);
+
+        return BuildPositionForStarNode(sn, info);
+    }
+
+    // the nodes of a chain one after another.
+    std::vector<RegExpSynTreeNode*> nodes;
+    RegExpSynTreeNodeType type = node->GetNodeType();
+
+    RegExpSyntaxTree::SplitChain(node->GetLeftNode(), type, nodes);
+    RegExpSyntaxTree::SplitChain(node->GetRightNode(), type, nodes);
+
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        PositionInfo next;
+        if (!BuildPosition(nodes[i], next)) return false;
+
+        if (i == 0)
+        {
+            info = next;
+        }
+        else if (type == RegExpSynTreeNodeType_Or)
+        {
+            info.nullable = info.nullable || next.nullable;
+            info.first = info.first | next.first;
+            info.last = info.last | next.last;
+        }
+        else
+        {
+            assert(type == RegExpSynTreeNodeType_Concat);
+            info = Concat(info, next);
+        }
+    }
+
+    return true;
+}
+
+bool RegExpBitNFA::BuildPositionForStarNode(RegExpSynTreeStarNode* sn, PositionInfo& info)
+{
+    RegExpSynTreeNode* child = sn->GetLeftNode();
+
+    int min = sn->GetMinRepeat();
+    int max = sn->GetMaxRepeat();
+
+    // every copy takes its own positions, give up early on large counts.
+    if (min >= MAX_POSITION || (max != INT_MAX && max > MAX_POSITION)) return false;
+
+    PositionInfo copy;
+    if (min == 0 && max == INT_MAX)
+    {
+        // (ab)*
+        if (!BuildPosition(child, copy)) return false;
+
+        AddFollow(copy.last, copy.first);
+        info = copy;
+        info.nullable = true;
+        return true;
+    }
+
+    // (ab){2, }, (ab){2, 4}: min copies in a row
+    info = PositionInfo();
+    for (int i = 0; i < min; ++i)
+    {
+        if (!BuildPosition(child, copy)) return false;
+
+        info = (i == 0)? copy : Concat(info, copy);
+    }
+
+    if (max == INT_MAX)
+    {
+        // the last copy repeats.
+        AddFollow(copy.last, copy.first);
+        return true;
+    }
+
+    if (max == min) return true;
+
+    // then (ab(ab(ab)?)?)? for the optional copies.
+    std::vector<PositionInfo> opt(max - min);
+    for (int i = 0; i < max - min; ++i)
+    {
+        if (!BuildPosition(child, opt[i])) return false;
+    }
+
+    PositionInfo tail = opt[max - min - 1];
+    tail.nullable = true;
+
+    for (int i = max - min - 2; i >= 0; --i)
+    {
+        tail = Concat(opt[i], tail);
+        tail.nullable = true;
+    }
+
+    info = (min == 0)? tail : Concat(info, tail);
+    return true;
+}
+
+bool RegExpBitNFA::RunMachine(const char* ps, const char* pe)
+{
+    return Match(ps, pe);
+}
+
+bool RegExpBitNFA::Match(const char* ps, const char* pe) const
+{
+    if (!isBuilt_) return false;
+
+    // same as the looping start/accept states of RegExpNFA.
+    const bool floating = support_partial_match_ && !headAnchor_;
+    const bool acceptLoop = support_partial_match_ && !tailAnchor_;
+
+    BIT_STATE_T d = 0;
+    bool matched = root_.nullable;
+
+    for (const char* in = ps; in <= pe; ++in)
+    {
+        unsigned char ch = *in;
+
+        BIT_STATE_T next = (d << 1) & shiftMask_;
+        for (BIT_STATE_T ex = d & exceptMask_; ex; ex &= ex - 1)
+        {
+            next |= followExcept_[__builtin_ctzll(ex)];
+        }
+
+        if (floating || in == ps) next |= root_.first;
+
+        d = next & charMask_[ch];
+        if (d & root_.last) matched = true;
+
+        if (acceptLoop && matched) return true;
+
+        // nothing can start any more.
+        if (!d && !floating) return false;
+    }
+
+    if (acceptLoop) return matched;
+
+    return (d & root_.last) || (root_.nullable && (floating || ps > pe));
+}
+
+bool RegExpBitNFA::SerializeState(std::string& image) const
+{
+    int info[] = { support_partial_match_, isBuilt_, headAnchor_, tailAnchor_, positionNum_, root_.nullable };
+    BIT_STATE_T mask[] = { root_.first, root_.last, shiftMask_, exceptMask_ };
+
+    AutomatonImageWriter writer(image, AutomatonImage_BitNFA);
+    writer.WriteSection(info, sizeof(info));
+    writer.WriteSection(mask, sizeof(mask));
+    writer.WriteSection(follow_, sizeof(follow_));
+    writer.WriteSection(followExcept_, sizeof(followExcept_));
+    writer.WriteSection(charMask_, sizeof(charMask_));
+    writer.Finish();
+
+    return true;
+}
+
+bool RegExpBitNFA::DeserializeState(const char* image, size_t len)
+{
+    Reset();
+
+    int info[6];
+    BIT_STATE_T mask[4];
+    AutomatonImageReader reader(image, len, AutomatonImage_BitNFA);
+
+    if (!reader.ReadSection(info, sizeof(info))
+            || !reader.ReadSection(mask, sizeof(mask))
+            || !reader.ReadSection(follow_, sizeof(follow_))
+            || !reader.ReadSection(followExcept_, sizeof(followExcept_))
+            || !reader.ReadSection(charMask_, sizeof(charMask_))
+            || info[4] < 0 || info[4] > MAX_POSITION)
+    {
+        Reset();
+        return false;
+    }
+
+    support_partial_match_ = info[0];
+    isBuilt_ = info[1];
+    headAnchor_ = info[2];
+    tailAnchor_ = info[3];
+    positionNum_ = info[4];
+    root_.nullable = info[5];
+
+    root_.first = mask[0];
+    root_.last = mask[1];
+    shiftMask_ = mask[2];
+    exceptMask_ = mask[3];
+
+    return true;
+}
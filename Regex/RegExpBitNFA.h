@@ -0,0 +1,85 @@
+#ifndef REGEXP_BIT_NFA_H_
+#define REGEXP_BIT_NFA_H_
+
+#include <stdint.h>
+#include "AutomatonBase.h"
+#include "RegExpTokenizer.h"
+
+class RegExpSyntaxTree;
+class RegExpSynTreeNode;
+class RegExpSynTreeStarNode;
+
+/*
+   glushkov automaton for patterns with at most 64 positions(char leaves,
+   counting the copies made by {m,n}), one bit per position.
+
+   active positions are kept in one 64-bit word and stepped shift-and style:
+   position p followed by p + 1 is done by a shift, the other follow edges
+   are looked up for the few positions having them.
+*/
+class RegExpBitNFA: public AutomatonBase
+{
+    public:
+
+        typedef uint64_t BIT_STATE_T;
+
+        enum { MAX_POSITION = 64 };
+
+        // partial matching has the same meaning as RegExpNFA.
+        explicit RegExpBitNFA(bool enable_partial_match = true);
+        ~RegExpBitNFA();
+
+        virtual bool SerializeState(std::string& image) const;
+        virtual bool DeserializeState(const char* image, size_t len);
+
+        // return number of positions, 0 if the pattern does not fit or
+        // contains back reference.
+        virtual int  BuildMachine(SyntaxTreeBase* tree);
+        virtual bool RunMachine(const char* ps, const char* pe);
+
+        // same as RunMachine(), nothing is changed by matching.
+        bool Match(const char* ps, const char* pe) const;
+
+        void Reset();
+
+        bool IsBuilt() const { return isBuilt_; }
+        int  GetPositionNumber() const { return positionNum_; }
+
+    private:
+
+        struct PositionInfo
+        {
+            PositionInfo(): nullable(true), first(0), last(0) {}
+
+            bool nullable;
+            BIT_STATE_T first;
+            BIT_STATE_T last;
+        };
+
+        int  CreatePosition(const char* chars, size_t len);
+        void AddFollow(BIT_STATE_T from, BIT_STATE_T to);
+
+        PositionInfo Concat(const PositionInfo& left, const PositionInfo& right);
+
+        bool BuildPosition(RegExpSynTreeNode* node, PositionInfo& info);
+        bool BuildPositionForStarNode(RegExpSynTreeStarNode* node, PositionInfo& info);
+
+    private:
+
+        bool isBuilt_;
+        bool headAnchor_, tailAnchor_;
+        bool support_partial_match_;
+
+        int positionNum_;
+        PositionInfo root_;
+
+        // follow_[p] & ~(p + 1) for positions in exceptMask_.
+        BIT_STATE_T shiftMask_, exceptMask_;
+        BIT_STATE_T follow_[MAX_POSITION];
+        BIT_STATE_T followExcept_[MAX_POSITION];
+
+        // positions matching a char.
+        BIT_STATE_T charMask_[REG_EXP_CHAR_MAX];
+};
+
+#endif
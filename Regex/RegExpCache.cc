@@ -0,0 +1,176 @@
+#include "RegExpCache.h"
+
+#include <time.h>
+
+#include "RegExpAutomata.h"
+#include "RegExpSyntaxTree.h"
+
+// bytes of an entry besides the nfa: key, list and index nodes.
+#define REG_EXP_CACHE_ENTRY_OVERHEAD (128)
+
+static double GetTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+RegExpCache::RegExpCache(size_t budget)
+    :budget_(budget)
+{
+    pthread_mutex_init(&lock_, NULL);
+}
+
+RegExpCache::~RegExpCache()
+{
+    pthread_mutex_destroy(&lock_);
+}
+
+RegExpCache::NFAPtr RegExpCache::Compile(const char* ps, const char* pe, int flags)
+{
+    RegExpSyntaxTree tree((flags & RegExpCacheFlag_UTF8) != 0);
+    if (!tree.BuildSyntaxTree(ps, pe)) return NFAPtr();
+
+    // groups are kept, the nfa may be asked for them.
+    tree.Optimize();
+
+    std::shared_ptr<RegExpNFA> nfa(new RegExpNFA((flags & RegExpCacheFlag_Partial) != 0));
+    nfa->BuildMachine(&tree);
+
+    return nfa;
+}
+
+RegExpCache::NFAPtr RegExpCache::Get(const char* ps, const char* pe, int flags)
+{
+    if (!ps || !pe || ps > pe) return NFAPtr();
+
+    CacheKey key(std::string(ps, pe - ps + 1), flags);
+
+    pthread_mutex_lock(&lock_);
+
+    std::map<CacheKey, CACHE_LIST_T::iterator>::iterator it = index_.find(key);
+    if (it != index_.end())
+    {
+        ++stat_.hits;
+        entries_.splice(entries_.begin(), entries_, it->second);
+
+        NFAPtr nfa = it->second->nfa;
+        pthread_mutex_unlock(&lock_);
+        return nfa;
+    }
+
+    ++stat_.misses;
+    pthread_mutex_unlock(&lock_);
+
+    double start = GetTime();
+
+    NFAPtr nfa;
+    try
+    {
+        nfa = Compile(ps, pe, flags);
+    }
+    catch (...)
+    {
+        double time = GetTime() - start;
+
+        pthread_mutex_lock(&lock_);
+        stat_.compileTime += time;
+        if (time > stat_.maxCompileTime) stat_.maxCompileTime = time;
+        pthread_mutex_unlock(&lock_);
+
+        throw;
+    }
+
+    double time = GetTime() - start;
+    size_t memory = nfa? nfa->GetMemorySize() + key.first.size() + REG_EXP_CACHE_ENTRY_OVERHEAD : 0;
+
+    pthread_mutex_lock(&lock_);
+
+    stat_.compileTime += time;
+    if (time > stat_.maxCompileTime) stat_.maxCompileTime = time;
+
+    it = index_.find(key);
+    if (it != index_.end())
+    {
+        // compiled by another thread meanwhile, all share the one kept.
+        entries_.splice(entries_.begin(), entries_, it->second);
+        nfa = it->second->nfa;
+    }
+    else if (nfa && memory <= budget_)
+    {
+        entries_.push_front(CacheEntry(key, nfa, memory));
+        index_[key] = entries_.begin();
+
+        ++stat_.entries;
+        stat_.memory += memory;
+
+        Evict();
+    }
+
+    pthread_mutex_unlock(&lock_);
+    return nfa;
+}
+
+RegExpCache::NFAPtr RegExpCache::Get(const std::string& pattern, int flags)
+{
+    const char* ps = pattern.c_str();
+    return Get(ps, ps + pattern.size() - 1, flags);
+}
+
+void RegExpCache::Evict()
+{
+    while (stat_.memory > budget_ && !entries_.empty())
+    {
+        const CacheEntry& entry = entries_.back();
+
+        stat_.memory -= entry.memory;
+        --stat_.entries;
+        ++stat_.evictions;
+
+        index_.erase(entry.key);
+        entries_.pop_back();
+    }
+}
+
+void RegExpCache::SetBudget(size_t budget)
+{
+    pthread_mutex_lock(&lock_);
+
+    budget_ = budget;
+    Evict();
+
+    pthread_mutex_unlock(&lock_);
+}
+
+size_t RegExpCache::GetBudget() const
+{
+    pthread_mutex_lock(&lock_);
+    size_t budget = budget_;
+    pthread_mutex_unlock(&lock_);
+
+    return budget;
+}
+
+void RegExpCache::Clear()
+{
+    pthread_mutex_lock(&lock_);
+
+    entries_.clear();
+    index_.clear();
+
+    stat_.entries = 0;
+    stat_.memory = 0;
+
+    pthread_mutex_unlock(&lock_);
+}
+
+RegExpCache::CacheStat RegExpCache::GetStat() const
+{
+    pthread_mutex_lock(&lock_);
+    CacheStat stat = stat_;
+    pthread_mutex_unlock(&lock_);
+
+    return stat;
+}
+
@@ -0,0 +1,113 @@
+#ifndef REGEXP_CACHE_H_
+#define REGEXP_CACHE_H_
+
+#include <map>
+#include <list>
+#include <memory>
+#include <string>
+#include <pthread.h>
+
+#include "Basic/NonCopyable.h"
+
+class RegExpNFA;
+
+enum RegExpCacheFlag
+{
+    RegExpCacheFlag_None = 0,
+    RegExpCacheFlag_Partial = 1, // see RegExpNFA(enable_partial_match)
+    RegExpCacheFlag_UTF8 = 2,    // see RegExpTokenizer::SetUTF8()
+};
+
+/*
+   compiled patterns kept by pattern text and flags, a pattern used over and
+   over is parsed and built once. once the entries take more than the memory
+   budget, the least recently used ones are dropped.
+
+   an nfa handed out is never changed by the cache, match it through a
+   RegExpMatchContext of each thread(see RegExpNFA::Match()). it is shared
+   with the cache, one dropped while in use lives until the last user lets
+   it go.
+
+   RegExpCache cache;
+   RegExpCache::NFAPtr nfa = cache.Get("ERROR[0-9]+", RegExpCacheFlag_Partial);
+   nfa->Match(ps, pe, ctx);
+
+   patterns are compiled without the lock held, threads missing the same
+   pattern at once may compile it each, the first one kept is used by all.
+*/
+class RegExpCache: public NonCopyable
+{
+    public:
+
+        typedef std::shared_ptr<const RegExpNFA> NFAPtr;
+
+        struct CacheStat
+        {
+            CacheStat()
+                :hits(0), misses(0), evictions(0), entries(0), memory(0)
+                ,compileTime(0), maxCompileTime(0)
+            {
+            }
+
+            size_t hits;      // patterns found compiled
+            size_t misses;    // patterns compiled, failed ones too
+            size_t evictions; // entries dropped for the budget
+            size_t entries;
+            size_t memory;    // bytes of the entries, see RegExpNFA::GetMemorySize()
+
+            // seconds spent compiling in all, and in the slowest compile.
+            double compileTime;
+            double maxCompileTime;
+        };
+
+        // an entry larger than budget alone is compiled but not kept.
+        explicit RegExpCache(size_t budget = 64 * 1024 * 1024);
+        ~RegExpCache();
+
+        // nfa of pattern [ps, pe], NULL if it is empty.
+        // throw LexErrException as RegExpSyntaxTree does for a bad pattern,
+        // which is not kept.
+        NFAPtr Get(const char* ps, const char* pe, int flags = RegExpCacheFlag_Partial);
+        NFAPtr Get(const std::string& pattern, int flags = RegExpCacheFlag_Partial);
+
+        // entries beyond the new budget are dropped at once.
+        void SetBudget(size_t budget);
+        size_t GetBudget() const;
+
+        void Clear();
+        CacheStat GetStat() const;
+
+    private:
+
+        typedef std::pair<std::string, int> CacheKey;
+
+        struct CacheEntry
+        {
+            CacheEntry(const CacheKey& k, const NFAPtr& n, size_t m): key(k), nfa(n), memory(m) {}
+
+            CacheKey key;
+            NFAPtr nfa;
+            size_t memory;
+        };
+
+        typedef std::list<CacheEntry> CACHE_LIST_T;
+
+        static NFAPtr Compile(const char* ps, const char* pe, int flags);
+
+        // drop the least recently used entries until they take at most budget_.
+        void Evict();
+
+    private:
+
+        size_t budget_;
+        CacheStat stat_;
+
+        // most recently used first, index_ finds the entry of a key.
+        CACHE_LIST_T entries_;
+        std::map<CacheKey, CACHE_LIST_T::iterator> index_;
+
+        mutable pthread_mutex_t lock_;
+};
+
+#endif
+
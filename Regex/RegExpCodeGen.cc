@@ -0,0 +1,152 @@
+#include "RegExpCodeGen.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include "RegExpAutomata.h"
+#include "RegExpTokenizer.h"
+
+#define REG_EXP_CODE_GEN_CASE_PER_LINE (8)
+
+static std::string StateLabel(int st)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "s%d", st);
+
+    return buf;
+}
+
+// jump to state to, -1 fails the match.
+static std::string StateJump(int to)
+{
+    return (to < 0)? "return false;" : "goto " + StateLabel(to) + ";";
+}
+
+// every byte moves st to itself, the state is a bare return.
+static bool IsFinalState(const RegExpDFA& dfa, int st)
+{
+    for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch)
+    {
+        if (dfa.GetNextState(st, ch) != st) return false;
+    }
+
+    return true;
+}
+
+bool RegExpCodeGen::GenerateDFA(const RegExpDFA& dfa, const std::string& name, std::string& code)
+{
+    if (!dfa.GetStateNumber() || dfa.GetStartState() < 0) return false;
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%d", dfa.GetStateNumber());
+
+    code += "// generated from a RegExpDFA of " + std::string(buf) + " states, do not edit.\n";
+    // only states some transition goes to get a label, and the input is
+    // only read if some state is not final, unused ones are warned.
+    // the loop of a final state is never taken, it returns at once.
+    bool readInput = false;
+    std::vector<char> isTarget(dfa.GetStateNumber(), 0);
+    for (int st = 0; st < dfa.GetStateNumber(); ++st)
+    {
+        if (IsFinalState(dfa, st)) continue;
+
+        readInput = true;
+        for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch)
+        {
+            int to = dfa.GetNextState(st, ch);
+            if (to >= 0) isTarget[to] = 1;
+        }
+    }
+
+    code += "bool " + name + "(const char* ps, const char* pe)\n";
+    code += "{\n";
+
+    if (readInput)
+    {
+        code += "    const unsigned char* in = reinterpret_cast<const unsigned char*>(ps);\n";
+        code += "    const unsigned char* end = reinterpret_cast<const unsigned char*>(pe) + 1;\n";
+        code += "\n";
+        code += "    if (ps > pe) end = in;\n";
+    }
+    else
+    {
+        code += "    (void)ps;\n";
+        code += "    (void)pe;\n";
+    }
+
+    code += "\n";
+
+    // the start state first, the others follow in the order Minimize() numbers them.
+    const int start = dfa.GetStartState();
+    GenerateState(dfa, start, isTarget[start], code);
+
+    for (int st = 0; st < dfa.GetStateNumber(); ++st)
+    {
+        if (st != start) GenerateState(dfa, st, isTarget[st], code);
+    }
+
+    code += "}\n";
+    return true;
+}
+
+void RegExpCodeGen::GenerateState(const RegExpDFA& dfa, int st, bool label, std::string& code)
+{
+    const char* accept = dfa.IsAcceptState(st)? "true" : "false";
+
+    std::vector<int> to(REG_EXP_CHAR_EPSILON);
+    for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch) to[ch] = dfa.GetNextState(st, ch);
+
+    // the state taken by most bytes goes to default.
+    std::vector<int> count(dfa.GetStateNumber() + 1, 0);
+    for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch) ++count[to[ch] + 1];
+
+    int def = -1;
+    for (int s = 0; s < dfa.GetStateNumber(); ++s)
+    {
+        if (count[s + 1] > count[def + 1]) def = s;
+    }
+
+    if (label) code += StateLabel(st) + ":\n";
+
+    // every byte stays, the result is known already.
+    if (IsFinalState(dfa, st))
+    {
+        code += "    return " + std::string(accept) + ";\n";
+        return;
+    }
+
+    code += "    if (in == end) return " + std::string(accept) + ";\n";
+    code += "\n";
+    code += "    switch (*in++)\n";
+    code += "    {\n";
+
+    std::vector<char> done(dfa.GetStateNumber() + 1, 0);
+    for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch)
+    {
+        int target = to[ch];
+        if (target == def || done[target + 1]) continue;
+
+        done[target + 1] = 1;
+
+        int num = 0;
+        for (int c = ch; c < REG_EXP_CHAR_EPSILON; ++c)
+        {
+            if (to[c] != target) continue;
+
+            char buf[32];
+            snprintf(buf, sizeof(buf), "case %d:", c);
+
+            code += (num % REG_EXP_CODE_GEN_CASE_PER_LINE)? " " : ((num? "\n" : "") + std::string("        "));
+            code += buf;
+            ++num;
+        }
+
+        code += "\n            " + StateJump(target) + "\n";
+    }
+
+    code += "        default:\n";
+    code += "            " + StateJump(def) + "\n";
+    code += "    }\n";
+    code += "\n";
+}
+
@@ -0,0 +1,32 @@
+#ifndef REGEXP_CODE_GEN_H_
+#define REGEXP_CODE_GEN_H_
+
+#include <string>
+
+class RegExpDFA;
+
+/*
+   c++ source of a built dfa, matching without any table: every state is a
+   label with a switch on the next byte, transitions are gotos.
+
+   the generated function is standalone,
+
+   bool name(const char* ps, const char* pe);
+
+   returning the same as RegExpDFA::RunMachine(ps, pe). see tools/xreg_codegen.cc
+   and xreg_add_matcher() in CMakeLists.txt for generating it at build time.
+*/
+class RegExpCodeGen
+{
+    public:
+
+        // append the function to code, return false if the dfa is not built.
+        static bool GenerateDFA(const RegExpDFA& dfa, const std::string& name, std::string& code);
+
+    private:
+
+        static void GenerateState(const RegExpDFA& dfa, int st, bool label, std::string& code);
+};
+
+#endif
+
@@ -0,0 +1,552 @@
+#include "RegExpPikeVM.h"
+
+#include <assert.h>
+#include <algorithm>
+
+#include "AutomatonImage.h"
+#include "RegExpSyntaxTree.h"
+
+void RegExpPikeVM::SlotPool::Reset(const std::vector<int>& init)
+{
+    slotNum_ = init.size();
+    init_ = init;
+
+    slots_.clear();
+    refs_.clear();
+    free_.clear();
+}
+
+int RegExpPikeVM::SlotPool::Create()
+{
+    int block;
+    if (!free_.empty())
+    {
+        block = free_.back();
+        free_.pop_back();
+
+        refs_[block] = 1;
+        std::copy(init_.begin(), init_.end(), slots_.begin() + block * slotNum_);
+        return block;
+    }
+
+    block = refs_.size();
+    refs_.push_back(1);
+    slots_.insert(slots_.end(), init_.begin(), init_.end());
+
+    return block;
+}
+
+void RegExpPikeVM::SlotPool::Release(int block)
+{
+    if (--refs_[block] == 0) free_.push_back(block);
+}
+
+int RegExpPikeVM::SlotPool::Write(int block, int slot, int value)
+{
+    if (refs_[block] > 1)
+    {
+        int copy = Create();
+        std::copy(slots_.begin() + block * slotNum_, slots_.begin() + (block + 1) * slotNum_,
+                slots_.begin() + copy * slotNum_);
+
+        --refs_[block];
+        block = copy;
+    }
+
+    slots_[block * slotNum_ + slot] = value;
+    return block;
+}
+
+void RegExpPikeVM::ThreadList::Reset(int num, int keyLen)
+{
+    Clear();
+
+    sparse_.resize(num);
+    keyLen_ = keyLen;
+}
+
+void RegExpPikeVM::ThreadList::Clear()
+{
+    dense.clear();
+
+    for (size_t i = 0; i < used_.size(); ++i) table_[used_[i]] = 0;
+
+    used_.clear();
+    entries_.clear();
+    entryNum_ = 0;
+}
+
+size_t RegExpPikeVM::ThreadList::Hash(const int* entry, int len)
+{
+    // fnv-1a over the ints.
+    size_t h = 2166136261u;
+    for (int i = 0; i < len; ++i) h = (h ^ static_cast<unsigned>(entry[i])) * 16777619u;
+
+    return h;
+}
+
+// table_ is kept at most half full.
+void RegExpPikeVM::ThreadList::Grow()
+{
+    const int len = keyLen_ + 1;
+
+    table_.assign(std::max<size_t>(64, 2 * table_.size()), 0);
+    used_.clear();
+
+    const size_t mask = table_.size() - 1;
+    for (int e = 0; e < entryNum_; ++e)
+    {
+        size_t i = Hash(&entries_[e * len], len) & mask;
+        while (table_[i]) i = (i + 1) & mask;
+
+        table_[i] = e + 1;
+        used_.push_back(i);
+    }
+}
+
+bool RegExpPikeVM::ThreadList::AddCounted(int pc, const std::vector<int>& key)
+{
+    const int len = keyLen_ + 1;
+
+    if (2 * (entryNum_ + 1) > static_cast<int>(table_.size())) Grow();
+
+    // the new entry goes behind the others, it is dropped if found.
+    entries_.push_back(pc);
+    entries_.insert(entries_.end(), key.begin(), key.end());
+
+    const int* entry = &entries_[entryNum_ * len];
+    const size_t mask = table_.size() - 1;
+
+    size_t i = Hash(entry, len) & mask;
+    for (; table_[i]; i = (i + 1) & mask)
+    {
+        const int* other = &entries_[(table_[i] - 1) * len];
+        if (std::equal(entry, entry + len, other))
+        {
+            entries_.resize(entryNum_ * len);
+            return false;
+        }
+    }
+
+    table_[i] = ++entryNum_;
+    used_.push_back(i);
+
+    return true;
+}
+
+RegExpPikeVM::RegExpPikeVM(bool partial)
+    :AutomatonBase(AutomatonType_NFA)
+    ,support_partial_match_(partial)
+{
+    Reset();
+}
+
+RegExpPikeVM::~RegExpPikeVM()
+{
+}
+
+void RegExpPikeVM::Reset()
+{
+    start_ = accept_ = -1;
+    isBuilt_ = false;
+
+    prog_.Reset();
+}
+
+bool RegExpPikeVM::SerializeState(std::string& image) const
+{
+    if (!isBuilt_) return false;
+
+    int info[] = { support_partial_match_ };
+
+    AutomatonImageWriter writer(image, AutomatonImage_PikeVM);
+    writer.WriteSection(info, sizeof(info));
+    prog_.Save(writer);
+    writer.Finish();
+
+    return true;
+}
+
+bool RegExpPikeVM::DeserializeState(const char* image, size_t len)
+{
+    Reset();
+
+    int info[1];
+    AutomatonImageReader reader(image, len, AutomatonImage_PikeVM);
+
+    int num = reader.ReadSection(info, sizeof(info))? prog_.Load(reader) : 0;
+    if (!num || prog_.HasRef())
+    {
+        Reset();
+        return false;
+    }
+
+    support_partial_match_ = info[0];
+    start_ = 0;
+    accept_ = num - 1;
+    isBuilt_ = true;
+
+    return true;
+}
+
+int RegExpPikeVM::BuildMachine(SyntaxTreeBase* tree)
+{
+    Reset();
+
+    RegExpSyntaxTree* reg_tree = dynamic_cast<RegExpSyntaxTree*>(tree);
+    if (!reg_tree) return 0;
+
+    int num = prog_.Build(reg_tree);
+    if (!num || prog_.HasRef())
+    {
+        Reset();
+        return 0;
+    }
+
+    start_ = 0;
+    accept_ = num - 1;
+    isBuilt_ = true;
+
+    return num;
+}
+
+bool RegExpPikeVM::RunMachine(const char* ps, const char* pe)
+{
+    return Match(ps, pe);
+}
+
+void RegExpPikeVM::MakeCountedKey(const int* block, int pos, std::vector<int>& key) const
+{
+    const int* counters = block + 2 * prog_.GetGroupNumber();
+    const int* regs = counters + prog_.GetCounterNumber();
+
+    key.assign(counters, regs);
+
+    for (int i = 0; i < prog_.GetRegNumber(); ++i) key.push_back(regs[i] == pos);
+}
+
+// follow the instructions not taking any char from pc, the threads reached
+// are added to list by priority. block is owned by the call.
+void RegExpPikeVM::AddThread(ThreadList& list, int pc, int block, int pos, Scratch& scratch) const
+{
+    // counters follow the groups in a block, then the registers.
+    const int counterBase = 2 * prog_.GetGroupNumber();
+    const int regBase = counterBase + prog_.GetCounterNumber();
+
+    SlotPool& pool = scratch.pool;
+    std::vector<Thread>& stack = scratch.stack;
+    std::vector<int>& key = scratch.key;
+
+    stack.push_back(Thread(pc, block));
+
+    while (!stack.empty())
+    {
+        pc = stack.back().pc;
+        block = stack.back().block;
+        stack.pop_back();
+
+        for (;;)
+        {
+            const RegExpInst& inst = prog_.GetInst(pc);
+            const bool stop = inst.op == RegExpInstOp_Char || inst.op == RegExpInstOp_Match;
+
+            // reached by a thread of higher priority.
+            if (prog_.IsCounted(pc))
+            {
+                MakeCountedKey(pool.GetBlock(block), pos, key);
+                if (!list.AddCounted(pc, key))
+                {
+                    pool.Release(block);
+                    break;
+                }
+
+                if (stop) list.dense.push_back(Thread(pc, block));
+            }
+            else if (list.Has(pc))
+            {
+                pool.Release(block);
+                break;
+            }
+            else
+            {
+                list.Add(pc, stop? block : -1);
+            }
+
+            if (stop) break;
+
+            if (inst.op == RegExpInstOp_Split)
+            {
+                pool.Retain(block);
+                stack.push_back(Thread(inst.y, block));
+                pc = inst.x;
+            }
+            else if (inst.op == RegExpInstOp_Jmp)
+            {
+                pc = inst.x;
+            }
+            else if (inst.op == RegExpInstOp_Open || inst.op == RegExpInstOp_Close)
+            {
+                for (int g = inst.x; g < inst.y; ++g)
+                {
+                    block = pool.Write(block, 2 * g + (inst.op == RegExpInstOp_Close), pos);
+                }
+
+                ++pc;
+            }
+            else if (inst.op == RegExpInstOp_Clear)
+            {
+                for (int slot = 2 * inst.x; slot < 2 * inst.y; ++slot)
+                {
+                    if (pool.Get(block, slot) >= 0) block = pool.Write(block, slot, -1);
+                }
+
+                ++pc;
+            }
+            else if (inst.op == RegExpInstOp_Zero || inst.op == RegExpInstOp_Incr)
+            {
+                int slot = counterBase + inst.x;
+                int n = (inst.op == RegExpInstOp_Zero)? 0 : pool.Get(block, slot) + 1;
+
+                if (pool.Get(block, slot) != n) block = pool.Write(block, slot, n);
+                ++pc;
+            }
+            else if (inst.op == RegExpInstOp_Count)
+            {
+                int n = pool.Get(block, counterBase + inst.x);
+                if (n < prog_.GetCounterMin(inst.x))
+                {
+                    ++pc;
+                }
+                else if (n >= prog_.GetCounterMax(inst.x))
+                {
+                    pc = inst.y;
+                }
+                else
+                {
+                    pool.Retain(block);
+                    stack.push_back(Thread(inst.y, block));
+                    ++pc;
+                }
+            }
+            else if (!prog_.IsCounted(pc))
+            {
+                // an empty round comes back to a pc in the list, no check needed.
+                assert(inst.op == RegExpInstOp_Mark || inst.op == RegExpInstOp_Check);
+                ++pc;
+            }
+            else if (inst.op == RegExpInstOp_Mark)
+            {
+                if (pool.Get(block, regBase + inst.x) != pos) block = pool.Write(block, regBase + inst.x, pos);
+                ++pc;
+            }
+            else
+            {
+                assert(inst.op == RegExpInstOp_Check);
+
+                // the counters differ after an empty round, cut it as RegExpBacktrack does.
+                if (pool.Get(block, regBase + inst.x) == pos)
+                {
+                    pool.Release(block);
+                    break;
+                }
+
+                ++pc;
+            }
+        }
+    }
+}
+
+void RegExpPikeVM::Prepare(Scratch& scratch) const
+{
+    const int groupNum = prog_.GetGroupNumber();
+    const int keyLen = prog_.GetCounterNumber() + prog_.GetRegNumber();
+
+    // groups, counters, registers, then the start.
+    std::vector<int>& init = scratch.init;
+    init.assign(2 * groupNum, -1);
+    init.resize(init.size() + prog_.GetCounterNumber(), 0);
+    init.resize(init.size() + prog_.GetRegNumber() + 1, -1);
+
+    scratch.pool.Reset(init);
+    scratch.list1.Reset(prog_.GetInstNumber(), keyLen);
+    scratch.list2.Reset(prog_.GetInstNumber(), keyLen);
+    scratch.stack.clear();
+}
+
+bool RegExpPikeVM::Match(const char* ps, const char* pe, std::vector<const char*>* groups) const
+{
+    Scratch scratch;
+    return Match(ps, pe, groups, scratch);
+}
+
+bool RegExpPikeVM::Match(const char* ps, const char* pe,
+        std::vector<const char*>* groups, Scratch& scratch) const
+{
+    if (!isBuilt_) return false;
+
+    // same as the looping start/accept states of RegExpNFA.
+    const bool floating = support_partial_match_ && !prog_.HasHeadAnchor();
+    const bool acceptLoop = support_partial_match_ && !prog_.HasTailAnchor();
+
+    const int len = (ps <= pe)? pe - ps + 1 : 0;
+    const int groupNum = prog_.GetGroupNumber();
+
+    Prepare(scratch);
+
+    SlotPool& pool = scratch.pool;
+    ThreadList* cur = &scratch.list1;
+    ThreadList* next = &scratch.list2;
+
+    int matched = -1;
+    for (int pos = 0; pos <= len; ++pos)
+    {
+        // a new start has the lowest priority, none after a match.
+        if (matched < 0 && (pos == 0 || floating))
+        {
+            AddThread(*cur, 0, pool.Create(), pos, scratch);
+        }
+
+        if (cur->dense.empty()) break;
+
+        for (size_t i = 0; i < cur->dense.size(); ++i)
+        {
+            const Thread& th = cur->dense[i];
+            if (th.block < 0) continue;
+
+            const RegExpInst& inst = prog_.GetInst(th.pc);
+            if (inst.op == RegExpInstOp_Char)
+            {
+                if (pos < len && prog_.IsCharIn(inst.x, ps[pos]))
+                {
+                    AddThread(*next, th.pc + 1, th.block, pos + 1, scratch);
+                }
+                else
+                {
+                    pool.Release(th.block);
+                }
+
+                continue;
+            }
+
+            if (!acceptLoop && pos < len)
+            {
+                pool.Release(th.block);
+                continue;
+            }
+
+            if (!groups) return true;
+
+            // threads of lower priority are dropped.
+            if (matched >= 0) pool.Release(matched);
+            matched = th.block;
+
+            for (size_t j = i + 1; j < cur->dense.size(); ++j)
+            {
+                if (cur->dense[j].block >= 0) pool.Release(cur->dense[j].block);
+            }
+
+            break;
+        }
+
+        cur->Clear();
+        std::swap(cur, next);
+    }
+
+    if (matched < 0) return false;
+
+    groups->assign(2 * groupNum, NULL);
+    for (int i = 0; i < groupNum; ++i)
+    {
+        int s = pool.Get(matched, 2 * i);
+        int e = pool.Get(matched, 2 * i + 1);
+        if (s < 0 || e < s) continue;
+
+        (*groups)[2 * i] = ps + s;
+        (*groups)[2 * i + 1] = ps + e - 1;
+    }
+
+    return true;
+}
+
+// threads are in the order of their starts, a thread dropped for reaching
+// a pc that is taken has the same future as the one there, which started
+// no later. so the threads kept find the leftmost start, the longest end
+// of it is the last match of a thread from there.
+bool RegExpPikeVM::Find(const char* ps, const char* pe, const char* from,
+        const char*& ms, const char*& me, Scratch& scratch) const
+{
+    if (!isBuilt_) return false;
+
+    const bool floating = support_partial_match_ && !prog_.HasHeadAnchor();
+    const bool tailAnchor = !support_partial_match_ || prog_.HasTailAnchor();
+
+    const int len = (ps <= pe)? pe - ps + 1 : 0;
+    const int startSlot = 2 * prog_.GetGroupNumber() + prog_.GetCounterNumber() + prog_.GetRegNumber();
+
+    int first = from - ps;
+    if (first > len || (!floating && first > 0)) return false;
+
+    Prepare(scratch);
+
+    SlotPool& pool = scratch.pool;
+    ThreadList* cur = &scratch.list1;
+    ThreadList* next = &scratch.list2;
+
+    int bestStart = -1, bestEnd = -1;
+    for (int pos = first; pos <= len; ++pos)
+    {
+        // a start after the one found can't be leftmost.
+        if (bestStart < 0 && (pos == first || floating))
+        {
+            int block = pool.Create();
+            AddThread(*cur, 0, pool.Write(block, startSlot, pos), pos, scratch);
+        }
+
+        if (cur->dense.empty()) break;
+
+        for (size_t i = 0; i < cur->dense.size(); ++i)
+        {
+            const Thread& th = cur->dense[i];
+            if (th.block < 0) continue;
+
+            int start = pool.Get(th.block, startSlot);
+            if (bestStart >= 0 && start > bestStart)
+            {
+                pool.Release(th.block);
+                continue;
+            }
+
+            const RegExpInst& inst = prog_.GetInst(th.pc);
+            if (inst.op == RegExpInstOp_Char)
+            {
+                if (pos < len && prog_.IsCharIn(inst.x, ps[pos]))
+                {
+                    AddThread(*next, th.pc + 1, th.block, pos + 1, scratch);
+                }
+                else
+                {
+                    pool.Release(th.block);
+                }
+
+                continue;
+            }
+
+            if (!tailAnchor || pos == len)
+            {
+                if (bestStart < 0 || start < bestStart || pos > bestEnd) bestEnd = pos;
+                bestStart = start;
+            }
+
+            pool.Release(th.block);
+        }
+
+        cur->Clear();
+        std::swap(cur, next);
+    }
+
+    if (bestStart < 0) return false;
+
+    ms = ps + bestStart;
+    me = ps + bestEnd - 1;
+    return true;
+}
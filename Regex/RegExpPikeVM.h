@@ -0,0 +1,180 @@
+#ifndef REGEXP_PIKE_VM_H_
+#define REGEXP_PIKE_VM_H_
+
+#include <vector>
+#include "AutomatonBase.h"
+#include "RegExpProgram.h"
+
+/*
+   pike vm for locating groups of patterns without back reference.
+
+   threads run the program(see RegExpProgram) in lock step, one instruction
+   takes at most one thread per input char, so matching costs O(n * m) for
+   n chars and m instructions. threads are kept in priority order and the
+   groups found are the ones RegExpBacktrack gives.
+
+   every thread refers to a block of 2 * groups slots, the counters and the
+   registers, threads split from each other share the block until one of
+   them writes to it. in a counted loop, threads at the same instruction are
+   the same only if their counters are, so a loop of n rounds may keep up to
+   n threads per instruction. empty rounds are cut there by the registers,
+   elsewhere a thread coming back to the same instruction is dropped anyway.
+   a block ends with the position the thread started from, for Find().
+*/
+class RegExpPikeVM: public AutomatonBase
+{
+    public:
+
+        // partial matching has the same meaning as RegExpNFA.
+        explicit RegExpPikeVM(bool enable_partial_match = true);
+        ~RegExpPikeVM();
+
+        // the image holds the program, false if nothing is built.
+        virtual bool SerializeState(std::string& image) const;
+        virtual bool DeserializeState(const char* image, size_t len);
+
+        // return number of instructions, 0 if the pattern contains back reference.
+        virtual int  BuildMachine(SyntaxTreeBase* tree);
+        virtual bool RunMachine(const char* ps, const char* pe);
+
+        struct Scratch;
+
+        // groups as RegExpBacktrack::Match() gives them.
+        bool Match(const char* ps, const char* pe, std::vector<const char*>* groups = NULL) const;
+
+        // same as above, with the buffers of scratch reused.
+        bool Match(const char* ps, const char* pe, std::vector<const char*>* groups, Scratch& scratch) const;
+
+        // leftmost-longest match in [ps, pe] beginning at or after from, as
+        // RegExpNFA::Find() gives it. ps is still where the input begins for ^.
+        bool Find(const char* ps, const char* pe, const char* from,
+                const char*& ms, const char*& me, Scratch& scratch) const;
+
+        void Reset();
+
+        bool IsBuilt() const { return isBuilt_; }
+        int  GetGroupNumber() const { return prog_.GetGroupNumber(); }
+        int  GetInstNumber() const { return prog_.GetInstNumber(); }
+        size_t GetMemorySize() const { return prog_.GetMemorySize(); }
+
+    private:
+
+        // slot blocks with reference counts, freed blocks are reused.
+        class SlotPool
+        {
+            public:
+
+                SlotPool(): slotNum_(0) {}
+
+                // drop all blocks, a new block starts as init.
+                void Reset(const std::vector<int>& init);
+
+                int  Create();
+                void Retain(int block) { ++refs_[block]; }
+                void Release(int block);
+
+                // block to write to, a copy if it is shared.
+                int  Write(int block, int slot, int value);
+
+                int  Get(int block, int slot) const { return slots_[block * slotNum_ + slot]; }
+                const int* GetBlock(int block) const { return &slots_[block * slotNum_]; }
+
+            private:
+
+                int slotNum_;
+                std::vector<int> init_;
+                std::vector<int> slots_;
+                std::vector<int> refs_;
+                std::vector<int> free_;
+        };
+
+        struct Thread
+        {
+            Thread(int p, int b): pc(p), block(b) {}
+
+            int pc;
+            int block; // -1 for instructions passed through
+        };
+
+        // threads of one position, by priority. sparse_[pc] indexes the thread
+        // at pc, so checking and clearing take O(1). instructions of counted
+        // loops may be reached once for every key(see MakeCountedKey()), the
+        // keys reaching them are kept in a hash table, so checking them takes
+        // O(1) as well, however many rounds the loop has.
+        class ThreadList
+        {
+            public:
+
+                ThreadList(): keyLen_(0), entryNum_(0) {}
+
+                // empty list of num instructions, keys of keyLen ints.
+                void Reset(int num, int keyLen);
+                void Clear();
+
+                // false if it is in the list already.
+                bool AddCounted(int pc, const std::vector<int>& key);
+
+                bool Has(int pc) const
+                {
+                    int i = sparse_[pc];
+                    return i < static_cast<int>(dense.size()) && dense[i].pc == pc;
+                }
+
+                void Add(int pc, int block)
+                {
+                    sparse_[pc] = dense.size();
+                    dense.push_back(Thread(pc, block));
+                }
+
+                std::vector<Thread> dense;
+
+            private:
+
+                static size_t Hash(const int* entry, int len);
+                void Grow();
+
+            private:
+
+                std::vector<int> sparse_;
+
+                // entries of pc then the key, keyLen_ + 1 ints each. table_ holds
+                // entry + 1 by hash, 0 for empty, used_ are the slots taken.
+                int keyLen_;
+                int entryNum_;
+                std::vector<int> entries_;
+                std::vector<int> table_;
+                std::vector<int> used_;
+        };
+
+    public:
+
+        // buffers of one Match(), kept for the next.
+        struct Scratch
+        {
+            std::vector<int> init;
+            SlotPool pool;
+            ThreadList list1, list2;
+            std::vector<Thread> stack;
+            std::vector<int> key;
+        };
+
+    private:
+
+        // pool and lists of scratch made ready for a run.
+        void Prepare(Scratch& scratch) const;
+
+        void AddThread(ThreadList& list, int pc, int block, int pos, Scratch& scratch) const;
+
+        // the counters and which registers are marked at pos.
+        void MakeCountedKey(const int* block, int pos, std::vector<int>& key) const;
+
+    private:
+
+        bool isBuilt_;
+        bool support_partial_match_;
+
+        RegExpProgram prog_;
+};
+
+#endif
+
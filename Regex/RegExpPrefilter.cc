@@ -0,0 +1,340 @@
+#include "RegExpPrefilter.h"
+
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "RegExpSyntaxTree.h"
+#include "RegExpSynTreeNode.h"
+
+// bounds on the literal sets tracked for a node.
+#define REG_EXP_PREFILTER_MAX_EXACT (16)
+#define REG_EXP_PREFILTER_MAX_CLASS (4)
+#define REG_EXP_PREFILTER_MAX_LITERAL (8)
+
+// shorter literals are too common to pay for the scan.
+#define REG_EXP_PREFILTER_MIN_LENGTH (2)
+
+typedef std::vector<std::string> LITERAL_LIST_T;
+
+// shortest literal decides how selective the list is.
+static size_t LiteralScore(const LITERAL_LIST_T& lits)
+{
+    if (lits.empty()) return 0;
+
+    size_t score = lits[0].size();
+    for (size_t i = 1; i < lits.size(); ++i)
+    {
+        if (lits[i].size() < score) score = lits[i].size();
+    }
+
+    return score;
+}
+
+static const LITERAL_LIST_T& BetterLiteral(const LITERAL_LIST_T& a, const LITERAL_LIST_T& b)
+{
+    size_t sa = LiteralScore(a);
+    size_t sb = LiteralScore(b);
+
+    if (sa != sb) return (sa > sb)? a : b;
+
+    return (a.size() <= b.size())? a : b;
+}
+
+RegExpPrefilter::RegExpPrefilter()
+{
+}
+
+bool RegExpPrefilter::Build(const RegExpSyntaxTree* tree)
+{
+    literals_.clear();
+
+    const RegExpSynTreeNode* root = tree->GetRoot();
+    if (!root) return false;
+
+    LiteralInfo info;
+    Analyze(root, info);
+
+    LITERAL_LIST_T lits = BestRequired(info);
+    if (LiteralScore(lits) < REG_EXP_PREFILTER_MIN_LENGTH) return false;
+
+    literals_.swap(lits);
+    return true;
+}
+
+LITERAL_LIST_T RegExpPrefilter::BestRequired(const LiteralInfo& info)
+{
+    LITERAL_LIST_T best = info.required;
+
+    const std::set<std::string>* cand[] = { &info.exact, &info.prefix, &info.suffix };
+    for (size_t i = 0; i < sizeof(cand)/sizeof(cand[0]); ++i)
+    {
+        if (i == 0 && !info.isExact) continue;
+        if (cand[i]->empty() || cand[i]->size() > REG_EXP_PREFILTER_MAX_LITERAL) continue;
+
+        LITERAL_LIST_T lits(cand[i]->begin(), cand[i]->end());
+        best = BetterLiteral(best, lits);
+    }
+
+    return best;
+}
+
+// return false if the product grows too large.
+static bool CrossProduct(const std::set<std::string>& left,
+        const std::set<std::string>& right, std::set<std::string>& out)
+{
+    if (left.size() * right.size() > REG_EXP_PREFILTER_MAX_EXACT) return false;
+
+    std::set<std::string> ret;
+    std::set<std::string>::const_iterator li = left.begin();
+    for (; li != left.end(); ++li)
+    {
+        std::set<std::string>::const_iterator ri = right.begin();
+        for (; ri != right.end(); ++ri)
+        {
+            ret.insert(*li + *ri);
+        }
+    }
+
+    out.swap(ret);
+    return true;
+}
+
+static bool Union(const std::set<std::string>& left,
+        const std::set<std::string>& right, std::set<std::string>& out)
+{
+    if (left.size() + right.size() > REG_EXP_PREFILTER_MAX_EXACT) return false;
+
+    out = left;
+    out.insert(right.begin(), right.end());
+    return true;
+}
+
+void RegExpPrefilter::AnalyzeLeaf(const RegExpSynTreeNode* node, LiteralInfo& info)
+{
+    const RegExpSynTreeLeafNode* ln = node->AsLeafNode();
+    assert(ln);
+
+    const std::string& txt = ln->GetNodeText();
+    RegExpSynTreeNodeLeafNodeType lt = ln->GetLeafNodeType();
+
+    // "" as prefix or suffix tells nothing.
+    info.prefix.insert("");
+    info.suffix.insert("");
+
+    if (lt == RegExpSynTreeNodeLeafNodeType_Head || lt == RegExpSynTreeNodeLeafNodeType_Tail)
+    {
+        info.exact.insert("");
+    }
+    else if (lt == RegExpSynTreeNodeLeafNodeType_Norm)
+    {
+        info.exact.insert(txt.substr(0, 1));
+    }
+    else if (lt == RegExpSynTreeNodeLeafNodeType_Str)
+    {
+        info.exact.insert(txt);
+    }
+    else if ((lt == RegExpSynTreeNodeLeafNodeType_Esc || lt == RegExpSynTreeNodeLeafNodeType_Alt)
+            && !txt.empty() && txt.size() <= REG_EXP_PREFILTER_MAX_CLASS)
+    {
+        for (size_t i = 0; i < txt.size(); ++i)
+        {
+            info.exact.insert(std::string(1, txt[i]));
+        }
+    }
+    else
+    {
+        // dot, large char class and back reference can be anything.
+        return;
+    }
+
+    info.SetExact();
+}
+
+void RegExpPrefilter::AnalyzeStar(const RegExpSynTreeNode* node, const LiteralInfo& child, LiteralInfo& info)
+{
+    const RegExpSynTreeStarNode* sn = node->AsStarNode();
+    assert(sn);
+
+    info.prefix.insert("");
+    info.suffix.insert("");
+
+    // nothing is required if the unit may not appear at all.
+    if (sn->GetMinRepeat() == 0) return;
+
+    info.prefix = child.prefix;
+    info.suffix = child.suffix;
+    info.required = BestRequired(child);
+
+    if (sn->GetMinRepeat() != sn->GetMaxRepeat() || !child.isExact || child.exact.size() != 1) return;
+
+    const std::string& unit = *child.exact.begin();
+    if (unit.size() * sn->GetMinRepeat() > 64) return;
+
+    std::string repeat;
+    for (int i = 0; i < sn->GetMinRepeat(); ++i) repeat += unit;
+
+    info.exact.insert(repeat);
+    info.SetExact();
+}
+
+void RegExpPrefilter::AnalyzeConcat(const LiteralInfo& left, const LiteralInfo& right, LiteralInfo& info)
+{
+    if (left.isExact && right.isExact && CrossProduct(left.exact, right.exact, info.exact))
+    {
+        info.SetExact();
+    }
+    else
+    {
+        // an exact side extends the known prefix or suffix of the other.
+        if (!left.isExact || !CrossProduct(left.exact, right.prefix, info.prefix)) info.prefix = left.prefix;
+        if (!right.isExact || !CrossProduct(left.suffix, right.exact, info.suffix)) info.suffix = right.suffix;
+    }
+
+    // literal spanning both sides.
+    std::set<std::string> span;
+    CrossProduct(left.suffix, right.prefix, span);
+
+    LITERAL_LIST_T mid(span.begin(), span.end());
+    if (mid.size() > REG_EXP_PREFILTER_MAX_LITERAL) mid.clear();
+
+    info.required = BetterLiteral(BetterLiteral(BestRequired(left), BestRequired(right)), mid);
+}
+
+void RegExpPrefilter::AnalyzeOr(const LiteralInfo& left, const LiteralInfo& right, LiteralInfo& info)
+{
+    if (left.isExact && right.isExact && Union(left.exact, right.exact, info.exact))
+    {
+        info.isExact = true;
+    }
+
+    if (!Union(left.prefix, right.prefix, info.prefix)) info.prefix.insert("");
+    if (!Union(left.suffix, right.suffix, info.suffix)) info.suffix.insert("");
+
+    // a match of either side contains a literal of that side.
+    LITERAL_LIST_T lr = BestRequired(left);
+    LITERAL_LIST_T rr = BestRequired(right);
+
+    if (lr.empty() || rr.empty() || lr.size() + rr.size() > REG_EXP_PREFILTER_MAX_LITERAL) return;
+
+    info.required.swap(lr);
+    info.required.insert(info.required.end(), rr.begin(), rr.end());
+}
+
+void RegExpPrefilter::Analyze(const RegExpSynTreeNode* node, LiteralInfo& info)
+{
+    if (!node)
+    {
+        info.exact.insert("");
+        info.SetExact();
+        return;
+    }
+
+    if (node->IsLeafNode())
+    {
+        AnalyzeLeaf(node, info);
+        return;
+    }
+
+    if (node->GetNodeType() == RegExpSynTreeNodeType_Star)
+    {
+        LiteralInfo child;
+        Analyze(node->GetLeftNode(), child);
+
+        AnalyzeStar(node, child, info);
+        return;
+    }
+
+    // a chain is taken in the order of its tree, concatenation from the
+    // left, alternation from the right.
+    std::vector<RegExpSynTreeNode*> nodes;
+    RegExpSynTreeNodeType type = node->GetNodeType();
+
+    RegExpSyntaxTree::SplitChain(node->GetLeftNode(), type, nodes);
+    RegExpSyntaxTree::SplitChain(node->GetRightNode(), type, nodes);
+
+    if (type == RegExpSynTreeNodeType_Or) std::reverse(nodes.begin(), nodes.end());
+
+    Analyze(nodes[0], info);
+    for (size_t i = 1; i < nodes.size(); ++i)
+    {
+        LiteralInfo next, done;
+        Analyze(nodes[i], next);
+
+        if (type == RegExpSynTreeNodeType_Or)
+        {
+            AnalyzeOr(next, info, done);
+        }
+        else
+        {
+            assert(type == RegExpSynTreeNodeType_Concat);
+            AnalyzeConcat(info, next, done);
+        }
+
+        info = done;
+    }
+}
+
+bool RegExpPrefilter::MayMatch(const char* ps, const char* pe) const
+{
+    for (size_t i = 0; i < literals_.size(); ++i)
+    {
+        if (FindLiteral(ps, pe, literals_[i])) return true;
+    }
+
+    return false;
+}
+
+const char* RegExpPrefilter::FindLiteral(const char* ps, const char* pe, const std::string& lit)
+{
+    const size_t n = lit.size();
+    if (ps > pe || n == 0) return n? NULL : ps;
+
+    const size_t len = pe - ps + 1;
+    if (len < n) return NULL;
+
+    const char* needle = lit.c_str();
+    if (n == 1) return static_cast<const char*>(memchr(ps, needle[0], len));
+
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // compare first and last char of the literal at 16 positions at once,
+    // then verify the candidates.
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+
+    for (; i + n + 15 <= len; i += 16)
+    {
+        __m128i bf = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ps + i));
+        __m128i bl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ps + i + n - 1));
+
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+                    _mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(ps + i + bit + 1, needle + 1, n - 2) == 0) return ps + i + bit;
+
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    while (i + n <= len)
+    {
+        const char* p = static_cast<const char*>(memchr(ps + i, needle[0], len - n - i + 1));
+        if (!p) return NULL;
+
+        if (memcmp(p + 1, needle + 1, n - 1) == 0) return p;
+
+        i = p - ps + 1;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,69 @@
+#ifndef REGEXP_PREFILTER_H_
+#define REGEXP_PREFILTER_H_
+
+#include <set>
+#include <string>
+#include <vector>
+
+class RegExpSyntaxTree;
+class RegExpSynTreeNode;
+
+/*
+   literals taken from the syntax tree that every match has to contain,
+   eg, ERROR[0-9]+:.*timeout requires "timeout".
+   input not containing any of them is rejected without running the automaton.
+*/
+class RegExpPrefilter
+{
+    public:
+
+        RegExpPrefilter();
+
+        // return false if no literal is worth scanning for.
+        bool Build(const RegExpSyntaxTree* tree);
+
+        // literals saved from a previous Build().
+        void SetLiterals(const std::vector<std::string>& literals) { literals_ = literals; }
+
+        bool HasLiteral() const { return !literals_.empty(); }
+        const std::vector<std::string>& GetLiterals() const { return literals_; }
+
+        // false if none of the literals occurs in [ps, pe].
+        bool MayMatch(const char* ps, const char* pe) const;
+
+        // first occurrence of lit in [ps, pe], NULL if not found.
+        static const char* FindLiteral(const char* ps, const char* pe, const std::string& lit);
+
+    private:
+
+        struct LiteralInfo
+        {
+            LiteralInfo(): isExact(false) {}
+
+            void SetExact() { isExact = true; prefix = suffix = exact; }
+
+            // all strings the node can match, if isExact.
+            bool isExact;
+            std::set<std::string> exact;
+
+            // every match starts/ends with one of them.
+            std::set<std::string> prefix;
+            std::set<std::string> suffix;
+
+            // one of them is in every match of the node.
+            std::vector<std::string> required;
+        };
+
+        static void Analyze(const RegExpSynTreeNode* node, LiteralInfo& info);
+        static void AnalyzeLeaf(const RegExpSynTreeNode* node, LiteralInfo& info);
+        static void AnalyzeStar(const RegExpSynTreeNode* node, const LiteralInfo& child, LiteralInfo& info);
+        static void AnalyzeConcat(const LiteralInfo& left, const LiteralInfo& right, LiteralInfo& info);
+        static void AnalyzeOr(const LiteralInfo& left, const LiteralInfo& right, LiteralInfo& info);
+        static std::vector<std::string> BestRequired(const LiteralInfo& info);
+
+    private:
+
+        std::vector<std::string> literals_;
+};
+
+#endif
@@ -0,0 +1,448 @@
+#include "RegExpProgram.h"
+
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+#include "AutomatonImage.h"
+#include "RegExpSyntaxTree.h"
+#include "RegExpSynTreeNode.h"
+
+RegExpProgram::RegExpProgram()
+{
+    Reset();
+}
+
+void RegExpProgram::Reset()
+{
+    headAnchor_ = tailAnchor_ = hasRef_ = false;
+    groupNum_ = regNum_ = 0;
+
+    insts_.clear();
+    charSet_.clear();
+    counterMin_.clear();
+    counterMax_.clear();
+    counted_.clear();
+    unitGroup_.clear();
+}
+
+size_t RegExpProgram::GetMemorySize() const
+{
+    return insts_.capacity() * sizeof(RegExpInst) + charSet_.capacity()
+        + (counterMin_.capacity() + counterMax_.capacity()) * sizeof(int) + counted_.capacity();
+}
+
+int RegExpProgram::Build(RegExpSyntaxTree* tree)
+{
+    Reset();
+
+    RegExpSynTreeNode* root = tree->GetRoot();
+    if (!root) return 0;
+
+    NumberGroup(root, groupNum_);
+    Compile(root);
+    Emit(RegExpInstOp_Match);
+
+    // a loop runs from its count instruction to the jmp in front of its exit.
+    for (size_t pc = 0; pc < insts_.size(); ++pc)
+    {
+        if (insts_[pc].op != RegExpInstOp_Count) continue;
+
+        counted_.resize(insts_.size(), 0);
+        std::fill(counted_.begin() + pc, counted_.begin() + insts_[pc].y, 1);
+    }
+
+    unitGroup_.clear();
+    return insts_.size();
+}
+
+// instructions are saved as (op, x, y).
+void RegExpProgram::Save(AutomatonImageWriter& writer) const
+{
+    int info[] = { headAnchor_, tailAnchor_, hasRef_, groupNum_, regNum_ };
+
+    std::vector<int> insts;
+    for (size_t pc = 0; pc < insts_.size(); ++pc)
+    {
+        insts.push_back(insts_[pc].op);
+        insts.push_back(insts_[pc].x);
+        insts.push_back(insts_[pc].y);
+    }
+
+    writer.WriteSection(info, sizeof(info));
+    writer.WriteSection(insts);
+    writer.WriteSection(counterMin_);
+    writer.WriteSection(counterMax_);
+    writer.WriteSection(counted_);
+    writer.WriteSection(charSet_);
+}
+
+int RegExpProgram::Load(AutomatonImageReader& reader)
+{
+    Reset();
+
+    int info[5];
+    std::vector<int> insts;
+
+    bool ok = reader.ReadSection(info, sizeof(info))
+        && reader.ReadSection(insts)
+        && reader.ReadSection(counterMin_)
+        && reader.ReadSection(counterMax_)
+        && reader.ReadSection(counted_)
+        && reader.ReadSection(charSet_);
+
+    const int num = insts.size() / 3;
+    const int setNum = charSet_.size() / REG_EXP_CHAR_EPSILON;
+    const int counterNum = counterMin_.size();
+
+    groupNum_ = ok? info[3] : 0;
+    regNum_ = ok? info[4] : 0;
+
+    ok = ok && num > 0 && insts.size() % 3 == 0 && groupNum_ >= 0 && regNum_ >= 0
+        && charSet_.size() % REG_EXP_CHAR_EPSILON == 0
+        && counterMax_.size() == counterMin_.size()
+        && (counted_.empty() || counted_.size() == insts.size() / 3)
+        && insts[3 * (num - 1)] == RegExpInstOp_Match;
+
+    for (int i = 0; ok && i < counterNum; ++i)
+    {
+        ok = counterMin_[i] >= 0 && counterMin_[i] <= counterMax_[i] && counterMax_[i] < INT_MAX;
+    }
+
+    // every instruction but match goes on to the next one or jumps.
+    for (int pc = 0; ok && pc < num; ++pc)
+    {
+        int op = insts[3 * pc], x = insts[3 * pc + 1], y = insts[3 * pc + 2];
+
+        switch (op)
+        {
+            case RegExpInstOp_Char:  ok = x >= 0 && x < setNum; break;
+            case RegExpInstOp_Split: ok = x >= 0 && x < num && y >= 0 && y < num; break;
+            case RegExpInstOp_Jmp:   ok = x >= 0 && x < num; break;
+            case RegExpInstOp_Open:
+            case RegExpInstOp_Close:
+            case RegExpInstOp_Clear: ok = x >= 0 && x <= y && y <= groupNum_; break;
+            case RegExpInstOp_Ref:   ok = x >= 0 && x < groupNum_; break;
+            case RegExpInstOp_Mark:
+            case RegExpInstOp_Check: ok = x >= 0 && x < regNum_; break;
+            case RegExpInstOp_Zero:
+            case RegExpInstOp_Incr:  ok = x >= 0 && x < counterNum; break;
+            case RegExpInstOp_Count: ok = x >= 0 && x < counterNum && y >= 0 && y < num; break;
+            case RegExpInstOp_Match: break;
+            default: ok = false; break;
+        }
+
+        if (ok) insts_.push_back(RegExpInst(static_cast<RegExpInstOp>(op), x, y));
+    }
+
+    if (!ok)
+    {
+        Reset();
+        return 0;
+    }
+
+    headAnchor_ = info[0];
+    tailAnchor_ = info[1];
+    hasRef_ = info[2];
+
+    return insts_.size();
+}
+
+int RegExpProgram::Emit(RegExpInstOp op, int x, int y)
+{
+    insts_.push_back(RegExpInst(op, x, y));
+    return insts_.size() - 1;
+}
+
+// the same numbering as RegExpSyntaxTree checks reference numbers against:
+// "(a(b))" is (b) then (a(b)), "(a)|(b)" is 0 for either.
+void RegExpProgram::NumberGroup(RegExpSynTreeNode* node, int& group)
+{
+    if (!node) return;
+
+    RegExpSynTreeNodeType type = node->GetNodeType();
+    if (type == RegExpSynTreeNodeType_Or || type == RegExpSynTreeNodeType_Concat)
+    {
+        std::vector<RegExpSynTreeNode*> nodes;
+        RegExpSyntaxTree::SplitChain(node->GetLeftNode(), type, nodes);
+        RegExpSyntaxTree::SplitChain(node->GetRightNode(), type, nodes);
+
+        // every alternative starts from the same number.
+        int base = group, top = group;
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            if (type == RegExpSynTreeNodeType_Or) group = base;
+
+            NumberGroup(nodes[i], group);
+            top = std::max(top, group);
+        }
+
+        group = top;
+    }
+    else
+    {
+        NumberGroup(node->GetLeftNode(), group);
+    }
+
+    if (node->IsUnit())
+    {
+        unitGroup_[node] = group;
+        group += node->IsUnit();
+    }
+}
+
+static bool IsNullable(RegExpSynTreeNode* node)
+{
+    if (!node) return true;
+
+    if (node->IsLeafNode())
+    {
+        RegExpSynTreeLeafNode* ln = node->AsLeafNode();
+        RegExpSynTreeNodeLeafNodeType lt = ln->GetLeafNodeType();
+
+        return lt == RegExpSynTreeNodeLeafNodeType_Head
+            || lt == RegExpSynTreeNodeLeafNodeType_Tail
+            || lt == RegExpSynTreeNodeLeafNodeType_Ref;
+    }
+
+    RegExpSynTreeNodeType type = node->GetNodeType();
+    if (type == RegExpSynTreeNodeType_Star)
+    {
+        RegExpSynTreeStarNode* sn = node->AsStarNode();
+        return sn->GetMinRepeat() == 0 || IsNullable(sn->GetLeftNode());
+    }
+
+    std::vector<RegExpSynTreeNode*> nodes;
+    RegExpSyntaxTree::SplitChain(node->GetLeftNode(), type, nodes);
+    RegExpSyntaxTree::SplitChain(node->GetRightNode(), type, nodes);
+
+    // any alternative of an alternation, every node of a concatenation.
+    bool any = (type == RegExpSynTreeNodeType_Or);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (IsNullable(nodes[i]) == any) return any;
+    }
+
+    return !any;
+}
+
+void RegExpProgram::Compile(RegExpSynTreeNode* node)
+{
+    if (!node) return;
+
+    int group = node->IsUnit()? unitGroup_[node] : -1;
+    if (group >= 0) Emit(RegExpInstOp_Open, group, group + node->IsUnit());
+
+    RegExpSynTreeNodeType type = node->GetNodeType();
+    if (node->IsLeafNode())
+    {
+        CompileLeafNode(node);
+    }
+    else if (type == RegExpSynTreeNodeType_Star)
+    {
+        RegExpSynTreeStarNode* sn = node->AsStarNode();
+        assert(sn);
+
+        CompileStarNode(sn);
+    }
+    else
+    {
+        std::vector<RegExpSynTreeNode*> nodes;
+        RegExpSyntaxTree::SplitChain(node->GetLeftNode(), type, nodes);
+        RegExpSyntaxTree::SplitChain(node->GetRightNode(), type, nodes);
+
+        // split L1, L2; L1: left; jmp L3; L2: right; L3:
+        // for every alternative but the last, all jmps go to the end.
+        std::vector<int> jmp;
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            bool alt = type == RegExpSynTreeNodeType_Or && i + 1 < nodes.size();
+
+            int split = alt? Emit(RegExpInstOp_Split, insts_.size() + 1) : -1;
+            Compile(nodes[i]);
+
+            if (!alt) continue;
+
+            jmp.push_back(Emit(RegExpInstOp_Jmp));
+            insts_[split].y = insts_.size();
+        }
+
+        for (size_t i = 0; i < jmp.size(); ++i) insts_[jmp[i]].x = insts_.size();
+    }
+
+    if (group >= 0) Emit(RegExpInstOp_Close, group, group + node->IsUnit());
+}
+
+void RegExpProgram::CompileStarNode(RegExpSynTreeStarNode* sn)
+{
+    RegExpSynTreeNode* child = sn->GetLeftNode();
+
+    int min = sn->GetMinRepeat();
+    int max = sn->GetMaxRepeat();
+
+    // groups of the child are cleared before every round, "(a|(b))*\\0" matches "ba",
+    // as \\0 is cleared by the round of 'a'.
+    int first = INT_MAX, last = -1;
+    GroupRange(child, first, last);
+
+    if (sn->IsCounted())
+    {
+        CompileCountedNode(sn, first, last);
+    }
+    else
+    {
+        // (ab){2,}, (ab){2,4}: min copies in a row.
+        for (int i = 0; i < min; ++i)
+        {
+            if (first < last) Emit(RegExpInstOp_Clear, first, last);
+            Compile(child);
+        }
+    }
+
+    if (max == INT_MAX)
+    {
+        // L1: split L2, L3; L2: child; jmp L1; L3:
+        // a child matching empty is marked and checked, "(a*)*" would loop forever.
+        int reg = IsNullable(child)? regNum_++ : -1;
+        int split = Emit(RegExpInstOp_Split, insts_.size() + 1);
+
+        if (reg >= 0) Emit(RegExpInstOp_Mark, reg);
+        if (first < last) Emit(RegExpInstOp_Clear, first, last);
+
+        Compile(child);
+        if (reg >= 0) Emit(RegExpInstOp_Check, reg);
+
+        Emit(RegExpInstOp_Jmp, split);
+        insts_[split].y = insts_.size();
+        return;
+    }
+
+    if (sn->IsCounted()) return;
+
+    // then (ab(ab(ab)?)?)? for the optional copies, each skipping to the end.
+    std::vector<int> split;
+    for (int i = min; i < max; ++i)
+    {
+        split.push_back(Emit(RegExpInstOp_Split, insts_.size() + 1));
+
+        if (first < last) Emit(RegExpInstOp_Clear, first, last);
+        Compile(child);
+    }
+
+    for (size_t i = 0; i < split.size(); ++i) insts_[split[i]].y = insts_.size();
+}
+
+// (ab){1000,2000} as a single copy of (ab) counted from 1000 to 2000,
+// (ab){1000,} is (ab){1000} here, the caller adds (ab)*.
+void RegExpProgram::CompileCountedNode(RegExpSynTreeStarNode* sn, int first, int last)
+{
+    RegExpSynTreeNode* child = sn->GetLeftNode();
+
+    int min = sn->GetMinRepeat();
+    int max = sn->GetMaxRepeat();
+    if (max == INT_MAX) max = min;
+
+    // a child matching empty may fill the rounds below min with empty ones,
+    // counting from 0 matches the same, empty rounds are then cut as for '*'.
+    int reg = IsNullable(child)? regNum_++ : -1;
+    if (reg >= 0) min = 0;
+
+    int counter = counterMin_.size();
+    counterMin_.push_back(min);
+    counterMax_.push_back(max);
+
+    Emit(RegExpInstOp_Zero, counter);
+    int count = Emit(RegExpInstOp_Count, counter);
+
+    if (reg >= 0) Emit(RegExpInstOp_Mark, reg);
+    if (first < last) Emit(RegExpInstOp_Clear, first, last);
+
+    Compile(child);
+    if (reg >= 0) Emit(RegExpInstOp_Check, reg);
+
+    Emit(RegExpInstOp_Incr, counter);
+    Emit(RegExpInstOp_Jmp, count);
+
+    // back to 0 on the way out, what follows doesn't depend on the count.
+    // emitted first, it may move the instructions.
+    int exit = Emit(RegExpInstOp_Zero, counter);
+    insts_[count].y = exit;
+}
+
+// groups of a subtree are [first, last).
+void RegExpProgram::GroupRange(RegExpSynTreeNode* node, int& first, int& last)
+{
+    std::vector<RegExpSynTreeNode*> stack;
+    if (node) stack.push_back(node);
+
+    while (!stack.empty())
+    {
+        node = stack.back();
+        stack.pop_back();
+
+        if (node->IsUnit())
+        {
+            int group = unitGroup_[node];
+
+            first = std::min(first, group);
+            last = std::max(last, group + node->IsUnit());
+        }
+
+        if (node->GetLeftNode()) stack.push_back(node->GetLeftNode());
+        if (node->GetRightNode()) stack.push_back(node->GetRightNode());
+    }
+}
+
+void RegExpProgram::CompileLeafNode(RegExpSynTreeNode* node)
+{
+    RegExpSynTreeLeafNode* ln = node->AsLeafNode();
+    assert(ln);
+
+    const std::string& txt = ln->GetNodeText();
+    RegExpSynTreeNodeLeafNodeType lt = ln->GetLeafNodeType();
+
+    if (lt == RegExpSynTreeNodeLeafNodeType_Head)
+    {
+        headAnchor_ = true;
+        return;
+    }
+    else if (lt == RegExpSynTreeNodeLeafNodeType_Tail)
+    {
+        tailAnchor_ = true;
+        return;
+    }
+    else if (lt == RegExpSynTreeNodeLeafNodeType_Ref)
+    {
+        RegExpSynTreeRefNode* rn = ln->AsRefNode();
+        assert(rn);
+
+        hasRef_ = true;
+        Emit(RegExpInstOp_Ref, rn->GetRef());
+        return;
+    }
+
+    // a string takes a char instruction for each of its chars.
+    size_t num = (lt == RegExpSynTreeNodeLeafNodeType_Str)? txt.size() : 1;
+    for (size_t n = 0; n < num; ++n)
+    {
+        int set = charSet_.size() / REG_EXP_CHAR_EPSILON;
+        charSet_.resize(charSet_.size() + REG_EXP_CHAR_EPSILON, 0);
+
+        char* chars = &charSet_[set * REG_EXP_CHAR_EPSILON];
+        if (lt == RegExpSynTreeNodeLeafNodeType_Dot)
+        {
+            memset(chars, 1, REG_EXP_CHAR_EPSILON);
+        }
+        else if (lt == RegExpSynTreeNodeLeafNodeType_Norm || lt == RegExpSynTreeNodeLeafNodeType_Str)
+        {
+            chars[static_cast<unsigned char>(txt[n])] = 1;
+        }
+        else
+        {
+            for (size_t i = 0; i < txt.size(); ++i) chars[static_cast<unsigned char>(txt[i])] = 1;
+        }
+
+        Emit(RegExpInstOp_Char, set);
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef REGEXP_PROGRAM_H_
+#define REGEXP_PROGRAM_H_
+
+#include <map>
+#include <vector>
+#include "RegExpTokenizer.h"
+
+class RegExpSyntaxTree;
+class RegExpSynTreeNode;
+class AutomatonImageWriter;
+class AutomatonImageReader;
+class RegExpSynTreeStarNode;
+
+enum RegExpInstOp
+{
+    RegExpInstOp_Char,  // x: char set
+    RegExpInstOp_Split, // try x, then y
+    RegExpInstOp_Jmp,   // x
+    RegExpInstOp_Open,  // groups [x, y) start
+    RegExpInstOp_Close, // groups [x, y) end
+    RegExpInstOp_Clear, // groups [x, y) get cleared
+    RegExpInstOp_Ref,   // x: group
+    RegExpInstOp_Mark,  // x: register, keep the position
+    RegExpInstOp_Check, // x: register, fail if nothing is matched since mark
+    RegExpInstOp_Zero,  // x: counter, set to 0
+    RegExpInstOp_Count, // x: counter, y: exit. rounds below min go on, max exit, else try both
+    RegExpInstOp_Incr,  // x: counter, add 1
+    RegExpInstOp_Match,
+};
+
+struct RegExpInst
+{
+    RegExpInst(RegExpInstOp o, int a = -1, int b = -1): op(o), x(a), y(b) {}
+
+    RegExpInstOp op;
+    int x, y;
+};
+
+/*
+   instructions compiled from a syntax tree, run by RegExpBacktrack and
+   RegExpPikeVM. the first of a split is tried first, so the match found is
+   the one perl would find.
+
+   groups are numbered by their closing parenthesis, alternatives number
+   theirs from the same base: in "((ab)|(cd))", both (ab) and (cd) are \\0,
+   the whole is \\1. groups inside a repetition are cleared on every round.
+
+   ^ and $ set the anchors the same way RegExpBitNFA does, they are no
+   instructions.
+
+   a counted repetition(see RegExpSynTreeStarNode::IsCounted()) is compiled
+   once, a counter keeps the rounds done:
+
+       zero c; L1: count c, L2; child; incr c; jmp L1; L2: zero c
+
+   counters are 0 outside their loop, so instructions outside any counted
+   loop depend on nothing but the position.
+*/
+class RegExpProgram
+{
+    public:
+
+        RegExpProgram();
+
+        // return number of instructions, 0 for an empty tree.
+        int  Build(RegExpSyntaxTree* tree);
+        void Reset();
+
+        // the program as sections of an image, Load() takes only programs
+        // whose operands are all in range, it returns number of instructions.
+        void Save(AutomatonImageWriter& writer) const;
+        int  Load(AutomatonImageReader& reader);
+
+        int  GetInstNumber() const { return insts_.size(); }
+
+        // bytes of the instructions and char sets.
+        size_t GetMemorySize() const;
+        const RegExpInst& GetInst(int pc) const { return insts_[pc]; }
+
+        bool IsCharIn(int set, unsigned char ch) const { return charSet_[set * REG_EXP_CHAR_EPSILON + ch]; }
+
+        int  GetGroupNumber() const { return groupNum_; }
+        int  GetRegNumber() const { return regNum_; }
+
+        int  GetCounterNumber() const { return counterMin_.size(); }
+        int  GetCounterMin(int counter) const { return counterMin_[counter]; }
+        int  GetCounterMax(int counter) const { return counterMax_[counter]; }
+
+        // instruction pc is in a counted loop, the counters matter for it.
+        bool IsCounted(int pc) const { return !counted_.empty() && counted_[pc]; }
+
+        bool HasHeadAnchor() const { return headAnchor_; }
+        bool HasTailAnchor() const { return tailAnchor_; }
+        bool HasRef() const { return hasRef_; }
+
+    private:
+
+        int  Emit(RegExpInstOp op, int x = -1, int y = -1);
+        void NumberGroup(RegExpSynTreeNode* node, int& group);
+
+        void Compile(RegExpSynTreeNode* node);
+        void CompileStarNode(RegExpSynTreeStarNode* node);
+        void CompileCountedNode(RegExpSynTreeStarNode* node, int first, int last);
+        void CompileLeafNode(RegExpSynTreeNode* node);
+        void GroupRange(RegExpSynTreeNode* node, int& first, int& last);
+
+    private:
+
+        bool headAnchor_, tailAnchor_;
+        bool hasRef_;
+
+        int groupNum_;
+        int regNum_;
+
+        std::vector<RegExpInst> insts_;
+
+        // bounds of the counters, max is never INT_MAX.
+        std::vector<int> counterMin_;
+        std::vector<int> counterMax_;
+        std::vector<char> counted_;
+
+        // char set x of RegExpInstOp_Char is charSet_[x * REG_EXP_CHAR_EPSILON, (x + 1) * REG_EXP_CHAR_EPSILON).
+        std::vector<char> charSet_;
+
+        // first group of a unit node, "((ab))" is one node of 2 groups.
+        // groups of a subtree are in a row.
+        std::map<const RegExpSynTreeNode*, int> unitGroup_;
+};
+
+#endif
+
@@ -0,0 +1,342 @@
+#include "RegExpSearch.h"
+
+#include <assert.h>
+#include <algorithm>
+
+#include "RegExpTokenizer.h"
+
+RegExpSearch::RegExpSearch()
+    :headAnchor_(false), tailAnchor_(false)
+    ,forward_(false), reverse_(false)
+    ,forwardDFA_(false), reverseDFA_(false)
+{
+}
+
+RegExpSearch::~RegExpSearch()
+{
+}
+
+void RegExpSearch::Build(const RegExpNFA& nfa, int start, int accept,
+        bool headAnchor, bool tailAnchor, int maxDFAState)
+{
+    headAnchor_ = headAnchor;
+    tailAnchor_ = tailAnchor;
+
+    // forward scan starts from a known position, the backward one
+    // from any position unless the pattern is tail anchored.
+    BuildSearchNFA(nfa, forward_, start, accept, false, true);
+    BuildSearchNFA(nfa, reverse_, start, accept, true, tailAnchor);
+
+    // HasDFA() needs both of them.
+    if (forward_.ConvertToDFA(forwardDFA_, maxDFAState)
+            && reverse_.ConvertToDFA(reverseDFA_, maxDFAState))
+    {
+        forwardDFA_.Minimize();
+        reverseDFA_.Minimize();
+    }
+}
+
+bool RegExpSearch::BuildTailDFA(const RegExpNFA& nfa, int start, int accept,
+        RegExpDFA& dfa, int maxDFAState)
+{
+    RegExpNFA reverse(false);
+    BuildSearchNFA(nfa, reverse, start, accept, true, true);
+
+    if (!reverse.ConvertToDFA(dfa, maxDFAState)) return false;
+
+    dfa.Minimize();
+    return true;
+}
+
+// copy of the nfa running from start to accept, or from accept to start if
+// reversed. the looping states for partial matching are left out, unless the
+// pattern is anchored a new looping state in front lets the match begin anywhere.
+void RegExpSearch::BuildSearchNFA(const RegExpNFA& from, RegExpNFA& to,
+        int start, int accept, bool reverse, bool anchored)
+{
+    to.ResetNFA(0);
+    to.states_ = from.states_;
+
+    const int num = from.states_.size();
+    const int loop = anchored? -1 : num;
+
+    if (loop >= 0) to.states_.push_back(MachineState(loop, State_Start));
+
+    const int total = to.states_.size();
+
+    std::vector<char> skip(num, 0);
+    if (from.start_ != start) skip[from.start_] = 1;
+    if (from.accept_ != accept) skip[from.accept_] = 1;
+
+    // (from, edge) pairs
+    std::vector<std::pair<int, MachineRangeEdge> > edges;
+    std::vector<std::pair<int, int> > epsilon;
+
+    for (int st = 0; st < num; ++st)
+    {
+        if (skip[st]) continue;
+
+        for (int i = from.edgeIndex_[st]; i < from.edgeIndex_[st + 1]; ++i)
+        {
+            MachineRangeEdge edge = from.edges_[i];
+            if (skip[edge.to]) continue;
+
+            int src = st;
+            if (reverse) std::swap(src, edge.to);
+
+            edges.push_back(std::make_pair(src, edge));
+        }
+
+        for (int i = from.epsilonIndex_[st]; i < from.epsilonIndex_[st + 1]; ++i)
+        {
+            int dst = from.epsilonEdges_[i];
+            if (skip[dst]) continue;
+
+            epsilon.push_back(reverse? std::make_pair(dst, st) : std::make_pair(st, dst));
+        }
+    }
+
+    const int head = reverse? accept : start;
+    if (loop >= 0)
+    {
+        MachineRangeEdge edge;
+        edge.lo = 0;
+        edge.hi = REG_EXP_CHAR_EPSILON - 1;
+        edge.to = loop;
+
+        edges.push_back(std::make_pair(loop, edge));
+        epsilon.push_back(std::make_pair(loop, head));
+    }
+
+    to.edgeIndex_.assign(total + 1, 0);
+    to.epsilonIndex_.assign(total + 1, 0);
+
+    for (size_t i = 0; i < edges.size(); ++i) ++to.edgeIndex_[edges[i].first + 1];
+    for (size_t i = 0; i < epsilon.size(); ++i) ++to.epsilonIndex_[epsilon[i].first + 1];
+
+    for (int i = 0; i < total; ++i)
+    {
+        to.edgeIndex_[i + 1] += to.edgeIndex_[i];
+        to.epsilonIndex_[i + 1] += to.epsilonIndex_[i];
+    }
+
+    std::vector<int> edgePos(to.edgeIndex_.begin(), to.edgeIndex_.end() - 1);
+    std::vector<int> epsilonPos(to.epsilonIndex_.begin(), to.epsilonIndex_.end() - 1);
+
+    to.edges_.resize(edges.size());
+    to.epsilonEdges_.resize(epsilon.size());
+
+    for (size_t i = 0; i < edges.size(); ++i) to.edges_[edgePos[edges[i].first]++] = edges[i].second;
+    for (size_t i = 0; i < epsilon.size(); ++i) to.epsilonEdges_[epsilonPos[epsilon[i].first]++] = epsilon[i].second;
+
+    to.BuildEpsilonClosure();
+
+    to.start_ = (loop >= 0)? loop : head;
+    to.accept_ = reverse? start : accept;
+}
+
+void RegExpSearch::FindStart(const char* ps, const char* pe, std::vector<char>& isStart) const
+{
+    isStart.assign(pe - ps + 2, 0);
+
+    if (!HasDFA())
+    {
+        FindStartByNFA(ps, pe, isStart);
+        return;
+    }
+
+    int st = reverseDFA_.GetStartState();
+    isStart[pe - ps + 1] = reverseDFA_.IsAcceptState(st);
+
+    for (const char* in = pe; in >= ps; --in)
+    {
+        unsigned char ch = *in;
+
+        st = reverseDFA_.GetNextState(st, ch);
+        if (st < 0) break;
+
+        isStart[in - ps] = reverseDFA_.IsAcceptState(st);
+    }
+
+    if (headAnchor_) std::fill(isStart.begin() + 1, isStart.end(), 0);
+}
+
+void RegExpSearch::FindStartByNFA(const char* ps, const char* pe, std::vector<char>& isStart) const
+{
+    const RegExpNFA& nfa = reverse_;
+
+    std::vector<int> curStat, toStat;
+    std::vector<char> isOn(nfa.states_.size(), 0);
+
+    nfa.AddStateWithEpsilon(nfa.start_, isOn, curStat);
+    for (size_t i = 0; i < curStat.size(); ++i) isOn[curStat[i]] = 0;
+
+    isStart[pe - ps + 1] = std::find(curStat.begin(), curStat.end(), nfa.accept_) != curStat.end();
+
+    for (const char* in = pe; in >= ps; --in)
+    {
+        unsigned char ch = *in;
+        if (curStat.empty()) break;
+
+        nfa.GenStatesMove(ch, curStat, isOn, toStat);
+        curStat.swap(toStat);
+        toStat.clear();
+
+        isStart[in - ps] = std::find(curStat.begin(), curStat.end(), nfa.accept_) != curStat.end();
+    }
+
+    if (headAnchor_) std::fill(isStart.begin() + 1, isStart.end(), 0);
+}
+
+bool RegExpSearch::FindLongestEnd(const char* ms, const char* pe, const char*& me) const
+{
+    if (!HasDFA()) return FindLongestEndByNFA(ms, pe, me);
+
+    bool found = false;
+    int st = forwardDFA_.GetStartState();
+
+    if (forwardDFA_.IsAcceptState(st) && (!tailAnchor_ || ms > pe))
+    {
+        found = true;
+        me = ms - 1;
+    }
+
+    for (const char* in = ms; in <= pe; ++in)
+    {
+        unsigned char ch = *in;
+
+        st = forwardDFA_.GetNextState(st, ch);
+        if (st < 0) break;
+
+        if (forwardDFA_.IsAcceptState(st) && (!tailAnchor_ || in == pe))
+        {
+            found = true;
+            me = in;
+        }
+    }
+
+    return found;
+}
+
+bool RegExpSearch::FindLongestEndByNFA(const char* ms, const char* pe, const char*& me) const
+{
+    const RegExpNFA& nfa = forward_;
+
+    std::vector<int> curStat, toStat;
+    std::vector<char> isOn(nfa.states_.size(), 0);
+
+    nfa.AddStateWithEpsilon(nfa.start_, isOn, curStat);
+    for (size_t i = 0; i < curStat.size(); ++i) isOn[curStat[i]] = 0;
+
+    bool found = false;
+    if ((!tailAnchor_ || ms > pe) && std::find(curStat.begin(), curStat.end(), nfa.accept_) != curStat.end())
+    {
+        found = true;
+        me = ms - 1;
+    }
+
+    for (const char* in = ms; in <= pe && !curStat.empty(); ++in)
+    {
+        unsigned char ch = *in;
+
+        nfa.GenStatesMove(ch, curStat, isOn, toStat);
+        curStat.swap(toStat);
+        toStat.clear();
+
+        if ((!tailAnchor_ || in == pe) && std::find(curStat.begin(), curStat.end(), nfa.accept_) != curStat.end())
+        {
+            found = true;
+            me = in;
+        }
+    }
+
+    return found;
+}
+
+bool RegExpSearch::MatchEnd(const RegExpDFA& dfa, const char* ps, const char* pe)
+{
+    int st = dfa.GetStartState();
+    for (const char* in = pe; in >= ps; --in)
+    {
+        // a match may begin anywhere.
+        if (dfa.IsAcceptState(st)) return true;
+
+        unsigned char ch = *in;
+
+        st = dfa.GetNextState(st, ch);
+        if (st < 0) return false;
+    }
+
+    return dfa.IsAcceptState(st);
+}
+
+RegExpMatchIterator::RegExpMatchIterator(const RegExpNFA& nfa, const char* ps, const char* pe)
+    :search_(nfa.GetSearch()), vm_(NULL), ps_(ps), pe_(pe), cur_(ps), lastEnd_(NULL)
+{
+    if (search_)
+    {
+        search_->FindStart(ps, pe, isStart_);
+        return;
+    }
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    if (nfa.hasCountedNode_ && !nfa.hasReferNode_) vm_ = &nfa.pikeVM_;
+#else
+    if (nfa.hasCountedNode_) vm_ = &nfa.pikeVM_;
+#endif
+
+    if (!vm_) cur_ = pe + 2;
+}
+
+bool RegExpMatchIterator::Next(const char*& ms, const char*& me)
+{
+    if (vm_) return NextByVM(ms, me);
+
+    for (; cur_ <= pe_ + 1; ++cur_)
+    {
+        if (!isStart_[cur_ - ps_]) continue;
+
+        const char* end;
+        bool found = search_->FindLongestEnd(cur_, pe_, end);
+        assert(found);
+
+        if (!found) continue;
+
+        // an empty match right behind the previous match is skipped.
+        if (end < cur_ && lastEnd_ && lastEnd_ + 1 == cur_) continue;
+
+        ms = cur_;
+        me = end;
+        lastEnd_ = end;
+        cur_ = (end < cur_)? cur_ + 1 : end + 1;
+        return true;
+    }
+
+    return false;
+}
+
+bool RegExpMatchIterator::NextByVM(const char*& ms, const char*& me)
+{
+    while (cur_ <= pe_ + 1)
+    {
+        const char* start;
+        const char* end;
+        if (!vm_->Find(ps_, pe_, cur_, start, end, scratch_)) break;
+
+        // an empty match right behind the previous match is skipped.
+        if (end < start && lastEnd_ && lastEnd_ + 1 == start)
+        {
+            cur_ = start + 1;
+            continue;
+        }
+
+        ms = start;
+        me = end;
+        lastEnd_ = end;
+        cur_ = (end < start)? start + 1 : end + 1;
+        return true;
+    }
+
+    cur_ = pe_ + 2;
+    return false;
+}
@@ -0,0 +1,97 @@
+#ifndef REGEXP_SEARCH_H_
+#define REGEXP_SEARCH_H_
+
+#include <vector>
+#include "RegExpAutomata.h"
+
+/*
+   automata for locating matches of a RegExpNFA, built from its states
+   without the looping start/accept states used for partial matching.
+
+   starts of all matches are found by one backward scan of the reversed nfa,
+   the end of the longest match from a start by a forward anchored scan.
+   both run on a dfa when it is small enough, on the nfa otherwise.
+*/
+class RegExpSearch
+{
+    public:
+
+        RegExpSearch();
+        ~RegExpSearch();
+
+        void Build(const RegExpNFA& nfa, int start, int accept,
+                bool headAnchor, bool tailAnchor, int maxDFAState = 1024);
+
+        // isStart[i] is set if a match begins at ps + i, i in [0, pe - ps + 1].
+        void FindStart(const char* ps, const char* pe, std::vector<char>& isStart) const;
+
+        // end of the longest match beginning at ms, ms - 1 if it is empty.
+        // return false if no match begins at ms.
+        bool FindLongestEnd(const char* ms, const char* pe, const char*& me) const;
+
+        bool HasDFA() const { return forwardDFA_.GetStateNumber() && reverseDFA_.GetStateNumber(); }
+
+        // the reversed dfa alone of a tail anchored nfa, for MatchEnd().
+        // return false if it takes more than maxDFAState states.
+        static bool BuildTailDFA(const RegExpNFA& nfa, int start, int accept,
+                RegExpDFA& dfa, int maxDFAState = 1024);
+
+        // whether a match of a floating, tail anchored pattern ends at pe, by the
+        // dfa of BuildTailDFA(). the backward scan stops once it is decided, not
+        // covering more than the match.
+        static bool MatchEnd(const RegExpDFA& dfa, const char* ps, const char* pe);
+
+    private:
+
+        static void BuildSearchNFA(const RegExpNFA& from, RegExpNFA& to,
+                int start, int accept, bool reverse, bool anchored);
+
+        void FindStartByNFA(const char* ps, const char* pe, std::vector<char>& isStart) const;
+        bool FindLongestEndByNFA(const char* ms, const char* pe, const char*& me) const;
+
+    private:
+
+        bool headAnchor_, tailAnchor_;
+
+        RegExpNFA forward_;
+        RegExpNFA reverse_;
+        RegExpDFA forwardDFA_;
+        RegExpDFA reverseDFA_;
+};
+
+/*
+   non-overlapping leftmost-longest matches, left to right.
+
+   RegExpMatchIterator it(nfa, ps, pe);
+   while (it.Next(ms, me)) ...
+
+   patterns with counted repetition have no search automata, their matches
+   are found one after another by the pike vm.
+*/
+class RegExpMatchIterator
+{
+    public:
+
+        RegExpMatchIterator(const RegExpNFA& nfa, const char* ps, const char* pe);
+
+        // [ms, me] of the next match, me is ms - 1 for an empty match.
+        bool Next(const char*& ms, const char*& me);
+
+    private:
+
+        bool NextByVM(const char*& ms, const char*& me);
+
+    private:
+
+        const RegExpSearch* search_;
+        const RegExpPikeVM* vm_;
+        const char* ps_;
+        const char* pe_;
+        const char* cur_;
+        const char* lastEnd_;
+
+        std::vector<char> isStart_;
+        RegExpPikeVM::Scratch scratch_;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "RegExpSet.h"
+
+#include <assert.h>
+#include <map>
+#include <algorithm>
+
+#include "RegExpSyntaxTree.h"
+#include "Parsing/LexException.h"
+
+RegExpSet::RegExpSet(bool partial, bool utf8)
+    :isCompiled_(false), support_partial_match_(partial), utf8_(utf8)
+    ,literal_(partial), nfa_(partial), classNum_(0)
+{
+}
+
+RegExpSet::~RegExpSet()
+{
+    Reset();
+
+    for (size_t i = 0; i < trees_.size(); ++i) delete trees_[i];
+}
+
+void RegExpSet::Reset()
+{
+    isCompiled_ = false;
+
+    setIds_.clear();
+    acceptTag_.clear();
+    sticky_.clear();
+
+    for (size_t i = 0; i < soloNFA_.size(); ++i) delete soloNFA_[i];
+
+    soloIds_.clear();
+    soloNFA_.clear();
+
+    classNum_ = 0;
+    byteClass_.clear();
+    DFAStatTran_.clear();
+    stickyIndex_.clear();
+    stickyIds_.clear();
+    endIndex_.clear();
+    endIds_.clear();
+}
+
+int RegExpSet::AddPattern(const char* ps, const char* pe)
+{
+    if (isCompiled_) return -1;
+
+    RegExpSyntaxTree* tree = new RegExpSyntaxTree(utf8_);
+
+    try
+    {
+        if (!tree->BuildSyntaxTree(ps, pe))
+        {
+            delete tree;
+            return -1;
+        }
+    }
+    catch (LexErrException&)
+    {
+        delete tree;
+        return -1;
+    }
+    catch (...)
+    {
+        delete tree;
+        throw;
+    }
+
+    trees_.push_back(tree);
+    return trees_.size() - 1;
+}
+
+int RegExpSet::AddPattern(const std::string& pattern)
+{
+    const char* ps = pattern.c_str();
+    return AddPattern(ps, ps + pattern.size() - 1);
+}
+
+bool RegExpSet::BuildLiteral()
+{
+    std::vector<int> ids;
+    std::vector<std::string> literals, lits;
+
+    for (size_t i = 0; i < trees_.size(); ++i)
+    {
+        if (!RegExpAhoCorasick::ExtractLiteral(trees_[i], lits)) return false;
+
+        literals.insert(literals.end(), lits.begin(), lits.end());
+        ids.insert(ids.end(), lits.size(), i);
+    }
+
+    return literal_.BuildLiteralMachine(literals, ids) > 0;
+}
+
+int RegExpSet::Compile(int maxDFAState)
+{
+    Reset();
+
+    if (BuildLiteral())
+    {
+        isCompiled_ = true;
+        return literal_.GetStateNumber();
+    }
+
+    std::vector<RegExpSyntaxTree*> trees;
+    for (size_t i = 0; i < trees_.size(); ++i)
+    {
+        // no capture is reported, groups may go.
+        trees_[i]->Optimize(false);
+
+        // back reference rewrites the states while matching, counted repetition
+        // has no states, neither can be shared.
+        bool solo = trees_[i]->HasCountedNode();
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+        solo = solo || trees_[i]->HasRefNode();
+#endif
+        if (solo)
+        {
+            RegExpNFA* nfa = new RegExpNFA(support_partial_match_);
+            nfa->BuildMachine(trees_[i]);
+
+            soloIds_.push_back(i);
+            soloNFA_.push_back(nfa);
+            continue;
+        }
+        setIds_.push_back(i);
+        trees.push_back(trees_[i]);
+    }
+
+    std::vector<int> accepts;
+    std::vector<char> sticky;
+
+    int num = nfa_.BuildSetNFA(trees, accepts, sticky);
+
+    sticky_.resize(trees_.size(), 0);
+    acceptTag_.resize(nfa_.states_.size(), -1);
+
+    for (size_t i = 0; i < accepts.size(); ++i)
+    {
+        acceptTag_[accepts[i]] = setIds_[i];
+        sticky_[setIds_[i]] = sticky[i];
+    }
+
+    if (!setIds_.empty()) BuildDFA(maxDFAState);
+
+    isCompiled_ = true;
+    return num;
+}
+
+// subset construction over nfa_ as RegExpNFA::ConvertToDFA does, accepting
+// dfa states remember the patterns they accept.
+bool RegExpSet::BuildDFA(int maxState)
+{
+    const RegExpNFA& nfa = nfa_;
+
+    std::vector<int> to;
+    std::vector<char> isOn(nfa.states_.size(), 0);
+    std::vector<std::vector<int> > dfaStates;
+    std::map<std::vector<int>, int> setToState;
+
+    to.reserve(nfa.states_.size());
+    nfa.AddStateWithEpsilon(nfa.start_, isOn, to);
+
+    for (size_t i = 0; i < to.size(); ++i) isOn[to[i]] = 0;
+
+    std::sort(to.begin(), to.end());
+    dfaStates.push_back(to);
+    setToState[to] = 0;
+
+    classNum_ = nfa.BuildByteClass(byteClass_);
+    DFAStatTran_.assign(classNum_, -1);
+
+    for (size_t cur = 0; cur < dfaStates.size(); ++cur)
+    {
+        for (int ch = 0; ch < REG_EXP_CHAR_EPSILON; ++ch)
+        {
+            if (ch && byteClass_[ch] == byteClass_[ch - 1]) continue;
+
+            to.clear();
+            nfa.GenStatesMove(ch, dfaStates[cur], isOn, to);
+
+            if (to.empty()) continue;
+
+            std::sort(to.begin(), to.end());
+            std::map<std::vector<int>, int>::iterator it = setToState.find(to);
+
+            int st;
+            if (it != setToState.end())
+            {
+                st = it->second;
+            }
+            else
+            {
+                if (static_cast<int>(dfaStates.size()) >= maxState)
+                {
+                    std::vector<int>().swap(DFAStatTran_);
+                    return false;
+                }
+
+                st = dfaStates.size();
+                setToState[to] = st;
+                dfaStates.push_back(to);
+                DFAStatTran_.resize(DFAStatTran_.size() + classNum_, -1);
+            }
+
+            DFAStatTran_[cur * classNum_ + byteClass_[ch]] = st;
+        }
+    }
+
+    stickyIndex_.assign(1, 0);
+    endIndex_.assign(1, 0);
+
+    for (size_t i = 0; i < dfaStates.size(); ++i)
+    {
+        const std::vector<int>& stat = dfaStates[i];
+        for (size_t j = 0; j < stat.size(); ++j)
+        {
+            int id = acceptTag_[stat[j]];
+            if (id < 0) continue;
+
+            endIds_.push_back(id);
+            if (sticky_[id]) stickyIds_.push_back(id);
+        }
+
+        stickyIndex_.push_back(stickyIds_.size());
+        endIndex_.push_back(endIds_.size());
+    }
+
+    return true;
+}
+
+void RegExpSet::MarkNFAMatch(const MachineStateSet& curStat, bool atEnd, std::vector<char>& matched) const
+{
+    for (int i = 0; i < curStat.Size(); ++i)
+    {
+        int id = acceptTag_[curStat[i]];
+        if (id >= 0 && (atEnd || sticky_[id])) matched[id] = 1;
+    }
+}
+
+void RegExpSet::MarkDFAMatch(int st, bool atEnd, std::vector<char>& matched) const
+{
+    const std::vector<int>& index = atEnd? endIndex_ : stickyIndex_;
+    const std::vector<int>& ids = atEnd? endIds_ : stickyIds_;
+
+    for (int i = index[st]; i < index[st + 1]; ++i) matched[ids[i]] = 1;
+}
+
+void RegExpSet::RunNFA(const char* ps, const char* pe, std::vector<char>& matched, RegExpMatchContext& ctx) const
+{
+    MachineStateSet& curStat = ctx.curStat_;
+    MachineStateSet& toStat = ctx.toStat_;
+
+    curStat.Resize(nfa_.states_.size());
+    toStat.Resize(nfa_.states_.size());
+
+    curStat.Clear();
+    nfa_.AddStateWithEpsilon(nfa_.start_, curStat);
+
+    MarkNFAMatch(curStat, false, matched);
+
+    for (const char* in = ps; in <= pe; ++in)
+    {
+        unsigned char ch = *in;
+        if (curStat.Empty()) break;
+
+        toStat.Clear();
+        nfa_.GenStatesMove(ch, curStat, toStat);
+        MarkNFAMatch(toStat, false, matched);
+
+        curStat.Swap(toStat);
+    }
+
+    MarkNFAMatch(curStat, true, matched);
+}
+
+void RegExpSet::RunDFA(const char* ps, const char* pe, std::vector<char>& matched) const
+{
+    int st = 0;
+    MarkDFAMatch(st, false, matched);
+
+    for (const char* in = ps; in <= pe; ++in)
+    {
+        unsigned char ch = *in;
+        if (st < 0) break;
+
+        st = DFAStatTran_[st * classNum_ + byteClass_[ch]];
+        if (st >= 0 && stickyIndex_[st] != stickyIndex_[st + 1]) MarkDFAMatch(st, false, matched);
+    }
+
+    if (st >= 0) MarkDFAMatch(st, true, matched);
+}
+
+int RegExpSet::Match(const char* ps, const char* pe, std::vector<int>& ids) const
+{
+    RegExpMatchContext ctx;
+    return Match(ps, pe, ids, ctx);
+}
+
+int RegExpSet::Match(const char* ps, const char* pe, std::vector<int>& ids, RegExpMatchContext& ctx) const
+{
+    ids.clear();
+    if (!isCompiled_) return 0;
+
+    std::vector<char>& matched = ctx.setMatch_;
+    matched.assign(trees_.size(), 0);
+
+    if (literal_.IsBuilt())
+    {
+        literal_.Match(ps, pe, matched);
+    }
+    else if (!setIds_.empty())
+    {
+        if (HasDFA())
+        {
+            RunDFA(ps, pe, matched);
+        }
+        else
+        {
+            RunNFA(ps, pe, matched, ctx);
+        }
+    }
+
+    for (size_t i = 0; i < soloNFA_.size(); ++i)
+    {
+        if (soloNFA_[i]->Match(ps, pe, ctx)) matched[soloIds_[i]] = 1;
+    }
+
+    for (size_t i = 0; i < matched.size(); ++i)
+    {
+        if (matched[i]) ids.push_back(i);
+    }
+
+    return ids.size();
+}
+
+bool RegExpSet::IsMatch(const char* ps, const char* pe) const
+{
+    std::vector<int> ids;
+    return Match(ps, pe, ids) > 0;
+}
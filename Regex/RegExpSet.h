@@ -0,0 +1,106 @@
+#ifndef REGEXP_SET_H_
+#define REGEXP_SET_H_
+
+#include <string>
+#include <vector>
+
+#include "Basic/NonCopyable.h"
+#include "RegExpAutomata.h"
+#include "RegExpAhoCorasick.h"
+#include "RegExpTokenizer.h"
+
+class RegExpSyntaxTree;
+
+/*
+   a group of patterns compiled into one automaton, every accept state is
+   tagged with the pattern it belongs to, so one pass over the input tells
+   all the patterns matching it.
+
+   RegExpSet set;
+   set.AddPattern("ERROR[0-9]+");
+   set.AddPattern("timeout$");
+   set.Compile();
+   set.Match(ps, pe, ids);
+*/
+class RegExpSet: public NonCopyable
+{
+    public:
+
+        // partial matching has the same meaning as RegExpNFA.
+        // patterns are parsed in utf-8 mode if utf8 is set, see RegExpTokenizer.
+        explicit RegExpSet(bool enable_partial_match = true, bool utf8 = false);
+        ~RegExpSet();
+
+        // return id of the pattern, -1 if it fails to parse.
+        // patterns can't be added after Compile().
+        int AddPattern(const char* ps, const char* pe);
+        int AddPattern(const std::string& pattern);
+
+        // build the combined nfa, and a dfa from it if the dfa takes at most
+        // maxDFAState states. return number of nfa states.
+        // sets of plain literals get an aho-corasick automaton instead,
+        // other patterns are optimized first, see RegExpSyntaxTree::Optimize().
+        int Compile(int maxDFAState = 4096);
+
+        // ids of the patterns matching [ps, pe] in increasing order,
+        // return number of them.
+        int Match(const char* ps, const char* pe, std::vector<int>& ids) const;
+        bool IsMatch(const char* ps, const char* pe) const;
+
+        // same as above, scratch of matching is kept in ctx. a compiled set is
+        // never changed by matching, threads share it with a ctx each.
+        // reusing ctx, matching allocates nothing once the buffers have grown.
+        int Match(const char* ps, const char* pe, std::vector<int>& ids, RegExpMatchContext& ctx) const;
+
+        size_t GetPatternNumber() const { return trees_.size(); }
+        bool IsCompiled() const { return isCompiled_; }
+        bool HasDFA() const { return !DFAStatTran_.empty(); }
+        bool IsLiteralSet() const { return literal_.IsBuilt(); }
+        int  GetDFAStateNumber() const { return HasDFA()? DFAStatTran_.size() / classNum_ : 0; }
+
+    private:
+
+        void Reset();
+        bool BuildLiteral();
+        bool BuildDFA(int maxState);
+
+        // tag nfa states of curStat, only sticky ones unless atEnd.
+        void MarkNFAMatch(const MachineStateSet& curStat, bool atEnd, std::vector<char>& matched) const;
+        void MarkDFAMatch(int st, bool atEnd, std::vector<char>& matched) const;
+
+        void RunNFA(const char* ps, const char* pe, std::vector<char>& matched, RegExpMatchContext& ctx) const;
+        void RunDFA(const char* ps, const char* pe, std::vector<char>& matched) const;
+
+    private:
+
+        bool isCompiled_;
+        bool support_partial_match_;
+        bool utf8_;
+
+        std::vector<RegExpSyntaxTree*> trees_;
+
+        // used when every pattern is a literal or alternation of literals.
+        RegExpAhoCorasick literal_;
+
+        // patterns merged into nfa_, ids of the rest are run by their own nfa.
+        RegExpNFA nfa_;
+        std::vector<int> setIds_;
+        std::vector<int> acceptTag_;  // nfa state to pattern id, -1 if not accepting
+        std::vector<char> sticky_;    // by pattern id
+
+        std::vector<int> soloIds_;
+        std::vector<RegExpNFA*> soloNFA_;
+
+        // dfa over nfa_, same layout as RegExpDFA::DFA_TRAN_T, with byteClass_ as the char classes.
+        // patterns accepted by dfa state st are in
+        // stickyIds_[stickyIndex_[st], stickyIndex_[st + 1]) and endIds_ likewise.
+        int classNum_;
+        std::vector<unsigned char> byteClass_;
+        std::vector<int> DFAStatTran_;
+        std::vector<int> stickyIndex_;
+        std::vector<int> stickyIds_;
+        std::vector<int> endIndex_;
+        std::vector<int> endIds_;
+};
+
+#endif
@@ -0,0 +1,462 @@
+#ifndef REGEXP_STATIC_H_
+#define REGEXP_STATIC_H_
+
+#include <stdint.h>
+
+/*
+   regular expression fixed at build time, header only.
+
+   the pattern is parsed by the compiler with the same grammar as RegExpSyntaxTree,
+   and turned into the position automaton RegExpBitNFA builds at run time: first,
+   last and follow sets of every position are compile time constants, so matching
+   runs without tokenizer, syntax tree or nfa, and the follow step is unrolled.
+
+   REG_EXP_STATIC(ErrorLine, "ERROR[0-9]+:.*timeout", true);
+   ErrorLine::Match(ps, pe);
+
+   limits: at most 64 positions(chars and classes, repeated units counted every copy),
+   no back reference and no utf-8 mode. bad patterns fail to compile.
+*/
+#define REG_EXP_STATIC(name, pattern, partial) \
+    struct name##_Pattern { static constexpr const char* Get() { return pattern; } }; \
+    typedef RegExpStatic<name##_Pattern, partial> name
+
+namespace RegExpStaticHelper {
+
+    // scanning the pattern, -1 if it is broken.
+
+    constexpr int Length(const char* p, int i = 0)
+    {
+        return p[i]? Length(p, i + 1) : i;
+    }
+
+    constexpr bool IsDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // index of the ']' closing the class that begins at i.
+    constexpr int ClassEnd(const char* p, int i)
+    {
+        return !p[i]? -1 : (p[i] == '\\' && p[i + 1])? ClassEnd(p, i + 2) : (p[i] == ']'? i : ClassEnd(p, i + 1));
+    }
+
+    constexpr int GroupEnd(const char* p, int i);
+
+    // index after the unit at i, quantifier not included.
+    constexpr int UnitEnd(const char* p, int i)
+    {
+        return i < 0? -1
+            : (p[i] == '\\' && p[i + 1])? i + 2
+            : p[i] == '['? (ClassEnd(p, i + 1) < 0? -1 : ClassEnd(p, i + 1) + 1)
+            : p[i] == '('? (GroupEnd(p, i + 1) < 0? -1 : GroupEnd(p, i + 1) + 1)
+            : i + 1;
+    }
+
+    // index of the ')' closing the group that begins at i.
+    constexpr int GroupEnd(const char* p, int i)
+    {
+        return (i < 0 || !p[i])? -1 : p[i] == ')'? i : GroupEnd(p, UnitEnd(p, i));
+    }
+
+    // index of the first '|' of [i, e) out of any group, e if there is none.
+    constexpr int AltEnd(const char* p, int i, int e)
+    {
+        return (i < 0 || i >= e)? e : p[i] == '|'? i : AltEnd(p, UnitEnd(p, i), e);
+    }
+
+    // {12,23}, {2,}, {3}, spaces are skipped as RegExpTokenizer::ExtractRepeatCount().
+    constexpr int CountEnd(const char* p, int i)
+    {
+        return !p[i]? -1 : p[i] == '}'? i : CountEnd(p, i + 1);
+    }
+
+    constexpr int NumberEnd(const char* p, int i)
+    {
+        return (IsDigit(p[i]) || p[i] == ' ')? NumberEnd(p, i + 1) : i;
+    }
+
+    constexpr int Number(const char* p, int i, int n = 0)
+    {
+        return IsDigit(p[i])? Number(p, i + 1, 10 * n + p[i] - '0') : p[i] == ' '? Number(p, i + 1, n) : n;
+    }
+
+    constexpr bool IsQuantifier(char c)
+    {
+        return c == '*' || c == '+' || c == '?' || c == '{';
+    }
+
+    // index after the quantifier at i, i if there is none.
+    constexpr int QuantifierEnd(const char* p, int i)
+    {
+        return i < 0? -1 : !IsQuantifier(p[i])? i : p[i] != '{'? i + 1 : (CountEnd(p, i) < 0? -1 : CountEnd(p, i) + 1);
+    }
+
+    // -1 stands for no limit.
+    constexpr int RepeatMin(const char* p, int i)
+    {
+        return (p[i] == '*' || p[i] == '?')? 0 : p[i] == '+'? 1 : Number(p, i + 1);
+    }
+
+    constexpr int RepeatMax(const char* p, int i)
+    {
+        return (p[i] == '*' || p[i] == '+')? -1 : p[i] == '?'? 1
+            : p[NumberEnd(p, i + 1)] == '}'? Number(p, i + 1)
+            : Number(p, NumberEnd(p, i + 1) + 1) == 0? -1 : Number(p, NumberEnd(p, i + 1) + 1);
+    }
+
+    // same as RegExpTokenizer::CanCharEscape() without back reference.
+    constexpr bool CanEscape(char c)
+    {
+        return c == '.' || c == '^' || c == '$' || c == '*' || c == '+' || c == '?' || c == '|'
+            || c == '[' || c == ']' || c == '(' || c == ')' || c == '{' || c == '}' || c == '\\'
+            || c == 's' || c == 'w' || c == 'd';
+    }
+
+    // chars of a leaf, same as the text RegExpSynTreeLeafNode builds.
+
+    constexpr bool EscapeHas(char c, unsigned char ch)
+    {
+        return c == 's'? ch == ' '
+            : c == 'd'? IsDigit(ch)
+            : c == 'w'? ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'))
+            : ch == static_cast<unsigned char>(c);
+    }
+
+    // [i, e) is the text in [] without '^', same as RegExpTokenizer::ConstructOptionString().
+    constexpr bool ClassHas(const char* p, int i, int e, unsigned char ch)
+    {
+        return i >= e? false
+            : (p[i] == '\\' && i + 1 < e && p[i + 1] == '-')? (ch == '-' || ClassHas(p, i + 2, e, ch))
+            : (i + 2 < e && p[i + 1] == '-')?
+                ((ch >= static_cast<unsigned char>(p[i]) && ch <= static_cast<unsigned char>(p[i + 2]))
+                 || ClassHas(p, i + 2, e, ch))
+            : (ch == static_cast<unsigned char>(p[i]) || ClassHas(p, i + 1, e, ch));
+    }
+
+    constexpr uint64_t Bit(int p)
+    {
+        return static_cast<uint64_t>(1) << p;
+    }
+
+    // syntax tree, as types.
+
+    struct Empty {};
+    struct Head {};
+    struct Tail {};
+
+    template <class M> struct Leaf {};
+    template <class L, class R> struct Concat {};
+    template <class L, class R> struct Or {};
+    template <class U, bool nullable> struct Loop {}; // U*, or U+ if not nullable
+    template <class U> struct Optional {};
+
+    struct AnyChar
+    {
+        static constexpr bool Has(unsigned char) { return true; }
+    };
+
+    template <char c>
+    struct PlainChar
+    {
+        static constexpr bool Has(unsigned char ch) { return ch == static_cast<unsigned char>(c); }
+    };
+
+    template <char c>
+    struct EscapeChar
+    {
+        static constexpr bool Has(unsigned char ch) { return EscapeHas(c, ch); }
+    };
+
+    // [s, e) is the text in [], a negated class takes char 0 as '.' does.
+    template <class P, int s, int e>
+    struct ClassChar
+    {
+        static constexpr bool Has(unsigned char ch)
+        {
+            return (P::Get()[s] == '^')? !ClassHas(P::Get(), s + 1, e, ch) : ClassHas(P::Get(), s, e, ch);
+        }
+    };
+
+    // U{min, max}, copies in a row as RegExpBitNFA::BuildPositionForStarNode().
+    template <class U, int min, int max>
+    struct Repeat
+    {
+        typedef Concat<U, typename Repeat<U, min - 1, (max < 0)? -1 : max - 1>::type> type;
+    };
+
+    template <class U> struct Repeat<U, 0, -1> { typedef Loop<U, true> type; };
+    template <class U> struct Repeat<U, 1, -1> { typedef Loop<U, false> type; };
+    template <class U> struct Repeat<U, 0, 0> { typedef Empty type; };
+
+    template <class U, int max>
+    struct Repeat<U, 0, max>
+    {
+        typedef Optional<Concat<U, typename Repeat<U, 0, max - 1>::type> > type;
+    };
+
+    // parser, [i, e) of the pattern.
+
+    template <class P, int i, int e, int a = AltEnd(P::Get(), i, e)> struct ParseAlt;
+    template <class P, int i, int e, bool done = (i >= e)> struct ParseSeq;
+
+    template <class P, int i, char c = P::Get()[i]>
+    struct ParseUnit
+    {
+        typedef Leaf<PlainChar<c> > type;
+    };
+
+    template <class P, int i> struct ParseUnit<P, i, '.'> { typedef Leaf<AnyChar> type; };
+    template <class P, int i> struct ParseUnit<P, i, '^'> { typedef Head type; };
+    template <class P, int i> struct ParseUnit<P, i, '$'> { typedef Tail type; };
+
+    template <class P, int i>
+    struct ParseUnit<P, i, '\\'>
+    {
+        static_assert(!IsDigit(P::Get()[i + 1]), "back reference is not supported");
+        static_assert(IsDigit(P::Get()[i + 1]) || CanEscape(P::Get()[i + 1]), "invalid escape character");
+        typedef Leaf<EscapeChar<P::Get()[i + 1]> > type;
+    };
+
+    template <class P, int i>
+    struct ParseUnit<P, i, '['>
+    {
+        typedef Leaf<ClassChar<P, i + 1, ClassEnd(P::Get(), i + 1)> > type;
+    };
+
+    template <class P, int i>
+    struct ParseUnit<P, i, '('>
+    {
+        typedef typename ParseAlt<P, i + 1, GroupEnd(P::Get(), i + 1)>::type type;
+    };
+
+    template <class P, class U, int q, bool has = IsQuantifier(P::Get()[q])>
+    struct ParseQuantifier
+    {
+        static_assert(RepeatMax(P::Get(), q) < 0 || RepeatMin(P::Get(), q) <= RepeatMax(P::Get(), q),
+                "invalid repeat number, min > max");
+        typedef typename Repeat<U, RepeatMin(P::Get(), q), RepeatMax(P::Get(), q)>::type type;
+    };
+
+    template <class P, class U, int q>
+    struct ParseQuantifier<P, U, q, false>
+    {
+        typedef U type;
+    };
+
+    template <class P, int i, int e, bool done>
+    struct ParseSeq
+    {
+        static constexpr int unitEnd = UnitEnd(P::Get(), i);
+        static constexpr int next = QuantifierEnd(P::Get(), unitEnd);
+
+        static_assert(unitEnd > 0 && next > 0, "unmatch parenthesis:\"(\", \"{\", or \"[\".");
+        static_assert(!IsQuantifier(P::Get()[i]) && P::Get()[i] != ')' && P::Get()[i] != ']' && P::Get()[i] != '}',
+                "invalid occurance of meta-character");
+
+        typedef typename ParseUnit<P, i>::type unit;
+        typedef Concat<typename ParseQuantifier<P, unit, unitEnd>::type,
+                typename ParseSeq<P, (next > 0)? next : e, e>::type> type;
+    };
+
+    template <class P, int i, int e>
+    struct ParseSeq<P, i, e, true>
+    {
+        typedef Empty type;
+    };
+
+    template <class P, int i, int e, int a>
+    struct ParseAlt
+    {
+        typedef Or<typename ParseSeq<P, i, a>::type, typename ParseAlt<P, a + 1, e>::type> type;
+    };
+
+    template <class P, int i, int e>
+    struct ParseAlt<P, i, e, e>
+    {
+        typedef typename ParseSeq<P, i, e>::type type;
+    };
+
+    // positions of a tree numbered from off: first, last, follow and chars of them.
+    // anchor has 1 set if there is '^', 2 if there is '$'.
+
+    template <class T, int off> struct Position;
+
+    template <int off>
+    struct Position<Empty, off>
+    {
+        static constexpr int Size() { return 0; }
+        static constexpr int Anchor() { return 0; }
+        static constexpr bool Nullable() { return true; }
+        static constexpr uint64_t First() { return 0; }
+        static constexpr uint64_t Last() { return 0; }
+        static constexpr uint64_t Follow(int) { return 0; }
+        static constexpr uint64_t CharMask(unsigned char) { return 0; }
+    };
+
+    template <int off>
+    struct Position<Head, off>: public Position<Empty, off>
+    {
+        static constexpr int Anchor() { return 1; }
+    };
+
+    template <int off>
+    struct Position<Tail, off>: public Position<Empty, off>
+    {
+        static constexpr int Anchor() { return 2; }
+    };
+
+    template <class M, int off>
+    struct Position<Leaf<M>, off>
+    {
+        static constexpr int Size() { return 1; }
+        static constexpr int Anchor() { return 0; }
+        static constexpr bool Nullable() { return false; }
+        static constexpr uint64_t First() { return Bit(off); }
+        static constexpr uint64_t Last() { return Bit(off); }
+        static constexpr uint64_t Follow(int) { return 0; }
+        static constexpr uint64_t CharMask(unsigned char ch) { return M::Has(ch)? Bit(off) : 0; }
+    };
+
+    template <class L, class R, int off>
+    struct Position<Concat<L, R>, off>
+    {
+        typedef Position<L, off> Left;
+        typedef Position<R, off + Left::Size()> Right;
+
+        static constexpr int Size() { return Left::Size() + Right::Size(); }
+        static constexpr int Anchor() { return Left::Anchor() | Right::Anchor(); }
+        static constexpr bool Nullable() { return Left::Nullable() && Right::Nullable(); }
+        static constexpr uint64_t First() { return Left::First() | (Left::Nullable()? Right::First() : 0); }
+        static constexpr uint64_t Last() { return Right::Last() | (Right::Nullable()? Left::Last() : 0); }
+        static constexpr uint64_t CharMask(unsigned char ch) { return Left::CharMask(ch) | Right::CharMask(ch); }
+
+        static constexpr uint64_t Follow(int p)
+        {
+            return (p < off + Left::Size())? Left::Follow(p) | ((Left::Last() & Bit(p))? Right::First() : 0) : Right::Follow(p);
+        }
+    };
+
+    template <class L, class R, int off>
+    struct Position<Or<L, R>, off>
+    {
+        typedef Position<L, off> Left;
+        typedef Position<R, off + Left::Size()> Right;
+
+        static constexpr int Size() { return Left::Size() + Right::Size(); }
+        static constexpr int Anchor() { return Left::Anchor() | Right::Anchor(); }
+        static constexpr bool Nullable() { return Left::Nullable() || Right::Nullable(); }
+        static constexpr uint64_t First() { return Left::First() | Right::First(); }
+        static constexpr uint64_t Last() { return Left::Last() | Right::Last(); }
+        static constexpr uint64_t CharMask(unsigned char ch) { return Left::CharMask(ch) | Right::CharMask(ch); }
+
+        static constexpr uint64_t Follow(int p)
+        {
+            return (p < off + Left::Size())? Left::Follow(p) : Right::Follow(p);
+        }
+    };
+
+    template <class U, bool nullable, int off>
+    struct Position<Loop<U, nullable>, off>
+    {
+        typedef Position<U, off> Unit;
+
+        static constexpr int Size() { return Unit::Size(); }
+        static constexpr int Anchor() { return Unit::Anchor(); }
+        static constexpr bool Nullable() { return nullable || Unit::Nullable(); }
+        static constexpr uint64_t First() { return Unit::First(); }
+        static constexpr uint64_t Last() { return Unit::Last(); }
+        static constexpr uint64_t CharMask(unsigned char ch) { return Unit::CharMask(ch); }
+
+        static constexpr uint64_t Follow(int p)
+        {
+            return Unit::Follow(p) | ((Unit::Last() & Bit(p))? Unit::First() : 0);
+        }
+    };
+
+    template <class U, int off>
+    struct Position<Optional<U>, off>: public Position<U, off>
+    {
+        static constexpr bool Nullable() { return true; }
+    };
+
+    // follow set of the positions in d, unrolled over [p, end).
+    template <class T, int p, int end, uint64_t follow = T::Follow(p)>
+    struct FollowStep
+    {
+        static uint64_t Run(uint64_t d)
+        {
+            return ((d & Bit(p))? follow : 0) | FollowStep<T, p + 1, end>::Run(d);
+        }
+    };
+
+    template <class T, int end, uint64_t follow>
+    struct FollowStep<T, end, end, follow>
+    {
+        static uint64_t Run(uint64_t) { return 0; }
+    };
+
+    template <int... i> struct IndexList {};
+    template <int n, int... i> struct MakeIndexList: public MakeIndexList<n - 1, n - 1, i...> {};
+    template <int... i> struct MakeIndexList<0, i...> { typedef IndexList<i...> type; };
+
+    template <class T, class L> struct CharTable;
+
+    template <class T, int... i>
+    struct CharTable<T, IndexList<i...> >
+    {
+        static const uint64_t mask[sizeof...(i)];
+    };
+
+    template <class T, int... i>
+    const uint64_t CharTable<T, IndexList<i...> >::mask[sizeof...(i)] = { T::CharMask(i)... };
+
+} // end namespace RegExpStaticHelper
+
+// P::Get() returns the pattern, see REG_EXP_STATIC.
+// partial matching has the same meaning as RegExpNFA.
+template <class P, bool partial = true>
+class RegExpStatic
+{
+    private:
+
+        typedef typename RegExpStaticHelper::ParseAlt<P, 0, RegExpStaticHelper::Length(P::Get())>::type Tree;
+        typedef RegExpStaticHelper::Position<Tree, 0> Root;
+        typedef RegExpStaticHelper::CharTable<Root, RegExpStaticHelper::MakeIndexList<256>::type> Table;
+
+        static_assert(Root::Size() <= 64, "too many positions for RegExpStatic");
+
+    public:
+
+        static int GetPositionNumber() { return Root::Size(); }
+
+        // same as RegExpBitNFA::Match().
+        static bool Match(const char* ps, const char* pe)
+        {
+            const bool floating = partial && !(Root::Anchor() & 1);
+            const bool acceptLoop = partial && !(Root::Anchor() & 2);
+
+            uint64_t d = 0;
+            bool matched = Root::Nullable();
+
+            for (const char* in = ps; in <= pe; ++in)
+            {
+                uint64_t next = RegExpStaticHelper::FollowStep<Root, 0, Root::Size()>::Run(d);
+                if (floating || in == ps) next |= Root::First();
+
+                d = next & Table::mask[static_cast<unsigned char>(*in)];
+                if (d & Root::Last()) matched = true;
+
+                if (acceptLoop && matched) return true;
+
+                if (!d && !floating) return false;
+            }
+
+            if (acceptLoop) return matched;
+
+            return (d & Root::Last()) || (Root::Nullable() && (floating || ps > pe));
+        }
+};
+
+#endif
+
@@ -0,0 +1,138 @@
+#include "RegExpStream.h"
+
+#include <algorithm>
+#include "RegExpTokenizer.h"
+
+// no states to stream with otherwise.
+bool RegExpStreamMatcher::IsStreamable(const RegExpNFA& nfa)
+{
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    if (nfa.hasReferNode_) return false;
+#endif
+
+    return !nfa.edgeIndex_.empty();
+}
+
+RegExpStreamMatcher::RegExpStreamMatcher(const RegExpNFA& nfa, const RegExpDFA* dfa)
+    :nfa_(nfa), dfa_(NULL), isSupported_(IsStreamable(nfa))
+{
+    if (isSupported_ && dfa && dfa->GetStateNumber() > 0) dfa_ = dfa;
+
+    Reset();
+}
+
+bool RegExpStreamMatcher::BuildDFA(const RegExpNFA& nfa, RegExpDFA& dfa, int maxDFAState)
+{
+    if (!IsStreamable(nfa) || !nfa.ConvertToDFA(dfa, maxDFAState)) return false;
+
+    dfa.Minimize();
+    return true;
+}
+
+RegExpStreamMatcher::~RegExpStreamMatcher()
+{
+}
+
+void RegExpStreamMatcher::Reset()
+{
+    isDead_ = !isSupported_;
+    offset_ = 0;
+    firstMatchEnd_ = -1;
+
+    dfaState_ = -1;
+    curStat_.clear();
+    toStat_.clear();
+
+    if (isDead_) return;
+
+    if (HasDFA())
+    {
+        dfaState_ = dfa_->GetStartState();
+    }
+    else
+    {
+        isOn_.assign(nfa_.states_.size(), 0);
+        nfa_.AddStateWithEpsilon(nfa_.start_, isOn_, curStat_);
+
+        for (size_t i = 0; i < curStat_.size(); ++i) isOn_[curStat_[i]] = 0;
+    }
+
+    if (IsAccept()) firstMatchEnd_ = 0;
+}
+
+bool RegExpStreamMatcher::IsAccept() const
+{
+    if (isDead_) return false;
+
+    if (HasDFA()) return dfa_->IsAcceptState(dfaState_);
+
+    return std::find(curStat_.begin(), curStat_.end(), nfa_.accept_) != curStat_.end();
+}
+
+bool RegExpStreamMatcher::IsMatched() const
+{
+    return IsAccept();
+}
+
+bool RegExpStreamMatcher::Feed(const char* ps, const char* pe)
+{
+    if (!isDead_ && ps <= pe)
+    {
+        if (HasDFA())
+        {
+            FeedDFA(ps, pe);
+        }
+        else
+        {
+            FeedNFA(ps, pe);
+        }
+    }
+
+    if (ps <= pe) offset_ += pe - ps + 1;
+
+    return IsMatched();
+}
+
+void RegExpStreamMatcher::FeedDFA(const char* ps, const char* pe)
+{
+    int st = dfaState_;
+    for (const char* in = ps; in <= pe; ++in)
+    {
+        st = dfa_->GetNextState(st, static_cast<unsigned char>(*in));
+        if (st < 0)
+        {
+            isDead_ = true;
+            return;
+        }
+
+        if (firstMatchEnd_ < 0 && dfa_->IsAcceptState(st))
+        {
+            firstMatchEnd_ = offset_ + (in - ps) + 1;
+        }
+    }
+
+    dfaState_ = st;
+}
+
+void RegExpStreamMatcher::FeedNFA(const char* ps, const char* pe)
+{
+    for (const char* in = ps; in <= pe; ++in)
+    {
+        if (curStat_.empty())
+        {
+            isDead_ = true;
+            return;
+        }
+
+        nfa_.GenStatesMove(static_cast<unsigned char>(*in), curStat_, isOn_, toStat_);
+        curStat_.swap(toStat_);
+        toStat_.clear();
+
+        if (firstMatchEnd_ < 0 && IsAccept())
+        {
+            firstMatchEnd_ = offset_ + (in - ps) + 1;
+        }
+    }
+
+    if (curStat_.empty()) isDead_ = true;
+}
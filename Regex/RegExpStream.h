@@ -0,0 +1,79 @@
+#ifndef REGEXP_STREAM_H_
+#define REGEXP_STREAM_H_
+
+#include <vector>
+#include "RegExpAutomata.h"
+
+/*
+   matching input that comes in chunks, without joining them.
+   the state of the automaton is kept between chunks, so a match may span any
+   number of them. the result is the same as RunMachine() on the whole input.
+
+   RegExpDFA dfa;
+   RegExpStreamMatcher::BuildDFA(nfa, dfa);
+
+   RegExpStreamMatcher sm(nfa, &dfa);
+   while (read(buf, len)) sm.Feed(buf, buf + len - 1);
+   sm.IsMatched();
+
+   the dfa is built once and shared by every stream of the nfa, a matcher
+   keeps nothing but the state of its own stream. without a dfa the nfa is
+   simulated.
+
+   the nfa and the dfa must outlive the matcher, patterns with back reference are not
+   supported since they need the text matched before, nor are those with
+   counted repetition, which have no states. IsSupported() tells them apart
+   from a stream that is not matched, Feed() never matches them.
+*/
+class RegExpStreamMatcher
+{
+    public:
+
+        // dfa is built by BuildDFA() from the same nfa, NULL to simulate the nfa.
+        explicit RegExpStreamMatcher(const RegExpNFA& nfa, const RegExpDFA* dfa = NULL);
+        ~RegExpStreamMatcher();
+
+        // minimal dfa of nfa for matchers to share, false if the nfa can't be
+        // streamed or the dfa takes more than maxDFAState states.
+        static bool BuildDFA(const RegExpNFA& nfa, RegExpDFA& dfa, int maxDFAState = 1024);
+
+        // start a new stream.
+        void Reset();
+
+        // feed the next chunk, return IsMatched().
+        bool Feed(const char* ps, const char* pe);
+
+        // if the input so far matches as a whole.
+        bool IsMatched() const;
+
+        // length of the shortest prefix of the input matching, -1 if none yet.
+        long GetFirstMatchEnd() const { return firstMatchEnd_; }
+
+        size_t GetOffset() const { return offset_; }
+        bool IsSupported() const { return isSupported_; }
+        bool HasDFA() const { return dfa_ != NULL; }
+
+    private:
+
+        static bool IsStreamable(const RegExpNFA& nfa);
+        bool IsAccept() const;
+
+        void FeedDFA(const char* ps, const char* pe);
+        void FeedNFA(const char* ps, const char* pe);
+
+    private:
+
+        const RegExpNFA& nfa_;
+        const RegExpDFA* dfa_;
+
+        bool isSupported_;
+        bool isDead_;     // nothing can match any more
+        size_t offset_;   // chars fed
+        long firstMatchEnd_;
+
+        int dfaState_;
+        std::vector<int> curStat_, toStat_;
+        std::vector<char> isOn_;
+};
+
+#endif
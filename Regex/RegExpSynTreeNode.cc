@@ -31,7 +31,7 @@ const std::string& RegExpSynTreeNode::GetNodeText() const
 
 RegExpSynTreeStarNode::RegExpSynTreeStarNode(int min, int max)
     :RegExpSynTreeNode(RegExpSynTreeNodeType_Star)
-    ,min_(min), max_(max)
+    ,min_(min), max_(max), isCounted_(false)
 {
 }
 
@@ -76,6 +76,14 @@ RegExpSynTreeLeafNode::RegExpSynTreeLeafNode(const char* s, const char* e, int p
     }
 }
 
+RegExpSynTreeLeafNode::RegExpSynTreeLeafNode(RegExpSynTreeNodeLeafNodeType type, const std::string& text, int pos)
+    :RegExpSynTreeNode(NULL, NULL, RegExpSynTreeNodeType_Leaf, pos)
+    ,textOrig_(text)
+    ,leafType_(type)
+{
+    text_ = text;
+}
+
 RegExpSynTreeLeafNode::RegExpSynTreeLeafNode(int pos)
     :RegExpSynTreeNode(NULL, NULL, RegExpSynTreeNodeType_Leaf, pos)
 {
@@ -3,6 +3,10 @@
 
 #include "Parsing/SyntaxTreeNodeBase.h"
 
+class RegExpSynTreeStarNode;
+class RegExpSynTreeLeafNode;
+class RegExpSynTreeRefNode;
+
 enum RegExpSynTreeNodeType
 {
     RegExpSynTreeNodeType_None,
@@ -21,6 +25,7 @@ enum RegExpSynTreeNodeLeafNodeType
     RegExpSynTreeNodeLeafNodeType_Dot, //.
     RegExpSynTreeNodeLeafNodeType_Head, //^
     RegExpSynTreeNodeLeafNodeType_Tail, //$
+    RegExpSynTreeNodeLeafNodeType_Str, // plain chars in a row, see RegExpSyntaxTree::Optimize()
     // TODO
     RegExpSynTreeNodeLeafNodeType_Ref, // for back-reference, \1, \2, etc
 };
@@ -34,11 +39,26 @@ class RegExpSynTreeNode: public SynTreeNodeBase
 
         int IsUnit() const { return isUnit_; }
         void SetUnit(bool isUnit) { isUnit_ += isUnit; }
+        void CopyUnit(const RegExpSynTreeNode* node) { isUnit_ = node->isUnit_; }
+        void ClearUnit() { isUnit_ = 0; }
 
         virtual bool IsLeafNode() const;
         virtual int  GetNodePosition() const { return position_; }
         RegExpSynTreeNodeType GetNodeType() const { return type_; }
 
+        // children of a regexp node are regexp nodes.
+        RegExpSynTreeNode* GetLeftNode() const { return static_cast<RegExpSynTreeNode*>(left_); }
+        RegExpSynTreeNode* GetRightNode() const { return static_cast<RegExpSynTreeNode*>(right_); }
+
+        // the node as the class of its kind, NULL if it is of another kind.
+        // the kind is told by the node type, no dynamic_cast is needed.
+        RegExpSynTreeStarNode* AsStarNode();
+        RegExpSynTreeLeafNode* AsLeafNode();
+        RegExpSynTreeRefNode*  AsRefNode();
+        const RegExpSynTreeStarNode* AsStarNode() const;
+        const RegExpSynTreeLeafNode* AsLeafNode() const;
+        const RegExpSynTreeRefNode*  AsRefNode() const;
+
         virtual const std::string& GetNodeText() const;
         virtual const std::string& GetOrigText() const { return GetNodeText(); }
 
@@ -64,10 +84,16 @@ class RegExpSynTreeStarNode: public RegExpSynTreeNode
         int GetMinRepeat() const { return min_; }
         int GetMaxRepeat() const { return max_; }
 
+        // a counted repetition keeps one copy of the child, rounds are
+        // counted while matching instead of being expanded into copies.
+        bool IsCounted() const { return isCounted_; }
+        void SetCounted(bool counted) { isCounted_ = counted; }
+
     private:
 
         int min_;
         int max_;
+        bool isCounted_;
 };
 
 class RegExpSynTreeLeafNode: public RegExpSynTreeNode
@@ -75,6 +101,10 @@ class RegExpSynTreeLeafNode: public RegExpSynTreeNode
     public:
 
         RegExpSynTreeLeafNode(const char* s, const char* e, int pos);
+
+        // leaf of the given chars, text is not parsed.
+        RegExpSynTreeLeafNode(RegExpSynTreeNodeLeafNodeType type, const std::string& text, int pos);
+
         RegExpSynTreeNodeLeafNodeType GetLeafNodeType() const { return leafType_; }
 
         const std::string& GetOrigText() const { return textOrig_; }
@@ -85,7 +115,6 @@ class RegExpSynTreeLeafNode: public RegExpSynTreeNode
 
     protected:
 
-        // TODO, currently only support ascil char.
         std::string textOrig_;
         RegExpSynTreeNodeLeafNodeType leafType_;
 };
@@ -103,5 +132,38 @@ class RegExpSynTreeRefNode: public RegExpSynTreeLeafNode
         int ref_;
 };
 
+inline RegExpSynTreeStarNode* RegExpSynTreeNode::AsStarNode()
+{
+    return type_ == RegExpSynTreeNodeType_Star? static_cast<RegExpSynTreeStarNode*>(this) : NULL;
+}
+
+inline RegExpSynTreeLeafNode* RegExpSynTreeNode::AsLeafNode()
+{
+    return type_ == RegExpSynTreeNodeType_Leaf? static_cast<RegExpSynTreeLeafNode*>(this) : NULL;
+}
+
+inline RegExpSynTreeRefNode* RegExpSynTreeNode::AsRefNode()
+{
+    RegExpSynTreeLeafNode* ln = AsLeafNode();
+    if (!ln || ln->GetLeafNodeType() != RegExpSynTreeNodeLeafNodeType_Ref) return NULL;
+
+    return static_cast<RegExpSynTreeRefNode*>(ln);
+}
+
+inline const RegExpSynTreeStarNode* RegExpSynTreeNode::AsStarNode() const
+{
+    return const_cast<RegExpSynTreeNode*>(this)->AsStarNode();
+}
+
+inline const RegExpSynTreeLeafNode* RegExpSynTreeNode::AsLeafNode() const
+{
+    return const_cast<RegExpSynTreeNode*>(this)->AsLeafNode();
+}
+
+inline const RegExpSynTreeRefNode* RegExpSynTreeNode::AsRefNode() const
+{
+    return const_cast<RegExpSynTreeNode*>(this)->AsRefNode();
+}
+
 #endif
 
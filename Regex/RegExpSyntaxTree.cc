@@ -1,29 +1,97 @@
 #include "RegExpSyntaxTree.h"
 
+#include <new>
+#include <algorithm>
+#include <ctype.h>
+#include <assert.h>
 #include <limits.h>
 #include "Parsing/LexException.h"
 #include "RegExpTokenizer.h"
 #include "RegExpSynTreeNode.h"
 
-RegExpSyntaxTree::RegExpSyntaxTree()
+// bytes of an arena block, nodes take about a hundred bytes each.
+#define REG_EXP_ARENA_BLOCK (16 * 1024)
+
+// alignment of the memory handed out by the arena.
+#define REG_EXP_ARENA_ALIGN (16)
+
+// leaves a repetition may expand to, larger ones are counted. an expanded
+// nfa is built and matched faster for all but the largest repetitions,
+// counted ones keep a thread for every round in progress.
+#define REG_EXP_MAX_REPEAT_EXPANSION (16384)
+
+// groups and repetitions nested in a pattern, the passes over the tree
+// recurse into them, chains are walked in loops.
+#define REG_EXP_MAX_NESTING (1000)
+
+// rounds of factoring the alternatives left behind a shared prefix, each
+// round nests the tree 2 more, the parser counts them for every alternation.
+#define REG_EXP_MAX_FACTOR_LEVEL (4)
+
+RegExpSynTreeArena::RegExpSynTreeArena()
+    :block_(0), used_(0)
+{
+}
+
+RegExpSynTreeArena::~RegExpSynTreeArena()
+{
+    Clear();
+
+    for (size_t i = 0; i < blocks_.size(); ++i) delete[] blocks_[i];
+}
+
+void* RegExpSynTreeArena::Allocate(size_t size)
+{
+    size = (size + REG_EXP_ARENA_ALIGN - 1) & ~static_cast<size_t>(REG_EXP_ARENA_ALIGN - 1);
+
+    if (blocks_.empty() || used_ + size > REG_EXP_ARENA_BLOCK)
+    {
+        if (!blocks_.empty()) ++block_;
+        if (block_ == blocks_.size()) blocks_.push_back(new char[REG_EXP_ARENA_BLOCK]);
+
+        used_ = 0;
+    }
+
+    void* mem = blocks_[block_] + used_;
+    used_ += size;
+
+    return mem;
+}
+
+void RegExpSynTreeArena::Clear()
+{
+    for (size_t i = 0; i < nodes_.size(); ++i)
+    {
+        // children are in the arena too, they must not be deleted.
+        nodes_[i]->SetLeftChild(NULL);
+        nodes_[i]->SetRightChild(NULL);
+        nodes_[i]->~SynTreeNodeBase();
+    }
+
+    nodes_.clear();
+    block_ = used_ = 0;
+}
+
+RegExpSyntaxTree::RegExpSyntaxTree(bool utf8)
     :leafIndex_(0)
     ,unitCounter_(-1)
     ,tokenizer_(new RegExpTokenizer())
     ,synTreeRoot_(NULL)
 {
+    tokenizer_->SetUTF8(utf8);
 }
 
 RegExpSyntaxTree::~RegExpSyntaxTree()
 {
     delete tokenizer_;
-    if (synTreeRoot_) delete synTreeRoot_;
 }
 
 bool RegExpSyntaxTree::BuildSyntaxTree(const char* ps, const char* pe)
 {
     if (!ps || !pe || ps > pe) return false;
 
-    if (synTreeRoot_) delete synTreeRoot_;
+    synTreeRoot_ = NULL;
+    arena_.Clear();
 
     leafIndex_ = 0;
     txtStart_ = ps;
@@ -33,138 +101,685 @@ bool RegExpSyntaxTree::BuildSyntaxTree(const char* ps, const char* pe)
 #ifdef SUPPORT_REG_EXP_BACK_REFERENCE
     hasReferNode_ = false;
 #endif
+    hasCountedNode_ = false;
+    optStat_ = OptimizeStat();
 
-    synTreeRoot_ = dynamic_cast<RegExpSynTreeNode*>(ConstructSyntaxTree(ps, pe));
+    synTreeRoot_ = static_cast<RegExpSynTreeNode*>(ConstructSyntaxTree(ps, pe));
 
     return true;
 }
 
+RegExpSynTreeNode* RegExpSyntaxTree::CreateNode(RegExpSynTreeNodeType type,
+        RegExpSynTreeNode* left, RegExpSynTreeNode* right)
+{
+    RegExpSynTreeNode* node = new (arena_.Allocate(sizeof(RegExpSynTreeNode))) RegExpSynTreeNode(type);
+    arena_.Track(node);
+
+    node->SetLeftChild(left);
+    node->SetRightChild(right);
+    return node;
+}
+
+RegExpSynTreeNode* RegExpSyntaxTree::CreateStarNode(int min, int max, RegExpSynTreeNode* child)
+{
+    RegExpSynTreeNode* node = new (arena_.Allocate(sizeof(RegExpSynTreeStarNode))) RegExpSynTreeStarNode(min, max);
+    arena_.Track(node);
+
+    node->SetLeftChild(child);
+    return node;
+}
+
+RegExpSynTreeNode* RegExpSyntaxTree::CreateLeafNode(const char* ps, const char* pe)
+{
+    RegExpSynTreeNode* node = new (arena_.Allocate(sizeof(RegExpSynTreeLeafNode))) RegExpSynTreeLeafNode(ps, pe, leafIndex_);
+    arena_.Track(node);
+
+    ++leafIndex_;
+    return node;
+}
+
+RegExpSynTreeNode* RegExpSyntaxTree::CreateLeafNode(RegExpSynTreeNodeLeafNodeType type, const std::string& text)
+{
+    RegExpSynTreeNode* node = new (arena_.Allocate(sizeof(RegExpSynTreeLeafNode))) RegExpSynTreeLeafNode(type, text, leafIndex_);
+    arena_.Track(node);
+
+    ++leafIndex_;
+    return node;
+}
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+RegExpSynTreeNode* RegExpSyntaxTree::CreateRefNode(const char* ps, const char* pe)
+{
+    RegExpSynTreeNode* node = new (arena_.Allocate(sizeof(RegExpSynTreeRefNode))) RegExpSynTreeRefNode(ps, pe, leafIndex_);
+    arena_.Track(node);
+
+    ++leafIndex_;
+    return node;
+}
+#endif
+
+static int ClampSize(long long size)
+{
+    return static_cast<int>(std::min<long long>(size, INT_MAX));
+}
+
 SynTreeNodeBase* RegExpSyntaxTree::ConstructSyntaxTree(const char* ps, const char* pe)
 {
-    const char* p = ps;
-    int paren_count = 0;
+    std::vector<ParseFrame> frames(1, ParseFrame(ps, 0));
+    std::vector<RegExpSynTreeNode*> alts;
 
-    while (p < pe)
+    for (const char* p = ps; p <= pe; ++p)
     {
-        if (!tokenizer_->IsCharEscape(ps, p))
+        ParseFrame& frame = frames.back();
+
+        if (*p == '(')
         {
-            if (*p == '|' && paren_count == 0) break;
+            ++unitCounter_;
+            frames.push_back(ParseFrame(p, alts.size()));
+        }
+        else if (*p == '|')
+        {
+            // an alternative of empty groups only, eg, a|(), matches nothing to build.
+            alts.push_back(CloseAlternative(frame));
+            if (!frame.hasAtom || !alts.back()) throw LexErrException(p, "empty alternative");
 
-            paren_count += (*p == '(');
-            paren_count -= (*p == ')');
+            // sizes of the alternatives add up.
+            int size = ClampSize(static_cast<long long>(frame.doneSize) + frame.lastSize);
+            int depth = std::max(frame.doneDepth, frame.lastDepth);
 
-            if (paren_count < 0) throw LexErrException(p, "parenthesis not matched!");
+            frame = ParseFrame(frame.start, frame.altBase);
+            frame.doneSize = size;
+            frame.doneDepth = depth;
         }
+        else if (*p == ')')
+        {
+            if (frames.size() == 1) throw LexErrException(p, "parenthesis not matched!");
+
+            RegExpSynTreeNode* node = NULL;
+            int size = ClampSize(static_cast<long long>(frame.doneSize) + frame.lastSize);
+            int depth = std::max(frame.doneDepth, frame.lastDepth);
+
+            if (frame.hasAtom || alts.size() > frame.altBase)
+            {
+                if (!frame.hasAtom) throw LexErrException(p, "empty alternative");
 
-        ++p;
+                // a chain in a group is one more level, an alternation may be factored.
+                if (alts.size() > frame.altBase) depth += 1 + 2 * REG_EXP_MAX_FACTOR_LEVEL;
+                else if (frame.concat) depth += 1;
+
+                node = CloseAlternative(frame);
+                if (!node && alts.size() > frame.altBase) throw LexErrException(p, "empty alternative");
+
+                while (alts.size() > frame.altBase)
+                {
+                    node = CreateNode(RegExpSynTreeNodeType_Or, alts.back(), node);
+                    alts.pop_back();
+                }
+
+                if (node) node->SetUnit(true);
+            }
+
+            frames.pop_back();
+            AddAtom(frames.back(), node, size, depth);
+
+            if (depth > REG_EXP_MAX_NESTING) throw LexErrException(p, "groups nested too deep");
+        }
+        else if (*p == '*' || *p == '+' || *p == '?' || *p == '{')
+        {
+            if (!frame.hasAtom || frame.quantified) throw LexErrException(p, "invalid occurance of meta-character");
+
+            int min = 0, max = INT_MAX;
+            if (*p == '+')
+            {
+                min = 1;
+            }
+            else if (*p == '?')
+            {
+                max = 1;
+            }
+            else if (*p == '{')
+            {
+                const char* e = p;
+                while (e <= pe && *e != '}') ++e;
+
+                if (e > pe) throw LexErrException(p, "unmatch parenthesis:\"{\".");
+
+                tokenizer_->ExtractRepeatCount(p, e, min, max);
+                p = e;
+            }
+
+            AddRepeat(frame, min, max);
+
+            if (frame.lastDepth > REG_EXP_MAX_NESTING) throw LexErrException(p, "repetitions nested too deep");
+        }
+        else
+        {
+            const char* e = ExtractToken(p, pe);
+
+            int leaf = leafIndex_;
+            RegExpSynTreeNode* node = ConstructToken(p, e);
+
+            AddAtom(frame, node, leafIndex_ - leaf, 1);
+            p = e;
+        }
     }
 
-    if (p == pe) return ConstructSyntaxTreeImp(ps, pe);
+    if (frames.size() > 1) throw LexErrException(frames.back().start, "parenthesis not matched!");
 
-    SynTreeNodeBase* left = ConstructSyntaxTree(ps, p - 1);
-    SynTreeNodeBase* right = ConstructSyntaxTree(p + 1, pe);
+    ParseFrame& frame = frames.back();
+    if (!frame.hasAtom) throw LexErrException(pe, "empty alternative");
 
-    RegExpSynTreeNode* cat = new RegExpSynTreeNode(RegExpSynTreeNodeType_Or);
-    cat->SetLeftChild(left);
-    cat->SetRightChild(right);
+    RegExpSynTreeNode* root = CloseAlternative(frame);
+    if (!root && !alts.empty()) throw LexErrException(pe, "empty alternative");
 
-    return cat;
+    while (!alts.empty())
+    {
+        root = CreateNode(RegExpSynTreeNodeType_Or, alts.back(), root);
+        alts.pop_back();
+    }
+
+    return root;
 }
 
-SynTreeNodeBase* RegExpSyntaxTree::ConstructSyntaxTreeImp(const char* ps, const char* pe)
+const char* RegExpSyntaxTree::ExtractToken(const char* ps, const char* pe) const
 {
-    if (!ps || !pe || ps > pe) return NULL;
+    if (*ps == '\\')
+    {
+        if (ps == pe || !RegExpTokenizer::CanCharEscape(*(ps + 1)))
+        {
+            throw LexErrException(ps, "invalid escape character");
+        }
+
+        return ps + 1;
+    }
+
+    if (*ps == '[')
+    {
+        const char* p = ps + 1;
+        while (p <= pe && (*p != ']' || RegExpTokenizer::IsCharEscape(ps, p))) ++p;
+
+        if (p > pe) throw LexErrException(ps, "[] does not match!");
+        if (p == ps + 1) throw LexErrException(ps, "empty []");
+
+        return p;
+    }
 
-    const char* te = tokenizer_->IsToken(ps, pe);
-    if (te)
+    if (*ps == ']' || *ps == '}')
     {
+        throw LexErrException(ps, "unmatch parenthesis:\"(\", \"{\", or \"[\".");
+    }
+
+    // the whole multi-byte char is the token in utf-8 mode.
+    if (tokenizer_->IsUTF8())
+    {
+        int len = RegExpTokenizer::GetUTF8Length(ps, pe);
+        if (len > 1) return ps + len - 1;
+    }
+
+    return ps;
+}
+
+RegExpSynTreeNode* RegExpSyntaxTree::ConstructToken(const char* ps, const char* pe)
+{
 #ifdef  SUPPORT_REG_EXP_BACK_REFERENCE
-        if (tokenizer_->IsRefToken(ps))
-        {
-            int co = *(ps + 1) - '0';
-            if (std::isdigit(*(ps + 2))) co = co * 10 + *(ps + 2);
+    if (RegExpTokenizer::IsRefToken(ps))
+    {
+        int co = *(ps + 1) - '0';
+        if (co > unitCounter_) throw LexErrException(ps, "invalid back reference number, out of range");
+
+        hasReferNode_ = true;
+        return CreateRefNode(ps, pe);
+    }
+#endif
+    RegExpSynTreeNode* un = tokenizer_->IsUTF8()? ConstructUTF8Token(ps, pe) : NULL;
+    if (un) return un;
+
+    return CreateLeafNode(ps, pe);
+}
+
+// "()" comes as a NULL atom, it leaves the concatenation as it is.
+void RegExpSyntaxTree::AddAtom(ParseFrame& frame, RegExpSynTreeNode* atom, int size, int depth)
+{
+    if (frame.last)
+    {
+        frame.concat = frame.concat? CreateNode(RegExpSynTreeNodeType_Concat, frame.concat, frame.last) : frame.last;
+    }
 
-            if (co > unitCounter_) throw LexErrException(ps, "invalid back reference number, out of range");
+    frame.last = atom;
+    frame.doneSize = ClampSize(static_cast<long long>(frame.doneSize) + frame.lastSize);
+    frame.lastSize = size;
+    frame.doneDepth = std::max(frame.doneDepth, frame.lastDepth);
+    frame.lastDepth = depth;
+    frame.hasAtom = true;
+    frame.quantified = false;
+}
+
+// the nfa takes a copy of the atom for every round up to max, or to min
+// for unbounded ones. a repetition of too many copies is counted instead.
+void RegExpSyntaxTree::AddRepeat(ParseFrame& frame, int min, int max)
+{
+    frame.quantified = true;
 
-            hasReferNode_ = true;
-            return new RegExpSynTreeRefNode(ps, te, leafIndex_++);
+    // a quantifier on an empty group is dropped.
+    if (!frame.last) return;
+
+    RegExpSynTreeNode* node = CreateStarNode(min, max, frame.last);
+
+    long long copy = (max == INT_MAX)? std::max(min, 1) : max;
+    long long size = copy * frame.lastSize;
+
+    if (size > REG_EXP_MAX_REPEAT_EXPANSION && copy > 1)
+    {
+        // one copy, and another for the unbounded tail.
+        node->AsStarNode()->SetCounted(true);
+        hasCountedNode_ = true;
+        size = 2LL * frame.lastSize;
+    }
+
+    frame.last = node;
+    frame.lastSize = ClampSize(size);
+    frame.lastDepth += 1;
+}
+
+RegExpSynTreeNode* RegExpSyntaxTree::CloseAlternative(ParseFrame& frame)
+{
+    if (!frame.last) return frame.concat;
+    if (!frame.concat) return frame.last;
+
+    return CreateNode(RegExpSynTreeNodeType_Concat, frame.concat, frame.last);
+}
+
+void RegExpSyntaxTree::SplitChain(RegExpSynTreeNode* node, RegExpSynTreeNodeType type,
+        std::vector<RegExpSynTreeNode*>& nodes)
+{
+    std::vector<RegExpSynTreeNode*> stack(1, node);
+    while (!stack.empty())
+    {
+        RegExpSynTreeNode* n = stack.back();
+        stack.pop_back();
+
+        if (n->GetNodeType() == type && !n->IsUnit())
+        {
+            stack.push_back(n->GetRightNode());
+            stack.push_back(n->GetLeftNode());
+        }
+        else
+        {
+            nodes.push_back(n);
         }
+    }
+}
+
+// sorted chars of a leaf taking one char, empty for other nodes and groups.
+static std::string GetCharSet(const RegExpSynTreeNode* node)
+{
+    const RegExpSynTreeLeafNode* ln = node->AsLeafNode();
+    if (!ln || node->IsUnit()) return std::string();
+
+    const std::string& txt = ln->GetNodeText();
+    RegExpSynTreeNodeLeafNodeType lt = ln->GetLeafNodeType();
+
+    std::string chars;
+    if (lt == RegExpSynTreeNodeLeafNodeType_Norm)
+    {
+        chars = txt.substr(0, 1);
+    }
+    else if (lt == RegExpSynTreeNodeLeafNodeType_Esc || lt == RegExpSynTreeNodeLeafNodeType_Alt)
+    {
+        chars = txt;
+    }
+
+    std::sort(chars.begin(), chars.end());
+    chars.erase(std::unique(chars.begin(), chars.end()), chars.end());
+    return chars;
+}
+
+// the only text a leaf matches, empty if it is not a plain string.
+static std::string GetLiteral(const RegExpSynTreeNode* node)
+{
+    const RegExpSynTreeLeafNode* ln = node->AsLeafNode();
+    if (!ln || node->IsUnit()) return std::string();
+
+    if (ln->GetLeafNodeType() == RegExpSynTreeNodeLeafNodeType_Str) return ln->GetNodeText();
+
+    std::string chars = GetCharSet(node);
+    return chars.size() == 1? chars : std::string();
+}
+
+// min of 0 or 1, max of 1 or unbounded, a star of two such is one star.
+static bool IsSimpleRepeat(const RegExpSynTreeStarNode* sn)
+{
+    int max = sn->GetMaxRepeat();
+    return !sn->IsCounted() && sn->GetMinRepeat() <= 1 && (max == 1 || max == INT_MAX);
+}
+
+void RegExpSyntaxTree::Optimize(bool keepGroups)
+{
+    optStat_ = OptimizeStat();
+    if (!synTreeRoot_) return;
+
+    optStat_.before = CountNodes();
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    // references are numbered by the groups.
+    keepGroups = keepGroups || hasReferNode_;
 #endif
-        return new RegExpSynTreeLeafNode(ps, te, leafIndex_++);
+    std::vector<RegExpSynTreeNode*> stack;
+    if (!keepGroups) stack.push_back(synTreeRoot_);
+
+    while (!stack.empty())
+    {
+        RegExpSynTreeNode* node = stack.back();
+        stack.pop_back();
+
+        node->ClearUnit();
+        if (node->GetLeftNode()) stack.push_back(node->GetLeftNode());
+        if (node->GetRightNode()) stack.push_back(node->GetRightNode());
+    }
+
+    // literals are folded last, factoring looks at the chars one by one.
+    synTreeRoot_ = OptimizeNode(synTreeRoot_);
+    synTreeRoot_ = FoldLiteral(synTreeRoot_);
+
+    optStat_.after = CountNodes();
+}
+
+int RegExpSyntaxTree::CountNodes() const
+{
+    int num = 0;
+    std::vector<RegExpSynTreeNode*> stack;
+    if (synTreeRoot_) stack.push_back(synTreeRoot_);
+
+    while (!stack.empty())
+    {
+        RegExpSynTreeNode* node = stack.back();
+        stack.pop_back();
+
+        ++num;
+        if (node->GetLeftNode()) stack.push_back(node->GetLeftNode());
+        if (node->GetRightNode()) stack.push_back(node->GetRightNode());
+    }
+
+    return num;
+}
+
+RegExpSynTreeNode* RegExpSyntaxTree::JoinNodes(RegExpSynTreeNodeType type,
+        const std::vector<RegExpSynTreeNode*>& nodes, size_t begin, size_t end)
+{
+    assert(begin < end);
+
+    // same shape as the parser gives, concatenation left-deep, alternation right-deep.
+    RegExpSynTreeNode* ret = NULL;
+    if (type == RegExpSynTreeNodeType_Concat)
+    {
+        ret = nodes[begin];
+        for (size_t i = begin + 1; i < end; ++i) ret = CreateNode(type, ret, nodes[i]);
+    }
+    else
+    {
+        ret = nodes[end - 1];
+        for (size_t i = end - 1; i > begin; --i) ret = CreateNode(type, nodes[i - 1], ret);
     }
 
-    bool is_parenthesis_unit = false;
-    const char* us = NULL, *ue = NULL; // unit start, unit end
-    const char* before_unit = NULL, *after_unit = NULL;
+    return ret;
+}
+
+// a chain of concatenation or alternation is rewritten as a whole, chains
+// are long, groups and stars are the only nesting to recurse into.
+RegExpSynTreeNode* RegExpSyntaxTree::OptimizeNode(RegExpSynTreeNode* node)
+{
+    RegExpSynTreeNodeType type = node->GetNodeType();
 
-    tokenizer_->ExtractRegUnit(ps, pe, us, ue, before_unit, after_unit);
-    is_parenthesis_unit = (*(before_unit + 1) == '(');
+    if (type == RegExpSynTreeNodeType_Leaf) return node;
+    if (type == RegExpSynTreeNodeType_Star) return OptimizeStar(node);
 
-    SynTreeNodeBase* left = NULL, *right = NULL;
-    if (before_unit >= ps)
+    std::vector<RegExpSynTreeNode*> nodes;
+    SplitChain(node->GetLeftNode(), type, nodes);
+    SplitChain(node->GetRightNode(), type, nodes);
+
+    bool changed = false;
+    for (size_t i = 0; i < nodes.size(); ++i)
     {
-        left = ConstructSyntaxTreeImp(ps, before_unit);
+        RegExpSynTreeNode* n = OptimizeNode(nodes[i]);
+
+        changed = changed || n != nodes[i];
+        nodes[i] = n;
+    }
+
+    RegExpSynTreeNode* ret = node;
+    if (type == RegExpSynTreeNodeType_Or)
+    {
+        ret = OptimizeAlternation(nodes, 0);
+    }
+    else if (changed)
+    {
+        ret = JoinNodes(type, nodes, 0, nodes.size());
+    }
+
+    if (ret != node) ret->CopyUnit(node);
+    return ret;
+}
+
+RegExpSynTreeNode* RegExpSyntaxTree::OptimizeStar(RegExpSynTreeNode* node)
+{
+    RegExpSynTreeStarNode* sn = node->AsStarNode();
+    assert(sn);
+
+    RegExpSynTreeNode* child = OptimizeNode(sn->GetLeftNode());
+    sn->SetLeftChild(child);
+
+    RegExpSynTreeStarNode* cn = child->AsStarNode();
+    if (!cn || child->IsUnit() || !IsSimpleRepeat(sn) || !IsSimpleRepeat(cn)) return node;
+
+    // (a+)? and (a?)+ are a*, (a?)? is a?, (a+)+ is a+.
+    int min = sn->GetMinRepeat() * cn->GetMinRepeat();
+    int max = (sn->GetMaxRepeat() == INT_MAX || cn->GetMaxRepeat() == INT_MAX)? INT_MAX : 1;
+
+    RegExpSynTreeNode* ret = CreateStarNode(min, max, cn->GetLeftNode());
+    ret->CopyUnit(node);
+
+    return ret;
+}
+
+// only alternatives next to each other are joined, the order of the
+// alternatives is the priority of the vms. level is the rounds of factoring
+// done above.
+RegExpSynTreeNode* RegExpSyntaxTree::OptimizeAlternation(const std::vector<RegExpSynTreeNode*>& alts, int level)
+{
+    std::vector<RegExpSynTreeNode*> factored;
+
+    size_t i = 0;
+    while (i < alts.size())
+    {
+        std::vector<std::vector<RegExpSynTreeNode*> > seqs(1);
+        SplitChain(alts[i], RegExpSynTreeNodeType_Concat, seqs[0]);
+
+        // leading chars shared by the alternatives from i on, something
+        // is left behind them in every one.
+        size_t prefix = 0;
+        while (level < REG_EXP_MAX_FACTOR_LEVEL && prefix + 1 < seqs[0].size()
+                && !GetCharSet(seqs[0][prefix]).empty()) ++prefix;
+
+        for (size_t j = i + 1; j < alts.size() && prefix > 0; ++j)
+        {
+            std::vector<RegExpSynTreeNode*> seq;
+            SplitChain(alts[j], RegExpSynTreeNodeType_Concat, seq);
+
+            size_t k = 0;
+            while (k < prefix && k + 1 < seq.size() && GetCharSet(seq[k]) == GetCharSet(seqs[0][k])) ++k;
+
+            if (k == 0) break;
+
+            prefix = k;
+            seqs.push_back(seq);
+        }
+
+        if (seqs.size() == 1)
+        {
+            factored.push_back(alts[i++]);
+            continue;
+        }
+
+        std::vector<RegExpSynTreeNode*> rest;
+        for (size_t j = 0; j < seqs.size(); ++j)
+        {
+            rest.push_back(JoinNodes(RegExpSynTreeNodeType_Concat, seqs[j], prefix, seqs[j].size()));
+        }
+
+        RegExpSynTreeNode* head = JoinNodes(RegExpSynTreeNodeType_Concat, seqs[0], 0, prefix);
+        factored.push_back(CreateNode(RegExpSynTreeNodeType_Concat, head, OptimizeAlternation(rest, level + 1)));
+
+        i += seqs.size();
     }
 
-    if (is_parenthesis_unit)
+    std::vector<RegExpSynTreeNode*> merged;
+    for (i = 0; i < factored.size(); ++i)
     {
-        ++unitCounter_;
-        right = ConstructSyntaxTree(us, ue);
+        std::string chars = GetCharSet(factored[i]);
 
-        if (right)
+        size_t j = i + 1;
+        while (!chars.empty() && j < factored.size() && !GetCharSet(factored[j]).empty())
         {
-            RegExpSynTreeNode* rn = dynamic_cast<RegExpSynTreeNode*>(right);
-            rn->SetUnit(true);
+            chars += GetCharSet(factored[j++]);
         }
+
+        if (j == i + 1)
+        {
+            merged.push_back(factored[i]);
+            continue;
+        }
+
+        std::sort(chars.begin(), chars.end());
+        chars.erase(std::unique(chars.begin(), chars.end()), chars.end());
+
+        merged.push_back(CreateLeafNode(RegExpSynTreeNodeLeafNodeType_Alt, chars));
+        i = j - 1;
     }
-    else
+
+    return JoinNodes(RegExpSynTreeNodeType_Or, merged, 0, merged.size());
+}
+
+RegExpSynTreeNode* RegExpSyntaxTree::FoldLiteral(RegExpSynTreeNode* node)
+{
+    RegExpSynTreeNodeType type = node->GetNodeType();
+
+    if (type == RegExpSynTreeNodeType_Leaf) return node;
+
+    if (type == RegExpSynTreeNodeType_Star)
     {
-        right = ConstructSyntaxTreeImp(us, ue);
+        node->SetLeftChild(FoldLiteral(node->GetLeftNode()));
+        return node;
     }
 
-    if (after_unit <= pe && right)
+    std::vector<RegExpSynTreeNode*> nodes;
+    SplitChain(node->GetLeftNode(), type, nodes);
+    SplitChain(node->GetRightNode(), type, nodes);
+
+    bool changed = false;
+    for (size_t i = 0; i < nodes.size(); ++i)
     {
-        int min = -1, max = -1;
+        RegExpSynTreeNode* n = FoldLiteral(nodes[i]);
 
-        if (!tokenizer_->IsCharEscape(ps, after_unit)) // *(after_unit - 1) != '\\')
+        changed = changed || n != nodes[i];
+        nodes[i] = n;
+    }
+
+    if (type == RegExpSynTreeNodeType_Concat)
+    {
+        std::vector<RegExpSynTreeNode*> folded;
+        for (size_t i = 0; i < nodes.size(); ++i)
         {
-            if (*after_unit == '*')
-            {
-                min = 0;
-                max = INT_MAX;
-            }
-            else if (*after_unit == '+')
-            {
-                min = 1;
-                max = INT_MAX;
-            }
-            else if (*after_unit == '?')
+            std::string txt = GetLiteral(nodes[i]);
+
+            size_t j = i + 1;
+            while (!txt.empty() && j < nodes.size() && !GetLiteral(nodes[j]).empty())
             {
-                min = 0;
-                max = 1;
+                txt += GetLiteral(nodes[j++]);
             }
-            else if (*after_unit == '{')
+
+            if (j == i + 1)
             {
-                tokenizer_->ExtractRepeatCount(after_unit, pe, min, max);
+                folded.push_back(nodes[i]);
+                continue;
             }
+
+            folded.push_back(CreateLeafNode(RegExpSynTreeNodeLeafNodeType_Str, txt));
+            i = j - 1;
         }
 
-        if (min >= 0)
+        changed = changed || folded.size() < nodes.size();
+        nodes.swap(folded);
+    }
+
+    if (!changed) return node;
+
+    RegExpSynTreeNode* ret = JoinNodes(type, nodes, 0, nodes.size());
+    ret->CopyUnit(node);
+
+    return ret;
+}
+
+RegExpSynTreeNode* RegExpSyntaxTree::ConstructUTF8Token(const char* ps, const char* pe)
+{
+    std::vector<std::pair<int, int> > ranges;
+
+    if (*ps == '.' && ps == pe)
+    {
+        ranges.push_back(std::make_pair(0, REG_EXP_UTF8_MAX));
+    }
+    else if (*ps == '[' && ps < pe)
+    {
+        RegExpTokenizer::ConstructOptionRange(ps + 1, pe - 1, ranges);
+
+        // ascii only, same as the byte leaf.
+        if (!ranges.empty() && ranges.back().second < 0x80) return NULL;
+    }
+    else if (ps < pe && *ps != '\\')
+    {
+        // multi-byte char, its bytes in a row.
+        RegExpSynTreeNode* ret = NULL;
+        for (const char* p = ps; p <= pe; ++p)
         {
-            RegExpSynTreeNode* sn = new RegExpSynTreeStarNode(min, max);
-            sn->SetLeftChild(right);
-            right = sn;
+            RegExpSynTreeNode* ln = CreateLeafNode(RegExpSynTreeNodeLeafNodeType_Norm, std::string(p, 1));
+            ret = ret? CreateNode(RegExpSynTreeNodeType_Concat, ret, ln) : ln;
         }
+
+        return ret;
+    }
+    else
+    {
+        return NULL;
     }
 
-    if (!left) return right;
-    if (!right) return left;
+    return ConstructUTF8Range(ranges);
+}
 
-    RegExpSynTreeNodeType type = RegExpSynTreeNodeType_Concat;
-    RegExpSynTreeNode* cat_node = new RegExpSynTreeNode(type);
+// alternation of the byte sequences of the codepoint ranges.
+RegExpSynTreeNode* RegExpSyntaxTree::ConstructUTF8Range(const std::vector<std::pair<int, int> >& ranges)
+{
+    std::vector<RegExpUTF8Sequence> seq;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        RegExpTokenizer::ConstructUTF8Sequence(ranges[i].first, ranges[i].second, seq);
+    }
 
-    cat_node->SetLeftChild(left);
-    cat_node->SetRightChild(right);
-    return cat_node;
-}
+    if (seq.empty()) throw LexErrException(txtStart_, "[] matches nothing in utf-8 mode:");
 
+    RegExpSynTreeNode* ret = NULL;
+    for (size_t i = 0; i < seq.size(); ++i)
+    {
+        RegExpSynTreeNode* sn = NULL;
+        for (int j = 0; j < seq[i].len; ++j)
+        {
+            std::string txt;
+            for (int ch = seq[i].lo[j]; ch <= seq[i].hi[j]; ++ch) txt.push_back(ch);
+
+            RegExpSynTreeNode* ln = CreateLeafNode(RegExpSynTreeNodeLeafNodeType_Alt, txt);
+            sn = sn? CreateNode(RegExpSynTreeNodeType_Concat, sn, ln) : ln;
+        }
+
+        ret = ret? CreateNode(RegExpSynTreeNodeType_Or, ret, sn) : sn;
+    }
+
+    return ret;
+}
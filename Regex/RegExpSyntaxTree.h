@@ -1,29 +1,171 @@
 #ifndef REG_EXP_SYNTAX_TREE_H_
 #define REG_EXP_SYNTAX_TREE_H_
 
+#include <string>
 #include <vector>
+#include "Basic/NonCopyable.h"
 #include "Parsing/SyntaxTreeBase.h"
 #include "RegExpSynTreeNode.h"
 
 class RegExpTokenizer;
 
+/*
+   memory of the nodes of a tree, taken from large blocks one after another.
+   the nodes are destroyed all together, the blocks are kept for the next tree.
+*/
+class RegExpSynTreeArena: public NonCopyable
+{
+    public:
+
+        RegExpSynTreeArena();
+        ~RegExpSynTreeArena();
+
+        void* Allocate(size_t size);
+
+        // node constructed in memory of Allocate(), destroyed by Clear().
+        void Track(SynTreeNodeBase* node) { nodes_.push_back(node); }
+        void Clear();
+
+    private:
+
+        size_t block_; // block in use
+        size_t used_;  // bytes of it taken
+
+        std::vector<char*> blocks_;
+        std::vector<SynTreeNodeBase*> nodes_;
+};
+
+/*
+   the pattern is parsed in one pass from left to right, open groups are kept
+   on a stack of their own, so the time is linear and deep nesting takes no
+   deep recursion.
+
+   concatenation is left-deep, "abc" is ((a b) c), alternation is right-deep,
+   "a|b|c" is (a | (b | c)). a group marks the node of its content as a unit,
+   "((ab))" is one node of 2 units, an empty group gives no node.
+
+   the passes over the tree walk a chain of concatenation or alternation in
+   a loop, see SplitChain(), and recurse into groups and repetitions only.
+   the parser rejects a pattern nesting those too deep, so no pass runs out
+   of stack, chains may be as long as the pattern.
+
+   Optimize() rewrites the tree in place into one of fewer nodes and nfa
+   states, matching the same text:
+   1. (a*)*, (a+)?, (a?)+ collapse into a single star.
+   2. alternatives next to each other sharing leading chars are factored,
+      "abc|abd" is "ab(c|d)".
+   3. single chars next to each other in an alternation merge into a class,
+      "c|d" is "[cd]".
+   4. plain chars in a row fold into one leaf of the string, "abc" is "abc"
+      as a single RegExpSynTreeNodeLeafNodeType_Str leaf.
+   the nodes of groups are never merged into others, dropping the groups
+   first lets more of the tree be rewritten, for callers that need no capture.
+   machines build the tree as it is given, the caller opts in by calling
+   Optimize() before, as only it knows whether the groups are needed.
+*/
 class RegExpSyntaxTree: public SyntaxTreeBase
 {
     public:
 
-        RegExpSyntaxTree();
+        explicit RegExpSyntaxTree(bool utf8 = false);
         ~RegExpSyntaxTree();
 
         bool BuildSyntaxTree(const char* ps, const char* pe);
 #ifdef SUPPORT_REG_EXP_BACK_REFERENCE
         bool HasRefNode() const { return hasReferNode_; }
 #endif
+        // some repetition is too large to expand, see RegExpSynTreeStarNode::IsCounted().
+        bool HasCountedNode() const { return hasCountedNode_; }
         virtual int GetNodeNumber() const { return leafIndex_ + 1; }
         virtual SynTreeNodeBase* GetSynTree() const { return synTreeRoot_; }
+        RegExpSynTreeNode* GetRoot() const { return synTreeRoot_; }
+
+        struct OptimizeStat
+        {
+            OptimizeStat(): before(0), after(0) {}
+
+            int before; // nodes before the last Optimize()
+            int after;  // nodes after it
+        };
+
+        // groups are dropped unless keepGroups, or the pattern has back reference.
+        // the nfa states before and after are what RegExpNFA::BuildMachine() returns.
+        void Optimize(bool keepGroups = true);
+        const OptimizeStat& GetOptimizeStat() const { return optStat_; }
+
+        // nodes of the tree as it is now.
+        int  CountNodes() const;
+
+        // nodes of the chain of the given type under node, from left to right.
+        // a group ends the chain, its node is taken as a whole.
+        static void SplitChain(RegExpSynTreeNode* node, RegExpSynTreeNodeType type,
+                std::vector<RegExpSynTreeNode*>& nodes);
+
     private:
 
+        // an open group, or the whole pattern at the bottom of the stack.
+        struct ParseFrame
+        {
+            ParseFrame(const char* p, size_t base)
+                :start(p), altBase(base), concat(NULL), last(NULL)
+                ,doneSize(0), lastSize(0), doneDepth(0), lastDepth(0)
+                ,hasAtom(false), quantified(false)
+            {
+            }
+
+            const char* start; // the '('
+            size_t altBase;    // alternatives done are alts[altBase, end)
+
+            RegExpSynTreeNode* concat; // atoms before the last one
+            RegExpSynTreeNode* last;   // quantifiers apply to it
+
+            // leaves the nfa gets once repetitions are expanded, of the
+            // alternatives and atoms before last, and of last.
+            int doneSize;
+            int lastSize;
+
+            // nesting of groups and repetitions, the same way.
+            int doneDepth;
+            int lastDepth;
+
+            bool hasAtom;      // "()" is an atom giving no node
+            bool quantified;
+        };
+
         virtual SynTreeNodeBase* ConstructSyntaxTree(const char* ps, const char* pe);
-        virtual SynTreeNodeBase* ConstructSyntaxTreeImp(const char* ps, const char* pe);
+
+        // leaf of the token [ps, pe].
+        RegExpSynTreeNode* ConstructToken(const char* ps, const char* pe);
+
+        // end of the token starting at ps.
+        const char* ExtractToken(const char* ps, const char* pe) const;
+
+        void AddAtom(ParseFrame& frame, RegExpSynTreeNode* atom, int size, int depth);
+        void AddRepeat(ParseFrame& frame, int min, int max);
+        RegExpSynTreeNode* CloseAlternative(ParseFrame& frame);
+
+        // passes of Optimize(), each returns the node to replace the given one.
+        RegExpSynTreeNode* OptimizeNode(RegExpSynTreeNode* node);
+        RegExpSynTreeNode* OptimizeStar(RegExpSynTreeNode* node);
+        RegExpSynTreeNode* OptimizeAlternation(const std::vector<RegExpSynTreeNode*>& alts, int level);
+        RegExpSynTreeNode* FoldLiteral(RegExpSynTreeNode* node);
+
+        // nodes[begin, end) joined by concatenation or alternation.
+        RegExpSynTreeNode* JoinNodes(RegExpSynTreeNodeType type,
+                const std::vector<RegExpSynTreeNode*>& nodes, size_t begin, size_t end);
+
+        // multi-byte char, . and [] in utf-8 mode, NULL if the token is a plain byte token.
+        RegExpSynTreeNode* ConstructUTF8Token(const char* ps, const char* pe);
+        RegExpSynTreeNode* ConstructUTF8Range(const std::vector<std::pair<int, int> >& ranges);
+
+        RegExpSynTreeNode* CreateNode(RegExpSynTreeNodeType type,
+                RegExpSynTreeNode* left, RegExpSynTreeNode* right);
+        RegExpSynTreeNode* CreateStarNode(int min, int max, RegExpSynTreeNode* child);
+        RegExpSynTreeNode* CreateLeafNode(const char* ps, const char* pe);
+        RegExpSynTreeNode* CreateLeafNode(RegExpSynTreeNodeLeafNodeType type, const std::string& text);
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+        RegExpSynTreeNode* CreateRefNode(const char* ps, const char* pe);
+#endif
 
     private:
 
@@ -32,11 +174,16 @@ class RegExpSyntaxTree: public SyntaxTreeBase
 #ifdef SUPPORT_REG_EXP_BACK_REFERENCE
         bool  hasReferNode_;
 #endif
+        bool hasCountedNode_;
+
         const char* txtEnd_;
         const char* txtStart_;
 
         RegExpTokenizer* tokenizer_;
         RegExpSynTreeNode* synTreeRoot_;
+
+        OptimizeStat optStat_;
+        RegExpSynTreeArena arena_;
 };
 
 #endif
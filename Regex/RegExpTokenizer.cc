@@ -4,8 +4,14 @@
 #include <string>
 #include <limits.h>
 #include <assert.h>
+#include <algorithm>
 #include "Parsing/LexException.h"
 
+RegExpTokenizer::RegExpTokenizer()
+    :utf8_(false)
+{
+}
+
 bool RegExpTokenizer::IsCharEscape(const char* ps, const char* pc)
 {
     const char* p = pc - 1;
@@ -85,6 +91,8 @@ const char* RegExpTokenizer::IsToken(const char* s, const char* e) const
 
     if (IsPlaceHolderMetaChar(*s) && s == e) return s;
 
+    if (utf8_ && s < e && GetUTF8Length(s, e) == e - s + 1) return e;
+
     if (s < e) return NULL;
 
     if (IsRegExpMetaChar(*s)) return NULL;
@@ -263,6 +271,16 @@ void RegExpTokenizer::ExtractRegUnit(const char* ps, const char* pe,
     {
         us = p;
         bu = p - 1;
+
+        // the whole multi-byte char is the unit in utf-8 mode.
+        const char* lead = p;
+        while (utf8_ && lead > ps && lead > p - 3 && (static_cast<unsigned char>(*lead) & 0xc0) == 0x80) --lead;
+
+        if (lead < p && GetUTF8Length(lead, p) == p - lead + 1)
+        {
+            us = lead;
+            bu = lead - 1;
+        }
     }
 
     return;
@@ -311,7 +329,7 @@ std::string RegExpTokenizer::ConstructOptionString(const char* s, const char* e)
     bool is_negate = (*p == '^');
 
     std::string ret;
-    std::vector<short> sel(REG_EXP_CHAR_MAX, 0);
+    std::vector<short> sel(REG_EXP_CHAR_EPSILON, 0);
 
     ret.reserve(2 * (e - s));
     if (!is_negate)
@@ -321,13 +339,14 @@ std::string RegExpTokenizer::ConstructOptionString(const char* s, const char* e)
             if (*p == '-' && (p > s && p < e))
             {
                 // [a-h]
-                if (*(p - 1) > *(p + 1))
+                unsigned char lo = *(p - 1), hi = *(p + 1);
+                if (lo > hi)
                 {
                     throw LexErrException(std::string(s, e - s + 1).c_str(),
                             "range values reversed in []:");
                 }
 
-                for (short j = *(p - 1); j <= *(p + 1); ++j)
+                for (short j = lo; j <= hi; ++j)
                 {
                     sel[j] = 1;
                 }
@@ -339,13 +358,13 @@ std::string RegExpTokenizer::ConstructOptionString(const char* s, const char* e)
                     ++p;
                 }
 
-                sel[*p] = 1;
+                sel[static_cast<unsigned char>(*p)] = 1;
             }
 
             ++p;
         }
 
-        for (short i = 1; i < REG_EXP_CHAR_MAX - 1; ++i)
+        for (short i = 0; i < REG_EXP_CHAR_EPSILON; ++i)
         {
             if (!sel[i]) continue;
 
@@ -360,13 +379,14 @@ std::string RegExpTokenizer::ConstructOptionString(const char* s, const char* e)
         {
             if (*p == '-' && (p > s && p < e))
             {
-                if (*(p - 1) > *(p + 1))
+                unsigned char lo = *(p - 1), hi = *(p + 1);
+                if (lo > hi)
                 {
                     throw LexErrException(std::string(s, e - s + 1).c_str(),
                             "range values reversed in []:");
                 }
 
-                for (short j = *(p - 1); j <= *(p + 1); ++j)
+                for (short j = lo; j <= hi; ++j)
                 {
                     sel[j] = 1;
                 }
@@ -378,13 +398,13 @@ std::string RegExpTokenizer::ConstructOptionString(const char* s, const char* e)
                     ++p;
                 }
 
-                sel[*p] = 1;
+                sel[static_cast<unsigned char>(*p)] = 1;
             }
 
             ++p;
         }
 
-        for (short i = 1; i < REG_EXP_CHAR_MAX - 1; ++i)
+        for (short i = 0; i < REG_EXP_CHAR_EPSILON; ++i)
         {
             if (sel[i]) continue;
 
@@ -395,3 +415,207 @@ std::string RegExpTokenizer::ConstructOptionString(const char* s, const char* e)
     return ret;
 }
 
+static int DecodeUTF8(const char* s, int len)
+{
+    static const unsigned char lead_mask[] = { 0, 0x7f, 0x1f, 0x0f, 0x07 };
+
+    int cp = static_cast<unsigned char>(*s) & lead_mask[len];
+    for (int i = 1; i < len; ++i) cp = (cp << 6) | (static_cast<unsigned char>(s[i]) & 0x3f);
+
+    return cp;
+}
+
+static int EncodeUTF8(int cp, unsigned char* out)
+{
+    if (cp < 0x80)
+    {
+        out[0] = cp;
+        return 1;
+    }
+
+    int len = (cp < 0x800)? 2 : ((cp < 0x10000)? 3 : 4);
+    for (int i = len - 1; i > 0; --i)
+    {
+        out[i] = 0x80 | (cp & 0x3f);
+        cp >>= 6;
+    }
+
+    static const unsigned char lead_bits[] = { 0, 0, 0xc0, 0xe0, 0xf0 };
+    out[0] = lead_bits[len] | cp;
+
+    return len;
+}
+
+// overlong forms, surrogates and codepoints above REG_EXP_UTF8_MAX are not well formed.
+int RegExpTokenizer::GetUTF8Length(const char* s, const char* e)
+{
+    unsigned char c = *s;
+
+    int len = 0;
+    unsigned char lo = 0x80, hi = 0xbf; // range of the second byte
+
+    if (c < 0x80) return 1;
+    else if (c >= 0xc2 && c <= 0xdf) len = 2;
+    else if (c >= 0xe0 && c <= 0xef) len = 3;
+    else if (c >= 0xf0 && c <= 0xf4) len = 4;
+    else return 0;
+
+    if (c == 0xe0) lo = 0xa0;
+    else if (c == 0xed) hi = 0x9f;
+    else if (c == 0xf0) lo = 0x90;
+    else if (c == 0xf4) hi = 0x8f;
+
+    if (e - s + 1 < len) return 0;
+
+    unsigned char c1 = s[1];
+    if (c1 < lo || c1 > hi) return 0;
+
+    for (int i = 2; i < len; ++i)
+    {
+        if ((static_cast<unsigned char>(s[i]) & 0xc0) != 0x80) return 0;
+    }
+
+    return len;
+}
+
+// same syntax as ConstructOptionString(), with codepoints in place of chars.
+void RegExpTokenizer::ConstructOptionRange(const char* s, const char* e, std::vector<std::pair<int, int> >& ranges)
+{
+    const char* p = s;
+    bool is_negate = (*p == '^');
+
+    if (is_negate) ++p;
+
+    // codepoints of the text, '-' between two of them stands for the range.
+    const char* begin = p;
+    std::vector<int> cp;
+    std::vector<char> isRange;
+
+    while (p <= e)
+    {
+        if (*p == '-' && p > begin && p < e)
+        {
+            cp.push_back('-');
+            isRange.push_back(1);
+            ++p;
+            continue;
+        }
+
+        if (p < e - 1 && *p == '\\' && *(p + 1) == '-') ++p;
+
+        int len = GetUTF8Length(p, e);
+        if (!len) throw LexErrException(p, "invalid utf-8 char in []:");
+
+        cp.push_back(DecodeUTF8(p, len));
+        isRange.push_back(0);
+        p += len;
+    }
+
+    std::vector<std::pair<int, int> > sel;
+    for (size_t i = 0; i < cp.size(); ++i)
+    {
+        if (!isRange[i] || isRange[i - 1] || i + 1 == cp.size() || isRange[i + 1])
+        {
+            sel.push_back(std::make_pair(cp[i], cp[i]));
+            continue;
+        }
+
+        if (cp[i - 1] > cp[i + 1])
+        {
+            throw LexErrException(std::string(s, e - s + 1).c_str(),
+                    "range values reversed in []:");
+        }
+
+        sel.push_back(std::make_pair(cp[i - 1], cp[i + 1]));
+    }
+
+    std::sort(sel.begin(), sel.end());
+
+    ranges.clear();
+    for (size_t i = 0; i < sel.size(); ++i)
+    {
+        if (!ranges.empty() && sel[i].first <= ranges.back().second + 1)
+        {
+            ranges.back().second = std::max(ranges.back().second, sel[i].second);
+            continue;
+        }
+
+        ranges.push_back(sel[i]);
+    }
+
+    if (!is_negate) return;
+
+    // as [^] on bytes, 0 is selected unless listed, the same as '.'.
+    std::vector<std::pair<int, int> > neg;
+
+    int next = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        if (ranges[i].first > next) neg.push_back(std::make_pair(next, ranges[i].first - 1));
+
+        next = std::max(next, ranges[i].second + 1);
+    }
+
+    if (next <= REG_EXP_UTF8_MAX) neg.push_back(std::make_pair(next, REG_EXP_UTF8_MAX));
+
+    ranges.swap(neg);
+}
+
+/*
+   [lo, hi] is split until both ends take the same number of bytes, and the
+   bytes behind the first differing one cover all the continuation bytes.
+   every piece is then one sequence of byte ranges, eg,
+   [0x80, 0xfff] is [c2-df][80-bf], [e0][a0-bf][80-bf].
+*/
+void RegExpTokenizer::ConstructUTF8Sequence(int lo, int hi, std::vector<RegExpUTF8Sequence>& seq)
+{
+    if (lo < 0xd800 && hi > 0xdfff)
+    {
+        ConstructUTF8Sequence(lo, 0xd7ff, seq);
+        ConstructUTF8Sequence(0xe000, hi, seq);
+        return;
+    }
+
+    if (lo >= 0xd800 && lo <= 0xdfff) lo = 0xe000;
+    if (hi >= 0xd800 && hi <= 0xdfff) hi = 0xd7ff;
+    if (hi > REG_EXP_UTF8_MAX) hi = REG_EXP_UTF8_MAX;
+    if (lo < 0) lo = 0;
+    if (lo > hi) return;
+
+    static const int max_of_len[] = { 0x7f, 0x7ff, 0xffff };
+    for (int i = 0; i < 3; ++i)
+    {
+        if (lo <= max_of_len[i] && hi > max_of_len[i])
+        {
+            ConstructUTF8Sequence(lo, max_of_len[i], seq);
+            ConstructUTF8Sequence(max_of_len[i] + 1, hi, seq);
+            return;
+        }
+    }
+
+    RegExpUTF8Sequence sq;
+    sq.len = EncodeUTF8(lo, sq.lo);
+    EncodeUTF8(hi, sq.hi);
+
+    for (int i = 1; i < sq.len; ++i)
+    {
+        int m = (1 << (6 * i)) - 1;
+        if ((lo & ~m) == (hi & ~m)) continue;
+
+        if (lo & m)
+        {
+            ConstructUTF8Sequence(lo, lo | m, seq);
+            ConstructUTF8Sequence((lo | m) + 1, hi, seq);
+            return;
+        }
+
+        if ((hi & m) != m)
+        {
+            ConstructUTF8Sequence(lo, (hi & ~m) - 1, seq);
+            ConstructUTF8Sequence(hi & ~m, hi, seq);
+            return;
+        }
+    }
+
+    seq.push_back(sq);
+}
@@ -1,15 +1,34 @@
 #ifndef REGEXP_TOKENIZER_H_
 #define REGEXP_TOKENIZER_H_
 
+#include <vector>
 #include "Parsing/LexTokenizerBase.h"
 
-#define REG_EXP_CHAR_MAX (128)
+// input chars are the bytes [0, REG_EXP_CHAR_EPSILON), epsilon transitions
+// are kept as one more char after them.
+#define REG_EXP_CHAR_MAX (257)
 #define REG_EXP_CHAR_EPSILON (REG_EXP_CHAR_MAX - 1)
 
+#define REG_EXP_UTF8_MAX (0x10ffff)
+
+// utf-8 encoding of a range of codepoints, the i-th byte is in [lo[i], hi[i]].
+struct RegExpUTF8Sequence
+{
+    int len;
+    unsigned char lo[4];
+    unsigned char hi[4];
+};
+
 class RegExpTokenizer: public LexTokenizerBase
 {
     public:
 
+        RegExpTokenizer();
+
+        // in utf-8 mode a multi-byte char is one unit, . and [] match codepoints.
+        void SetUTF8(bool utf8) { utf8_ = utf8; }
+        bool IsUTF8() const { return utf8_; }
+
         virtual bool IsMetaChar(char c) const;
         virtual const char* IsToken(const char* s, const char* e) const;
         virtual const char* IsToken(const std::string& str) const;
@@ -26,9 +45,21 @@ class RegExpTokenizer: public LexTokenizerBase
 
         bool ExtractRepeatCount(const char* s, const char* e, int& min, int& max) const;
 
-        // TODO, support 2-bytes char.
         static std::string ConstructEscapeString(const char* s, const char* e);
         static std::string ConstructOptionString(const char* s, const char* e);
+
+        // codepoints selected by [s, e], the text between [], as sorted disjoint ranges.
+        static void ConstructOptionRange(const char* s, const char* e, std::vector<std::pair<int, int> >& ranges);
+
+        // length of the utf-8 char [s, e] starts with, 0 if it is not well formed.
+        static int GetUTF8Length(const char* s, const char* e);
+
+        // split codepoints [lo, hi] into byte sequences, surrogates are left out.
+        static void ConstructUTF8Sequence(int lo, int hi, std::vector<RegExpUTF8Sequence>& seq);
+
+    private:
+
+        bool utf8_;
 };
 
 #endif
@@ -0,0 +1,120 @@
+/*
+   generate c++ source of the dfa of a pattern, see RegExpCodeGen.
+
+   usage: xreg_codegen [-f] [-v] [-s max_state] name pattern output
+   -f: whole input must match, otherwise partial matching as RegExpNFA does.
+   -v: print the nodes and nfa states before and after the pattern is optimized.
+   -s: give up if the dfa takes more states than max_state, 4096 by default.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "Parsing/LexException.h"
+#include "Regex/RegExpAutomata.h"
+#include "Regex/RegExpCodeGen.h"
+#include "Regex/RegExpSyntaxTree.h"
+
+static int Usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-f] [-v] [-s max_state] name pattern output\n", prog);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    bool partial = true;
+    bool verbose = false;
+    int maxState = 4096;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i)
+    {
+        if (!strcmp(argv[i], "-f"))
+        {
+            partial = false;
+        }
+        else if (!strcmp(argv[i], "-v"))
+        {
+            verbose = true;
+        }
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+        {
+            maxState = atoi(argv[++i]);
+        }
+        else
+        {
+            return Usage(argv[0]);
+        }
+    }
+
+    if (argc - i != 3) return Usage(argv[0]);
+
+    const char* name = argv[i];
+    const char* pattern = argv[i + 1];
+    const char* output = argv[i + 2];
+
+    std::string code;
+    try
+    {
+        RegExpSyntaxTree tree;
+        if (!tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1))
+        {
+            fprintf(stderr, "empty pattern\n");
+            return 1;
+        }
+
+        RegExpNFA nfa(partial);
+        RegExpDFA dfa(partial);
+
+        int states = verbose? nfa.BuildMachine(&tree) : 0;
+
+        // only the dfa is generated, no group is needed.
+        tree.Optimize(false);
+
+        int built = nfa.BuildMachine(&tree);
+        if (verbose)
+        {
+            const RegExpSyntaxTree::OptimizeStat& stat = tree.GetOptimizeStat();
+            fprintf(stderr, "nodes: %d -> %d, nfa states: %d -> %d\n",
+                    stat.before, stat.after, states, built);
+        }
+
+        if (!built || !nfa.ConvertToDFA(dfa, maxState))
+        {
+            fprintf(stderr, "no dfa for pattern \"%s\", back reference or more than %d states\n", pattern, maxState);
+            return 1;
+        }
+
+        dfa.Minimize();
+
+        // quoted, a trailing '\\' would continue the comment line.
+        std::string txt(pattern);
+        for (size_t j = 0; j < txt.size(); ++j)
+        {
+            if (txt[j] < ' ' || txt[j] == 127) txt[j] = '?';
+        }
+
+        code += "// pattern: \"" + txt + "\"\n";
+        RegExpCodeGen::GenerateDFA(dfa, name, code);
+    }
+    catch (LexErrException& e)
+    {
+        fprintf(stderr, "invalid pattern \"%s\": %s\n", pattern, e.what());
+        return 1;
+    }
+
+    FILE* fp = fopen(output, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "can't open %s\n", output);
+        return 1;
+    }
+
+    bool ok = fwrite(code.c_str(), 1, code.size(), fp) == code.size();
+    ok = (fclose(fp) == 0) && ok;
+
+    return ok? 0 : 1;
+}
+
@@ -4,24 +4,37 @@
 #include <string>
 #include <sstream>
 #include <climits>
+#include <cstdlib>
 #include <sstream>
 #include <algorithm>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #define private public
 #define protected public
 
+#include "AutomatonImage.h"
 #include "RegExpAutomata.h"
+#include "RegExpAhoCorasick.h"
+#include "RegExpCodeGen.h"
+#include "RegExpSearch.h"
+#include "RegExpSet.h"
+#include "RegExpStatic.h"
+#include "RegExpStream.h"
 #include "RegExpSyntaxTree.h"
+#include "RegExpTokenizer.h"
 
 class nfa_case
 {
     public:
 
         nfa_case(const char* pattern, bool partial = true)
-            :pattern_(pattern), nfa_(partial), tree_(), txt2match_()
+            :pattern_(pattern), nfa_(partial), dfa_(partial), tree_(), txt2match_()
         {
             tree_.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
             nfa_.BuildMachine(&tree_);
+            hasDFA_ = nfa_.ConvertToDFA(dfa_);
         }
 
         void AddTestCase(const std::string& txt, bool ismatch)
@@ -50,6 +63,8 @@ class nfa_case
 
         std::string pattern_;
         RegExpNFA nfa_;
+        RegExpDFA dfa_;
+        bool hasDFA_;
         RegExpSyntaxTree tree_;
         std::map<std::string, bool> txt2match_;
 };
@@ -102,7 +117,7 @@ TEST(test_matching_txt, test_automata_gen)
 
     nfa_case* c8_4 = new nfa_case("(a*)*bc\\0", false);
     c8_4->AddTestCase("abca", true);
-    c8_4->AddTestCase("aabcaa", false);
+    c8_4->AddTestCase("aabcaa", true); // one round of "aa".
     c8_4->AddTestCase("aabca", true);
     c8_4->AddTestCase("abc", false);
     c8_4->AddTestCase("bbc", false);
@@ -356,6 +371,21 @@ TEST(test_matching_txt, test_automata_gen)
     c5->AddTestCase("aaregesxpxpbb", false);
     cases.push_back(c5);
 
+    nfa_case* c5_0 = new nfa_case("abc");
+    c5_0->AddTestCase("abc", true);
+    c5_0->AddTestCase("aabc", true);
+    c5_0->AddTestCase("ababcd", true);
+    c5_0->AddTestCase("abab", false);
+    c5_0->AddTestCase("", false);
+    cases.push_back(c5_0);
+
+    nfa_case* c5_1 = new nfa_case("a(bc)*d$");
+    c5_1->AddTestCase("abcbd", false);
+    c5_1->AddTestCase("abcbad", true);
+    c5_1->AddTestCase("abcbcdd", false);
+    c5_1->AddTestCase("xxabcbcd", true);
+    cases.push_back(c5_1);
+
     nfa_case* c6 = new nfa_case("abc", false);
     c6->AddTestCase("", false);
     cases.push_back(c6);
@@ -550,6 +580,23 @@ TEST(test_matching_txt, test_automata_gen)
    ct_1->AddTestCase("MMMMMCMXCIV", false);
    cases.push_back(ct_1);
 
+    // the loop of a star must not leak into the other branch.
+    nfa_case* cs_0 = new nfa_case("a*c|bx", false);
+    cs_0->AddTestCase("aac", true);
+    cs_0->AddTestCase("bx", true);
+    cs_0->AddTestCase("abx", false);
+    cases.push_back(cs_0);
+
+    nfa_case* cs_1 = new nfa_case("ca*|bx", false);
+    cs_1->AddTestCase("caa", true);
+    cs_1->AddTestCase("bxa", false);
+    cases.push_back(cs_1);
+
+    nfa_case* cs_2 = new nfa_case("(x*y)*", false);
+    cs_2->AddTestCase("xyy", true);
+    cs_2->AddTestCase("x", false);
+    cases.push_back(cs_2);
+
     for (size_t i = 0; i < cases.size(); ++i)
     {
         for (std::map<std::string, bool>::iterator it = cases[i]->txt2match_.begin();
@@ -563,6 +610,15 @@ TEST(test_matching_txt, test_automata_gen)
                     << ", group:" << cases[i]->GetGroupInfo()
 #endif
                     << std::endl;
+
+                if (!cases[i]->hasDFA_) continue;
+
+                EXPECT_EQ(it->second, cases[i]->nfa_.RunNFA(cases[i]->nfa_.start_, cases[i]->nfa_.accept_,
+                            it->first.c_str(), it->first.c_str() + it->first.size() - 1))
+                    << "nfa case:" << i << ", pattern:" << cases[i]->pattern_ << ", test:" << it->first << std::endl;
+
+                EXPECT_EQ(it->second, cases[i]->dfa_.RunMachine(it->first.c_str(), it->first.c_str() + it->first.size() - 1))
+                    << "dfa case:" << i << ", pattern:" << cases[i]->pattern_ << ", test:" << it->first << std::endl;
             }
             catch (...)
             {
@@ -575,3 +631,1820 @@ TEST(test_matching_txt, test_automata_gen)
     }
 }
 
+
+static std::string GenRandomText(const char* alphabet, size_t len)
+{
+    std::string ret;
+    size_t sz = strlen(alphabet);
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        ret.push_back(alphabet[rand() % sz]);
+    }
+
+    return ret;
+}
+
+TEST(test_lazy_dfa, test_automata_gen)
+{
+    const char* patterns[] =
+    {
+        "(a|b)*a(a|b){6}",
+        "ab(ab|ba)*b{2,3}",
+        "^(ab|ba)+a",
+        "a[bc]+d$",
+        "^a[bc]+d$",
+    };
+
+    srand(7);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        const char* pattern = patterns[i];
+
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+        RegExpNFA nfa, lazy, small;
+        nfa.BuildMachine(&tree);
+        lazy.BuildMachine(&tree);
+        small.BuildMachine(&tree);
+
+        lazy.SetLazyDFACache(1 << 20);
+        small.SetLazyDFACache(2048);
+
+        for (int j = 0; j < 200; ++j)
+        {
+            std::string txt = GenRandomText("abcd", 1 + rand() % 64);
+            const char* ps = txt.c_str();
+            const char* pe = ps + txt.size() - 1;
+
+            bool expect = nfa.RunMachine(ps, pe);
+            EXPECT_EQ(expect, lazy.RunMachine(ps, pe)) << "pattern:" << pattern << ", test:" << txt << std::endl;
+            EXPECT_EQ(expect, small.RunMachine(ps, pe)) << "pattern:" << pattern << ", test:" << txt << std::endl;
+        }
+
+        // a floating pattern ending with $ is matched backward by the tail dfa,
+        // the cache is never used.
+        if (lazy.tailDFA_)
+        {
+            EXPECT_EQ(0u, lazy.GetLazyDFAStat().misses) << "pattern:" << pattern << std::endl;
+            continue;
+        }
+
+        EXPECT_GT(lazy.GetLazyDFAStat().hits, 0u) << "pattern:" << pattern << std::endl;
+        EXPECT_GT(lazy.GetLazyDFAStat().misses, 0u) << "pattern:" << pattern << std::endl;
+        EXPECT_EQ(0u, lazy.GetLazyDFAStat().flushes) << "pattern:" << pattern << std::endl;
+    }
+
+    const char* pattern = "(a|b)*a(a|b){6}";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    // a partial match is accepted early, matching the whole input runs through it.
+    RegExpNFA nfa(false);
+    nfa.BuildMachine(&tree);
+    nfa.SetLazyDFACache(2048);
+
+    std::string txt = GenRandomText("ab", 4096);
+    nfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1);
+
+    EXPECT_GT(nfa.GetLazyDFAStat().flushes, 0u);
+    EXPECT_EQ(1u, nfa.GetLazyDFAStat().fallbacks);
+}
+
+TEST(test_anchored_match, test_automata_gen)
+{
+    const char* patterns[] =
+    {
+        "^ab(c|d)+",
+        "^a*b",
+        "^",
+        "(ab|cd)+d$",
+        "a[bc]*d$",
+        "b*$",
+        "$",
+        "^ab$",
+        "(a|b)*a(a|b){10}$",
+        "(a|b){10}a(a|b)*$", // too many states for the reversed dfa, matched forward
+    };
+
+    srand(11);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        const char* pattern = patterns[i];
+
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+        RegExpNFA nfa, lazy;
+        nfa.BuildMachine(&tree);
+        lazy.BuildMachine(&tree);
+        lazy.SetLazyDFACache(1 << 20);
+
+        std::vector<const char*> groups;
+        for (int j = 0; j < 300; ++j)
+        {
+            std::string txt = GenRandomText("abcd", rand() % 48);
+            const char* ps = txt.c_str();
+            const char* pe = ps + txt.size() - 1;
+
+            bool expect = nfa.Capture(ps, pe, groups);
+            EXPECT_EQ(expect, nfa.RunMachine(ps, pe)) << "pattern:" << pattern << ", test:" << txt << std::endl;
+            EXPECT_EQ(expect, lazy.RunMachine(ps, pe)) << "pattern:" << pattern << ", test:" << txt << std::endl;
+            EXPECT_EQ(expect, nfa.RunNFA(nfa.start_, nfa.accept_, ps, pe)) << "pattern:" << pattern << ", test:" << txt << std::endl;
+        }
+    }
+
+    // anchored patterns stop within the match on a long input.
+    std::string txt = "abcd" + std::string(1 << 20, 'x');
+    const char* ps = txt.c_str();
+    const char* pe = ps + txt.size() - 1;
+
+    const char* pattern = "^ab(c|d)+";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA head;
+    head.BuildMachine(&tree);
+    head.SetLazyDFACache(1 << 20);
+
+    EXPECT_TRUE(head.RunMachine(ps, pe));
+    EXPECT_EQ(3u, head.GetLazyDFAStat().hits + head.GetLazyDFAStat().misses);
+
+    std::string miss = "abx" + txt;
+    EXPECT_FALSE(head.RunMachine(miss.c_str(), miss.c_str() + miss.size() - 1));
+    EXPECT_EQ(6u, head.GetLazyDFAStat().hits + head.GetLazyDFAStat().misses);
+
+    pattern = "c[a-d]*x$";
+
+    RegExpSyntaxTree tailTree;
+    tailTree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA tail;
+    tail.BuildMachine(&tailTree);
+    tail.SetLazyDFACache(1 << 20);
+
+    EXPECT_FALSE(tail.RunMachine(ps, pe));
+    EXPECT_TRUE(tail.RunMachine(ps, ps + 4));
+    EXPECT_FALSE(tail.RunMachine(ps, ps + 5));
+
+    txt[1 << 19] = 'c';
+    EXPECT_TRUE(tail.RunMachine(ps, ps + (1 << 19) + 1));
+
+    // decided by the backward scan, the lazy dfa is not run.
+    EXPECT_EQ(0u, tail.GetLazyDFAStat().hits + tail.GetLazyDFAStat().misses);
+
+    // the reversed dfa is built with the nfa, and counted in its size.
+    ASSERT_TRUE(tail.tailDFA_ != NULL);
+    EXPECT_TRUE(tail.search_ == NULL);
+    EXPECT_GT(tail.GetMemorySize(), tail.tailDFA_->GetMemorySize());
+
+    std::string image;
+    ASSERT_TRUE(tail.SerializeState(image));
+
+    RegExpNFA loaded;
+    ASSERT_TRUE(loaded.DeserializeState(image.data(), image.size()));
+    ASSERT_TRUE(loaded.tailDFA_ != NULL);
+    EXPECT_EQ(tail.tailDFA_->GetStateNumber(), loaded.tailDFA_->GetStateNumber());
+    EXPECT_TRUE(loaded.RunMachine(ps, ps + (1 << 19) + 1));
+    EXPECT_FALSE(loaded.RunMachine(ps, pe));
+
+    // no dfa that small, the forward engines run, through the context.
+    pattern = "(a|b){10}a(a|b)*$";
+
+    RegExpSyntaxTree largeTree;
+    largeTree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA large;
+    large.BuildMachine(&largeTree);
+    large.SetLazyDFACache(1 << 20);
+    EXPECT_TRUE(large.tailDFA_ == NULL);
+
+    std::string ab = std::string(10, 'b') + "a" + std::string(1000, 'b');
+    EXPECT_TRUE(large.RunMachine(ab.c_str(), ab.c_str() + ab.size() - 1));
+    EXPECT_FALSE(large.RunMachine(ab.c_str() + 1, ab.c_str() + ab.size() - 1));
+    EXPECT_GT(large.GetLazyDFAStat().hits + large.GetLazyDFAStat().misses, 0u);
+    EXPECT_TRUE(large.search_ == NULL);
+}
+
+// one worker of test_match_context, matching shared automata with a context of its own.
+struct match_context_job
+{
+    const RegExpNFA* lazy;
+    const RegExpNFA* ref;
+    const RegExpSet* set;
+    const std::vector<std::string>* txt;
+
+    // expected results by text.
+    const std::vector<char>* lazyMatch;
+    const std::vector<char>* refMatch;
+    const std::vector<std::vector<int> >* setMatch;
+    const std::vector<int>* findStart;
+
+    int fail;
+};
+
+static void* RunMatchContextJob(void* arg)
+{
+    match_context_job* job = static_cast<match_context_job*>(arg);
+
+    RegExpMatchContext ctx;
+    std::vector<int> ids;
+
+    for (int round = 0; round < 10; ++round)
+    {
+        for (size_t i = 0; i < job->txt->size(); ++i)
+        {
+            const std::string& txt = (*job->txt)[i];
+            const char* ps = txt.c_str();
+            const char* pe = ps + txt.size() - 1;
+
+            if (job->lazy->Match(ps, pe, ctx) != (*job->lazyMatch)[i]) ++job->fail;
+            if (job->ref->Match(ps, pe, ctx) != (*job->refMatch)[i]) ++job->fail;
+
+            job->set->Match(ps, pe, ids, ctx);
+            if (ids != (*job->setMatch)[i]) ++job->fail;
+
+            const char* ms = NULL;
+            const char* me = NULL;
+            int start = job->lazy->Find(ps, pe, ms, me)? ms - ps : -1;
+            if (start != (*job->findStart)[i]) ++job->fail;
+        }
+    }
+
+    return NULL;
+}
+
+TEST(test_match_context, test_automata_gen)
+{
+    const char* pattern = "(a|b)*a(a|b){6}";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    // a small cache, every context flushes it on its own.
+    RegExpNFA lazy;
+    lazy.BuildMachine(&tree);
+    lazy.SetLazyDFACache(2048);
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    const char* refPattern = "((a|b)c)\\1";
+#else
+    const char* refPattern = "(ac|bc)(ac|bc)";
+#endif
+
+    RegExpSyntaxTree refTree;
+    refTree.BuildSyntaxTree(refPattern, refPattern + strlen(refPattern) - 1);
+
+    RegExpNFA ref;
+    ref.BuildMachine(&refTree);
+
+    RegExpSet set;
+    set.AddPattern("ab+c");
+    set.AddPattern("^(a|c)*b$");
+    set.AddPattern(refPattern);
+    set.Compile();
+
+    // expected results, from an nfa of this thread only.
+    RegExpNFA copy;
+    copy.BuildMachine(&tree);
+
+    srand(11);
+
+    std::vector<std::string> txt;
+    std::vector<char> lazyMatch, refMatch;
+    std::vector<std::vector<int> > setMatch(200);
+    std::vector<int> findStart;
+
+    for (int i = 0; i < 200; ++i)
+    {
+        txt.push_back(GenRandomText("abc", 1 + rand() % 32));
+
+        const char* ps = txt[i].c_str();
+        const char* pe = ps + txt[i].size() - 1;
+
+        lazyMatch.push_back(copy.RunMachine(ps, pe));
+        refMatch.push_back(ref.RunMachine(ps, pe));
+        set.Match(ps, pe, setMatch[i]);
+
+        const char* ms = NULL;
+        const char* me = NULL;
+        findStart.push_back(copy.Find(ps, pe, ms, me)? ms - ps : -1);
+    }
+
+    const int threadNum = 4;
+    pthread_t threads[threadNum];
+    match_context_job jobs[threadNum];
+
+    for (int i = 0; i < threadNum; ++i)
+    {
+        match_context_job job = { &lazy, &ref, &set, &txt, &lazyMatch, &refMatch, &setMatch, &findStart, 0 };
+        jobs[i] = job;
+
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, RunMatchContextJob, &jobs[i]));
+    }
+
+    for (int i = 0; i < threadNum; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ(0, jobs[i].fail) << "thread:" << i << std::endl;
+    }
+
+    // matching through a context leaves the cache of the nfa untouched.
+    EXPECT_EQ(0u, lazy.GetLazyDFAStat().hits + lazy.GetLazyDFAStat().misses);
+
+    // the search is built by the first Find(), the others skip the lock.
+    EXPECT_TRUE(lazy.searchBuilt_);
+    EXPECT_TRUE(lazy.search_ != NULL);
+
+    // a pattern that can't be searched is tried once, too.
+    const char* ms = NULL;
+    const char* me = NULL;
+    RegExpNFA none;
+    EXPECT_FALSE(none.Find("ab", "ab" + 1, ms, me));
+    EXPECT_TRUE(none.searchBuilt_);
+    EXPECT_TRUE(none.search_ == NULL);
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    RegExpMatchContext ctx;
+    std::string in = "xbcbcy";
+
+    ASSERT_TRUE(ref.Match(in.c_str(), in.c_str() + in.size() - 1, ctx));
+    ASSERT_EQ(4u, ctx.GetGroups().size());
+    EXPECT_EQ("bc", std::string(ctx.GetGroups()[2], ctx.GetGroups()[3] + 1));
+#endif
+}
+
+TEST(test_match_scratch, test_automata_gen)
+{
+    // too many positions for the bit parallel nfa, so the state sets are used.
+    const char* pattern = "x(a[bc]d){30}y|(ab)*c";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA nfa;
+    nfa.BuildMachine(&tree);
+    ASSERT_FALSE(nfa.bitNFA_.IsBuilt());
+
+    RegExpSet set;
+    set.AddPattern(pattern);
+    set.AddPattern("b+c$");
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    set.AddPattern("(a|b)\\0c");
+#endif
+    set.Compile(0);
+    ASSERT_FALSE(set.HasDFA());
+
+    srand(13);
+
+    std::vector<std::string> txt;
+    for (int i = 0; i < 100; ++i) txt.push_back(GenRandomText("abcdxy", 1 + rand() % 48));
+
+    RegExpMatchContext ctx;
+    std::vector<int> ids, expectIds;
+    std::vector<const int*> buffers;
+
+    for (int round = 0; round < 2; ++round)
+    {
+        for (size_t i = 0; i < txt.size(); ++i)
+        {
+            const char* ps = txt[i].c_str();
+            const char* pe = ps + txt[i].size() - 1;
+
+            EXPECT_EQ(nfa.RunNFA(nfa.start_, nfa.accept_, ps, pe), nfa.Match(ps, pe, ctx)) << "test:" << txt[i];
+
+            set.Match(ps, pe, expectIds);
+            set.Match(ps, pe, ids, ctx);
+            EXPECT_EQ(expectIds, ids) << "test:" << txt[i];
+        }
+
+        // buffers grown in the first round are reused by the second,
+        // the two sets may have swapped theirs.
+        std::vector<const int*> now;
+        now.push_back(&ctx.curStat_.dense_[0]);
+        now.push_back(&ctx.toStat_.dense_[0]);
+        now.push_back(&ctx.curStat_.sparse_[0]);
+        now.push_back(&ctx.toStat_.sparse_[0]);
+        std::sort(now.begin(), now.end());
+
+        if (round)
+        {
+            EXPECT_TRUE(buffers == now);
+        }
+
+        buffers.swap(now);
+    }
+}
+
+TEST(test_compact_nfa, test_automata_gen)
+{
+    const char* pattern = "x(a[bc]d){300,600}y";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA nfa;
+    nfa.BuildMachine(&tree);
+
+    // building table is dropped, every char edge is one range.
+    EXPECT_TRUE(nfa.GetNFATran().empty());
+    EXPECT_EQ(nfa.GetAllStates().size() + 1, nfa.edgeIndex_.size());
+    EXPECT_GT(2 * nfa.GetAllStates().size(), nfa.edges_.size());
+
+    std::string txt = "zzx";
+    for (int i = 0; i < 400; ++i) txt += (i % 2)? "abd" : "acd";
+
+    std::string bad = txt + "ay";
+    txt += "yzz";
+
+    EXPECT_TRUE(nfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+    EXPECT_FALSE(nfa.RunMachine(bad.c_str(), bad.c_str() + bad.size() - 1));
+}
+
+TEST(test_epsilon_closure, test_automata_gen)
+{
+    const char* patterns[] = { "(ab|cd)*e(f|g)?h", "(a?){1000}c" };
+    bool precomputed[] = { true, false };
+
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        const char* pattern = patterns[i];
+
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+        RegExpNFA nfa;
+        nfa.BuildMachine(&tree);
+
+        EXPECT_EQ(precomputed[i], !nfa.closureIndex_.empty()) << "pattern:" << pattern << std::endl;
+
+        // closure of a state starts with the state itself and is sorted.
+        for (size_t st = 0; st + 1 < nfa.closureIndex_.size(); ++st)
+        {
+            std::vector<int> closure(nfa.closureStates_.begin() + nfa.closureIndex_[st],
+                    nfa.closureStates_.begin() + nfa.closureIndex_[st + 1]);
+
+            EXPECT_TRUE(std::find(closure.begin(), closure.end(), (int)st) != closure.end());
+            EXPECT_TRUE(std::adjacent_find(closure.begin(), closure.end(), std::greater_equal<int>()) == closure.end());
+        }
+    }
+
+    const char* pattern = "x(a?){1000}c";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA nfa(false);
+    nfa.BuildMachine(&tree);
+
+    std::string txt = "x" + std::string(700, 'a') + "c";
+    std::string bad = "x" + std::string(1001, 'a') + "c";
+
+    EXPECT_TRUE(nfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+    EXPECT_FALSE(nfa.RunMachine(bad.c_str(), bad.c_str() + bad.size() - 1));
+}
+
+TEST(test_bit_nfa, test_automata_gen)
+{
+    const char* patterns[] =
+    {
+        "ab(cd|ef)*g",
+        "^(ab|a)b*c$",
+        "x[0-9]{2,4}y?",
+        "(a|b)*a(a|b){3}",
+        "(a?){5}a{5}",
+        ".*(ab)+c",
+        "^a*$",
+        "b{3,}",
+    };
+
+    srand(11);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        for (int partial = 0; partial < 2; ++partial)
+        {
+            const char* pattern = patterns[i];
+
+            RegExpSyntaxTree tree;
+            tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+            RegExpNFA nfa(partial);
+            RegExpBitNFA bit(partial);
+
+            nfa.BuildMachine(&tree);
+            EXPECT_LT(0, bit.BuildMachine(&tree)) << "pattern:" << pattern << std::endl;
+            EXPECT_TRUE(nfa.bitNFA_.IsBuilt()) << "pattern:" << pattern << std::endl;
+
+            for (int j = 0; j < 300; ++j)
+            {
+                std::string txt = GenRandomText("abcdefgxy0123", rand() % 16);
+                const char* ps = txt.c_str();
+                const char* pe = ps + txt.size() - 1;
+
+                EXPECT_EQ(nfa.RunNFA(nfa.start_, nfa.accept_, ps, pe), bit.RunMachine(ps, pe))
+                    << "pattern:" << pattern << ", partial:" << partial << ", test:" << txt << std::endl;
+            }
+        }
+    }
+
+    // too many positions.
+    const char* large[] = { "(abcdefgh){9}", "a{65}", "[abc]{30,40}x{30}" };
+    for (size_t i = 0; i < sizeof(large)/sizeof(large[0]); ++i)
+    {
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(large[i], large[i] + strlen(large[i]) - 1);
+
+        RegExpBitNFA bit;
+        EXPECT_EQ(0, bit.BuildMachine(&tree)) << "pattern:" << large[i] << std::endl;
+        EXPECT_FALSE(bit.IsBuilt());
+    }
+}
+
+TEST(test_backtrack, test_automata_gen)
+{
+    const char* patterns[] =
+    {
+        "ab(cd|ef)*g",
+        "^(ab|a)b*c$",
+        "x[0-9]{2,4}y?",
+        "(a|b)*a(a|b){3}",
+        "(a?){5}a{5}",
+        "(a*)*b",
+        "^a*$",
+        "b{3,}",
+    };
+
+    srand(17);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        for (int partial = 0; partial < 2; ++partial)
+        {
+            const char* pattern = patterns[i];
+
+            RegExpSyntaxTree tree;
+            tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+            RegExpNFA nfa(partial);
+            RegExpBacktrack bt(partial);
+
+            nfa.BuildMachine(&tree);
+            EXPECT_LT(0, bt.BuildMachine(&tree)) << "pattern:" << pattern << std::endl;
+
+            for (int j = 0; j < 300; ++j)
+            {
+                std::string txt = GenRandomText("abcdefgxy0123", rand() % 16);
+                const char* ps = txt.c_str();
+                const char* pe = ps + txt.size() - 1;
+
+                EXPECT_EQ(nfa.RunNFA(nfa.start_, nfa.accept_, ps, pe), bt.RunMachine(ps, pe))
+                    << "pattern:" << pattern << ", partial:" << partial << ", test:" << txt << std::endl;
+            }
+        }
+    }
+
+    // exponential without the memo table.
+    const char* pattern = "(a|aa)*(a|aa)*b";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpBacktrack bt(false);
+    bt.BuildMachine(&tree);
+
+    std::string txt(2000, 'a');
+    EXPECT_FALSE(bt.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+
+    txt += 'b';
+    EXPECT_TRUE(bt.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    // matching leaves the nfa as it is, groups come with the match.
+    const char* ref = "(x+)(y|z)\\0(a|aa)*b";
+
+    RegExpSyntaxTree refTree;
+    refTree.BuildSyntaxTree(ref, ref + strlen(ref) - 1);
+
+    RegExpNFA nfa(false);
+    nfa.BuildMachine(&refTree);
+
+    size_t stateNum = nfa.GetAllStates().size();
+    txt = "xxzxx" + std::string(2000, 'a');
+
+    EXPECT_FALSE(nfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+    EXPECT_EQ(stateNum, nfa.GetAllStates().size());
+
+    txt += 'b';
+    EXPECT_TRUE(nfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+
+    std::vector<std::string> group = nfa.GetCaptureGroup();
+    ASSERT_EQ(3u, group.size());
+    EXPECT_EQ("xx", group[0]);
+    EXPECT_EQ("z", group[1]);
+    EXPECT_EQ("a", group[2]);
+
+    const char* ps = "xyxb";
+    std::vector<const char*> groups;
+    EXPECT_TRUE(nfa.backtrack_.Match(ps, ps + 3, &groups));
+    ASSERT_EQ(6u, groups.size());
+    EXPECT_EQ(ps, groups[0]);
+    EXPECT_EQ(ps, groups[1]);
+    EXPECT_TRUE(groups[4] == NULL && groups[5] == NULL);
+#endif
+}
+
+TEST(test_pike_vm, test_automata_gen)
+{
+    const char* patterns[] =
+    {
+        "a(b|c)*(d)",
+        "^(ab|a)(b*)c$",
+        "x([0-9]{2,4})(y?)",
+        "((a|b)*)a((a|b){2})",
+        "(a*)*b",
+        "((a)|(b))+c",
+        "(.*)(ab)+",
+        "(a?){3}(b)",
+    };
+
+    srand(19);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        for (int partial = 0; partial < 2; ++partial)
+        {
+            const char* pattern = patterns[i];
+
+            RegExpSyntaxTree tree;
+            tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+            RegExpPikeVM vm(partial);
+            RegExpBacktrack bt(partial);
+
+            EXPECT_LT(0, vm.BuildMachine(&tree)) << "pattern:" << pattern << std::endl;
+            EXPECT_EQ(vm.GetInstNumber(), bt.BuildMachine(&tree));
+
+            for (int j = 0; j < 300; ++j)
+            {
+                std::string txt = GenRandomText("abcdxy01", rand() % 16);
+                const char* ps = txt.c_str();
+                const char* pe = ps + txt.size() - 1;
+
+                std::vector<const char*> expect, groups;
+                bool match = bt.Match(ps, pe, &expect);
+
+                EXPECT_EQ(match, vm.Match(ps, pe, &groups))
+                    << "pattern:" << pattern << ", partial:" << partial << ", test:" << txt << std::endl;
+                EXPECT_EQ(match, vm.RunMachine(ps, pe));
+
+                if (!match) continue;
+
+                EXPECT_TRUE(expect == groups) << "pattern:" << pattern << ", test:" << txt << std::endl;
+            }
+        }
+    }
+
+    const char* pattern = "(\\w+)@((\\w+)\\.)+(com|org)";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA nfa;
+    nfa.BuildMachine(&tree);
+
+    std::string txt = "mail to: xyz@abc.def.org!";
+    const char* ps = txt.c_str();
+
+    std::vector<const char*> groups;
+    ASSERT_TRUE(nfa.Capture(ps, ps + txt.size() - 1, groups));
+    ASSERT_EQ(8u, groups.size());
+
+    // a group is numbered after the ones inside it, the last round is kept.
+    EXPECT_EQ("xyz", std::string(groups[0], groups[1] + 1));
+    EXPECT_EQ("def", std::string(groups[2], groups[3] + 1));
+    EXPECT_EQ("def.", std::string(groups[4], groups[5] + 1));
+    EXPECT_EQ("org", std::string(groups[6], groups[7] + 1));
+
+    EXPECT_FALSE(nfa.Capture(ps, ps + 15, groups));
+}
+
+// rounds of every repetition are counted, as if it was too large to expand.
+static void SetCounted(RegExpSynTreeNode* node)
+{
+    if (!node) return;
+
+    RegExpSynTreeStarNode* sn = node->AsStarNode();
+    if (sn && (sn->GetMaxRepeat() == INT_MAX? sn->GetMinRepeat() : sn->GetMaxRepeat()) > 1)
+    {
+        sn->SetCounted(true);
+    }
+
+    SetCounted(node->GetLeftNode());
+    SetCounted(node->GetRightNode());
+}
+
+TEST(test_counted_repeat, test_automata_gen)
+{
+    const char* patterns[] =
+    {
+        "a{2,4}",
+        "x(ab|a){2,5}b",
+        "^(a|b){3}c$",
+        "((a){1,3}b){2,}",
+        "c(a{2}b){2,3}",
+        "[ab]{3,}c",
+        "(a*){2,3}b",
+        "(b?){3}(a)",
+    };
+
+    srand(23);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        for (int partial = 0; partial < 2; ++partial)
+        {
+            const char* pattern = patterns[i];
+
+            RegExpSyntaxTree tree, counted;
+            tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+            counted.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+            SetCounted(counted.GetRoot());
+            counted.hasCountedNode_ = true;
+
+            RegExpNFA nfa(partial), cnfa(partial);
+            RegExpBacktrack cbt(partial);
+
+            nfa.BuildMachine(&tree);
+            EXPECT_LT(0, cnfa.BuildMachine(&counted)) << "pattern:" << pattern << std::endl;
+            EXPECT_LT(0, cbt.BuildMachine(&counted));
+            EXPECT_TRUE(cnfa.GetAllStates().empty());
+
+            for (int j = 0; j < 300; ++j)
+            {
+                std::string txt = GenRandomText("abcx", rand() % 12);
+                const char* ps = txt.c_str();
+                const char* pe = ps + txt.size() - 1;
+
+                bool match = nfa.RunMachine(ps, pe);
+                EXPECT_EQ(match, cnfa.RunMachine(ps, pe))
+                    << "pattern:" << pattern << ", partial:" << partial << ", test:" << txt << std::endl;
+
+                std::vector<const char*> expect, groups;
+                EXPECT_EQ(match, cbt.Match(ps, pe, &expect));
+                EXPECT_EQ(match, cnfa.Capture(ps, pe, groups));
+
+                EXPECT_TRUE(expect == groups) << "pattern:" << pattern << ", test:" << txt << std::endl;
+            }
+        }
+    }
+
+    // the nfa would take 21000 leaves.
+    const char* pattern = "x(abc){6000,7000}y";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+    EXPECT_TRUE(tree.HasCountedNode());
+
+    RegExpNFA nfa;
+    EXPECT_GT(32, nfa.BuildMachine(&tree));
+
+    RegExpSet set;
+    set.AddPattern(pattern);
+    set.AddPattern("ab+c");
+    set.Compile();
+
+    RegExpDFA streamDFA;
+    RegExpStreamMatcher sm(nfa, &streamDFA);
+    EXPECT_FALSE(sm.IsSupported());
+    EXPECT_FALSE(RegExpStreamMatcher::BuildDFA(nfa, streamDFA));
+
+    const int rounds[] = { 5999, 6000, 6500, 7000, 7001 };
+    for (size_t i = 0; i < sizeof(rounds)/sizeof(rounds[0]); ++i)
+    {
+        std::string txt = "zx";
+        for (int j = 0; j < rounds[i]; ++j) txt += "abc";
+
+        txt += "yzx";
+
+        const char* ps = txt.c_str();
+        const char* pe = ps + txt.size() - 1;
+        bool match = rounds[i] >= 6000 && rounds[i] <= 7000;
+
+        EXPECT_EQ(match, nfa.RunMachine(ps, pe)) << "rounds:" << rounds[i] << std::endl;
+
+        // found by the pike vm, the nfa has no states to search with.
+        const char* ms = NULL;
+        const char* me = NULL;
+        EXPECT_EQ(match, nfa.Find(ps, pe, ms, me)) << "rounds:" << rounds[i] << std::endl;
+
+        if (match)
+        {
+            EXPECT_EQ(ps + 1, ms);
+            EXPECT_EQ(pe - 2, me);
+        }
+
+        std::vector<int> ids;
+        EXPECT_EQ(match? 2 : 1, set.Match(ps, pe, ids));
+
+        std::vector<const char*> groups;
+        EXPECT_EQ(match, nfa.Capture(ps, pe, groups));
+
+        if (match)
+        {
+            ASSERT_EQ(2u, groups.size());
+            EXPECT_EQ(pe - 5, groups[0]);
+            EXPECT_EQ(pe - 3, groups[1]);
+        }
+    }
+
+#ifdef SUPPORT_REG_EXP_BACK_REFERENCE
+    // back reference in a counted loop, run by the backtracking vm.
+    pattern = "^((ab|cd)\\0){4000}$";
+
+    RegExpSyntaxTree ref;
+    ref.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+    EXPECT_TRUE(ref.HasCountedNode() && ref.HasRefNode());
+
+    RegExpNFA refNFA;
+    EXPECT_GT(32, refNFA.BuildMachine(&ref));
+
+    std::string txt;
+    for (int i = 0; i < 3999; ++i) txt += (i % 3)? "abab" : "cdcd";
+
+    std::string bad = txt + "cdab";
+    txt += "abab";
+
+    EXPECT_TRUE(refNFA.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+    EXPECT_FALSE(refNFA.RunMachine(bad.c_str(), bad.c_str() + bad.size() - 1));
+#endif
+}
+
+// a counted loop keeps a thread for every round in progress, each checked in
+// O(1) against the others at its instruction by a hash table. the loop is
+// compiled once, and the table grows with the rounds in progress, not with
+// the input or the count.
+TEST(test_counted_scale, test_automata_gen)
+{
+    const char* pattern = "a{20000}b";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+    ASSERT_TRUE(tree.HasCountedNode());
+
+    RegExpNFA nfa;
+    nfa.BuildMachine(&tree);
+    EXPECT_GT(16, nfa.pikeVM_.GetInstNumber());
+
+    // 300 rounds in progress twice, "ab" gets it by the prefilter.
+    RegExpMatchContext ctx;
+    std::string txt = std::string(300, 'a') + "b" + std::string(300, 'a');
+
+    EXPECT_FALSE(nfa.Match(txt.c_str(), txt.c_str() + txt.size() - 1, ctx));
+    EXPECT_LT(0u, ctx.pikeVM_.list1.table_.size());
+    EXPECT_GE(4096u, ctx.pikeVM_.list1.table_.size());
+    EXPECT_GE(4096u, ctx.pikeVM_.list2.table_.size());
+
+    // a long input of short runs keeps the table small.
+    RegExpMatchContext runCtx;
+
+    srand(29);
+    txt = GenRandomText("aab", 1 << 16);
+
+    EXPECT_FALSE(nfa.Match(txt.c_str(), txt.c_str() + txt.size() - 1, runCtx));
+    EXPECT_GE(1024u, runCtx.pikeVM_.list1.table_.size());
+    EXPECT_GE(1024u, runCtx.pikeVM_.list2.table_.size());
+
+    txt = std::string(300, 'a') + "b";
+    EXPECT_FALSE(nfa.Match(txt.c_str(), txt.c_str() + txt.size() - 1, ctx));
+
+    // the buffers of the vm are kept in the context.
+    RegExpPikeVM::Scratch& scratch = ctx.pikeVM_;
+    const int* slots = &scratch.pool.slots_[0];
+    const int* table = &scratch.list1.table_[0];
+
+    EXPECT_FALSE(nfa.Match(txt.c_str(), txt.c_str() + txt.size() - 1, ctx));
+    EXPECT_EQ(slots, &scratch.pool.slots_[0]);
+    EXPECT_EQ(table, &scratch.list1.table_[0]);
+}
+
+TEST(test_prefilter, test_automata_gen)
+{
+    struct
+    {
+        const char* pattern;
+        const char* literals; // separated by space
+    } lits[] =
+    {
+        { "ERROR[0-9]+:.*timeout", "timeout" },
+        { "abc", "abc" },
+        { "^ab(cd|ef)g$", "abcdg abefg" },
+        { "x(abc|defg)+y", "xabc xdefg" },
+        { "(ab){3}", "ababab" },
+        { "a.*b", "" },
+        { "(ab)*c", "" },
+        { "a|bc", "" },
+    };
+
+    for (size_t i = 0; i < sizeof(lits)/sizeof(lits[0]); ++i)
+    {
+        const char* pattern = lits[i].pattern;
+
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+        RegExpPrefilter filter;
+        filter.Build(&tree);
+
+        std::string got;
+        for (size_t j = 0; j < filter.GetLiterals().size(); ++j)
+        {
+            got += (j? " " : "") + filter.GetLiterals()[j];
+        }
+
+        EXPECT_STREQ(lits[i].literals, got.c_str()) << "pattern:" << pattern << std::endl;
+    }
+
+    // literal search against std::string::find, covering the vector loop and the tail.
+    srand(17);
+    for (int i = 0; i < 2000; ++i)
+    {
+        std::string txt = GenRandomText("abc", rand() % 80);
+        std::string lit = GenRandomText("abc", 1 + rand() % 5);
+
+        const char* ps = txt.c_str();
+        const char* pe = ps + txt.size() - 1;
+        const char* ret = RegExpPrefilter::FindLiteral(ps, pe, lit);
+
+        size_t pos = txt.find(lit);
+        EXPECT_EQ(pos == std::string::npos? NULL : ps + pos, ret) << "text:" << txt << ", literal:" << lit << std::endl;
+    }
+
+    const char* pattern = "ERROR[0-9]+:.*timeout";
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA nfa;
+    nfa.BuildMachine(&tree);
+    EXPECT_TRUE(nfa.prefilter_.HasLiteral());
+
+    const char* txt[] = { "ERROR12: connect timeout", "ERROR12: connected", "INFO: timeout", "ERRORx: timeout" };
+    const bool expect[] = { true, false, false, false };
+
+    for (size_t i = 0; i < sizeof(txt)/sizeof(txt[0]); ++i)
+    {
+        const char* ps = txt[i];
+        const char* pe = ps + strlen(ps) - 1;
+
+        EXPECT_EQ(expect[i], nfa.RunMachine(ps, pe)) << "text:" << txt[i] << std::endl;
+        EXPECT_EQ(expect[i], nfa.RunNFA(nfa.start_, nfa.accept_, ps, pe)) << "text:" << txt[i] << std::endl;
+    }
+
+    EXPECT_FALSE(nfa.prefilter_.MayMatch(txt[1], txt[1] + strlen(txt[1]) - 1));
+
+    // the prefilter must never reject a match.
+    const char* patterns[] = { "ab(c|d)+b", "(ab|ba){2}a", "a.b.*ab", "^b[ab]+ba$", "(a|b)(ab){2,3}" };
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(patterns[i], patterns[i] + strlen(patterns[i]) - 1);
+
+        RegExpNFA nfa;
+        nfa.BuildMachine(&tree);
+        EXPECT_TRUE(nfa.prefilter_.HasLiteral()) << "pattern:" << patterns[i] << std::endl;
+
+        for (int j = 0; j < 300; ++j)
+        {
+            std::string txt = GenRandomText("abcd", rand() % 16);
+            const char* ps = txt.c_str();
+            const char* pe = ps + txt.size() - 1;
+
+            EXPECT_EQ(nfa.RunNFA(nfa.start_, nfa.accept_, ps, pe), nfa.RunMachine(ps, pe))
+                << "pattern:" << patterns[i] << ", test:" << txt << std::endl;
+        }
+    }
+}
+
+// brute force leftmost-longest match from cur on, full is a nfa without partial matching.
+static bool FindByFullMatch(RegExpNFA& full, bool head, bool tail, const char* ps,
+        const char* pe, const char* cur, const char*& ms, const char*& me)
+{
+    for (const char* s = cur; s <= pe + 1; ++s)
+    {
+        if (head && s != ps) break;
+
+        for (const char* e = pe; e >= s - 1; --e)
+        {
+            if (tail && e != pe) continue;
+            if (!full.RunMachine(s, e)) continue;
+
+            ms = s;
+            me = e;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TEST(test_find, test_automata_gen)
+{
+    const char* patterns[] =
+    {
+        "ab", "a(b|c)*d", "b*", "^ab*", "ab*$", "(ab|a)(bc|c)", "a{2,3}",
+        "c(a|b)?", "^$", "(abc|b)+", "d.*d",
+    };
+
+    srand(37);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        const char* pattern = patterns[i];
+        bool head = pattern[0] == '^';
+        bool tail = pattern[strlen(pattern) - 1] == '$';
+
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+        // the same with repetitions counted, found by the pike vm.
+        RegExpSyntaxTree counted;
+        counted.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+        SetCounted(counted.GetRoot());
+        counted.hasCountedNode_ = true;
+
+        RegExpNFA nfa, full(false), cnfa;
+        nfa.BuildMachine(&tree);
+        full.BuildMachine(&tree);
+        cnfa.BuildMachine(&counted);
+
+        ASSERT_TRUE(nfa.GetSearch() != NULL) << "pattern:" << pattern << std::endl;
+        EXPECT_TRUE(cnfa.GetSearch() == NULL) << "pattern:" << pattern << std::endl;
+        EXPECT_TRUE(nfa.GetSearch()->HasDFA()) << "pattern:" << pattern << std::endl;
+
+        for (int j = 0; j < 200; ++j)
+        {
+            std::string txt = GenRandomText("abcd", rand() % 12);
+            const char* ps = txt.c_str();
+            const char* pe = ps + txt.size() - 1;
+
+            const char* ms = NULL;
+            const char* me = NULL;
+            const char* ems = NULL;
+            const char* eme = NULL;
+
+            bool found = nfa.Find(ps, pe, ms, me);
+            bool expect = FindByFullMatch(full, head, tail, ps, pe, ps, ems, eme);
+
+            ASSERT_EQ(expect, found) << "pattern:" << pattern << ", text:" << txt << std::endl;
+            EXPECT_EQ(nfa.RunMachine(ps, pe), found) << "pattern:" << pattern << ", text:" << txt << std::endl;
+
+            const char* cms = NULL;
+            const char* cme = NULL;
+            EXPECT_EQ(found, cnfa.Find(ps, pe, cms, cme)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+
+            if (!found) continue;
+
+            EXPECT_EQ(ems - ps, ms - ps) << "pattern:" << pattern << ", text:" << txt << std::endl;
+            EXPECT_EQ(eme - ps, me - ps) << "pattern:" << pattern << ", text:" << txt << std::endl;
+            EXPECT_EQ(ems - ps, cms - ps) << "pattern:" << pattern << ", text:" << txt << std::endl;
+            EXPECT_EQ(eme - ps, cme - ps) << "pattern:" << pattern << ", text:" << txt << std::endl;
+
+            // non-overlapping matches, an empty match right behind the previous one is skipped.
+            RegExpMatchIterator it(nfa, ps, pe);
+            RegExpMatchIterator cit(cnfa, ps, pe);
+
+            const char* cur = ps;
+            const char* last = NULL;
+            while (FindByFullMatch(full, head, tail, ps, pe, cur, ems, eme))
+            {
+                cur = (eme < ems)? ems + 1 : eme + 1;
+                if (eme < ems && last && last + 1 == ems) continue;
+
+                last = eme;
+                ASSERT_TRUE(it.Next(ms, me)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(ems - ps, ms - ps) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(eme - ps, me - ps) << "pattern:" << pattern << ", text:" << txt << std::endl;
+
+                ASSERT_TRUE(cit.Next(cms, cme)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(ems - ps, cms - ps) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(eme - ps, cme - ps) << "pattern:" << pattern << ", text:" << txt << std::endl;
+            }
+
+            EXPECT_FALSE(it.Next(ms, me)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+            EXPECT_FALSE(cit.Next(cms, cme)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+        }
+    }
+
+    // dfa too large, the nfa is used.
+    const char* pattern = "(a|b)*a(a|b){8}";
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA nfa;
+    nfa.BuildMachine(&tree);
+
+    RegExpSearch search;
+    search.Build(nfa, nfa.coreStart_, nfa.coreAccept_, false, false, 16);
+    EXPECT_FALSE(search.HasDFA());
+
+    std::string txt = "ccabbbbbbbbbabc";
+    std::vector<char> isStart;
+    const char* ps = txt.c_str();
+    const char* pe = ps + txt.size() - 1;
+    const char* me = NULL;
+
+    search.FindStart(ps, pe, isStart);
+    EXPECT_EQ(2, std::find(isStart.begin(), isStart.end(), 1) - isStart.begin());
+    EXPECT_TRUE(search.FindLongestEnd(ps + 2, pe, me));
+    EXPECT_EQ(10, me - ps);
+    EXPECT_FALSE(search.FindLongestEnd(ps + 3, pe, me));
+}
+
+TEST(test_stream, test_automata_gen)
+{
+    const char* patterns[] = { "ab", "a(b|c)*d", "^ab*", "ab*$", "(ab|a)(bc|c)", "b*", "a.{3}d" };
+
+    srand(41);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        for (int partial = 0; partial < 2; ++partial)
+        {
+            const char* pattern = patterns[i];
+
+            RegExpSyntaxTree tree;
+            tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+            RegExpNFA nfa(partial);
+            nfa.BuildMachine(&tree);
+
+            // one dfa for every stream.
+            RegExpDFA dfa, tiny;
+            ASSERT_TRUE(RegExpStreamMatcher::BuildDFA(nfa, dfa));
+            EXPECT_EQ(dfa.GetStateNumber() == 1, RegExpStreamMatcher::BuildDFA(nfa, tiny, 1));
+
+            RegExpStreamMatcher dfa_sm(nfa, &dfa);
+            RegExpStreamMatcher nfa_sm(nfa);
+
+            EXPECT_TRUE(dfa_sm.HasDFA());
+            EXPECT_EQ(&dfa, dfa_sm.dfa_);
+            EXPECT_FALSE(nfa_sm.HasDFA());
+
+            for (int j = 0; j < 200; ++j)
+            {
+                std::string txt = GenRandomText("abcd", rand() % 16);
+                const char* ps = txt.c_str();
+
+                long first = -1;
+                for (size_t k = 0; k <= txt.size(); ++k)
+                {
+                    if (nfa.RunNFA(nfa.start_, nfa.accept_, ps, ps + k - 1))
+                    {
+                        first = k;
+                        break;
+                    }
+                }
+
+                dfa_sm.Reset();
+                nfa_sm.Reset();
+
+                // random chunks, empty ones included.
+                for (size_t k = 0; k < txt.size();)
+                {
+                    size_t len = std::min(txt.size() - k, static_cast<size_t>(rand() % 5));
+
+                    dfa_sm.Feed(ps + k, ps + k + len - 1);
+                    nfa_sm.Feed(ps + k, ps + k + len - 1);
+                    k += len;
+                }
+
+                bool expect = nfa.RunNFA(nfa.start_, nfa.accept_, ps, ps + txt.size() - 1);
+
+                EXPECT_EQ(expect, dfa_sm.IsMatched()) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(expect, nfa_sm.IsMatched()) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(first, dfa_sm.GetFirstMatchEnd()) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(first, nfa_sm.GetFirstMatchEnd()) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(txt.size(), dfa_sm.GetOffset());
+            }
+        }
+    }
+}
+
+TEST(test_serialize, test_automata_gen)
+{
+    const char* patterns[] = { "ab", "a(b|c)*d", "^ab*", "ab*$", "x[a-c]+timeout", "(ab|a)(bc|c)", "a.{3}d", "a{70}b" };
+
+    srand(43);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        for (int partial = 0; partial < 2; ++partial)
+        {
+            const char* pattern = patterns[i];
+
+            RegExpSyntaxTree tree;
+            tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+            RegExpNFA nfa(partial);
+            nfa.BuildMachine(&tree);
+
+            RegExpDFA dfa(partial);
+            ASSERT_TRUE(nfa.ConvertToDFA(dfa));
+
+            std::string nfaImage, dfaImage;
+            ASSERT_TRUE(nfa.SerializeState(nfaImage));
+            ASSERT_TRUE(dfa.SerializeState(dfaImage));
+
+            // the dfa is used in place from a mapped file.
+            FILE* fp = tmpfile();
+            ASSERT_TRUE(fp != NULL);
+            ASSERT_EQ(dfaImage.size(), fwrite(dfaImage.data(), 1, dfaImage.size(), fp));
+            fflush(fp);
+
+            void* mapped = mmap(NULL, dfaImage.size(), PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+            ASSERT_TRUE(mapped != MAP_FAILED);
+
+            RegExpNFA loadedNFA(!partial);
+            RegExpDFA loadedDFA, mappedDFA;
+
+            EXPECT_TRUE(loadedNFA.DeserializeState(nfaImage.data(), nfaImage.size()));
+            EXPECT_TRUE(loadedDFA.DeserializeState(dfaImage.data(), dfaImage.size()));
+            EXPECT_TRUE(mappedDFA.MapState(static_cast<const char*>(mapped), dfaImage.size()));
+
+            EXPECT_EQ(nfa.bitNFA_.IsBuilt(), loadedNFA.bitNFA_.IsBuilt());
+            EXPECT_EQ(nfa.prefilter_.GetLiterals(), loadedNFA.prefilter_.GetLiterals());
+            EXPECT_EQ(dfa.GetStateNumber(), mappedDFA.GetStateNumber());
+            EXPECT_TRUE(mappedDFA.GetDFATran().empty());
+
+            for (int j = 0; j < 200; ++j)
+            {
+                std::string txt = GenRandomText("abcdx", rand() % 80);
+                if (j % 10 == 0) txt += "xbtimeout";
+
+                const char* ps = txt.c_str();
+                const char* pe = ps + txt.size() - 1;
+
+                bool expect = nfa.RunNFA(nfa.start_, nfa.accept_, ps, pe);
+
+                EXPECT_EQ(expect, loadedNFA.RunMachine(ps, pe)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(expect, loadedDFA.RunMachine(ps, pe)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(expect, mappedDFA.RunMachine(ps, pe)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+
+                const char *ms1 = NULL, *me1 = NULL, *ms2 = NULL, *me2 = NULL;
+                EXPECT_EQ(nfa.Find(ps, pe, ms1, me1), loadedNFA.Find(ps, pe, ms2, me2));
+                EXPECT_EQ(ms1, ms2);
+                EXPECT_EQ(me1, me2);
+
+                // groups come from the program saved with the nfa.
+                std::vector<const char*> g1, g2;
+                EXPECT_EQ(expect, nfa.Capture(ps, pe, g1)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(expect, loadedNFA.Capture(ps, pe, g2)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(g1, g2) << "pattern:" << pattern << ", text:" << txt << std::endl;
+            }
+
+            munmap(mapped, dfaImage.size());
+            fclose(fp);
+        }
+    }
+
+    // images are checked before use.
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree("ab|cd", "ab|cd" + 4);
+
+    RegExpNFA nfa;
+    nfa.BuildMachine(&tree);
+
+    std::string image;
+    ASSERT_TRUE(nfa.SerializeState(image));
+
+    RegExpNFA loaded;
+    RegExpDFA dfa;
+    EXPECT_FALSE(loaded.DeserializeState(image.data(), image.size() - 8));
+    EXPECT_FALSE(loaded.RunMachine("ab", "ab" + 1));
+    EXPECT_FALSE(dfa.DeserializeState(image.data(), image.size()));
+
+    std::string broken = image;
+    broken[4] = 99; // version
+    EXPECT_FALSE(loaded.DeserializeState(broken.data(), broken.size()));
+
+    // a dfa image with a transition out of range, used in place or copied.
+    RegExpDFA full;
+    ASSERT_TRUE(nfa.ConvertToDFA(full));
+
+    std::string dfaImage;
+    ASSERT_TRUE(full.SerializeState(dfaImage));
+
+    int info[4];
+    size_t tranNum = 0;
+    AutomatonImageReader reader(dfaImage.data(), dfaImage.size(), AutomatonImage_DFA);
+
+    ASSERT_TRUE(reader.ReadSection(info, sizeof(info)));
+    const int* tran = reader.ViewSection<int>(tranNum);
+    ASSERT_TRUE(tran && tranNum > 0);
+
+    broken = dfaImage;
+    int bad = info[1] + 5;
+    memcpy(&broken[reinterpret_cast<const char*>(tran) - dfaImage.data()], &bad, sizeof(bad));
+
+    RegExpDFA mappedDFA, loadedDFA;
+    EXPECT_TRUE(mappedDFA.MapState(dfaImage.data(), dfaImage.size()));
+    EXPECT_FALSE(mappedDFA.MapState(broken.data(), broken.size()));
+    EXPECT_FALSE(loadedDFA.DeserializeState(broken.data(), broken.size()));
+
+    // images can be put one after another.
+    RegExpAhoCorasick ac, loadedAC;
+    ASSERT_TRUE(ac.BuildMachine(&tree));
+    ASSERT_TRUE(ac.SerializeState(image));
+
+    size_t first = AutomatonImageReader::GetImageSize(image.data(), image.size());
+    ASSERT_TRUE(first > 0 && first < image.size());
+
+    EXPECT_TRUE(loaded.DeserializeState(image.data(), first));
+    EXPECT_TRUE(loadedAC.DeserializeState(image.data() + first, image.size() - first));
+
+    EXPECT_TRUE(loaded.RunMachine("xcdx", "xcdx" + 3));
+    EXPECT_TRUE(loadedAC.RunMachine("xcdx", "xcdx" + 3));
+    EXPECT_FALSE(loadedAC.RunMachine("xcax", "xcax" + 3));
+    EXPECT_EQ(ac.GetStateNumber(), loadedAC.GetStateNumber());
+
+    // a program with a jump out of range is refused with the nfa.
+    RegExpSyntaxTree groupTree;
+    groupTree.BuildSyntaxTree("(ab|a)(bc|c)", "(ab|a)(bc|c)" + 11);
+
+    RegExpNFA groupNFA;
+    groupNFA.BuildMachine(&groupTree);
+
+    std::string pikeImage;
+    ASSERT_TRUE(groupNFA.pikeVM_.SerializeState(pikeImage));
+
+    size_t instNum = 0;
+    AutomatonImageReader pikeReader(pikeImage.data(), pikeImage.size(), AutomatonImage_PikeVM);
+
+    ASSERT_TRUE(pikeReader.ReadSection(info, sizeof(int)));
+    ASSERT_TRUE(pikeReader.ViewSection(tranNum) != NULL);
+    const int* insts = pikeReader.ViewSection<int>(instNum); // (op, x, y)
+    ASSERT_TRUE(insts && instNum % 3 == 0);
+
+    size_t split = 0;
+    while (split < instNum && insts[split] != RegExpInstOp_Split) split += 3;
+    ASSERT_LT(split, instNum);
+
+    RegExpPikeVM loadedVM;
+    EXPECT_TRUE(loadedVM.DeserializeState(pikeImage.data(), pikeImage.size()));
+
+    broken = pikeImage;
+    bad = instNum;
+    memcpy(&broken[reinterpret_cast<const char*>(insts + split + 2) - pikeImage.data()], &bad, sizeof(bad));
+    EXPECT_FALSE(loadedVM.DeserializeState(broken.data(), broken.size()));
+    EXPECT_FALSE(loadedVM.IsBuilt());
+
+    std::string groupImage;
+    ASSERT_TRUE(groupNFA.SerializeState(groupImage));
+
+    size_t pikePos = groupImage.find(pikeImage);
+    ASSERT_NE(std::string::npos, pikePos);
+
+    groupImage.replace(pikePos, broken.size(), broken);
+    EXPECT_FALSE(loaded.DeserializeState(groupImage.data(), groupImage.size()));
+
+    // aho-corasick images with an index out of range or a looping fail chain.
+    std::string acImage;
+    ASSERT_TRUE(ac.SerializeState(acImage));
+
+    size_t unitNum = 0, outNum = 0, idNum = 0;
+    AutomatonImageReader acReader(acImage.data(), acImage.size(), AutomatonImage_AhoCorasick);
+
+    ASSERT_TRUE(acReader.ReadSection(info, 3 * sizeof(int)));
+    const int* units = acReader.ViewSection<int>(unitNum); // (base, check, fail, dict)
+    ASSERT_TRUE(acReader.ViewSection<int>(outNum) != NULL);
+    const int* ids = acReader.ViewSection<int>(idNum);
+    ASSERT_TRUE(units && ids && unitNum >= 8 && idNum > 0);
+
+    const size_t unitPos = reinterpret_cast<const char*>(units) - acImage.data();
+    const size_t idPos = reinterpret_cast<const char*>(ids) - acImage.data();
+
+    std::pair<size_t, int> patches[] =
+    {
+        std::make_pair(unitPos, -3),                                // base of root
+        std::make_pair(unitPos + sizeof(int), (int)unitNum),        // check of root
+        std::make_pair(unitPos + 6 * sizeof(int), 1),               // fail of unit 1 to itself
+        std::make_pair(unitPos + 7 * sizeof(int), 1),               // dict of unit 1 to itself
+        std::make_pair(idPos, info[2]),                             // id beyond the id number
+    };
+
+    for (size_t i = 0; i < sizeof(patches)/sizeof(patches[0]); ++i)
+    {
+        broken = acImage;
+        memcpy(&broken[patches[i].first], &patches[i].second, sizeof(int));
+
+        RegExpAhoCorasick brokenAC;
+        EXPECT_FALSE(brokenAC.DeserializeState(broken.data(), broken.size())) << "patch:" << i;
+        EXPECT_FALSE(brokenAC.RunMachine("xcdx", "xcdx" + 3));
+    }
+}
+
+TEST(test_dfa_minimize, test_automata_gen)
+{
+    // (pattern, states of the minimal dfa without partial matching)
+    std::pair<const char*, int> patterns[] =
+    {
+        std::make_pair("(a|b)*abb", 4),
+        std::make_pair("(ab|ab|ab)c", 4),
+        std::make_pair("a{2,5}", 6),
+        std::make_pair("(a|b){3}", 4),
+        std::make_pair("abc|abd|xbc|xbd", 4),
+        std::make_pair("(a|ab)(c|bcd)(d*)", 0),
+        std::make_pair("(x|y)*(a|b).{4}", 0),
+        std::make_pair("^ab*c$", 0),
+    };
+
+    srand(47);
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        for (int partial = 0; partial < 2; ++partial)
+        {
+            const char* pattern = patterns[i].first;
+
+            RegExpSyntaxTree tree;
+            tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+            RegExpNFA nfa(partial);
+            nfa.BuildMachine(&tree);
+
+            RegExpDFA dfa(partial), minDFA(partial);
+            ASSERT_TRUE(nfa.ConvertToDFA(dfa));
+            ASSERT_TRUE(nfa.ConvertToDFA(minDFA));
+
+            int num = minDFA.Minimize();
+
+            EXPECT_EQ(dfa.GetStateNumber(), minDFA.GetMinimizeStat().before);
+            EXPECT_EQ(num, minDFA.GetMinimizeStat().after);
+            EXPECT_LE(num, dfa.GetStateNumber());
+            if (!partial && patterns[i].second)
+            {
+                EXPECT_EQ(patterns[i].second, num) << "pattern:" << pattern;
+            }
+
+            // already minimal.
+            EXPECT_EQ(num, minDFA.Minimize());
+
+            for (int j = 0; j < 300; ++j)
+            {
+                std::string txt = GenRandomText("abcdxy", rand() % 12);
+
+                const char* ps = txt.c_str();
+                const char* pe = ps + txt.size() - 1;
+
+                bool expect = nfa.RunNFA(nfa.start_, nfa.accept_, ps, pe);
+                EXPECT_EQ(expect, dfa.RunMachine(ps, pe)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+                EXPECT_EQ(expect, minDFA.RunMachine(ps, pe)) << "pattern:" << pattern << ", text:" << txt << std::endl;
+            }
+        }
+    }
+
+    // a dfa used in place from an image gets tables of its own.
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree("(ab|ab|ab)c", "(ab|ab|ab)c" + 10);
+
+    RegExpNFA nfa(false);
+    nfa.BuildMachine(&tree);
+
+    RegExpDFA dfa(false), mapped(false);
+    ASSERT_TRUE(nfa.ConvertToDFA(dfa));
+
+    std::string image;
+    ASSERT_TRUE(dfa.SerializeState(image));
+    ASSERT_TRUE(mapped.MapState(image.data(), image.size()));
+
+    EXPECT_EQ(4, mapped.Minimize());
+    EXPECT_FALSE(mapped.GetDFATran().empty());
+
+    image.clear();
+    EXPECT_TRUE(mapped.RunMachine("abc", "abc" + 2));
+    EXPECT_FALSE(mapped.RunMachine("abcc", "abcc" + 3));
+
+    // the subset construction of a pattern needing 2^19 states stops at the budget.
+    const char* large = "(a|b)*a(a|b){18}";
+
+    RegExpSyntaxTree largeTree;
+    largeTree.BuildSyntaxTree(large, large + strlen(large) - 1);
+
+    RegExpDFA largeDFA(false);
+    EXPECT_EQ(0, largeDFA.BuildMachine(&largeTree));
+    EXPECT_EQ(0, largeDFA.GetStateNumber());
+
+    // (a|b)*a(a|b){4} takes 32 states.
+    const char* small = "(a|b)*a(a|b){4}";
+
+    RegExpSyntaxTree smallTree;
+    smallTree.BuildSyntaxTree(small, small + strlen(small) - 1);
+
+    RegExpDFA tightDFA(false, 16), smallDFA(false);
+    EXPECT_EQ(0, tightDFA.BuildMachine(&smallTree));
+    EXPECT_EQ(32, smallDFA.BuildMachine(&smallTree));
+    EXPECT_TRUE(smallDFA.RunMachine("babbba", "babbba" + 5));
+    EXPECT_FALSE(smallDFA.RunMachine("babbbbb", "babbbbb" + 6));
+}
+
+TEST(test_byte_class, test_automata_gen)
+{
+    const char* patterns[] = { "[a-c]x", "a(b|c)*d", "^ab*", "[0-9]+\\.[0-9]*", "ERROR[0-9]+:.*timeout", "a.{3}d", "\\w+@\\w+" };
+
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        for (int partial = 0; partial < 2; ++partial)
+        {
+            const char* pattern = patterns[i];
+
+            RegExpSyntaxTree tree;
+            tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+            RegExpNFA nfa(partial);
+            nfa.BuildMachine(&tree);
+
+            std::vector<unsigned char> byteClass;
+            int num = nfa.BuildByteClass(byteClass);
+
+            ASSERT_EQ(REG_EXP_CHAR_EPSILON, byteClass.size());
+            EXPECT_LT(num, 32) << "pattern:" << pattern;
+
+            // chars of a class move every state to the same states.
+            for (int ch = 1; ch < REG_EXP_CHAR_EPSILON; ++ch)
+            {
+                if (byteClass[ch] != byteClass[ch - 1]) continue;
+
+                for (size_t st = 0; st < nfa.states_.size(); ++st)
+                {
+                    std::vector<int> cur(1, st), to1, to2;
+                    std::vector<char> isOn(nfa.states_.size(), 0);
+
+                    nfa.GenStatesMove(ch, cur, isOn, to1);
+                    nfa.GenStatesMove(ch - 1, cur, isOn, to2);
+
+                    std::sort(to1.begin(), to1.end());
+                    std::sort(to2.begin(), to2.end());
+                    EXPECT_EQ(to1, to2) << "pattern:" << pattern << ", char:" << ch;
+                }
+            }
+
+            RegExpDFA dfa(partial);
+            ASSERT_TRUE(nfa.ConvertToDFA(dfa));
+
+            EXPECT_EQ(num, dfa.GetClassNumber());
+            EXPECT_EQ(dfa.GetStateNumber() * num, dfa.GetDFATran().size());
+        }
+    }
+
+    // [a-c]x: [0, 'a'), [a-c], (c, 'x'), x, (x, 255].
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree("[a-c]x", "[a-c]x" + 5);
+
+    RegExpNFA nfa(false);
+    nfa.BuildMachine(&tree);
+
+    std::vector<unsigned char> byteClass;
+    EXPECT_EQ(5, nfa.BuildByteClass(byteClass));
+    EXPECT_EQ(byteClass['a'], byteClass['c']);
+    EXPECT_NE(byteClass['c'], byteClass['d']);
+    EXPECT_EQ(byteClass['d'], byteClass['w']);
+
+    // byte 0 is taken by [^a] as by '.', 8-bit text may hold it.
+    const char* nuls[] = { "x[^a]y", "x.y", "x[^\\w]y" };
+    const char txt[] = { 'x', 0, 'y' };
+
+    for (size_t i = 0; i < sizeof(nuls)/sizeof(nuls[0]); ++i)
+    {
+        RegExpSyntaxTree nulTree;
+        nulTree.BuildSyntaxTree(nuls[i], nuls[i] + strlen(nuls[i]) - 1);
+
+        RegExpNFA nulNFA(false);
+        nulNFA.BuildMachine(&nulTree);
+
+        RegExpDFA nulDFA(false);
+        ASSERT_TRUE(nulNFA.ConvertToDFA(nulDFA));
+
+        EXPECT_TRUE(nulNFA.RunMachine(txt, txt + 2)) << "pattern:" << nuls[i];
+        EXPECT_TRUE(nulDFA.RunMachine(txt, txt + 2)) << "pattern:" << nuls[i];
+    }
+}
+
+TEST(test_utf8, test_automata_gen)
+{
+    // bytes above 127 are plain chars without utf-8 mode.
+    {
+        const char* pattern = "a\xe9+[\x80-\xff]";
+
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+        RegExpNFA nfa(false);
+        ASSERT_LT(0, nfa.BuildMachine(&tree));
+
+        RegExpDFA dfa(false);
+        ASSERT_TRUE(nfa.ConvertToDFA(dfa));
+
+        std::string txt = "a\xe9\xe9\xff";
+        EXPECT_TRUE(nfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+        EXPECT_TRUE(dfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+
+        txt = "a\xe9" "b";
+        EXPECT_FALSE(nfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+        EXPECT_FALSE(dfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+    }
+
+    // é is \xc3\xa9, 中 is \xe4\xb8\xad, 😀 is \xf0\x9f\x98\x80.
+    const char* patterns[] = { "x\xc3\xa9+y", "x[\xc3\xa0-\xc3\xbf]+y", "x[^a-z]y", "x.y", "x[a\xe4\xb8\xad-\xe4\xb8\xaf]+y" };
+    const char* matches[] = { "x\xc3\xa9\xc3\xa9y", "x\xc3\xa0\xc3\xa9y", "x\xe4\xb8\xady", "x\xf0\x9f\x98\x80y", "xa\xe4\xb8\xae\xe4\xb8\xafy" };
+    const char* fails[] = { "x\xc3\xa9\xa9y", "x\xc3\x9fy", "x\xc3\xa9\xc3\xa9y", "x\xed\xa0\x80y", "x\xe4\xb8\xb0y" };
+
+    for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); ++i)
+    {
+        RegExpSyntaxTree tree(true);
+        tree.BuildSyntaxTree(patterns[i], patterns[i] + strlen(patterns[i]) - 1);
+
+        RegExpNFA nfa(false);
+        ASSERT_LT(0, nfa.BuildMachine(&tree)) << "pattern:" << patterns[i];
+
+        RegExpDFA dfa(false);
+        ASSERT_TRUE(nfa.ConvertToDFA(dfa));
+
+        const char* ms = matches[i];
+        const char* fs = fails[i];
+
+        EXPECT_TRUE(nfa.RunMachine(ms, ms + strlen(ms) - 1)) << "pattern:" << patterns[i];
+        EXPECT_TRUE(dfa.RunMachine(ms, ms + strlen(ms) - 1)) << "pattern:" << patterns[i];
+        EXPECT_FALSE(nfa.RunMachine(fs, fs + strlen(fs) - 1)) << "pattern:" << patterns[i];
+        EXPECT_FALSE(dfa.RunMachine(fs, fs + strlen(fs) - 1)) << "pattern:" << patterns[i];
+
+        // byte 0 is a codepoint of its own, the negated class and '.' take it.
+        const char nul[] = { 'x', 0, 'y' };
+        bool expect = (i == 2 || i == 3);
+
+        EXPECT_EQ(expect, nfa.RunMachine(nul, nul + 2)) << "pattern:" << patterns[i];
+        EXPECT_EQ(expect, dfa.RunMachine(nul, nul + 2)) << "pattern:" << patterns[i];
+    }
+
+    // [\x80, \xfff] in utf-8: [c2-df][80-bf], [e0][a0-bf][80-bf].
+    std::vector<RegExpUTF8Sequence> seq;
+    RegExpTokenizer::ConstructUTF8Sequence(0x80, 0xfff, seq);
+
+    ASSERT_EQ(2, seq.size());
+    EXPECT_EQ(2, seq[0].len);
+    EXPECT_EQ(0xc2, seq[0].lo[0]);
+    EXPECT_EQ(0xdf, seq[0].hi[0]);
+    EXPECT_EQ(3, seq[1].len);
+    EXPECT_EQ(0xe0, seq[1].lo[0]);
+    EXPECT_EQ(0xa0, seq[1].lo[1]);
+    EXPECT_EQ(0xbf, seq[1].hi[2]);
+
+    // every codepoint but the surrogates is covered once.
+    seq.clear();
+    RegExpTokenizer::ConstructUTF8Sequence(0, REG_EXP_UTF8_MAX, seq);
+
+    int total = 0;
+    for (size_t i = 0; i < seq.size(); ++i)
+    {
+        int num = 1;
+        for (int j = 0; j < seq[i].len; ++j) num *= seq[i].hi[j] - seq[i].lo[j] + 1;
+
+        total += num;
+    }
+
+    EXPECT_EQ(REG_EXP_UTF8_MAX + 1 - 0x800, total);
+    EXPECT_GT(16, seq.size());
+}
+
+REG_EXP_STATIC(StaticAlt, "ab(cd|ef)*g", true);
+REG_EXP_STATIC(StaticAnchor, "^(ab|a)b*c$", true);
+REG_EXP_STATIC(StaticCount, "x[0-9]{2,4}y?", true);
+REG_EXP_STATIC(StaticTail, "(a|b)*a(a|b){3}", true);
+REG_EXP_STATIC(StaticOpt, "(a?){5}a{ 2, }", true);
+REG_EXP_STATIC(StaticDot, "x.*(ab)+c|\\d\\.[^a-c\\-]", true);
+REG_EXP_STATIC(StaticEmpty, "a()b|x{0}y", false);
+
+template <class P>
+static void TestStaticPattern(const char* pattern)
+{
+    srand(13);
+    for (int partial = 0; partial < 2; ++partial)
+    {
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+        RegExpNFA nfa(partial);
+        nfa.BuildMachine(&tree);
+
+        for (int j = 0; j < 300; ++j)
+        {
+            std::string txt = GenRandomText("abcdefgxy0123-.", rand() % 16);
+            const char* ps = txt.c_str();
+            const char* pe = ps + txt.size() - 1;
+
+            bool expect = nfa.RunNFA(nfa.start_, nfa.accept_, ps, pe);
+            bool ret = partial? RegExpStatic<P, true>::Match(ps, pe) : RegExpStatic<P, false>::Match(ps, pe);
+
+            EXPECT_EQ(expect, ret) << "pattern:" << pattern << ", partial:" << partial << ", test:" << txt << std::endl;
+        }
+    }
+}
+
+TEST(test_static, test_automata_gen)
+{
+    TestStaticPattern<StaticAlt_Pattern>(StaticAlt_Pattern::Get());
+    TestStaticPattern<StaticAnchor_Pattern>(StaticAnchor_Pattern::Get());
+    TestStaticPattern<StaticCount_Pattern>(StaticCount_Pattern::Get());
+    TestStaticPattern<StaticTail_Pattern>(StaticTail_Pattern::Get());
+    TestStaticPattern<StaticOpt_Pattern>(StaticOpt_Pattern::Get());
+    TestStaticPattern<StaticDot_Pattern>(StaticDot_Pattern::Get());
+
+    EXPECT_EQ(9, StaticTail::GetPositionNumber());
+    EXPECT_TRUE(StaticCount::Match("ax123y", "ax123y" + 5));
+    EXPECT_FALSE(StaticCount::Match("ax1y", "ax1y" + 3));
+
+    EXPECT_TRUE(StaticEmpty::Match("ab", "ab" + 1));
+    EXPECT_TRUE(StaticEmpty::Match("y", "y"));
+    EXPECT_FALSE(StaticEmpty::Match("xy", "xy" + 1));
+
+    const char nul[] = { '1', '.', 0 };
+    EXPECT_TRUE(StaticDot::Match(nul, nul + 2));
+}
+
+#ifdef XREG_GENERATED_MATCHER
+// generated by xreg_add_matcher() in CMakeLists.txt.
+bool GenMatchCount(const char* ps, const char* pe);
+bool GenMatchFull(const char* ps, const char* pe);
+#endif
+
+TEST(test_code_gen, test_automata_gen)
+{
+    const char* pattern = "x[0-9]{2,4}y?";
+
+    RegExpSyntaxTree tree;
+    tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+    RegExpNFA nfa(true);
+    RegExpDFA dfa(true);
+    nfa.BuildMachine(&tree);
+    ASSERT_TRUE(nfa.ConvertToDFA(dfa));
+    dfa.Minimize();
+
+    std::string code;
+    EXPECT_FALSE(RegExpCodeGen::GenerateDFA(RegExpDFA(), "GenMatch", code));
+    ASSERT_TRUE(RegExpCodeGen::GenerateDFA(dfa, "GenMatch", code));
+
+    // one label per state, the accepting state keeps accepting.
+    EXPECT_NE(std::string::npos, code.find("bool GenMatch(const char* ps, const char* pe)"));
+    EXPECT_NE(std::string::npos, code.find("    return true;"));
+
+    for (int st = 0; st < dfa.GetStateNumber(); ++st)
+    {
+        std::ostringstream label;
+        label << "s" << st << ":";
+        EXPECT_NE(std::string::npos, code.find(label.str())) << "state:" << st;
+    }
+
+    // states every byte keeps are bare returns, their own loops give them no
+    // label, and a dfa of such states only doesn't read the input.
+    const char* finals[] = { "ab", "a*" };
+    const size_t labels[] = { 3, 0 };
+
+    for (size_t i = 0; i < sizeof(finals)/sizeof(finals[0]); ++i)
+    {
+        RegExpSyntaxTree finalTree;
+        finalTree.BuildSyntaxTree(finals[i], finals[i] + strlen(finals[i]) - 1);
+
+        RegExpNFA finalNFA(true);
+        RegExpDFA finalDFA(true);
+        finalNFA.BuildMachine(&finalTree);
+        ASSERT_TRUE(finalNFA.ConvertToDFA(finalDFA));
+        finalDFA.Minimize();
+
+        std::string finalCode;
+        ASSERT_TRUE(RegExpCodeGen::GenerateDFA(finalDFA, "GenFinal", finalCode));
+
+        size_t num = 0;
+        for (size_t pos = finalCode.find("\ns"); pos != std::string::npos; pos = finalCode.find("\ns", pos + 1)) ++num;
+
+        EXPECT_EQ(labels[i], num) << "pattern:" << finals[i];
+        EXPECT_EQ(labels[i] == 0, finalCode.find("end") == std::string::npos) << "pattern:" << finals[i];
+    }
+
+#ifdef XREG_GENERATED_MATCHER
+    const char* full = "(a|b)*a(a|b){3}";
+
+    RegExpSyntaxTree fullTree;
+    fullTree.BuildSyntaxTree(full, full + strlen(full) - 1);
+
+    RegExpNFA fullNFA(false);
+    fullNFA.BuildMachine(&fullTree);
+
+    srand(17);
+    for (int i = 0; i < 500; ++i)
+    {
+        std::string txt = GenRandomText("abxy0123", rand() % 12);
+        const char* ps = txt.c_str();
+        const char* pe = ps + txt.size() - 1;
+
+        EXPECT_EQ(nfa.RunMachine(ps, pe), GenMatchCount(ps, pe)) << "test:" << txt;
+        EXPECT_EQ(fullNFA.RunMachine(ps, pe), GenMatchFull(ps, pe)) << "test:" << txt;
+    }
+#endif
+}
@@ -0,0 +1,148 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+#include <string.h>
+#include <pthread.h>
+
+#include "RegExpCache.h"
+#include "RegExpAutomata.h"
+#include "Parsing/LexException.h"
+
+using namespace std;
+
+#define ArrSize(arr) (sizeof(arr)/sizeof(arr[0]))
+
+static size_t GetEntryMemory(const char* pattern)
+{
+    RegExpCache cache;
+    cache.Get(pattern);
+
+    return cache.GetStat().memory;
+}
+
+TEST(test_reg_exp_cache, test_cache_hit_and_evict)
+{
+    RegExpCache cache;
+    RegExpMatchContext ctx;
+
+    RegExpCache::NFAPtr p1 = cache.Get("ab+c");
+    RegExpCache::NFAPtr p2 = cache.Get(string("ab+c"));
+    RegExpCache::NFAPtr f1 = cache.Get("ab+c", RegExpCacheFlag_None);
+
+    ASSERT_TRUE(p1 && f1);
+    EXPECT_EQ(p1.get(), p2.get());
+    EXPECT_NE(p1.get(), f1.get());
+
+    const char* txt = "xabbcx";
+    EXPECT_TRUE(p1->Match(txt, txt + 5, ctx));
+    EXPECT_FALSE(f1->Match(txt, txt + 5, ctx));
+    EXPECT_TRUE(f1->Match(txt + 1, txt + 4, ctx));
+
+    RegExpCache::CacheStat stat = cache.GetStat();
+    EXPECT_EQ(1u, stat.hits);
+    EXPECT_EQ(2u, stat.misses);
+    EXPECT_EQ(2u, stat.entries);
+    EXPECT_TRUE(stat.memory > 0);
+    EXPECT_TRUE(stat.compileTime > 0 && stat.maxCompileTime <= stat.compileTime);
+
+    // a bad pattern throws and is not kept, an empty one gives no nfa.
+    EXPECT_THROW(cache.Get("a(b"), LexErrException);
+    EXPECT_THROW(cache.Get("a(b"), LexErrException);
+    EXPECT_FALSE(cache.Get(""));
+    EXPECT_EQ(2u, cache.GetStat().entries);
+    EXPECT_EQ(4u, cache.GetStat().misses);
+
+    // the least recently used goes first.
+    const char* pats[] = { "abc[0-9]+x", "(ab|cd)*e", "[a-f]{2,5}z" };
+
+    size_t budget = 0;
+    for (size_t i = 0; i < ArrSize(pats); ++i) budget += GetEntryMemory(pats[i]);
+
+    cache.Clear();
+    EXPECT_EQ(0u, cache.GetStat().entries);
+    EXPECT_EQ(0u, cache.GetStat().memory);
+
+    cache.SetBudget(budget - 1);
+
+    RegExpCache::NFAPtr a = cache.Get(pats[0]);
+    RegExpCache::NFAPtr b = cache.Get(pats[1]);
+    cache.Get(pats[0]);
+    cache.Get(pats[2]);
+
+    stat = cache.GetStat();
+    EXPECT_EQ(2u, stat.entries);
+    EXPECT_EQ(1u, stat.evictions);
+    EXPECT_EQ(budget - GetEntryMemory(pats[1]), stat.memory);
+
+    EXPECT_EQ(a.get(), cache.Get(pats[0]).get());
+    EXPECT_EQ(stat.hits + 1, cache.GetStat().hits);
+
+    // an evicted nfa in use lives on, getting it again compiles a new one.
+    txt = "ababcde";
+    EXPECT_TRUE(b->Match(txt, txt + 6, ctx));
+    EXPECT_NE(b.get(), cache.Get(pats[1]).get());
+
+    // too large to keep, still compiled.
+    cache.SetBudget(1);
+    EXPECT_TRUE(cache.Get(pats[2]));
+    EXPECT_EQ(0u, cache.GetStat().entries);
+
+}
+
+struct cache_job
+{
+    RegExpCache* cache;
+    int fail;
+};
+
+static void* RunCacheJob(void* arg)
+{
+    cache_job* job = static_cast<cache_job*>(arg);
+
+    const char* pats[] = { "ab+c", "x[0-9]{2,4}y", "(foo|bar)+baz", "^start", "end$" };
+    const char* txts[] = { "zabbbc", "x123y", "foobarbaz", "start here", "the end" };
+
+    RegExpMatchContext ctx;
+    for (int round = 0; round < 200; ++round)
+    {
+        for (size_t i = 0; i < ArrSize(pats); ++i)
+        {
+            RegExpCache::NFAPtr nfa = job->cache->Get(pats[(i + round) % ArrSize(pats)]);
+            const char* txt = txts[(i + round) % ArrSize(pats)];
+
+            if (!nfa || !nfa->Match(txt, txt + strlen(txt) - 1, ctx)) ++job->fail;
+        }
+    }
+
+    return NULL;
+}
+
+TEST(test_reg_exp_cache, test_cache_threads)
+{
+    RegExpCache cache;
+
+    const int threadNum = 4;
+    pthread_t threads[threadNum];
+    cache_job jobs[threadNum];
+
+    for (int i = 0; i < threadNum; ++i)
+    {
+        cache_job job = { &cache, 0 };
+        jobs[i] = job;
+
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, RunCacheJob, &jobs[i]));
+    }
+
+    for (int i = 0; i < threadNum; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ(0, jobs[i].fail) << "thread:" << i << std::endl;
+    }
+
+    RegExpCache::CacheStat stat = cache.GetStat();
+    EXPECT_EQ(5u, stat.entries);
+    EXPECT_EQ(threadNum * 200u * 5u, stat.hits + stat.misses);
+    EXPECT_TRUE(stat.misses >= 5u && stat.misses <= threadNum * 5u);
+}
+
@@ -0,0 +1,273 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define private public
+#define protected public
+
+#include "RegExpSet.h"
+#include "RegExpAutomata.h"
+#include "RegExpSyntaxTree.h"
+
+using namespace std;
+
+#define ArrSize(arr) (sizeof(arr)/sizeof(arr[0]))
+
+static string GenText(const char* alphabet, size_t len)
+{
+    string ret;
+    size_t sz = strlen(alphabet);
+
+    for (size_t i = 0; i < len; ++i) ret.push_back(alphabet[rand() % sz]);
+
+    return ret;
+}
+
+TEST(test_reg_exp_set, test_reg_exp_set_match)
+{
+    RegExpSet set;
+
+    EXPECT_EQ(0, set.AddPattern("ERROR[0-9]+"));
+    EXPECT_EQ(-1, set.AddPattern("a|("));
+    EXPECT_EQ(1, set.AddPattern("timeout$"));
+    EXPECT_EQ(2, set.AddPattern("^WARN"));
+    EXPECT_EQ(3, set.AddPattern("a(bc)*d"));
+
+    EXPECT_LT(0, set.Compile());
+    EXPECT_TRUE(set.IsCompiled());
+    EXPECT_TRUE(set.HasDFA());
+    EXPECT_EQ(-1, set.AddPattern("xyz"));
+
+    struct
+    {
+        const char* txt;
+        const char* ids;
+    } cases[] =
+    {
+        { "ERROR12: timeout", "0 1" },
+        { "WARN: abcbcd timeout", "1 2 3" },
+        { "ERROR: timeout!", "" },
+        { "INFO: WARN ad", "3" },
+        { "", "" },
+    };
+
+    for (size_t i = 0; i < ArrSize(cases); ++i)
+    {
+        vector<int> ids;
+        const char* ps = cases[i].txt;
+        const char* pe = ps + strlen(ps) - 1;
+
+        string got;
+        set.Match(ps, pe, ids);
+        for (size_t j = 0; j < ids.size(); ++j)
+        {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%s%d", j? " " : "", ids[j]);
+            got += buf;
+        }
+
+        EXPECT_STREQ(cases[i].ids, got.c_str()) << "text:" << cases[i].txt << endl;
+        EXPECT_EQ(!got.empty(), set.IsMatch(ps, pe)) << "text:" << cases[i].txt << endl;
+    }
+}
+
+// every pattern of the set must give the same answer as its own nfa.
+TEST(test_reg_exp_set, test_reg_exp_set_random)
+{
+    const char* patterns[] =
+    {
+        "ab", "a(b|c)*d", "^ab", "cd$", "^a.*d$", "(ab|ba){2,3}",
+        "b+c?d", "[ab]{3}", "^$", "a*", "d.c",
+    };
+
+    srand(23);
+    for (int partial = 0; partial < 2; ++partial)
+    {
+        vector<RegExpNFA*> nfa;
+        vector<RegExpSyntaxTree*> tree;
+
+        RegExpSet dfaSet(partial);
+        RegExpSet nfaSet(partial);
+
+        for (size_t i = 0; i < ArrSize(patterns); ++i)
+        {
+            const char* ps = patterns[i];
+            const char* pe = ps + strlen(ps) - 1;
+
+            EXPECT_EQ(static_cast<int>(i), dfaSet.AddPattern(ps, pe));
+            EXPECT_EQ(static_cast<int>(i), nfaSet.AddPattern(ps, pe));
+
+            tree.push_back(new RegExpSyntaxTree());
+            tree.back()->BuildSyntaxTree(ps, pe);
+
+            nfa.push_back(new RegExpNFA(partial));
+            nfa.back()->BuildMachine(tree.back());
+        }
+
+        dfaSet.Compile();
+        nfaSet.Compile(1);
+
+        EXPECT_TRUE(dfaSet.HasDFA());
+        EXPECT_FALSE(nfaSet.HasDFA());
+
+        for (int i = 0; i < 500; ++i)
+        {
+            string txt = GenText("abcd", rand() % 12);
+            const char* ps = txt.c_str();
+            const char* pe = ps + txt.size() - 1;
+
+            vector<int> expect, got1, got2;
+            for (size_t j = 0; j < nfa.size(); ++j)
+            {
+                if (nfa[j]->RunMachine(ps, pe)) expect.push_back(j);
+            }
+
+            dfaSet.Match(ps, pe, got1);
+            nfaSet.Match(ps, pe, got2);
+
+            EXPECT_TRUE(expect == got1) << "partial:" << partial << ", text:" << txt << endl;
+            EXPECT_TRUE(expect == got2) << "partial:" << partial << ", text:" << txt << endl;
+        }
+
+        for (size_t i = 0; i < nfa.size(); ++i)
+        {
+            delete nfa[i];
+            delete tree[i];
+        }
+    }
+}
+
+TEST(test_aho_corasick, test_reg_exp_set_match)
+{
+    struct
+    {
+        const char* pattern;
+        const char* literals; // separated by space, "-" if not literal
+    } cases[] =
+    {
+        { "abc", "abc" },
+        { "foo|bar|baz", "foo bar baz" },
+        { "a(b|c)d", "abd acd" },
+        { "x\\.y[z]", "x.yz" },
+        { "(ab){3}c", "abababc" },
+        { "ab*", "-" },
+        { "a.c", "-" },
+        { "^abc", "-" },
+        { "a[bc]", "-" },
+        { "a\\d", "-" },
+    };
+
+    for (size_t i = 0; i < ArrSize(cases); ++i)
+    {
+        const char* pattern = cases[i].pattern;
+
+        RegExpSyntaxTree tree;
+        tree.BuildSyntaxTree(pattern, pattern + strlen(pattern) - 1);
+
+        string got;
+        vector<string> literals;
+        if (!RegExpAhoCorasick::ExtractLiteral(&tree, literals)) got = "-";
+
+        for (size_t j = 0; j < literals.size(); ++j) got += (j? " " : "") + literals[j];
+
+        EXPECT_STREQ(cases[i].literals, got.c_str()) << "pattern:" << pattern << endl;
+
+        RegExpAhoCorasick ac;
+        EXPECT_EQ(got != "-", ac.BuildMachine(&tree) > 0) << "pattern:" << pattern << endl;
+    }
+
+    // keyword list against std::string::find.
+    srand(29);
+    vector<string> words;
+    vector<int> ids;
+    for (int i = 0; i < 3000; ++i)
+    {
+        words.push_back(GenText("abcdef", 2 + rand() % 6));
+        ids.push_back(i);
+    }
+
+    RegExpAhoCorasick ac;
+    EXPECT_LT(0, ac.BuildLiteralMachine(words, ids));
+    EXPECT_TRUE(ac.IsBuilt());
+
+    for (int i = 0; i < 50; ++i)
+    {
+        string txt = GenText("abcdefg", rand() % 40);
+        const char* ps = txt.c_str();
+        const char* pe = ps + txt.size() - 1;
+
+        vector<char> matched;
+        bool found = ac.Match(ps, pe, matched);
+        EXPECT_EQ(found, ac.RunMachine(ps, pe));
+
+        bool expect_found = false;
+        for (size_t j = 0; j < words.size(); ++j)
+        {
+            bool expect = txt.find(words[j]) != string::npos;
+            expect_found = expect_found || expect;
+
+            EXPECT_EQ(expect, matched[j] != 0) << "text:" << txt << ", word:" << words[j] << endl;
+        }
+
+        EXPECT_EQ(expect_found, found) << "text:" << txt << endl;
+    }
+}
+
+// literal sets are routed to aho-corasick, answers must stay the same.
+TEST(test_aho_corasick, test_reg_exp_set_random)
+{
+    const char* patterns[] = { "ab", "abc", "bca", "c", "(ab|cd){2}", "d\\.a", "ca(b|d)" };
+
+    srand(31);
+    for (int partial = 0; partial < 2; ++partial)
+    {
+        RegExpSet set(partial);
+        vector<RegExpNFA*> nfa;
+        vector<RegExpSyntaxTree*> tree;
+
+        for (size_t i = 0; i < ArrSize(patterns); ++i)
+        {
+            const char* ps = patterns[i];
+            const char* pe = ps + strlen(ps) - 1;
+
+            set.AddPattern(ps, pe);
+
+            tree.push_back(new RegExpSyntaxTree());
+            tree.back()->BuildSyntaxTree(ps, pe);
+
+            nfa.push_back(new RegExpNFA(partial));
+            nfa.back()->BuildMachine(tree.back());
+        }
+
+        set.Compile();
+        EXPECT_TRUE(set.IsLiteralSet());
+
+        for (int i = 0; i < 500; ++i)
+        {
+            string txt = GenText(partial? "abcd." : "abcd", rand() % 10);
+            if (!partial && i % 2) txt = patterns[rand() % 4];
+
+            const char* ps = txt.c_str();
+            const char* pe = ps + txt.size() - 1;
+
+            vector<int> expect, got;
+            for (size_t j = 0; j < nfa.size(); ++j)
+            {
+                if (nfa[j]->RunMachine(ps, pe)) expect.push_back(j);
+            }
+
+            set.Match(ps, pe, got);
+            EXPECT_TRUE(expect == got) << "partial:" << partial << ", text:" << txt << endl;
+        }
+
+        for (size_t i = 0; i < nfa.size(); ++i)
+        {
+            delete nfa[i];
+            delete tree[i];
+        }
+    }
+}
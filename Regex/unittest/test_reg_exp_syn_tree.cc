@@ -10,6 +10,7 @@
 #include "RegExpAutomata.h"
 #include "RegExpTokenizer.h"
 #include "RegExpSyntaxTree.h"
+#include "Parsing/LexException.h"
 
 /*
 positive case:
@@ -306,6 +307,230 @@ TEST(test_construct_reg_syn_tree, test_reg_exp_automata_gen)
 }
 
 
+TEST(test_parse_syn_tree_linear, test_reg_exp_automata_gen)
+{
+    const char* errs[] =
+    {
+        "|a", "a||b", "a|", "(|a)", "(a", "a)", "a**", "*a", "a{2}*", "a{2", "[ab", "a\\",
+        "[]", "[]a]", "a|()", "()|a", "(a|())", "(()|a)b", "a|()*",
+    };
+
+    RegExpSyntaxTree tree;
+    for (size_t i = 0; i < ArrSize(errs); ++i)
+    {
+        EXPECT_THROW(tree.BuildSyntaxTree(errs[i], errs[i] + strlen(errs[i]) - 1), LexErrException) << "case: " << i;
+    }
+
+    // deep nesting, long alternation and concatenation, the tree is reused.
+    const int num = 20000;
+
+    string nest = string(num, '(') + "a" + string(num, ')');
+    ASSERT_TRUE(tree.BuildSyntaxTree(nest.c_str(), nest.c_str() + nest.size() - 1));
+    ASSERT_TRUE(tree.GetRoot() && tree.GetRoot()->AsLeafNode());
+    EXPECT_EQ(num, tree.GetRoot()->IsUnit());
+
+    string alt = "a";
+    for (int i = 1; i < num; ++i) alt += "|a";
+
+    ASSERT_TRUE(tree.BuildSyntaxTree(alt.c_str(), alt.c_str() + alt.size() - 1));
+
+    int ors = 0;
+    RegExpSynTreeNode* node = tree.GetRoot();
+    for (; node->GetNodeType() == RegExpSynTreeNodeType_Or; node = node->GetRightNode())
+    {
+        ASSERT_TRUE(node->GetLeftNode()->AsLeafNode());
+        ++ors;
+    }
+
+    EXPECT_EQ(num - 1, ors);
+    EXPECT_TRUE(node->AsLeafNode() != NULL);
+
+    string cat = string(num, 'b') + "c";
+    ASSERT_TRUE(tree.BuildSyntaxTree(cat.c_str(), cat.c_str() + cat.size() - 1));
+
+    int cats = 0;
+    for (node = tree.GetRoot(); node->GetNodeType() == RegExpSynTreeNodeType_Concat; node = node->GetLeftNode())
+    {
+        ++cats;
+    }
+
+    EXPECT_EQ(num, cats);
+    EXPECT_STREQ("c", tree.GetRoot()->GetRightNode()->GetNodeText().c_str());
+    EXPECT_EQ(num + 2, tree.GetNodeNumber());
+
+    const char* pat = "(ab|c)+d";
+    ASSERT_TRUE(tree.BuildSyntaxTree(pat, pat + strlen(pat) - 1));
+
+    RegExpNFA nfa;
+    EXPECT_TRUE(nfa.BuildMachine(&tree) > 0);
+    EXPECT_TRUE(nfa.RunMachine("xabcabd", "xabcabd" + 6));
+}
+
+TEST(test_parse_nesting_bound, test_reg_exp_automata_gen)
+{
+    RegExpSyntaxTree tree;
+
+    // (a(a(...)*)*)*, every level is a group and a star.
+    string deep;
+    for (int i = 0; i < 10000; ++i) deep += "(a";
+    for (int i = 0; i < 10000; ++i) deep += ")*";
+
+    EXPECT_THROW(tree.BuildSyntaxTree(deep.c_str(), deep.c_str() + deep.size() - 1), LexErrException);
+
+    string stars = string(10000, '(') + "a";
+    for (int i = 0; i < 10000; ++i) stars += ")*";
+
+    EXPECT_THROW(tree.BuildSyntaxTree(stars.c_str(), stars.c_str() + stars.size() - 1), LexErrException);
+
+    // as deep as it may be, every pass takes it, with and without Optimize().
+    string nest;
+    for (int i = 0; i < 450; ++i) nest += "(ab";
+    nest += "c";
+    for (int i = 0; i < 450; ++i) nest += ")*";
+    nest += "d";
+
+    string txt;
+    for (int i = 0; i < 450; ++i) txt += "ab";
+    txt += "cd";
+
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        ASSERT_TRUE(tree.BuildSyntaxTree(nest.c_str(), nest.c_str() + nest.size() - 1));
+        if (mode) tree.Optimize(false);
+
+        RegExpNFA nfa;
+        ASSERT_TRUE(nfa.BuildMachine(&tree) > 0);
+        EXPECT_TRUE(nfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 1));
+        EXPECT_FALSE(nfa.RunMachine(txt.c_str(), txt.c_str() + txt.size() - 2));
+    }
+
+    // long chains take no recursion.
+    string alt = "xa";
+    for (int i = 1; i < 5000; ++i) alt += "|xa";
+
+    string cat = string(20000, 'b') + "c";
+    const string* pats[] = { &alt, &cat };
+
+    for (size_t i = 0; i < ArrSize(pats); ++i)
+    {
+        ASSERT_TRUE(tree.BuildSyntaxTree(pats[i]->c_str(), pats[i]->c_str() + pats[i]->size() - 1));
+
+        RegExpNFA nfa;
+        ASSERT_TRUE(nfa.BuildMachine(&tree) > 0);
+        EXPECT_TRUE(nfa.RunMachine(cat.c_str(), cat.c_str() + cat.size() - 1) == (i == 1)) << "case: " << i;
+    }
+}
+
+static int BuildOptimized(RegExpSyntaxTree& tree, const char* pat, int mode, RegExpNFA& nfa)
+{
+    tree.BuildSyntaxTree(pat, pat + strlen(pat) - 1);
+    if (mode) tree.Optimize(mode == 2);
+
+    return nfa.BuildMachine(&tree);
+}
+
+TEST(test_optimize_syn_tree, test_reg_exp_automata_gen)
+{
+    RegExpSyntaxTree tree;
+
+    // node and nfa state counts, before and after.
+    struct { const char* pat; int nodes; int states; int optNodes; int optStates; } counts[] =
+    {
+        { "abc|abd", 11, 8, 3, 4 },
+        { "a|b|c", 5, 6, 1, 2 },
+        { "(a*)*", 3, 6, 2, 4 },
+        { "(a?)+b", 5, 5, 4, 5 },
+        { "xabcd", 9, 6, 1, 6 },
+        { "ab(x|y|z)cd|abe", 19, 14, 7, 8 },
+    };
+
+    for (size_t i = 0; i < ArrSize(counts); ++i)
+    {
+        RegExpNFA nfa(false);
+        const char* pat = counts[i].pat;
+
+        EXPECT_EQ(counts[i].states, BuildOptimized(tree, pat, 0, nfa)) << "case: " << pat;
+        EXPECT_EQ(counts[i].nodes, tree.CountNodes()) << "case: " << pat;
+
+        EXPECT_EQ(counts[i].optStates, BuildOptimized(tree, pat, 1, nfa)) << "case: " << pat;
+        EXPECT_EQ(counts[i].optNodes, tree.CountNodes()) << "case: " << pat;
+
+        EXPECT_EQ(counts[i].nodes, tree.GetOptimizeStat().before) << "case: " << pat;
+        EXPECT_EQ(counts[i].optNodes, tree.GetOptimizeStat().after) << "case: " << pat;
+    }
+
+    // a new tree is not optimized yet.
+    RegExpNFA plain;
+    BuildOptimized(tree, "abc|abd", 0, plain);
+    EXPECT_EQ(0, tree.GetOptimizeStat().before);
+    EXPECT_EQ(0, tree.GetOptimizeStat().after);
+
+    // abc|abd is ab[cd].
+    RegExpNFA nfa;
+    BuildOptimized(tree, "abc|abd", 1, nfa);
+
+    RegExpSynTreeNode* root = tree.GetRoot();
+    ASSERT_EQ(RegExpSynTreeNodeType_Concat, root->GetNodeType());
+    ASSERT_TRUE(root->GetLeftNode()->AsLeafNode() && root->GetRightNode()->AsLeafNode());
+    EXPECT_EQ(RegExpSynTreeNodeLeafNodeType_Str, root->GetLeftNode()->AsLeafNode()->GetLeafNodeType());
+    EXPECT_STREQ("ab", root->GetLeftNode()->GetNodeText().c_str());
+    EXPECT_EQ(RegExpSynTreeNodeLeafNodeType_Alt, root->GetRightNode()->AsLeafNode()->GetLeafNodeType());
+    EXPECT_STREQ("cd", root->GetRightNode()->GetNodeText().c_str());
+
+    // groups are kept if asked, the one around the alternation moves to its new node.
+    BuildOptimized(tree, "(abc|abd)(a*)*", 2, nfa);
+    ASSERT_EQ(RegExpSynTreeNodeType_Concat, tree.GetRoot()->GetNodeType());
+    EXPECT_EQ(1, tree.GetRoot()->GetLeftNode()->IsUnit());
+    EXPECT_EQ(RegExpSynTreeNodeType_Concat, tree.GetRoot()->GetLeftNode()->GetNodeType());
+    EXPECT_EQ(1, tree.GetRoot()->GetRightNode()->GetLeftNode()->IsUnit());
+
+    // the same texts match, with the same groups if they are kept.
+    const char* pats[] =
+    {
+        "abc|abd", "x(abc|abd)+y", "abx|aby|acz|d", "ab|abc", "a|[ab]y|b", "\\d|x|[a-c]",
+        "(a*)*b", "((a+)?c)+", "(a?)+c", "^(foo|foobar|fox)$", "(ab|ac)(d|e)\\w", "a.b|a.c",
+        "(a|b)(c|d)|(a|b)e", "ab(cd|ce)*|abf",
+    };
+
+    const char* txts[] =
+    {
+        "", "abc", "abd", "ab", "xabcabdy", "xy", "aby", "acz", "d", "by", "a", "b", "3", "x",
+        "aaab", "b", "acaac", "c", "foo", "foobar", "fox", "foob", "abd_", "acex", "a\nc", "ace",
+        "bd", "abcdcecd", "abcdf", "abf",
+    };
+
+    for (size_t i = 0; i < ArrSize(pats); ++i)
+    {
+        for (int partial = 0; partial < 2; ++partial)
+        {
+            RegExpNFA orig(partial), opt(partial), grouped(partial);
+            RegExpDFA dfa(partial);
+
+            RegExpSyntaxTree t1, t2, t3;
+            BuildOptimized(t1, pats[i], 0, orig);
+            BuildOptimized(t2, pats[i], 1, opt);
+            BuildOptimized(t3, pats[i], 2, grouped);
+
+            ASSERT_TRUE(opt.ConvertToDFA(dfa));
+
+            for (size_t j = 0; j < ArrSize(txts); ++j)
+            {
+                const char* ps = txts[j];
+                const char* pe = ps + strlen(ps) - 1;
+
+                std::vector<const char*> g1, g3;
+                bool expect = orig.Capture(ps, pe, g1);
+
+                EXPECT_EQ(expect, opt.RunMachine(ps, pe)) << "case: " << pats[i] << ", txt: " << ps;
+                EXPECT_EQ(expect, dfa.RunMachine(ps, pe)) << "case: " << pats[i] << ", txt: " << ps;
+                EXPECT_EQ(expect, grouped.Capture(ps, pe, g3)) << "case: " << pats[i] << ", txt: " << ps;
+                EXPECT_TRUE(g1 == g3) << "case: " << pats[i] << ", txt: " << ps;
+            }
+        }
+    }
+}
+
+
 class RegToken
 {
     public:
@@ -378,14 +603,15 @@ class StrToken
 {
     public:
 
-        StrToken(const char* str, const char* expect)
+        StrToken(const char* str, const std::string& expect)
             :str_(str), expect_(expect)
         {
         }
 
         void test(const std::string& s)
         {
-            EXPECT_STREQ(expect_.c_str(), s.c_str()); // << "actual:" << s << endl << "expect:" << expect_ << endl;
+            // negated classes start with char 0, compare the whole string.
+            EXPECT_EQ(expect_, s);
         }
 
         const std::string& get() const { return str_; }
@@ -399,7 +625,7 @@ class StrToken
 std::string GenNegString(const std::string& s)
 {
     string neg;
-    for (size_t i = 1; i < REG_EXP_CHAR_MAX - 1; ++i)
+    for (size_t i = 0; i < REG_EXP_CHAR_MAX - 1; ++i)
     {
         if (s.find(i) != std::string::npos) continue;
 
@@ -417,9 +643,9 @@ TEST(test_string_constructor, test_reg_exp_tokenizer)
         StrToken("abcdnnnw", "abcdnw"),
         StrToken("1234", "1234"),
         StrToken("vb-f\\-", "-\\bcdefv"),
-        StrToken("^1234", GenNegString("1234").c_str()),
-        StrToken("^qwerty", GenNegString("qwerty").c_str()),
-        StrToken("^qwa-d\\-p", GenNegString("qwabcd-p").c_str()),
+        StrToken("^1234", GenNegString("1234")),
+        StrToken("^qwerty", GenNegString("qwerty")),
+        StrToken("^qwa-d\\-p", GenNegString("qwabcd-p")),
         StrToken("ab-fi-l", "abcdefijkl"),
         StrToken("ab-fg2-5l", "2345abcdefgl"),
     };